@@ -0,0 +1,155 @@
+/*
+ * Thin wrappers around POSIX threads
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#ifndef XZF_MYTHREAD_H
+#define XZF_MYTHREAD_H
+
+#include "sysdefs.h"
+
+#include <unistd.h>
+
+
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+#include <signal.h>
+
+#define MYTHREAD_ENABLED 1
+
+
+typedef pthread_t mythread;
+typedef pthread_mutex_t mythread_mutex;
+typedef pthread_cond_t mythread_cond;
+
+
+// Create a new thread with all signals blocked. The signals must be
+// handled by the application threads, not by the worker threads that
+// are hidden inside the library.
+static inline int
+mythread_create(mythread *thread, void *(*func)(void *arg), void *arg)
+{
+	sigset_t old;
+	sigset_t all;
+	sigfillset(&all);
+
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	const int ret = pthread_create(thread, NULL, func, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return ret;
+}
+
+
+static inline int
+mythread_join(mythread thread)
+{
+	return pthread_join(thread, NULL);
+}
+
+
+static inline int
+mythread_mutex_init(mythread_mutex *mutex)
+{
+	return pthread_mutex_init(mutex, NULL);
+}
+
+
+static inline void
+mythread_mutex_destroy(mythread_mutex *mutex)
+{
+	const int ret = pthread_mutex_destroy(mutex);
+	assert(ret == 0);
+	(void)ret;
+}
+
+
+static inline void
+mythread_mutex_lock(mythread_mutex *mutex)
+{
+	const int ret = pthread_mutex_lock(mutex);
+	assert(ret == 0);
+	(void)ret;
+}
+
+
+static inline void
+mythread_mutex_unlock(mythread_mutex *mutex)
+{
+	const int ret = pthread_mutex_unlock(mutex);
+	assert(ret == 0);
+	(void)ret;
+}
+
+
+static inline int
+mythread_cond_init(mythread_cond *cond)
+{
+	return pthread_cond_init(cond, NULL);
+}
+
+
+static inline void
+mythread_cond_destroy(mythread_cond *cond)
+{
+	const int ret = pthread_cond_destroy(cond);
+	assert(ret == 0);
+	(void)ret;
+}
+
+
+static inline void
+mythread_cond_signal(mythread_cond *cond)
+{
+	const int ret = pthread_cond_signal(cond);
+	assert(ret == 0);
+	(void)ret;
+}
+
+
+static inline void
+mythread_cond_broadcast(mythread_cond *cond)
+{
+	const int ret = pthread_cond_broadcast(cond);
+	assert(ret == 0);
+	(void)ret;
+}
+
+
+static inline void
+mythread_cond_wait(mythread_cond *cond, mythread_mutex *mutex)
+{
+	const int ret = pthread_cond_wait(cond, mutex);
+	assert(ret == 0);
+	(void)ret;
+}
+
+#endif
+
+
+// Get the number of online processors. If it cannot be determined,
+// one is returned so that the callers can always use the result as is.
+static inline unsigned int
+mythread_ncpus(void)
+{
+	long n = -1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	if (n < 1)
+		return 1;
+
+	if (n > 1024)
+		return 1024;
+
+	return (unsigned int)n;
+}
+
+#endif
@@ -0,0 +1,480 @@
+/*
+ * Backend for reading BGZF files
+ *
+ * BGZF is a .gz file that consists of members of at most 64 KiB whose
+ * compressed size is stored in the "BC" extra field. A position in the
+ * file is a virtual offset: the compressed offset of a member shifted
+ * left by 16 bits ORed with an offset in the uncompressed data of that
+ * member. Seeking to a virtual offset needs to decompress only one member.
+ *
+ * The decompressed data is given to the frontend with peekin so that the
+ * backend always knows how much has been consumed. This way xzf_seek()
+ * and XZF_KEY_ZOFFSET can tell the exact virtual offset.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <zlib.h>
+
+
+/// Maximum size of a BGZF block, both compressed and uncompressed
+#define BGZF_BLOCK_MAX 65536
+
+/// Size of the fixed part of the .gz header, XLEN included
+#define BGZF_FIXED_SIZE 12
+
+/// Size of the .gz trailer
+#define BGZF_TRAILER_SIZE 8
+
+
+/// Part of the uncompressed buffer that came from one block
+struct bgzfin_segment {
+	/// Position of the first byte in bgzfin_state.buf
+	size_t start;
+
+	/// Compressed offset of the block
+	xzf_off in;
+
+	/// Uncompressed offset of the first byte within the block
+	size_t off;
+};
+
+
+struct bgzfin_state {
+	xzf_stream *in;
+	z_stream s;
+
+	/// Offset of the beginning of the BGZF data in the substream.
+	/// Compressed offsets in virtual offsets are relative to this.
+	xzf_off base;
+
+	/// Compressed offset of the next block to decode
+	xzf_off zpos;
+
+	/// True once the end of the substream has been reached
+	bool eof;
+
+	/// Error from decoding a block. The substream position is
+	/// unknown after it so every read fails until a successful seek.
+	int errnum;
+
+	/// Compressed block
+	unsigned char *cbuf;
+
+	/// Uncompressed data. This has room for two blocks so that
+	/// the frontend can get up to BGZF_BLOCK_MAX bytes at once.
+	unsigned char *buf;
+	size_t pos;
+	size_t size;
+
+	/// Blocks that have data in buf[0] to buf[size - 1].
+	/// Empty blocks aren't included. Usually there are one or
+	/// two but tiny blocks can make this grow.
+	struct bgzfin_segment *segs;
+	size_t segs_count;
+	size_t segs_alloc;
+};
+
+
+static int
+bgzfin_errno(int zerrnum)
+{
+	return zerrnum == Z_MEM_ERROR ? ENOMEM
+			: zerrnum == Z_DATA_ERROR ? XZF_E_ZCORRUPT
+			: zerrnum == Z_BUF_ERROR ? XZF_E_ZCORRUPT
+			: XZF_E_BUG;
+}
+
+
+static uint32_t
+get_le32(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8)
+			| ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
+/// Read exactly size bytes from the substream. A short read is
+/// reported as XZF_E_ZTRUNC.
+static int
+read_exact(struct bgzfin_state *state, unsigned char *buf, size_t size)
+{
+	if (xzf_read(state->in, buf, size) == size)
+		return 0;
+
+	return errno == XZF_E_EOF ? XZF_E_ZTRUNC : errno;
+}
+
+
+/// Decompress the next block and append its data to buf. The caller
+/// must make sure that there is room for BGZF_BLOCK_MAX bytes.
+static int
+decode_block(struct bgzfin_state *state)
+{
+	assert(state->size + BGZF_BLOCK_MAX <= 2 * BGZF_BLOCK_MAX);
+
+	// Compressed offsets must fit into the upper 48 bits.
+	if (state->zpos > XZF_OFF_MAX >> 16)
+		return EFBIG;
+
+	unsigned char *cbuf = state->cbuf;
+	const size_t n = xzf_read(state->in, cbuf, BGZF_FIXED_SIZE);
+	if (n == 0 && errno == XZF_E_EOF) {
+		state->eof = true;
+		return 0;
+	}
+
+	if (n < BGZF_FIXED_SIZE)
+		return errno == XZF_E_EOF ? XZF_E_ZTRUNC : errno;
+
+	// The header must have FEXTRA and nothing else that has
+	// a variable length because BSIZE covers the whole block.
+	if (cbuf[0] != 0x1F || cbuf[1] != 0x8B || cbuf[2] != 0x08
+			|| cbuf[3] != 0x04)
+		return XZF_E_FORMAT;
+
+	// The whole block, XLEN included, has to fit into cbuf.
+	const size_t xlen = (size_t)cbuf[10] | ((size_t)cbuf[11] << 8);
+	if (xlen > BGZF_BLOCK_MAX - BGZF_FIXED_SIZE - BGZF_TRAILER_SIZE)
+		return XZF_E_FORMAT;
+
+	int ret = read_exact(state, cbuf + BGZF_FIXED_SIZE, xlen);
+	if (ret != 0)
+		return ret;
+
+	// Find the BC subfield.
+	size_t bsize = 0;
+	const unsigned char *extra = cbuf + BGZF_FIXED_SIZE;
+	for (size_t i = 0; i + 4 <= xlen; ) {
+		const size_t slen = (size_t)extra[i + 2]
+				| ((size_t)extra[i + 3] << 8);
+		if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2
+				&& i + 6 <= xlen) {
+			bsize = ((size_t)extra[i + 4]
+					| ((size_t)extra[i + 5] << 8)) + 1;
+			break;
+		}
+
+		i += 4 + slen;
+	}
+
+	const size_t header_size = BGZF_FIXED_SIZE + xlen;
+	if (bsize < header_size + BGZF_TRAILER_SIZE)
+		return XZF_E_FORMAT;
+
+	ret = read_exact(state, cbuf + header_size, bsize - header_size);
+	if (ret != 0)
+		return ret;
+
+	const unsigned char *trailer = cbuf + bsize - BGZF_TRAILER_SIZE;
+	const uint32_t crc = get_le32(trailer);
+	const uint32_t isize = get_le32(trailer + 4);
+	if (isize > BGZF_BLOCK_MAX)
+		return XZF_E_ZCORRUPT;
+
+	ret = inflateReset(&state->s);
+	if (ret != Z_OK)
+		return bgzfin_errno(ret);
+
+	unsigned char *out = state->buf + state->size;
+	state->s.next_in = cbuf + header_size;
+	state->s.avail_in = (uInt)(bsize - header_size - BGZF_TRAILER_SIZE);
+	state->s.next_out = out;
+	state->s.avail_out = BGZF_BLOCK_MAX;
+
+	ret = inflate(&state->s, Z_FINISH);
+	if (ret != Z_STREAM_END)
+		return ret == Z_OK ? XZF_E_ZCORRUPT : bgzfin_errno(ret);
+
+	if (state->s.avail_in != 0 || state->s.total_out != isize
+			|| crc32(crc32(0, Z_NULL, 0), out, (uInt)isize) != crc)
+		return XZF_E_ZCORRUPT;
+
+	if (isize > 0) {
+		if (state->segs_count == state->segs_alloc) {
+			const size_t new_alloc = state->segs_alloc * 2;
+			struct bgzfin_segment *new_segs = realloc(state->segs,
+					new_alloc * sizeof(*new_segs));
+			if (new_segs == NULL)
+				return ENOMEM;
+
+			state->segs = new_segs;
+			state->segs_alloc = new_alloc;
+		}
+
+		struct bgzfin_segment *seg = &state->segs[state->segs_count++];
+		seg->start = state->size;
+		seg->in = state->zpos;
+		seg->off = 0;
+		state->size += isize;
+	}
+
+	state->zpos += (xzf_off)bsize;
+	return 0;
+}
+
+
+/// Drop the data before pos from buf.
+static void
+discard_used(struct bgzfin_state *state)
+{
+	if (state->pos == 0)
+		return;
+
+	// Skip the segments that have been consumed completely.
+	size_t first = 0;
+	while (first + 1 < state->segs_count
+			&& state->segs[first + 1].start <= state->pos)
+		++first;
+
+	if (state->pos == state->size)
+		first = state->segs_count;
+
+	state->segs_count -= first;
+	memmove(state->segs, state->segs + first,
+			state->segs_count * sizeof(state->segs[0]));
+
+	for (size_t i = 0; i < state->segs_count; ++i) {
+		struct bgzfin_segment *seg = &state->segs[i];
+		if (seg->start < state->pos) {
+			seg->off += state->pos - seg->start;
+			seg->start = 0;
+		} else {
+			seg->start -= state->pos;
+		}
+	}
+
+	memmove(state->buf, state->buf + state->pos,
+			state->size - state->pos);
+	state->size -= state->pos;
+	state->pos = 0;
+}
+
+
+/// Get the virtual offset of the next byte that the frontend will get
+static xzf_off
+get_voffset(const struct bgzfin_state *state)
+{
+	// At the end of a block, point to the beginning of the next one.
+	if (state->pos == state->size)
+		return state->zpos << 16;
+
+	size_t i = state->segs_count - 1;
+	while (state->segs[i].start > state->pos)
+		--i;
+
+	const struct bgzfin_segment *seg = &state->segs[i];
+	return (seg->in << 16) | (xzf_off)(seg->off + state->pos - seg->start);
+}
+
+
+static int
+bgzfin_peekin_start(void *stateptr, const unsigned char **buf, size_t *size)
+{
+	struct bgzfin_state *state = stateptr;
+	const size_t min = *size;
+	assert(min <= BGZF_BLOCK_MAX);
+
+	if (state->errnum != 0) {
+		*size = 0;
+		return state->errnum;
+	}
+
+	while (state->size - state->pos < min && !state->eof) {
+		discard_used(state);
+
+		state->errnum = decode_block(state);
+		if (state->errnum != 0) {
+			*size = 0;
+			return state->errnum;
+		}
+	}
+
+	*buf = state->buf + state->pos;
+	*size = state->size - state->pos;
+
+	if (*size < min)
+		return XZF_E_EOF;
+
+	return 0;
+}
+
+
+static int
+bgzfin_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct bgzfin_state *state = stateptr;
+	assert(bytes_used <= state->size - state->pos);
+	state->pos += bytes_used;
+	return 0;
+}
+
+
+static int
+bgzfin_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct bgzfin_state *state = stateptr;
+
+	// Virtual offsets cannot be added together so only telling
+	// the current position is supported with XZF_SEEK_CUR.
+	if (whence == XZF_SEEK_CUR && *offset == 0) {
+		*offset = get_voffset(state);
+		return 0;
+	}
+
+	if (whence != XZF_SEEK_SET)
+		return EINVAL;
+
+	const xzf_off zpos = *offset >> 16;
+	const size_t off = (size_t)(*offset & 0xFFFF);
+
+	if (zpos > XZF_OFF_MAX - state->base)
+		return EINVAL;
+
+	if (xzf_seek(state->in, state->base + zpos, XZF_SEEK_SET) == -1)
+		return errno;
+
+	state->zpos = zpos;
+	state->eof = false;
+	state->errnum = 0;
+	state->pos = 0;
+	state->size = 0;
+	state->segs_count = 0;
+
+	// Empty blocks are skipped so that off is within the first
+	// block that has data. On error, reading fails until
+	// another seek succeeds.
+	while (state->size == 0 && !state->eof) {
+		state->errnum = decode_block(state);
+		if (state->errnum != 0)
+			return state->errnum;
+	}
+
+	if (off > state->size)
+		return EINVAL;
+
+	state->pos = off;
+	return 0;
+}
+
+
+static int
+bgzfin_close(void *stateptr, int cl_flags)
+{
+	struct bgzfin_state *state = stateptr;
+	xzf_stream *in = state->in;
+
+	(void)inflateEnd(&state->s);
+	free(state->segs);
+	free(state->cbuf);
+	free(state->buf);
+	free(state);
+
+	return cl_flags & XZF_CL_DETACH ? 0 : xzf_close(in, cl_flags);
+}
+
+
+static int
+bgzfin_getinfo(void *stateptr, int key, void *value)
+{
+	struct bgzfin_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_SUBSTREAM: {
+			xzf_stream **strm = value;
+			*strm = state->in;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_GZ;
+			return 0;
+		}
+
+		case XZF_KEY_ZOFFSET: {
+			xzf_off *offset = value;
+			*offset = get_voffset(state);
+			return 0;
+		}
+	}
+
+	return xzf_getinfo(state->in, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend bgzfin_backend = {
+	.version = 0,
+	.seek = &bgzfin_seek,
+	.close = &bgzfin_close,
+	.peekin_start = &bgzfin_peekin_start,
+	.peekin_end = &bgzfin_peekin_end,
+	.getinfo = &bgzfin_getinfo,
+};
+
+
+extern xzf_stream *
+xzf_bgzfin_open(xzf_stream *in)
+{
+	struct bgzfin_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->in = in;
+
+	int flags = XZF_READ;
+	if (xzf_getflags(in) & XZF_SEEKABLE) {
+		state->base = xzf_seek(in, 0, XZF_SEEK_CUR);
+		if (state->base == -1) {
+			free(state);
+			return NULL;
+		}
+
+		flags |= XZF_SEEKABLE;
+	}
+
+	state->segs_alloc = 4;
+	state->segs = malloc(state->segs_alloc * sizeof(*state->segs));
+	state->cbuf = malloc(BGZF_BLOCK_MAX);
+	state->buf = malloc(2 * BGZF_BLOCK_MAX);
+	if (state->segs == NULL || state->cbuf == NULL
+			|| state->buf == NULL) {
+		free(state->segs);
+		free(state->cbuf);
+		free(state->buf);
+		free(state);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	state->s.zalloc = Z_NULL;
+	state->s.zfree = Z_NULL;
+	state->s.opaque = Z_NULL;
+
+	const int ret = inflateInit2(&state->s, -15);
+	if (ret != Z_OK) {
+		free(state->segs);
+		free(state->cbuf);
+		free(state->buf);
+		free(state);
+		errno = bgzfin_errno(ret);
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &bgzfin_backend, state,
+			flags, BGZF_BLOCK_MAX, XZF_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		bgzfin_close(state, XZF_CL_DETACH);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
@@ -0,0 +1,229 @@
+/*
+ * Backend for reading .bz2 files
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <bzlib.h>
+
+
+struct bz2in_state {
+	xzf_stream *in;
+	bool concatenated;
+	bool finished;
+
+	/// True if s has been initialized and needs BZ2_bzDecompressEnd()
+	bool initialized;
+
+	bz_stream s;
+};
+
+
+static int
+bz2in_errno(int ret)
+{
+	switch (ret) {
+	case BZ_MEM_ERROR:
+		return ENOMEM;
+
+	case BZ_DATA_ERROR_MAGIC:
+		return XZF_E_FORMAT;
+
+	case BZ_DATA_ERROR:
+		return XZF_E_ZCORRUPT;
+
+	default:
+		return XZF_E_BUG;
+	}
+}
+
+
+static int
+bz2in_init(struct bz2in_state *state)
+{
+	state->s.bzalloc = NULL;
+	state->s.bzfree = NULL;
+	state->s.opaque = NULL;
+
+	const int ret = BZ2_bzDecompressInit(&state->s, 0, 0);
+	state->initialized = ret == BZ_OK;
+	return ret == BZ_OK ? 0 : bz2in_errno(ret);
+}
+
+
+static int
+bz2in_read(void *stateptr, unsigned char *out, size_t *out_size)
+{
+	struct bz2in_state *state = stateptr;
+	size_t remaining = *out_size;
+	*out_size = 0;
+
+	do {
+		// Prepare the input buffer.
+		const unsigned char *in;
+		size_t in_size = xzf_peekin_start(state->in, &in, 1);
+		if (in_size == 0 && (errno != XZF_E_EOF || state->finished))
+			return errno;
+
+		if (state->finished) {
+			assert(in_size > 0);
+
+			// The previous .bz2 stream was successfully
+			// decompressed. Since we got more input,
+			// it has to be due to concatenated .bz2 streams.
+			(void)BZ2_bzDecompressEnd(&state->s);
+			state->initialized = false;
+
+			const int errnum = bz2in_init(state);
+			if (errnum != 0) {
+				xzf_peekin_end(state->in, 0);
+				return errnum;
+			}
+
+			state->finished = false;
+		}
+
+#if UINT_MAX < SIZE_MAX
+		if (in_size > UINT_MAX)
+			in_size = UINT_MAX;
+#endif
+
+		state->s.next_in = (char *)in;
+		state->s.avail_in = (unsigned int)in_size;
+
+		// Prepare the output buffer.
+		size_t out_limit = remaining;
+
+#if UINT_MAX < SIZE_MAX
+		if (out_limit > UINT_MAX)
+			out_limit = UINT_MAX;
+#endif
+
+		state->s.next_out = (char *)out;
+		state->s.avail_out = (unsigned int)out_limit;
+
+		// Decompress
+		const int ret = BZ2_bzDecompress(&state->s);
+
+		// Update the input buffer position.
+		if (in_size > 0)
+			xzf_peekin_end(state->in,
+					in_size - state->s.avail_in);
+
+		// Update the output buffer position.
+		const size_t out_used = out_limit - state->s.avail_out;
+		out += out_used;
+		*out_size += out_used;
+		remaining -= out_used;
+
+		if (ret == BZ_OK) {
+			// Without input, no progress means that
+			// the file is truncated.
+			if (in_size == 0 && out_used == 0)
+				return XZF_E_ZTRUNC;
+
+			continue;
+		}
+
+		if (ret != BZ_STREAM_END)
+			return bz2in_errno(ret);
+
+		// If we aren't decompressing concatenated
+		// .bz2 streams, indicate the end of the file now.
+		if (!state->concatenated)
+			return XZF_E_EOF;
+
+		state->finished = true;
+	} while (remaining > 0);
+
+	return 0;
+}
+
+
+static int
+bz2in_close(void *stateptr, int cl_flags)
+{
+	struct bz2in_state *state = stateptr;
+	xzf_stream *in = state->in;
+
+	if (state->initialized)
+		(void)BZ2_bzDecompressEnd(&state->s);
+
+	free(state);
+
+	return cl_flags & XZF_CL_DETACH ? 0 : xzf_close(in, cl_flags);
+}
+
+
+static int
+bz2in_getinfo(void *stateptr, int key, void *value)
+{
+	struct bz2in_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_SUBSTREAM: {
+			xzf_stream **strm = value;
+			*strm = state->in;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_BZ2;
+			return 0;
+		}
+	}
+
+	return xzf_getinfo(state->in, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend bz2in_backend = {
+	.version = 0,
+	.read = &bz2in_read,
+	.close = &bz2in_close,
+	.getinfo = &bz2in_getinfo,
+};
+
+
+extern xzf_stream *
+xzf_bz2in_open(xzf_stream *in, int zflags)
+{
+	static const int supported_flags = XZF_Z_SINGLE;
+	if (zflags & ~supported_flags) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct bz2in_state *state = malloc(sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->in = in;
+	state->concatenated = (zflags & XZF_Z_SINGLE) == 0;
+	state->finished = false;
+
+	const int errnum = bz2in_init(state);
+	if (errnum != 0) {
+		free(state);
+		errno = errnum;
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &bz2in_backend, state,
+			XZF_READ, XZF_BUFSIZE, XZF_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		bz2in_close(state, XZF_CL_DETACH);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
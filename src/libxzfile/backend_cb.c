@@ -1,6 +1,14 @@
 /*
  * Backend to call a callback on the data read or written
  *
+ * The asynchronous variant calls the callback in a worker thread. The
+ * data is read or written in the calling thread into a ring of buffers
+ * and each buffer is also queued for the callback. A buffer is reused
+ * only after the callback has returned, so the data isn't copied for
+ * the callback. The callback is called on one buffer at a time in order,
+ * so its state needs no locking, but the application must not look at
+ * the state until xzf_flush() or xzf_close() has waited for the worker.
+ *
  * Author: Lasse Collin <lasse.collin@tukaani.org>
  *
  * This file has been put into the public domain.
@@ -8,9 +16,15 @@
  */
 
 #include "sysdefs.h"
+#include "mythread.h"
 #include "xzfile.h"
 
 
+/// Number and size of the buffers in the asynchronous mode
+#define CB_ASYNC_NBUFS 4
+#define CB_ASYNC_BUFSIZE (UINT32_C(256) << 10)
+
+
 struct cb_state {
 	xzf_stream *strm;
 
@@ -130,6 +144,14 @@ cb_getinfo(void *stateptr, int key, void *value)
 {
 	struct cb_state *state = stateptr;
 
+	// Without this the callback stream would look like the file
+	// descriptor of the substream and xzf_copy() would bypass it.
+	if (key == XZF_KEY_SUBSTREAM) {
+		xzf_stream **strm = value;
+		*strm = state->strm;
+		return 0;
+	}
+
 /*
 	FIXME Useless?
 	if (key == XZF_KEY_TYPE) {
@@ -215,3 +237,466 @@ xzf_cb_open(xzf_stream *sub_strm,
 
 	return strm;
 }
+
+
+#ifdef MYTHREAD_ENABLED
+struct cb_async_state {
+	xzf_stream *strm;
+
+	void (*cb)(void *cb_state, const unsigned char *buf, size_t size);
+	void *cb_state;
+
+	/// When reading, each buffer has this much room before the data.
+	/// The unused end of the previous buffer is copied there so that
+	/// peekin can return data that spans two buffers in one piece.
+	/// When writing, this is zero.
+	size_t room;
+
+	unsigned char *bufs[CB_ASYNC_NBUFS];
+
+	/// Number of bytes after the room in each buffer
+	size_t sizes[CB_ASYNC_NBUFS];
+
+	/// Sequence number of the oldest buffer that the callback
+	/// hasn't finished. Buffer n is bufs[n % CB_ASYNC_NBUFS].
+	uint64_t head;
+
+	/// Number of buffers that have been queued for the callback
+	uint64_t tail;
+
+	/// When reading, the buffer tail - 1 is given out with peekin and
+	/// the unused data is in cur[pos, end). When writing, pos bytes
+	/// have been written to the buffer tail which isn't queued yet.
+	/// These are used by the calling thread only.
+	unsigned char *cur;
+	size_t pos;
+	size_t end;
+
+	/// XZF_E_EOF or an error code once the substream has been read
+	/// up to the end of the current buffer
+	int read_errnum;
+
+	/// Tells the worker thread to exit once the queue is empty
+	bool stop;
+
+	mythread thread;
+	bool thread_running;
+
+	mythread_mutex mutex;
+	bool mutex_init;
+
+	/// Signaled when a buffer has been queued or stop is set
+	mythread_cond queued_cond;
+
+	/// Signaled when the callback has finished a buffer
+	mythread_cond done_cond;
+};
+
+
+static void *
+async_worker_main(void *stateptr)
+{
+	struct cb_async_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (true) {
+		if (state->head == state->tail) {
+			if (state->stop)
+				break;
+
+			mythread_cond_wait(&state->queued_cond,
+					&state->mutex);
+			continue;
+		}
+
+		const size_t i = (size_t)(state->head % CB_ASYNC_NBUFS);
+		mythread_mutex_unlock(&state->mutex);
+
+		state->cb(state->cb_state, state->bufs[i] + state->room,
+				state->sizes[i]);
+
+		mythread_mutex_lock(&state->mutex);
+		++state->head;
+		mythread_cond_signal(&state->done_cond);
+	}
+
+	mythread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+
+
+/// Wait until the callback is done with the buffer that will be queued
+/// next and return it.
+static unsigned char *
+async_wait_free(struct cb_async_state *state)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	while (state->tail - state->head == CB_ASYNC_NBUFS)
+		mythread_cond_wait(&state->done_cond, &state->mutex);
+
+	unsigned char *buf = state->bufs[state->tail % CB_ASYNC_NBUFS];
+	mythread_mutex_unlock(&state->mutex);
+	return buf;
+}
+
+
+/// Queue the buffer tail for the callback.
+static void
+async_queue(struct cb_async_state *state, size_t size)
+{
+	mythread_mutex_lock(&state->mutex);
+	state->sizes[state->tail % CB_ASYNC_NBUFS] = size;
+	++state->tail;
+	mythread_cond_signal(&state->queued_cond);
+	mythread_mutex_unlock(&state->mutex);
+}
+
+
+/// Wait until the callback has been called on all the queued buffers.
+/// This is the barrier after which the application may use the state
+/// of the callback.
+static void
+async_drain(struct cb_async_state *state)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	while (state->head != state->tail)
+		mythread_cond_wait(&state->done_cond, &state->mutex);
+
+	mythread_mutex_unlock(&state->mutex);
+}
+
+
+static int
+async_peekin_start(void *stateptr, const unsigned char **buf, size_t *size)
+{
+	struct cb_async_state *state = stateptr;
+	const size_t min = *size;
+	assert(min <= state->room);
+
+	while (state->end - state->pos < min && state->read_errnum == 0) {
+		unsigned char *next = async_wait_free(state);
+
+		// xzf_read() reads large amounts directly from the backend
+		// so there is no extra copying in the substream.
+		const size_t n = xzf_read(state->strm, next + state->room,
+				CB_ASYNC_BUFSIZE);
+		if (n < CB_ASYNC_BUFSIZE)
+			state->read_errnum = errno != 0 ? errno : XZF_E_EOF;
+
+		if (n > 0) {
+			// The callback has already seen the unused data.
+			const size_t avail = state->end - state->pos;
+			memcpy(next + state->room - avail,
+					state->cur + state->pos, avail);
+
+			async_queue(state, n);
+			state->cur = next;
+			state->pos = state->room - avail;
+			state->end = state->room + n;
+		}
+	}
+
+	*buf = state->cur + state->pos;
+	*size = state->end - state->pos;
+	return *size >= min ? 0 : state->read_errnum;
+}
+
+
+static int
+async_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct cb_async_state *state = stateptr;
+	state->pos += bytes_used;
+	return 0;
+}
+
+
+/// Write the current output buffer to the substream
+/// and queue it for the callback.
+static int
+async_submit(struct cb_async_state *state)
+{
+	if (state->pos == 0)
+		return 0;
+
+	if (xzf_write(state->strm, state->cur, state->pos))
+		return errno;
+
+	async_queue(state, state->pos);
+	state->pos = 0;
+	return 0;
+}
+
+
+static int
+async_peekout_start(void *stateptr, unsigned char **buf, size_t *size)
+{
+	struct cb_async_state *state = stateptr;
+	const size_t min = *size;
+	assert(min <= CB_ASYNC_BUFSIZE);
+
+	if (CB_ASYNC_BUFSIZE - state->pos < min) {
+		const int errnum = async_submit(state);
+		if (errnum != 0) {
+			*size = 0;
+			return errnum;
+		}
+	}
+
+	if (state->pos == 0)
+		state->cur = async_wait_free(state);
+
+	*buf = state->cur + state->pos;
+	*size = CB_ASYNC_BUFSIZE - state->pos;
+	return 0;
+}
+
+
+static int
+async_peekout_end(void *stateptr, size_t bytes_written)
+{
+	struct cb_async_state *state = stateptr;
+	state->pos += bytes_written;
+	return state->pos == CB_ASYNC_BUFSIZE ? async_submit(state) : 0;
+}
+
+
+static int
+async_flush(void *stateptr, int fl_flags)
+{
+	struct cb_async_state *state = stateptr;
+
+	if (state->room > 0) {
+		async_drain(state);
+		return 0;
+	}
+
+	const int errnum = async_submit(state);
+	async_drain(state);
+	if (errnum != 0)
+		return errnum;
+
+	return xzf_flush(state->strm, fl_flags) ? errno : 0;
+}
+
+
+/// Stop the thread and free the memory. This works also
+/// on a partially initialized state.
+static void
+async_free(struct cb_async_state *state)
+{
+	if (state->thread_running) {
+		mythread_mutex_lock(&state->mutex);
+		state->stop = true;
+		mythread_cond_signal(&state->queued_cond);
+		mythread_mutex_unlock(&state->mutex);
+
+		(void)mythread_join(state->thread);
+	}
+
+	if (state->mutex_init) {
+		mythread_cond_destroy(&state->done_cond);
+		mythread_cond_destroy(&state->queued_cond);
+		mythread_mutex_destroy(&state->mutex);
+	}
+
+	for (size_t i = 0; i < CB_ASYNC_NBUFS; ++i)
+		free(state->bufs[i]);
+
+	free(state);
+}
+
+
+static int
+async_close(void *stateptr, int cl_flags)
+{
+	struct cb_async_state *state = stateptr;
+	xzf_stream *strm = state->strm;
+
+	// The output that hasn't been written yet is discarded
+	// with XZF_CL_FORGET.
+	int errnum = 0;
+	if (state->room == 0 && !(cl_flags & XZF_CL_FORGET))
+		errnum = async_submit(state);
+
+	// Stopping the thread waits for the queued buffers.
+	async_free(state);
+
+	if (cl_flags & XZF_CL_DETACH)
+		return errnum;
+
+	const int ret = xzf_close(strm, cl_flags);
+	return errnum != 0 ? errnum : ret;
+}
+
+
+static int
+async_getinfo(void *stateptr, int key, void *value)
+{
+	struct cb_async_state *state = stateptr;
+
+	// The worker never uses the substream so it can be used here.
+	if (key == XZF_KEY_SUBSTREAM) {
+		xzf_stream **strm = value;
+		*strm = state->strm;
+		return 0;
+	}
+
+	return xzf_getinfo(state->strm, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend cb_async_in_backend = {
+	.version = 0,
+	.flush = &async_flush,
+	.close = &async_close,
+	.peekin_start = &async_peekin_start,
+	.peekin_end = &async_peekin_end,
+	.getinfo = &async_getinfo,
+};
+
+
+static const struct xzf_backend cb_async_out_backend = {
+	.version = 0,
+	.flush = &async_flush,
+	.close = &async_close,
+	.peekout_start = &async_peekout_start,
+	.peekout_end = &async_peekout_end,
+	.getinfo = &async_getinfo,
+};
+
+
+static int
+async_init(struct cb_async_state *state)
+{
+	for (size_t i = 0; i < CB_ASYNC_NBUFS; ++i) {
+		state->bufs[i] = malloc(state->room + CB_ASYNC_BUFSIZE);
+		if (state->bufs[i] == NULL)
+			return ENOMEM;
+	}
+
+	state->cur = state->bufs[0];
+
+	int ret = mythread_mutex_init(&state->mutex);
+	if (ret != 0)
+		return ret;
+
+	ret = mythread_cond_init(&state->queued_cond);
+	if (ret != 0) {
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	ret = mythread_cond_init(&state->done_cond);
+	if (ret != 0) {
+		mythread_cond_destroy(&state->queued_cond);
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	state->mutex_init = true;
+
+	ret = mythread_create(&state->thread, &async_worker_main, state);
+	if (ret != 0)
+		return ret;
+
+	state->thread_running = true;
+	return 0;
+}
+
+
+static xzf_stream *
+async_open(xzf_stream *sub_strm, int flags,
+		void (*cb)(void *cb_state, const unsigned char *buf,
+			size_t size),
+		void *cb_state)
+{
+	struct cb_async_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->strm = sub_strm;
+	state->cb = cb;
+	state->cb_state = cb_state;
+	state->room = flags == XZF_READ ? XZF_BUFSIZE : 0;
+
+	const int ret = async_init(state);
+	if (ret != 0) {
+		async_free(state);
+		errno = ret;
+		return NULL;
+	}
+
+	// The biggest peekin is limited by the room before the data.
+	xzf_stream *strm = flags == XZF_READ
+			? xzf_stream_init(NULL, &cb_async_in_backend, state,
+				XZF_READ, state->room, 0)
+			: xzf_stream_init(NULL, &cb_async_out_backend, state,
+				XZF_WRITE, 0, CB_ASYNC_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		async_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
+#endif
+
+
+extern xzf_stream *
+xzf_cb_async_inopen(xzf_stream *sub_strm,
+		void (*in_cb)(void *in_state,
+			const unsigned char *buf, size_t size),
+		void *in_state)
+{
+	if (sub_strm == NULL)
+		return NULL;
+
+	if (in_cb == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(xzf_getflags(sub_strm) & XZF_READ)) {
+		errno = XZF_E_NOTREADABLE;
+		return NULL;
+	}
+
+#ifdef MYTHREAD_ENABLED
+	return async_open(sub_strm, XZF_READ, in_cb, in_state);
+#else
+	return xzf_cb_inopen(sub_strm, in_cb, in_state);
+#endif
+}
+
+
+extern xzf_stream *
+xzf_cb_async_outopen(xzf_stream *sub_strm,
+		void (*out_cb)(void *out_state,
+			const unsigned char *buf, size_t size),
+		void *out_state)
+{
+	if (sub_strm == NULL)
+		return NULL;
+
+	if (out_cb == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!(xzf_getflags(sub_strm) & XZF_WRITE)) {
+		errno = XZF_E_NOTWRITABLE;
+		return NULL;
+	}
+
+#ifdef MYTHREAD_ENABLED
+	return async_open(sub_strm, XZF_WRITE, out_cb, out_state);
+#else
+	return xzf_cb_outopen(sub_strm, out_cb, out_state);
+#endif
+}
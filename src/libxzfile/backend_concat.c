@@ -0,0 +1,679 @@
+/*
+ * Concatenation of several inputs into one stream
+ *
+ * The inputs are read one after another like with cat. A prefetch thread
+ * prepares the next input while the current one is being read: it opens
+ * the file, detects the compression format, initializes the decompressor,
+ * and fills the first buffer. Thus switching to the next input doesn't
+ * wait for the file system or the decoder setup, which matters when
+ * there are many small files.
+ *
+ * The prefetch thread uses only the input that it is preparing, and the
+ * reader uses it only after it has been handed over, so the inputs don't
+ * need XZF_THRSAFE.
+ *
+ * The frontend peeks the buffer of the current input directly so the data
+ * isn't copied in between. If the input is memory-mapped, nothing is
+ * copied at all. Only a peek that spans the end of an input is assembled
+ * into a small joint buffer. Skipping and getinfo go to the current input.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "mythread.h"
+#include "xzfile.h"
+
+
+/// Maximum number of inputs
+#define CONCAT_INPUTS_MAX (SIZE_MAX / sizeof(xzf_stream *))
+
+/// Maximum size of a peek and thus the size of the joint buffer
+#define CONCAT_JOINT_SIZE XZF_BUFSIZE
+
+/// Number of inputs that are prepared ahead. Several are needed so that
+/// the threads don't have to wake each other for every small file.
+#define CONCAT_PREFETCH 4
+
+
+struct concat_state {
+	/// Either the names of the files to open or the streams
+	/// given by the application
+	const char *const *filenames;
+	xzf_stream **streams;
+	size_t count;
+
+	/// Flags and compression flags for xzf_open()
+	int flags;
+	int zflags;
+
+	/// Called when an input cannot be opened or read.
+	/// If it is NULL, the error is returned to the reader.
+	void (*skip_cb)(void *skip_state, const char *filename, int errnum,
+			int opened);
+	void *skip_state;
+
+	/// The input being read or NULL if the next one hasn't
+	/// been taken yet
+	xzf_stream *cur;
+
+	/// Number of inputs that have been taken by the reader
+	size_t taken;
+
+	/// Buffer for a peek that spans the end of an input. The bytes
+	/// from joint_pos to joint_size haven't been used yet.
+	unsigned char *joint;
+	size_t joint_pos;
+	size_t joint_size;
+
+	/// True if the frontend is peeking the joint buffer instead of
+	/// the buffer of the current input
+	bool joint_peek;
+
+	/// Buffer of the current input that the frontend is peeking,
+	/// or NULL if it isn't peeking the input directly. The input
+	/// stays locked until the peek is ended.
+	const unsigned char *input_peek;
+	size_t input_peek_size;
+
+#ifdef MYTHREAD_ENABLED
+	/// Index of the input that the prefetch thread prepares next.
+	/// The inputs from taken to next - 1 have been prepared.
+	size_t next;
+
+	/// The prepared input i is in ready[i % CONCAT_PREFETCH].
+	/// The stream is NULL if opening failed.
+	struct {
+		xzf_stream *strm;
+		int errnum;
+	} ready[CONCAT_PREFETCH];
+
+	/// Tells the prefetch thread to exit
+	bool stop;
+
+	mythread thread;
+	bool thread_running;
+
+	mythread_mutex mutex;
+	bool mutex_init;
+
+	/// Signaled when an input has been prepared while none were ready
+	mythread_cond ready_cond;
+
+	/// Signaled when half of the prepared inputs have been taken
+	/// or stop is set
+	mythread_cond taken_cond;
+#endif
+};
+
+
+/// Get the filename of the input i for error messages
+static const char *
+input_name(const struct concat_state *state, size_t i)
+{
+	return state->filenames != NULL ? state->filenames[i] : NULL;
+}
+
+
+/// Open the input i and let it read and decode its first buffer.
+/// On error, NULL is returned and *errnum is set.
+static xzf_stream *
+prepare_input(struct concat_state *state, size_t i, int *errnum)
+{
+	xzf_stream *strm = state->filenames != NULL
+			? xzf_open(state->filenames[i], state->flags,
+				state->zflags)
+			: state->streams[i];
+	if (strm == NULL) {
+		*errnum = errno;
+		return NULL;
+	}
+
+	// Errors are sticky so the reader sees them later.
+	const unsigned char *buf;
+	if (xzf_peekin_start(strm, &buf, 1) > 0)
+		xzf_peekin_end(strm, 0);
+
+	*errnum = 0;
+	return strm;
+}
+
+
+/// Close an input. The streams given by the application are left open
+/// if XZF_CL_DETACH is used.
+static int
+close_input(struct concat_state *state, xzf_stream *strm, int cl_flags)
+{
+	if (state->filenames != NULL)
+		return xzf_close(strm, cl_flags & ~XZF_CL_DETACH);
+
+	return cl_flags & XZF_CL_DETACH ? 0 : xzf_close(strm, cl_flags);
+}
+
+
+#ifdef MYTHREAD_ENABLED
+static void *
+prefetch_main(void *stateptr)
+{
+	struct concat_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (!state->stop) {
+		if (state->next - state->taken == CONCAT_PREFETCH
+				|| state->next == state->count) {
+			mythread_cond_wait(&state->taken_cond, &state->mutex);
+			continue;
+		}
+
+		const size_t i = state->next;
+		mythread_mutex_unlock(&state->mutex);
+
+		int errnum;
+		xzf_stream *strm = prepare_input(state, i, &errnum);
+
+		mythread_mutex_lock(&state->mutex);
+		state->ready[i % CONCAT_PREFETCH].strm = strm;
+		state->ready[i % CONCAT_PREFETCH].errnum = errnum;
+		++state->next;
+
+		// The reader can be waiting only if nothing was ready.
+		if (state->next - state->taken == 1)
+			mythread_cond_signal(&state->ready_cond);
+	}
+
+	mythread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+
+
+/// Take the next input from the prefetch thread.
+static xzf_stream *
+take_input(struct concat_state *state, int *errnum)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	while (state->next == state->taken)
+		mythread_cond_wait(&state->ready_cond, &state->mutex);
+
+	const size_t i = state->taken++ % CONCAT_PREFETCH;
+	xzf_stream *strm = state->ready[i].strm;
+	*errnum = state->ready[i].errnum;
+
+	if (state->next - state->taken == CONCAT_PREFETCH / 2)
+		mythread_cond_signal(&state->taken_cond);
+
+	mythread_mutex_unlock(&state->mutex);
+	return strm;
+}
+
+#else
+
+static xzf_stream *
+take_input(struct concat_state *state, int *errnum)
+{
+	return prepare_input(state, state->taken++, errnum);
+}
+#endif
+
+
+/// Make the next input current. Inputs that cannot be opened are
+/// skipped if there is a callback. Returns XZF_E_EOF after the last one.
+static int
+next_input(struct concat_state *state)
+{
+	while (state->taken < state->count) {
+		int errnum;
+		state->cur = take_input(state, &errnum);
+
+		if (state->cur != NULL)
+			return 0;
+
+		if (state->skip_cb == NULL)
+			return errnum;
+
+		state->skip_cb(state->skip_state,
+				input_name(state, state->taken - 1), errnum, 0);
+	}
+
+	return XZF_E_EOF;
+}
+
+
+/// Close the current input after its end or an error. Returns the error
+/// for the reader or zero if reading can continue from the next input.
+static int
+end_input(struct concat_state *state, int read_errnum)
+{
+	// Closing returns the sticky read error too.
+	const int close_errnum = close_input(state, state->cur, 0);
+	state->cur = NULL;
+
+	const int errnum = read_errnum != XZF_E_EOF
+			? read_errnum : close_errnum;
+	if (errnum == 0 || state->skip_cb == NULL)
+		return errnum;
+
+	state->skip_cb(state->skip_state,
+			input_name(state, state->taken - 1), errnum, 1);
+	return 0;
+}
+
+
+/// Start peeking the buffer of the next input that has data left.
+/// XZF_E_EOF is returned after the last input.
+static int
+peek_input(struct concat_state *state, const unsigned char **buf,
+		size_t *size)
+{
+	while (true) {
+		if (state->cur == NULL) {
+			const int errnum = next_input(state);
+			if (errnum != 0) {
+				*size = 0;
+				return errnum;
+			}
+		}
+
+		// An error after this data is sticky in state->cur
+		// so it is noticed on the next call.
+		*size = xzf_peekin_start(state->cur, buf, 1);
+		if (*size > 0)
+			return 0;
+
+		// The input is closed also after an error.
+		const int errnum = end_input(state, errno);
+		if (errnum != 0)
+			return errnum;
+	}
+}
+
+
+/// Copy from the inputs to buf. Less than *size bytes are copied only
+/// at the end of the last input or on error.
+static int
+read_inputs(struct concat_state *state, unsigned char *buf, size_t *size)
+{
+	size_t pos = 0;
+	int errnum = 0;
+
+	while (pos < *size) {
+		const unsigned char *in;
+		size_t avail;
+		errnum = peek_input(state, &in, &avail);
+		if (errnum != 0)
+			break;
+
+		if (avail > *size - pos)
+			avail = *size - pos;
+
+		memcpy(buf + pos, in, avail);
+		xzf_peekin_end(state->cur, avail);
+		pos += avail;
+	}
+
+	*size = pos;
+	return errnum;
+}
+
+
+static int
+concat_peekin_start(void *stateptr, const unsigned char **buf, size_t *size)
+{
+	struct concat_state *state = stateptr;
+	const size_t min = *size;
+	assert(min <= CONCAT_JOINT_SIZE);
+
+	if (state->joint_pos == state->joint_size) {
+		// Usually the buffer of the current input is enough.
+		const int errnum = peek_input(state, buf, size);
+		if (errnum != 0)
+			return errnum;
+
+		if (*size >= min) {
+			state->input_peek = *buf;
+			state->input_peek_size = *size;
+			return 0;
+		}
+
+		// The input ends before min bytes. Copy what it has
+		// to the joint buffer and continue from the next input.
+		if (state->joint == NULL) {
+			state->joint = malloc(CONCAT_JOINT_SIZE);
+			if (state->joint == NULL) {
+				xzf_peekin_end(state->cur, 0);
+				*size = 0;
+				return ENOMEM;
+			}
+		}
+
+		memcpy(state->joint, *buf, *size);
+		xzf_peekin_end(state->cur, *size);
+		state->joint_pos = 0;
+		state->joint_size = *size;
+
+	} else if (state->joint_pos > 0) {
+		// Move the unused bytes to the beginning.
+		state->joint_size -= state->joint_pos;
+		memmove(state->joint, state->joint + state->joint_pos,
+				state->joint_size);
+		state->joint_pos = 0;
+	}
+
+	int errnum = 0;
+	if (state->joint_size < min) {
+		size_t n = min - state->joint_size;
+		errnum = read_inputs(state, state->joint + state->joint_size,
+				&n);
+		state->joint_size += n;
+	}
+
+	// The frontend ends the peek only if it got some data.
+	*buf = state->joint;
+	*size = state->joint_size;
+	state->joint_peek = *size > 0;
+	return errnum;
+}
+
+
+static int
+concat_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct concat_state *state = stateptr;
+
+	if (state->joint_peek) {
+		state->joint_peek = false;
+		state->joint_pos += bytes_used;
+	} else {
+		state->input_peek = NULL;
+		xzf_peekin_end(state->cur, bytes_used);
+	}
+
+	return 0;
+}
+
+
+static int
+concat_skip(void *stateptr, xzf_off *amount)
+{
+	struct concat_state *state = stateptr;
+	xzf_off left = *amount;
+
+	// The unused bytes in the joint buffer are before the current
+	// position of the input.
+	const size_t joint_avail = state->joint_size - state->joint_pos;
+	if (joint_avail > 0) {
+		const size_t n = (unsigned long long)left < joint_avail
+				? (size_t)left : joint_avail;
+		state->joint_pos += n;
+		left -= (xzf_off)n;
+	}
+
+	int errnum = 0;
+	while (left > 0) {
+		if (state->cur == NULL) {
+			errnum = next_input(state);
+			if (errnum != 0)
+				break;
+		}
+
+		const xzf_off n = xzf_skip(state->cur, left);
+		if (n > 0)
+			left -= n;
+
+		if (left == 0)
+			break;
+
+		// Less than requested means the end of the input
+		// or an error.
+		errnum = end_input(state, errno);
+		if (errnum != 0)
+			break;
+	}
+
+	*amount -= left;
+	return errnum;
+}
+
+
+static int
+concat_getinfo(void *stateptr, int key, void *value)
+{
+	struct concat_state *state = stateptr;
+
+	// The information is about the input that is being read.
+	if (state->cur == NULL)
+		return XZF_E_NOKEY;
+
+	switch (key) {
+		case XZF_KEY_SUBSTREAM: {
+			xzf_stream **strm = value;
+			*strm = state->cur;
+			return 0;
+		}
+	}
+
+	// If the frontend is peeking the buffer of the input, the input
+	// is locked. End the peek for the call and start it again. Only
+	// XZF_KEY_ZOFFSET could move the buffer of the input, and for it
+	// our frontend has already ended the peek.
+	if (state->input_peek != NULL)
+		xzf_peekin_end(state->cur, 0);
+
+	const int ret = xzf_getinfo(state->cur, key, value) ? errno : 0;
+
+	if (state->input_peek != NULL) {
+		const unsigned char *buf;
+		const size_t size = xzf_peekin_start(state->cur, &buf, 1);
+		assert(buf == state->input_peek);
+		assert(size == state->input_peek_size);
+		(void)size;
+	}
+
+	return ret;
+}
+
+
+/// Stop the prefetch thread. After this the inputs are used
+/// only by the calling thread.
+static void
+stop_prefetch(struct concat_state *state)
+{
+#ifdef MYTHREAD_ENABLED
+	if (state->thread_running) {
+		mythread_mutex_lock(&state->mutex);
+		state->stop = true;
+		mythread_cond_signal(&state->taken_cond);
+		mythread_mutex_unlock(&state->mutex);
+
+		(void)mythread_join(state->thread);
+		state->thread_running = false;
+	}
+#else
+	(void)state;
+#endif
+}
+
+
+/// Stop the thread and free the memory. This works also
+/// on a partially initialized state.
+static void
+concat_free(struct concat_state *state)
+{
+	stop_prefetch(state);
+
+#ifdef MYTHREAD_ENABLED
+	if (state->mutex_init) {
+		mythread_cond_destroy(&state->taken_cond);
+		mythread_cond_destroy(&state->ready_cond);
+		mythread_mutex_destroy(&state->mutex);
+	}
+#endif
+
+	free(state->joint);
+	free(state->streams);
+	free(state);
+}
+
+
+static int
+concat_close(void *stateptr, int cl_flags)
+{
+	struct concat_state *state = stateptr;
+
+	// Stop the prefetching first so that the inputs aren't used
+	// by two threads.
+	stop_prefetch(state);
+
+	int ret = 0;
+	if (state->cur != NULL)
+		ret = close_input(state, state->cur, cl_flags);
+
+	// The inputs that haven't been reached are closed too. Their
+	// errors, for example from prefetching, don't matter anymore.
+	size_t first_unused = state->taken;
+
+#ifdef MYTHREAD_ENABLED
+	for (; first_unused < state->next; ++first_unused) {
+		xzf_stream *strm = state->ready[
+				first_unused % CONCAT_PREFETCH].strm;
+		if (strm != NULL)
+			(void)close_input(state, strm, cl_flags);
+	}
+#endif
+
+	if (state->streams != NULL && !(cl_flags & XZF_CL_DETACH))
+		for (size_t i = first_unused; i < state->count; ++i)
+			(void)xzf_close(state->streams[i], cl_flags);
+
+	concat_free(state);
+	return ret;
+}
+
+
+static const struct xzf_backend concat_backend = {
+	.version = 0,
+	.close = &concat_close,
+	.peekin_start = &concat_peekin_start,
+	.peekin_end = &concat_peekin_end,
+	.getinfo = &concat_getinfo,
+	.skip = &concat_skip,
+};
+
+
+static xzf_stream *
+concat_open(struct concat_state *state)
+{
+#ifdef MYTHREAD_ENABLED
+	int ret = mythread_mutex_init(&state->mutex);
+	if (ret == 0) {
+		ret = mythread_cond_init(&state->ready_cond);
+		if (ret != 0) {
+			mythread_mutex_destroy(&state->mutex);
+		} else {
+			ret = mythread_cond_init(&state->taken_cond);
+			if (ret != 0) {
+				mythread_cond_destroy(&state->ready_cond);
+				mythread_mutex_destroy(&state->mutex);
+			}
+		}
+	}
+
+	if (ret == 0) {
+		state->mutex_init = true;
+
+		// The first input is prepared already while
+		// the application continues.
+		ret = mythread_create(&state->thread, &prefetch_main, state);
+		if (ret == 0)
+			state->thread_running = true;
+	}
+
+	if (ret != 0) {
+		concat_free(state);
+		errno = ret;
+		return NULL;
+	}
+#endif
+
+	xzf_stream *strm = xzf_stream_init(NULL, &concat_backend, state,
+			XZF_READ, CONCAT_JOINT_SIZE, 0);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		concat_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
+
+
+extern xzf_stream *
+xzf_concat_open(const char *const *filenames, size_t nfiles,
+		int flags, int zflags,
+		void (*skip_cb)(void *skip_state, const char *filename,
+			int errnum, int opened),
+		void *skip_state)
+{
+	if ((filenames == NULL && nfiles > 0) || !(flags & XZF_READ)
+			|| (flags & (XZF_WRITE | XZF_CREAT))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct concat_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->filenames = filenames;
+	state->count = nfiles;
+	state->flags = flags;
+	state->zflags = zflags;
+	state->skip_cb = skip_cb;
+	state->skip_state = skip_state;
+
+	return concat_open(state);
+}
+
+
+extern xzf_stream *
+xzf_concat_sopen(xzf_stream **streams, size_t nstreams)
+{
+	if ((streams == NULL && nstreams > 0)
+			|| nstreams > CONCAT_INPUTS_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (size_t i = 0; i < nstreams; ++i) {
+		if (streams[i] == NULL)
+			return NULL;
+
+		if (!(xzf_getflags(streams[i]) & XZF_READ)) {
+			errno = XZF_E_NOTREADABLE;
+			return NULL;
+		}
+	}
+
+	struct concat_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	// The array is copied so that the application may free it.
+	if (nstreams > 0) {
+		state->streams = malloc(nstreams * sizeof(*streams));
+		if (state->streams == NULL) {
+			free(state);
+			return NULL;
+		}
+
+		memcpy(state->streams, streams, nstreams * sizeof(*streams));
+	}
+
+	state->count = nstreams;
+	return concat_open(state);
+}
@@ -12,70 +12,1004 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#	include <arm_neon.h>
+#endif
+
+
+#ifndef O_BINARY
+#	define O_BINARY 0
+#endif
+
+#ifndef O_NOCTTY
+#	define O_NOCTTY 0
+#endif
+
+#ifndef O_CLOEXEC
+#	define O_CLOEXEC 0
+#endif
+
+// Without O_DIRECT, XZF_DIRECT only makes the I/O aligned.
+#ifndef O_DIRECT
+#	define O_DIRECT 0
+#endif
+
+/// Block size to use for sparse files if st_blksize isn't sensible
+#define FD_SPARSE_BLOCK 4096
+
+/// Size of the buffer for direct I/O
+#define FD_DIRECT_BUF_SIZE (UINT32_C(1) << 20)
+
+/// Minimum alignment for direct I/O. The logical block size of
+/// common devices is 512 or 4096 bytes.
+#define FD_DIRECT_ALIGN 4096
+
+/// With XZF_NOCACHE, the page cache is managed every time this many
+/// bytes have been read or written.
+#define FD_NOCACHE_CHUNK (UINT32_C(8) << 20)
+
+/// With XZF_NOCACHE, the amount to read ahead of the current position
+#define FD_NOCACHE_AHEAD (2 * FD_NOCACHE_CHUNK)
+
+/// Maximum number of buffers given to readv() and writev() at once.
+/// This is far below IOV_MAX on all systems.
+#define FD_IOV_MAX 16
+
+
+struct fd_state {
+	int fd;
+	bool writing;
+
+	/// Descriptor of /dev/null for skipping with splice() or -1 if
+	/// it hasn't been opened. It is opened on the first skip.
+	int null_fd;
+
+	/// True if blocks of zeros are skipped with lseek() instead
+	/// of writing them
+	bool sparse;
+
+	/// Sparse mode: Size of the blocks that are checked for zeros.
+	/// Only blocks at offsets that are multiples of this are skipped.
+	size_t block_size;
+
+	/// Sparse mode: File offset or -1 if it isn't known. Reading
+	/// makes it unknown.
+	xzf_off pos;
+
+	/// Sparse mode: Size of the file as far as it has been written.
+	/// Zeros are skipped only past this because existing data
+	/// has to be overwritten.
+	xzf_off size;
+
+	/// Sparse mode: End of the last skipped block if nothing has been
+	/// written after it. The file has to be extended to this size
+	/// with ftruncate() since skipping doesn't do it.
+	xzf_off hole_end;
+
+	/// True if holes are returned as zeros without reading them
+	bool holes;
+
+	/// Hole-aware reading: File offset of the kernel or -1 if it
+	/// isn't known
+	xzf_off read_pos;
+
+	/// Hole-aware reading: Offset of the next hole at or after
+	/// read_pos or -1 if it isn't known
+	xzf_off data_end;
+
+	/// Hole-aware reading: Number of zeros still to be returned.
+	/// The kernel file offset is already past them so the logical
+	/// position is read_pos - zeros.
+	xzf_off zeros;
+
+	/// Direct I/O: Aligned buffer or NULL if direct I/O isn't used.
+	/// When writing, it has room for two times FD_DIRECT_BUF_SIZE
+	/// so that peekout can always give FD_DIRECT_BUF_SIZE bytes.
+	unsigned char *direct_buf;
+
+	/// Direct I/O: One aligned block for merging a partially
+	/// written block with the data that is already in the file
+	unsigned char *direct_block;
+
+	/// Direct I/O: Alignment of file offsets, sizes, and memory
+	size_t align;
+
+	/// Direct I/O: File offset of direct_buf[0]. This is
+	/// a multiple of align.
+	xzf_off buf_off;
+
+	/// Direct I/O: Number of bytes in direct_buf that have been read
+	/// or that are waiting to be written
+	size_t buf_fill;
+
+	/// Direct I/O: Reading: Position of the next byte in direct_buf
+	size_t buf_pos;
+
+	/// Direct I/O: Writing: Size of the file. The last partial block
+	/// is written in full and then the file is truncated to this size.
+	xzf_off file_size;
+
+	/// True if the pages that have been read or written are dropped
+	/// from the page cache
+	bool nocache;
+
+	/// Cache dropping: Bytes read or written since the last time
+	/// the page cache was managed
+	size_t nocache_count;
+
+	/// Cache dropping: Start of the range that hasn't been dropped
+	xzf_off drop_off;
+
+	/// Cache dropping: Writing: Start of the range whose writeback
+	/// hasn't been started. The range between drop_off and this is
+	/// being written back.
+	xzf_off writeback_off;
+};
+
+
+/// Forget the position of the next hole. This is needed when the file
+/// offset changes in other ways than reading.
+static void
+holes_reset(struct fd_state *state)
+{
+	state->read_pos = -1;
+	state->data_end = -1;
+	state->zeros = 0;
+}
+
+
+/// Look up where the data at or after read_pos begins and ends. Holes
+/// in between are skipped with lseek() and counted in zeros.
+static int
+holes_find(struct fd_state *state)
+{
+	if (state->read_pos == -1) {
+		state->read_pos = lseek(state->fd, 0, SEEK_CUR);
+		if (state->read_pos == -1)
+			return errno;
+	}
+
+#ifdef SEEK_DATA
+	const off_t data = lseek(state->fd, (off_t)state->read_pos, SEEK_DATA);
+	if (data != -1) {
+		const off_t hole = lseek(state->fd, data, SEEK_HOLE);
+		if (hole == -1 || lseek(state->fd, data, SEEK_SET) == -1)
+			return errno;
+
+		state->zeros = (xzf_off)data - state->read_pos;
+		state->read_pos = (xzf_off)data;
+		state->data_end = (xzf_off)hole;
+		return 0;
+	}
+
+	if (errno == ENXIO) {
+		// There's no data after read_pos so the rest of
+		// the file is a hole.
+		struct stat st;
+		if (fstat(state->fd, &st))
+			return errno;
+
+		if ((xzf_off)st.st_size > state->read_pos) {
+			if (lseek(state->fd, st.st_size, SEEK_SET) == -1)
+				return errno;
+
+			state->zeros = (xzf_off)st.st_size - state->read_pos;
+			state->read_pos = (xzf_off)st.st_size;
+		}
+	} else if (errno != EINVAL) {
+		// EINVAL means that the file system doesn't support
+		// SEEK_DATA. Then the whole file is data.
+		return errno;
+	}
+#endif
+
+	// Read normally until the end of the file. If the file grows,
+	// the new data will be read too.
+	state->data_end = XZF_OFF_MAX;
+	return 0;
+}
+
+
+/// Read from a sparse file so that holes aren't read from the kernel
+static int
+holes_read(struct fd_state *state, unsigned char *buf, size_t *size)
+{
+	if (state->zeros == 0 && (state->data_end == -1
+			|| state->read_pos == -1
+			|| state->read_pos >= state->data_end)) {
+		const int errnum = holes_find(state);
+		if (errnum != 0) {
+			*size = 0;
+			return errnum;
+		}
+	}
+
+	if (state->zeros > 0) {
+		if ((xzf_off)*size > state->zeros)
+			*size = (size_t)state->zeros;
+
+		memset(buf, 0, *size);
+		state->zeros -= (xzf_off)*size;
+		return 0;
+	}
+
+	// Don't read past the beginning of the next hole.
+	size_t limit = *size <= SSIZE_MAX ? *size : SSIZE_MAX;
+	if ((xzf_off)limit > state->data_end - state->read_pos)
+		limit = (size_t)(state->data_end - state->read_pos);
+
+	while (true) {
+		const ssize_t ret = read(state->fd, buf, limit);
+
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			*size = 0;
+			return ret == 0 ? XZF_E_EOF : errno;
+		}
+
+		*size = ret;
+		state->read_pos += ret;
+		return 0;
+	}
+}
+
+
+/// Move the file offset back to the logical position if zeros of
+/// a hole are still pending.
+static int
+holes_unread(struct fd_state *state)
+{
+	if (state->zeros > 0 && lseek(state->fd,
+			-(off_t)state->zeros, SEEK_CUR) == -1)
+		return errno;
+
+	holes_reset(state);
+	return 0;
+}
+
+
+/// Drop the pages in [offset, offset + len) from the page cache.
+/// len == 0 means until the end of the file. Dirty pages stay.
+static void
+nocache_drop(struct fd_state *state, xzf_off offset, xzf_off len)
+{
+#ifdef HAVE_POSIX_FADVISE
+	(void)posix_fadvise(state->fd, (off_t)offset, (off_t)len,
+			POSIX_FADV_DONTNEED);
+#else
+	(void)state;
+	(void)offset;
+	(void)len;
+#endif
+}
+
+
+/// Write [offset, offset + len) to the disk and wait for it so that
+/// the pages become clean and can be dropped.
+static void
+nocache_writeback(struct fd_state *state, xzf_off offset, xzf_off len,
+		bool wait)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	(void)sync_file_range(state->fd, (off_t)offset, (off_t)len, wait
+			? SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+				| SYNC_FILE_RANGE_WAIT_AFTER
+			: SYNC_FILE_RANGE_WRITE);
+#else
+	(void)state;
+	(void)offset;
+	(void)len;
+	(void)wait;
+#endif
+}
+
+
+/// Reading: Read ahead of pos and drop what is behind it.
+static void
+nocache_read(struct fd_state *state, xzf_off pos)
+{
+#if defined(HAVE_READAHEAD)
+	(void)readahead(state->fd, (off_t)pos, FD_NOCACHE_AHEAD);
+#elif defined(HAVE_POSIX_FADVISE)
+	(void)posix_fadvise(state->fd, (off_t)pos, FD_NOCACHE_AHEAD,
+			POSIX_FADV_WILLNEED);
+#endif
+
+	if (pos > state->drop_off)
+		nocache_drop(state, state->drop_off, pos - state->drop_off);
+
+	state->drop_off = pos;
+}
+
+
+/// Writing: Start the writeback of the data up to pos. The previous
+/// range has had time to be written, so wait for it and drop it.
+static void
+nocache_write(struct fd_state *state, xzf_off pos)
+{
+	if (pos <= state->writeback_off)
+		return;
+
+	nocache_writeback(state, state->writeback_off,
+			pos - state->writeback_off, false);
+
+	if (state->writeback_off > state->drop_off) {
+		const xzf_off len = state->writeback_off - state->drop_off;
+		nocache_writeback(state, state->drop_off, len, true);
+		nocache_drop(state, state->drop_off, len);
+	}
+
+	state->drop_off = state->writeback_off;
+	state->writeback_off = pos;
+}
+
+
+/// Manage the page cache after size bytes have been read or written.
+/// The file offset is looked up only once per FD_NOCACHE_CHUNK
+/// so seeking and holes don't need to be tracked here.
+static void
+nocache_advance(struct fd_state *state, size_t size)
+{
+	state->nocache_count += size;
+	if (state->nocache_count < FD_NOCACHE_CHUNK)
+		return;
+
+	state->nocache_count = 0;
+
+	const off_t pos = lseek(state->fd, 0, SEEK_CUR);
+	if (pos == -1)
+		return;
+
+	if (state->writing)
+		nocache_write(state, (xzf_off)pos);
+	else
+		nocache_read(state, (xzf_off)pos);
+}
+
+
+/// Drop everything that has been read or written since the last time.
+/// This is done before seeking and closing.
+static void
+nocache_finish(struct fd_state *state)
+{
+	if (!state->writing) {
+		// This includes what was read ahead.
+		nocache_drop(state, state->drop_off, 0);
+		return;
+	}
+
+	const off_t pos = lseek(state->fd, 0, SEEK_CUR);
+	if (pos == -1 || (xzf_off)pos <= state->drop_off)
+		return;
+
+	const xzf_off len = (xzf_off)pos - state->drop_off;
+	nocache_writeback(state, state->drop_off, len, true);
+	nocache_drop(state, state->drop_off, len);
+}
+
+
+/// Start dropping the pages from the current file offset.
+static void
+nocache_reset(struct fd_state *state)
+{
+	const off_t pos = lseek(state->fd, 0, SEEK_CUR);
+	state->nocache_count = 0;
+	state->drop_off = pos == -1 ? 0 : (xzf_off)pos;
+	state->writeback_off = state->drop_off;
+}
+
+
+static int
+read_some(struct fd_state *state, unsigned char *buf, size_t *size)
+{
+	while (true) {
+		const size_t limit = *size <= SSIZE_MAX ? *size : SSIZE_MAX;
+		const ssize_t ret = read(state->fd, buf, limit);
+
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			*size = 0;
+			return ret == 0 ? XZF_E_EOF : errno;
+		}
+
+		*size = ret;
+		return 0;
+	}
+}
+
+
+static int
+fd_read(void *stateptr, unsigned char *buf, size_t *size)
+{
+	struct fd_state *state = stateptr;
+
+	// Reading moves the file offset that sparse writing tracks.
+	if (state->sparse)
+		state->pos = -1;
+
+	const int errnum = state->holes
+			? holes_read(state, buf, size)
+			: read_some(state, buf, size);
+
+	if (state->nocache)
+		nocache_advance(state, *size);
+
+	return errnum;
+}
+
+
+/// Convert up to FD_IOV_MAX buffers starting from iov[i] at the offset off
+/// to struct iovec. Empty buffers are omitted and the total size is
+/// limited to SSIZE_MAX. Returns the number of elements in vec.
+static int
+make_iovec(struct iovec *vec, const xzf_iovec *iov, size_t iovcnt,
+		size_t i, size_t off)
+{
+	int n = 0;
+	size_t sum = 0;
+
+	for (; i < iovcnt && n < FD_IOV_MAX && sum < SSIZE_MAX; ++i) {
+		size_t len = iov[i].len - off;
+		if (len > SSIZE_MAX - sum)
+			len = SSIZE_MAX - sum;
+
+		if (len > 0) {
+			vec[n].iov_base = (unsigned char *)iov[i].base + off;
+			vec[n++].iov_len = len;
+			sum += len;
+		}
+
+		off = 0;
+	}
+
+	return n;
+}
+
+
+static int
+fd_readv(void *stateptr, const xzf_iovec *iov, size_t iovcnt, size_t *size)
+{
+	struct fd_state *state = stateptr;
+
+	if (state->holes) {
+		// The zeros of holes are returned one buffer at a time.
+		for (size_t i = 0; i < iovcnt; ++i) {
+			if (iov[i].len > 0) {
+				*size = iov[i].len;
+				return fd_read(state, iov[i].base, size);
+			}
+		}
+
+		*size = 0;
+		return 0;
+	}
+
+	if (state->sparse)
+		state->pos = -1;
+
+	struct iovec vec[FD_IOV_MAX];
+	const int n = make_iovec(vec, iov, iovcnt, 0, 0);
+	ssize_t ret = 0;
+
+	while (n > 0) {
+		ret = readv(state->fd, vec, n);
+
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			*size = 0;
+			return ret == 0 ? XZF_E_EOF : errno;
+		}
+
+		break;
+	}
+
+	*size = ret;
+
+	if (state->nocache)
+		nocache_advance(state, *size);
+
+	return 0;
+}
+
+
+/// Check if a buffer contains only zeros. size must be a multiple of 64.
+static bool
+is_zero(const unsigned char *buf, size_t size)
+{
+	assert(size % 64 == 0);
+
+	// Accumulate 64 bytes at a time with OR and check the result
+	// only once per block. Blocks with data usually have it early
+	// so the first 64 bytes are checked separately.
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (size_t i = 0; i < size; ) {
+		const size_t end = i == 0 ? 64 : size;
+		__m128i acc = zero;
+
+		for (; i < end; i += 64) {
+			const __m128i *p = (const __m128i *)(buf + i);
+			acc = _mm_or_si128(acc, _mm_or_si128(
+					_mm_or_si128(_mm_loadu_si128(p),
+						_mm_loadu_si128(p + 1)),
+					_mm_or_si128(_mm_loadu_si128(p + 2),
+						_mm_loadu_si128(p + 3))));
+		}
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+			return false;
+	}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	for (size_t i = 0; i < size; ) {
+		const size_t end = i == 0 ? 64 : size;
+		uint8x16_t acc = vdupq_n_u8(0);
+
+		for (; i < end; i += 64)
+			acc = vorrq_u8(acc, vorrq_u8(
+					vorrq_u8(vld1q_u8(buf + i),
+						vld1q_u8(buf + i + 16)),
+					vorrq_u8(vld1q_u8(buf + i + 32),
+						vld1q_u8(buf + i + 48))));
+
+		if (vmaxvq_u8(acc) != 0)
+			return false;
+	}
+
+#else
+	for (size_t i = 0; i < size; ) {
+		const size_t end = i == 0 ? 64 : size;
+		uint64_t acc = 0;
+
+		for (; i < end; i += 8) {
+			uint64_t word;
+			memcpy(&word, buf + i, sizeof(word));
+			acc |= word;
+		}
+
+		if (acc != 0)
+			return false;
+	}
+#endif
+
+	return true;
+}
+
+
+static int
+write_all(struct fd_state *state, const unsigned char *buf, size_t size)
+{
+	do {
+		const size_t limit = size <= SSIZE_MAX
+				? size : SSIZE_MAX;
+		const ssize_t ret = write(state->fd, buf, limit);
+
+		if (ret < 0)
+			return errno;
+
+		// FIXME: ENOSPC like in gnulib if ret == 0?
+
+		buf += ret;
+		size -= ret;
+
+	} while (size > 0);
+
+	return 0;
+}
+
+
+/// Check if the block at buf, which is at the file offset pos,
+/// can be skipped. size is the number of bytes available at buf.
+static bool
+is_hole(const struct fd_state *state, const unsigned char *buf, size_t size,
+		xzf_off pos)
+{
+	return size >= state->block_size
+			&& pos % (xzf_off)state->block_size == 0
+			&& pos >= state->size
+			&& is_zero(buf, state->block_size);
+}
+
+
+/// Write so that whole blocks of zeros past the end of the file
+/// are skipped with lseek().
+static int
+sparse_write(struct fd_state *state, const unsigned char *buf, size_t size)
+{
+	if (state->pos == -1) {
+		state->pos = lseek(state->fd, 0, SEEK_CUR);
+		if (state->pos == -1)
+			return errno;
+	}
+
+	while (size > 0) {
+		// Find a run of either skippable blocks or other data.
+		const bool hole = is_hole(state, buf, size, state->pos);
+		size_t run = 0;
+
+		do {
+			// Advance to the next block boundary.
+			const size_t misalign = (size_t)((state->pos
+					+ (xzf_off)run)
+					% (xzf_off)state->block_size);
+			size_t n = state->block_size - misalign;
+			if (n > size - run)
+				n = size - run;
+
+			run += n;
+		} while (run < size && is_hole(state, buf + run, size - run,
+				state->pos + (xzf_off)run) == hole);
+
+		if (hole) {
+			if (lseek(state->fd, (off_t)run, SEEK_CUR) == -1)
+				return errno;
+
+			state->pos += (xzf_off)run;
+			state->hole_end = state->pos;
+		} else {
+			const int errnum = write_all(state, buf, run);
+			if (errnum != 0)
+				return errnum;
+
+			state->pos += (xzf_off)run;
+			if (state->size < state->pos)
+				state->size = state->pos;
+
+			state->hole_end = 0;
+		}
+
+		buf += run;
+		size -= run;
+	}
+
+	return 0;
+}
+
+
+/// Extend the file to cover the skipped blocks at its end.
+static int
+sparse_finish(struct fd_state *state)
+{
+	if (state->hole_end > state->size) {
+		if (ftruncate(state->fd, (off_t)state->hole_end))
+			return errno;
+
+		state->size = state->hole_end;
+	}
+
+	state->hole_end = 0;
+	return 0;
+}
+
+
+static int
+fd_write(void *stateptr, const unsigned char *buf, size_t size)
+{
+	struct fd_state *state = stateptr;
+
+	if (state->holes) {
+		const int errnum = holes_unread(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	const int errnum = state->sparse
+			? sparse_write(state, buf, size)
+			: write_all(state, buf, size);
+
+	if (errnum == 0 && state->nocache)
+		nocache_advance(state, size);
+
+	return errnum;
+}
+
+
+static int
+fd_writev(void *stateptr, const xzf_iovec *iov, size_t iovcnt)
+{
+	struct fd_state *state = stateptr;
+
+	// Holes are looked for in each buffer separately.
+	if (state->sparse) {
+		for (size_t i = 0; i < iovcnt; ++i) {
+			const int errnum = fd_write(state,
+					iov[i].base, iov[i].len);
+			if (errnum != 0)
+				return errnum;
+		}
+
+		return 0;
+	}
+
+	if (state->holes) {
+		const int errnum = holes_unread(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	size_t i = 0;
+	size_t off = 0;
+	size_t total = 0;
+
+	while (true) {
+		struct iovec vec[FD_IOV_MAX];
+		const int n = make_iovec(vec, iov, iovcnt, i, off);
+		if (n == 0)
+			break;
+
+		ssize_t ret = writev(state->fd, vec, n);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return errno;
+		}
+
+		// Skip what was written. A partial write continues
+		// from the middle of a buffer.
+		total += (size_t)ret;
+		while (i < iovcnt && (size_t)ret >= iov[i].len - off) {
+			ret -= iov[i].len - off;
+			++i;
+			off = 0;
+		}
 
-#ifndef O_BINARY
-#	define O_BINARY 0
-#endif
+		off += (size_t)ret;
+	}
 
-#ifndef O_NOCTTY
-#	define O_NOCTTY 0
-#endif
+	if (state->nocache)
+		nocache_advance(state, total);
 
+	return 0;
+}
 
-struct fd_state {
-	int fd;
-	bool writing;
-};
+
+/// Read one aligned block at offset. The part that is past
+/// the end of the file is set to zeros.
+static int
+direct_read_block(struct fd_state *state, unsigned char *buf, xzf_off offset)
+{
+	memset(buf, 0, state->align);
+
+	while (pread(state->fd, buf, state->align, (off_t)offset) == -1)
+		if (errno != EINTR)
+			return errno;
+
+	return 0;
+}
 
 
+/// Write size bytes from the beginning of direct_buf to buf_off.
+/// size must be a multiple of align.
 static int
-fd_read(void *stateptr, unsigned char *buf, size_t *size)
+direct_write(struct fd_state *state, size_t size)
 {
-	struct fd_state *state = stateptr;
+	size_t done = 0;
 
-	while (true) {
-		const size_t limit = *size <= SSIZE_MAX ? *size : SSIZE_MAX;
-		const ssize_t ret = read(state->fd, buf, limit);
+	while (done < size) {
+		const ssize_t ret = pwrite(state->fd, state->direct_buf + done,
+				size - done,
+				(off_t)(state->buf_off + (xzf_off)done));
 
-		if (ret <= 0) {
-			if (ret < 0 && errno == EINTR)
+		if (ret == -1) {
+			if (errno == EINTR)
 				continue;
 
-			*size = 0;
-			return ret == 0 ? XZF_E_EOF : errno;
+			return errno;
 		}
 
-		*size = ret;
+		// A write that stops in the middle of a block cannot be
+		// continued with O_DIRECT. It happens when the disk is full.
+		if (ret == 0 || (size_t)ret % state->align != 0)
+			return ENOSPC;
+
+		done += (size_t)ret;
+	}
+
+	if (state->file_size < state->buf_off + (xzf_off)size)
+		state->file_size = state->buf_off + (xzf_off)size;
+
+	return 0;
+}
+
+
+/// Write all the data in direct_buf. The last partial block is padded
+/// with what the file already has after it and the file is truncated
+/// afterwards if the padding extended it. The partial block is kept
+/// in direct_buf because more data may be written after it.
+static int
+direct_flush(struct fd_state *state)
+{
+	const size_t tail = state->buf_fill % state->align;
+	const size_t whole = state->buf_fill - tail;
+	const xzf_off end = state->buf_off + (xzf_off)state->buf_fill;
+	xzf_off file_size = state->file_size;
+	size_t size = whole;
+
+	if (tail > 0) {
+		if (file_size > end) {
+			const int errnum = direct_read_block(state,
+					state->direct_block,
+					state->buf_off + (xzf_off)whole);
+			if (errnum != 0)
+				return errnum;
+
+			memcpy(state->direct_buf + state->buf_fill,
+					state->direct_block + tail,
+					state->align - tail);
+		} else {
+			memset(state->direct_buf + state->buf_fill, 0,
+					state->align - tail);
+		}
+
+		size += state->align;
+	}
+
+	if (size == 0)
 		return 0;
+
+	const int errnum = direct_write(state, size);
+	if (errnum != 0)
+		return errnum;
+
+	if (file_size < end)
+		file_size = end;
+
+	if (state->file_size > file_size) {
+		if (ftruncate(state->fd, (off_t)file_size))
+			return errno;
+
+		state->file_size = file_size;
 	}
+
+	memmove(state->direct_buf, state->direct_buf + whole, tail);
+	state->buf_off += (xzf_off)whole;
+	state->buf_fill = tail;
+	return 0;
 }
 
 
+/// Update file_size from the file. Block devices have the size
+/// only at their end.
 static int
-fd_write(void *stateptr, const unsigned char *buf, size_t size)
+direct_file_size(struct fd_state *state)
 {
-	// TODO: Sparse file support
+	struct stat st;
+	if (fstat(state->fd, &st))
+		return errno;
 
-	struct fd_state *state = stateptr;
+	if (S_ISREG(st.st_mode)) {
+		state->file_size = (xzf_off)st.st_size;
+		return 0;
+	}
 
-	do {
-		const size_t limit = size <= SSIZE_MAX
-				? size : SSIZE_MAX;
-		const ssize_t ret = write(state->fd, buf, limit);
+	const off_t end = lseek(state->fd, 0, SEEK_END);
+	if (end == -1)
+		return errno;
+
+	state->file_size = (xzf_off)end;
+	return 0;
+}
+
+
+/// Read so that direct_buf starts at the block of buf_pos
+/// and has as much after it as fits.
+static int
+direct_fill(struct fd_state *state)
+{
+	// The whole blocks from the block of buf_pos onwards are kept.
+	const size_t start = state->buf_pos - state->buf_pos % state->align;
+	const size_t end = state->buf_fill - state->buf_fill % state->align;
+	const size_t keep = end > start ? end - start : 0;
+
+	memmove(state->direct_buf, state->direct_buf + start, keep);
+	state->buf_off += (xzf_off)start;
+	state->buf_pos -= start;
+	state->buf_fill = keep;
+
+	// A read ends in the middle of a block only at the end of the
+	// file. That block is read again on the next call in case
+	// the file has grown.
+	while (state->buf_fill < FD_DIRECT_BUF_SIZE
+			&& state->buf_fill % state->align == 0) {
+		const ssize_t ret = pread(state->fd,
+				state->direct_buf + state->buf_fill,
+				FD_DIRECT_BUF_SIZE - state->buf_fill,
+				(off_t)(state->buf_off
+					+ (xzf_off)state->buf_fill));
+
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
 
-		if (ret < 0)
 			return errno;
+		}
 
-		// FIXME: ENOSPC like in gnulib if ret == 0?
+		if (ret == 0)
+			break;
 
-		buf += ret;
-		size -= ret;
+		state->buf_fill += (size_t)ret;
+	}
 
-	} while (size > 0);
+	return 0;
+}
+
+
+static int
+direct_peekin_start(void *stateptr, const unsigned char **buf, size_t *size)
+{
+	struct fd_state *state = stateptr;
+	const size_t min = *size;
+
+	int errnum = 0;
+	if (state->buf_fill < state->buf_pos
+			|| state->buf_fill - state->buf_pos < min)
+		errnum = direct_fill(state);
+
+	const size_t avail = state->buf_fill > state->buf_pos
+			? state->buf_fill - state->buf_pos : 0;
+
+	*buf = state->direct_buf + state->buf_pos;
+	*size = avail;
+
+	if (errnum == 0 && avail < min)
+		errnum = XZF_E_EOF;
+
+	return errnum;
+}
+
+
+static int
+direct_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct fd_state *state = stateptr;
+	state->buf_pos += bytes_used;
+	return 0;
+}
+
+
+static int
+direct_peekout_start(void *stateptr, unsigned char **buf, size_t *size)
+{
+	struct fd_state *state = stateptr;
+	assert(state->buf_fill < FD_DIRECT_BUF_SIZE);
+
+	*buf = state->direct_buf + state->buf_fill;
+	*size = FD_DIRECT_BUF_SIZE;
+	return 0;
+}
+
+
+static int
+direct_peekout_end(void *stateptr, size_t bytes_written)
+{
+	struct fd_state *state = stateptr;
+	state->buf_fill += bytes_written;
+
+	if (state->buf_fill < FD_DIRECT_BUF_SIZE)
+		return 0;
 
+	const int errnum = direct_write(state, FD_DIRECT_BUF_SIZE);
+	if (errnum != 0)
+		return errnum;
+
+	state->buf_fill -= FD_DIRECT_BUF_SIZE;
+	memmove(state->direct_buf, state->direct_buf + FD_DIRECT_BUF_SIZE,
+			state->buf_fill);
+	state->buf_off += FD_DIRECT_BUF_SIZE;
 	return 0;
 }
 
@@ -85,6 +1019,18 @@ fd_flush(void *stateptr, int fl_flags)
 {
 	struct fd_state *state = stateptr;
 
+	if (state->sparse) {
+		const int errnum = sparse_finish(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	if (state->direct_buf != NULL && state->writing) {
+		const int errnum = direct_flush(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
 	if ((fl_flags & XZF_FL_SYNC) && state->writing)
 		while (fsync(state->fd) && errno != EINVAL)
 			if (errno != EINTR)
@@ -94,23 +1040,220 @@ fd_flush(void *stateptr, int fl_flags)
 }
 
 
+/// Convert enum xzf_whence to the lseek() constants
+static const int convert_whence[5] = {
+	SEEK_SET,
+	SEEK_CUR,
+	SEEK_END,
+#ifdef SEEK_DATA
+	SEEK_DATA,
+	SEEK_HOLE,
+#else
+	-1,
+	-1,
+#endif
+};
+
+
 static int
 fd_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
 {
-	static const int convert[3] = {
-		SEEK_SET,
-		SEEK_CUR,
-		SEEK_END,
-	};
-
 	// FIXME: This is broken if large file support isn't available.
 
 	struct fd_state *state = stateptr;
-	*offset = lseek(state->fd, *offset, convert[whence]);
+
+	if ((unsigned int)whence >= ARRAY_SIZE(convert_whence)
+			|| convert_whence[whence] == -1)
+		return EINVAL;
+
+	if (state->holes) {
+		// The kernel offset is ahead of the logical position by
+		// the number of pending zeros. Move it back so that the
+		// zeros aren't lost if lseek() fails, for example with
+		// ENXIO from SEEK_DATA.
+		const int errnum = holes_unread(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	if (state->sparse) {
+		const int errnum = sparse_finish(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	if (state->nocache)
+		nocache_finish(state);
+
+	*offset = lseek(state->fd, *offset, convert_whence[whence]);
+
+	if (state->sparse)
+		state->pos = *offset;
+
+	if (state->nocache)
+		nocache_reset(state);
+
 	return *offset == -1 ? errno : 0;
 }
 
 
+static int
+direct_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct fd_state *state = stateptr;
+
+	if ((unsigned int)whence >= ARRAY_SIZE(convert_whence)
+			|| convert_whence[whence] == -1)
+		return EINVAL;
+
+	if (state->writing) {
+		const int errnum = direct_flush(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	// The file offset of the descriptor isn't used
+	// so the current position is converted here.
+	if (whence == XZF_SEEK_CUR) {
+		const xzf_off cur = state->buf_off + (xzf_off)(state->writing
+				? state->buf_fill : state->buf_pos);
+		if (*offset > XZF_OFF_MAX - cur)
+			return EINVAL;
+
+		*offset += cur;
+		whence = XZF_SEEK_SET;
+	}
+
+	const off_t pos = lseek(state->fd, (off_t)*offset,
+			convert_whence[whence]);
+	if (pos == -1)
+		return errno;
+
+	*offset = (xzf_off)pos;
+	const size_t misalign = (size_t)(*offset % (xzf_off)state->align);
+
+	if (state->writing) {
+		// Something else may have written to the file.
+		int errnum = direct_file_size(state);
+		if (errnum != 0)
+			return errnum;
+
+		// The beginning of the block is taken from the file.
+		state->buf_off = *offset - (xzf_off)misalign;
+		state->buf_fill = misalign;
+		if (misalign > 0) {
+			errnum = direct_read_block(state, state->direct_buf,
+					state->buf_off);
+			if (errnum != 0)
+				return errnum;
+		}
+	} else if (*offset >= state->buf_off && *offset - state->buf_off
+			<= (xzf_off)state->buf_fill) {
+		// The buffered data is kept if the new position is in it.
+		state->buf_pos = (size_t)(*offset - state->buf_off);
+	} else {
+		state->buf_off = *offset - (xzf_off)misalign;
+		state->buf_fill = 0;
+		state->buf_pos = misalign;
+	}
+
+	return 0;
+}
+
+
+/// Skip by reading into a temporary buffer
+static int
+skip_by_reading(struct fd_state *state, xzf_off *amount)
+{
+	unsigned char buf[8192];
+	size_t size = sizeof(buf);
+	if ((xzf_off)size > *amount)
+		size = (size_t)*amount;
+
+	const int errnum = fd_read(state, buf, &size);
+	*amount = (xzf_off)size;
+	return errnum;
+}
+
+
+static int
+fd_skip(void *stateptr, xzf_off *amount)
+{
+	struct fd_state *state = stateptr;
+
+	if (state->sparse)
+		state->pos = -1;
+
+	if (state->holes) {
+		// Pending zeros are skipped simply by forgetting them.
+		if (state->zeros > 0) {
+			if (*amount > state->zeros)
+				*amount = state->zeros;
+
+			state->zeros -= *amount;
+			return 0;
+		}
+
+		holes_reset(state);
+	}
+
+	// In a regular file, skipping is seeking but not past the end.
+	struct stat st;
+	if (fstat(state->fd, &st))
+		return skip_by_reading(state, amount);
+
+	if (S_ISREG(st.st_mode)) {
+		const off_t pos = lseek(state->fd, 0, SEEK_CUR);
+		if (pos != -1) {
+			const xzf_off avail = pos < st.st_size
+					? (xzf_off)(st.st_size - pos) : 0;
+			const bool eof = avail < *amount;
+			if (eof)
+				*amount = avail;
+
+			if (lseek(state->fd, (off_t)*amount, SEEK_CUR) == -1) {
+				*amount = 0;
+				return errno;
+			}
+
+			return eof ? XZF_E_EOF : 0;
+		}
+	}
+
+#ifdef HAVE_SPLICE
+	// From a pipe, the kernel can move the data to /dev/null
+	// without copying it to user space.
+	if (S_ISFIFO(st.st_mode)) {
+		if (state->null_fd == -1)
+			state->null_fd = open("/dev/null",
+					O_WRONLY | O_CLOEXEC);
+
+		while (state->null_fd != -1) {
+			const size_t limit = *amount < SSIZE_MAX
+					? (size_t)*amount : SSIZE_MAX;
+			const ssize_t ret = splice(state->fd, NULL,
+					state->null_fd, NULL, limit, 0);
+
+			if (ret > 0) {
+				*amount = ret;
+				return 0;
+			}
+
+			if (ret == 0) {
+				*amount = 0;
+				return XZF_E_EOF;
+			}
+
+			if (errno != EINTR)
+				break;
+		}
+	}
+#endif
+
+	return skip_by_reading(state, amount);
+}
+
+
 static int
 fd_close(void *stateptr, int cl_flags)
 {
@@ -119,9 +1262,17 @@ fd_close(void *stateptr, int cl_flags)
 	// XZF_CL_SYNC == XZF_FL_SYNC so we can just call fd_flush().
 	const int fsync_errnum = fd_flush(state, cl_flags);
 
+	if (state->nocache)
+		nocache_finish(state);
+
 	const int close_ret = cl_flags & XZF_CL_DETACH ? 0 : close(state->fd);
 	const int close_errnum = errno;
 
+	if (state->null_fd != -1)
+		(void)close(state->null_fd);
+
+	free(state->direct_buf);
+	free(state->direct_block);
 	free(state);
 
 	if (fsync_errnum != 0)
@@ -151,12 +1302,133 @@ fd_getinfo(void *stateptr, int key, void *value)
 			*result = isatty(state->fd);
 			return 0;
 		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_NONE;
+			return 0;
+		}
 	}
 
 	return XZF_E_NOKEY;
 }
 
 
+/// Enable sparse mode if XZF_SPARSE was given and the file is a regular
+/// file. Holes are skipped when reading. When writing, O_APPEND must not
+/// be used. Otherwise the flag is ignored because skipping wouldn't work.
+static int
+sparse_init(struct fd_state *state, int xflags)
+{
+	state->sparse = false;
+	state->holes = false;
+
+	if (!(xflags & XZF_SPARSE))
+		return 0;
+
+	const int oflags = fcntl(state->fd, F_GETFL);
+	if (oflags == -1)
+		return errno;
+
+	struct stat st;
+	if (fstat(state->fd, &st))
+		return errno;
+
+	if (!S_ISREG(st.st_mode))
+		return 0;
+
+	if (xflags & XZF_READ) {
+		state->holes = true;
+		holes_reset(state);
+	}
+
+	if (!(xflags & XZF_WRITE) || (oflags & O_APPEND))
+		return 0;
+
+	state->block_size = FD_SPARSE_BLOCK;
+	if (st.st_blksize >= 512 && st.st_blksize <= (1 << 20)
+			&& st.st_blksize % 64 == 0)
+		state->block_size = (size_t)st.st_blksize;
+
+	state->sparse = true;
+	state->pos = -1;
+	state->size = (xzf_off)st.st_size;
+	state->hole_end = 0;
+	return 0;
+}
+
+
+/// Enable dropping the pages from the page cache if XZF_NOCACHE was given
+/// and the file is a regular file or a block device.
+static int
+nocache_init(struct fd_state *state, int xflags)
+{
+	state->nocache = false;
+
+	if (!(xflags & XZF_NOCACHE))
+		return 0;
+
+	struct stat st;
+	if (fstat(state->fd, &st))
+		return errno;
+
+	if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+		return 0;
+
+#ifdef HAVE_POSIX_FADVISE
+	// This makes the kernel read ahead more.
+	if (!state->writing)
+		(void)posix_fadvise(state->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	state->nocache = true;
+	nocache_reset(state);
+	return 0;
+}
+
+
+/// Set up direct I/O. Only regular files and block devices are supported
+/// because the I/O is done at explicit file offsets.
+static int
+direct_init(struct fd_state *state)
+{
+	struct stat st;
+	if (fstat(state->fd, &st))
+		return errno;
+
+	if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+		return XZF_E_NOTFILE;
+
+	// st_blksize is at least the logical block size, so a bigger
+	// power of two is a safe alignment too.
+	state->align = FD_DIRECT_ALIGN;
+	if (st.st_blksize > FD_DIRECT_ALIGN && st.st_blksize <= (1 << 16)
+			&& (st.st_blksize & (st.st_blksize - 1)) == 0)
+		state->align = (size_t)st.st_blksize;
+
+	void *mem;
+	int errnum = posix_memalign(&mem, state->align, state->writing
+			? 2 * FD_DIRECT_BUF_SIZE : FD_DIRECT_BUF_SIZE);
+	if (errnum != 0)
+		return errnum;
+
+	state->direct_buf = mem;
+
+	errnum = posix_memalign(&mem, state->align, state->align);
+	if (errnum != 0)
+		return errnum;
+
+	state->direct_block = mem;
+
+	state->buf_off = 0;
+	state->buf_fill = 0;
+	state->buf_pos = 0;
+	state->file_size = 0;
+
+	return state->writing ? direct_file_size(state) : 0;
+}
+
+
 static const struct xzf_backend fd_backend = {
 	.version = 0,
 	.read = &fd_read,
@@ -165,6 +1437,22 @@ static const struct xzf_backend fd_backend = {
 	.flush = &fd_flush,
 	.close = &fd_close,
 	.getinfo = &fd_getinfo,
+	.skip = &fd_skip,
+	.readv = &fd_readv,
+	.writev = &fd_writev,
+};
+
+
+static const struct xzf_backend fd_direct_backend = {
+	.version = 0,
+	.seek = &direct_seek,
+	.flush = &fd_flush,
+	.close = &fd_close,
+	.peekin_start = &direct_peekin_start,
+	.peekin_end = &direct_peekin_end,
+	.peekout_start = &direct_peekout_start,
+	.peekout_end = &direct_peekout_end,
+	.getinfo = &fd_getinfo,
 };
 
 
@@ -173,7 +1461,8 @@ xzf_fd_open(const char *filename, int xflags, int mode /* FIXME unsigned? */)
 {
 	static const int supported_xflags
 			= XZF_RW | XZF_APPEND | XZF_CREAT | XZF_TRUNC
-			| XZF_EXCL | XZF_NOFOLLOW | XZF_REGFILE;
+			| XZF_EXCL | XZF_NOFOLLOW | XZF_REGFILE | XZF_SPARSE
+			| XZF_DIRECT | XZF_NOCACHE;
 			// FIXME: THRSAFE, LINEBUF etc. etc.
 
 	if (xflags & ~supported_xflags) {
@@ -181,6 +1470,14 @@ xzf_fd_open(const char *filename, int xflags, int mode /* FIXME unsigned? */)
 		return NULL;
 	}
 
+	// Direct I/O is done at explicit file offsets in one direction.
+	if ((xflags & XZF_DIRECT) && ((xflags & XZF_RW) == XZF_RW
+			|| (xflags & XZF_APPEND & ~XZF_WRITE)
+			|| (xflags & XZF_SPARSE))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
 	// TODO: Validate the flags and convert them to be usable with open().
 	int oflags;
 
@@ -195,7 +1492,8 @@ xzf_fd_open(const char *filename, int xflags, int mode /* FIXME unsigned? */)
 		return NULL;
 	}
 
-	if ((xflags & XZF_APPEND) != 0) {
+	// XZF_APPEND includes XZF_WRITE so test only the append bit.
+	if ((xflags & XZF_APPEND & ~XZF_WRITE) != 0) {
 		if ((xflags & XZF_WRITE) == 0) {
 			// XZF_WRITE bit wasn't included but the append
 			// bit was. XZF_APPEND includes both so the caller
@@ -224,13 +1522,23 @@ xzf_fd_open(const char *filename, int xflags, int mode /* FIXME unsigned? */)
 	if (xflags & XZF_REGFILE)
 		oflags |= O_NONBLOCK;
 
+	// Partial blocks are merged with the data in the file
+	// so direct I/O needs to read also when writing.
+	if (xflags & XZF_DIRECT) {
+		if (xflags & XZF_WRITE)
+			oflags = (oflags & ~O_WRONLY) | O_RDWR;
+
+		oflags |= O_DIRECT;
+	}
+
 	// Flags that we always want.
 	oflags |= O_NOCTTY | O_BINARY;
 
-	// Allocate memory.
+	// Allocate memory. Direct I/O has buffers of its own.
+	const bool buffered = (xflags & XZF_DIRECT) == 0;
 	xzf_stream_mem *strm_mem = xzf_stream_prealloc(
-			xflags & XZF_READ ? XZF_BUFSIZE : 0,
-			xflags & XZF_WRITE ? XZF_BUFSIZE : 0);
+			buffered && (xflags & XZF_READ) ? XZF_BUFSIZE : 0,
+			buffered && (xflags & XZF_WRITE) ? XZF_BUFSIZE : 0);
 	if (strm_mem == NULL)
 		return NULL;
 
@@ -242,9 +1550,18 @@ xzf_fd_open(const char *filename, int xflags, int mode /* FIXME unsigned? */)
 
 	state->fd = -1;
 	state->writing = (xflags & XZF_WRITE) != 0;
+	state->null_fd = -1;
+	state->direct_buf = NULL;
+	state->direct_block = NULL;
 
 	// FIXME: Use custom error code for O_NOFOLLOW failure.
 	state->fd = open(filename, oflags, (mode_t)mode);
+
+	// Some file systems like tmpfs don't support O_DIRECT. The I/O
+	// is still done in large aligned blocks without it.
+	if (state->fd == -1 && errno == EINVAL && (oflags & O_DIRECT))
+		state->fd = open(filename, oflags & ~O_DIRECT, (mode_t)mode);
+
 	if (state->fd == -1)
 		goto error;
 
@@ -268,14 +1585,35 @@ xzf_fd_open(const char *filename, int xflags, int mode /* FIXME unsigned? */)
 			goto error;
 	}
 
+	// Direct I/O doesn't use the page cache in the first place.
+	int errnum = sparse_init(state, xflags);
+	if (errnum == 0)
+		errnum = nocache_init(state,
+				xflags & XZF_DIRECT ? 0 : xflags);
+
+	if (errnum == 0 && (xflags & XZF_DIRECT))
+		errnum = direct_init(state);
+
+	if (errnum != 0) {
+		errno = errnum;
+		goto error;
+	}
+
 	// FIXME!
+	const bool direct = (xflags & XZF_DIRECT) != 0;
 	xflags &= XZF_RW;
 
 	if (lseek(state->fd, 0, SEEK_CUR) != -1)
 		xflags |= XZF_SEEKABLE | XZF_FIXREADPOS;
 
-	xzf_stream *strm = xzf_stream_init(
-			strm_mem, &fd_backend, state, xflags, 0, 0);
+	// With direct I/O the largest peek must fit in the buffer
+	// after the unaligned beginning of the current block.
+	xzf_stream *strm = direct
+			? xzf_stream_init(strm_mem, &fd_direct_backend, state,
+				xflags, FD_DIRECT_BUF_SIZE - state->align,
+				FD_DIRECT_BUF_SIZE)
+			: xzf_stream_init(strm_mem, &fd_backend, state,
+				xflags, 0, 0);
 	assert(strm != NULL);
 	if (strm == NULL) {
 		strm_mem = NULL;
@@ -291,6 +1629,8 @@ error:
 		if (state->fd != -1)
 			(void)close(state->fd);
 
+		free(state->direct_buf);
+		free(state->direct_block);
 		free(state);
 		xzf_stream_free(strm_mem);
 
@@ -304,7 +1644,8 @@ extern xzf_stream *
 xzf_fd_fdopen(int fd, int xflags)
 {
 	static const int supported_xflags
-			= XZF_RW | XZF_LINEBUF | XZF_UNBUF;
+			= XZF_RW | XZF_LINEBUF | XZF_UNBUF | XZF_SPARSE
+			| XZF_NOCACHE;
 			// FIXME: THRSAFE, LINEBUF etc. etc.
 
 	if (xflags & ~supported_xflags) {
@@ -318,6 +1659,21 @@ xzf_fd_fdopen(int fd, int xflags)
 
 	state->fd = fd;
 	state->writing = (xflags & XZF_WRITE) != 0;
+	state->null_fd = -1;
+	state->direct_buf = NULL;
+	state->direct_block = NULL;
+
+	int errnum = sparse_init(state, xflags);
+	if (errnum == 0)
+		errnum = nocache_init(state, xflags);
+
+	if (errnum != 0) {
+		free(state);
+		errno = errnum;
+		return NULL;
+	}
+
+	xflags &= ~(XZF_SPARSE | XZF_NOCACHE);
 
 	if (lseek(fd, 0, SEEK_CUR) != -1)
 		xflags |= XZF_SEEKABLE | XZF_FIXREADPOS;
@@ -9,15 +9,59 @@
 
 #include "sysdefs.h"
 #include "xzfile.h"
+#include "zindex.h"
 
 #include <zlib.h>
 
 
+/// Default distance between checkpoints
+#define GZIN_SPAN_DEFAULT (UINT64_C(1) << 20)
+
+/// Size of the Deflate window that is saved in each checkpoint
+#define GZIN_WINDOW_SIZE 32768
+
+/// Size of the buffer that skipped data is decompressed into
+#define GZIN_SCRATCH_SIZE 65536
+
+
 struct gzin_state {
 	xzf_stream *in;
 	bool concatenated;
 	bool finished;
+
+	/// True after seeking to or past the end of the uncompressed data
+	/// when its size is already known. Reading indicates the end of
+	/// the file then without decompressing anything.
+	bool at_end;
 	z_stream s;
+
+	/// Minimum distance between checkpoints in the uncompressed data.
+	/// This is zero if checkpoints aren't recorded and thus seeking
+	/// isn't supported.
+	xzf_off span;
+
+	/// Checkpoints recorded so far. Those cover the part of the
+	/// file that has been decompressed at least once.
+	struct xzf_zindex idx;
+
+	/// Current position in the substream and in the uncompressed data
+	xzf_off zpos;
+	xzf_off upos;
+
+	/// True when decoding raw Deflate data after seeking to
+	/// a checkpoint. zlib doesn't see the .gz header then, so
+	/// the CRC32 is calculated here and the trailer is verified
+	/// by read_trailer().
+	bool raw;
+
+	/// CRC32 (only in raw mode) and size (modulo 2^32) of the
+	/// uncompressed data of the current .gz member
+	uint32_t crc;
+	uint32_t isize;
+
+	/// Buffer for decompressing data that is skipped. This is
+	/// allocated when needed.
+	unsigned char *scratch;
 };
 
 
@@ -52,6 +96,94 @@ gzin_errno(int zerrnum)
 }
 
 
+/// Get the uncompressed offset at or after which the next checkpoint
+/// will be recorded. The index may have been replaced by xzf_index_load()
+/// so this isn't cached in gzin_state.
+static xzf_off
+next_checkpoint(const struct gzin_state *state)
+{
+	if (state->idx.count == 0)
+		return state->span;
+
+	const xzf_off last = state->idx.entries[state->idx.count - 1].out;
+	return last > XZF_OFF_MAX - state->span
+			? XZF_OFF_MAX : last + state->span;
+}
+
+
+#ifdef HAVE_INFLATEGETDICTIONARY
+/// Record a checkpoint at the current position. This must be called only
+/// when inflate() is at a Deflate block boundary. A failure to allocate
+/// memory isn't an error: it only makes seeking slower.
+static void
+add_checkpoint(struct gzin_state *state)
+{
+	unsigned char *window = malloc(GZIN_WINDOW_SIZE);
+	if (window == NULL)
+		return;
+
+	uInt window_size = GZIN_WINDOW_SIZE;
+	if (inflateGetDictionary(&state->s, window, &window_size) != Z_OK) {
+		free(window);
+		return;
+	}
+
+	struct xzf_zindex_entry *entry = xzf_zindex_add(&state->idx,
+			state->zpos, state->upos);
+	if (entry == NULL) {
+		free(window);
+		return;
+	}
+
+	entry->bits = (unsigned int)state->s.data_type & 7;
+	entry->crc = state->raw ? state->crc : (uint32_t)state->s.adler;
+	entry->isize = state->isize;
+
+	if (window_size == 0) {
+		free(window);
+	} else {
+		entry->window = window;
+		entry->window_size = window_size;
+	}
+}
+#endif
+
+
+/// Read and verify the .gz trailer after raw Deflate data has been
+/// decoded. The decoder is then switched back to the .gz format.
+static int
+read_trailer(struct gzin_state *state)
+{
+	const unsigned char *buf;
+	const size_t avail = xzf_peekin_start(state->in, &buf, 8);
+	if (avail < 8) {
+		if (avail == 0)
+			return errno == XZF_E_EOF ? XZF_E_ZTRUNC : errno;
+
+		xzf_peekin_end(state->in, 0);
+		return XZF_E_ZTRUNC;
+	}
+
+	const uint32_t crc = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8)
+			| ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+	const uint32_t isize = (uint32_t)buf[4] | ((uint32_t)buf[5] << 8)
+			| ((uint32_t)buf[6] << 16) | ((uint32_t)buf[7] << 24);
+
+	xzf_peekin_end(state->in, 8);
+	state->zpos += 8;
+
+	if (crc != state->crc || isize != state->isize)
+		return XZF_E_ZCORRUPT;
+
+	const int ret = inflateReset2(&state->s, 31);
+	if (ret != Z_OK)
+		return gzin_errno(ret);
+
+	state->raw = false;
+	return 0;
+}
+
+
 static int
 gzin_read(void *stateptr, unsigned char *out, size_t *out_size)
 {
@@ -59,12 +191,19 @@ gzin_read(void *stateptr, unsigned char *out, size_t *out_size)
 	size_t remaining = *out_size;
 	*out_size = 0;
 
+	if (state->at_end)
+		return XZF_E_EOF;
+
 	do {
 		// Prepare the input buffer.
 		const unsigned char *in;
 		size_t in_size = xzf_peekin_start(state->in, &in, 1);
-		if (in_size == 0 && (errno != XZF_E_EOF || state->finished))
+		if (in_size == 0 && (errno != XZF_E_EOF || state->finished)) {
+			if (errno == XZF_E_EOF)
+				state->idx.usize = state->upos;
+
 			return errno;
+		}
 
 		if (state->finished) {
 			assert(in_size > 0);
@@ -79,6 +218,7 @@ gzin_read(void *stateptr, unsigned char *out, size_t *out_size)
 			}
 
 			state->finished = false;
+			state->isize = 0;
 		}
 
 #if UINT_MAX < SIZE_MAX
@@ -100,19 +240,48 @@ gzin_read(void *stateptr, unsigned char *out, size_t *out_size)
 		state->s.next_out = out;
 		state->s.avail_out = (unsigned int)out_limit;
 
-		// Decompress
-		const int ret = inflate(&state->s, Z_NO_FLUSH);
+		// Decompress. When it is time to record a checkpoint,
+		// make inflate() stop at the next Deflate block boundary.
+		const bool want_checkpoint = state->span != 0
+				&& state->upos >= next_checkpoint(state);
+		const int ret = inflate(&state->s,
+				want_checkpoint ? Z_BLOCK : Z_NO_FLUSH);
 
 		// Update the input buffer position.
-		if (in_size > 0)
-			xzf_peekin_end(state->in,
-					in_size - state->s.avail_in);
+		if (in_size > 0) {
+			const size_t in_used = in_size - state->s.avail_in;
+			xzf_peekin_end(state->in, in_used);
+			state->zpos += (xzf_off)in_used;
+		}
 
 		// Update the output buffer position.
 		const size_t out_used = out_limit - state->s.avail_out;
+		if (state->raw)
+			state->crc = (uint32_t)crc32(state->crc, out,
+					(uInt)out_used);
+
 		out += out_used;
 		*out_size += out_used;
 		remaining -= out_used;
+		state->upos += (xzf_off)out_used;
+		state->isize += (uint32_t)out_used;
+
+#ifdef HAVE_INFLATEGETDICTIONARY
+		// A checkpoint can be taken at the end of any Deflate block
+		// except the last one of the .gz member. This includes the
+		// position right after the .gz header.
+		if (want_checkpoint && ret == Z_OK
+				&& (state->s.data_type & 128)
+				&& !(state->s.data_type & 64))
+			add_checkpoint(state);
+#endif
+
+		// The .gz trailer has to be handled here in raw mode.
+		if (ret == Z_STREAM_END && state->raw) {
+			const int errnum = read_trailer(state);
+			if (errnum != 0)
+				return errnum;
+		}
 
 		// Handle end of file and errors.
 		if (ret != Z_OK) {
@@ -122,8 +291,10 @@ gzin_read(void *stateptr, unsigned char *out, size_t *out_size)
 
 			// If we aren't decompressing concatenated
 			// .gz streams, indicate the end of the file now.
-			if (!state->concatenated)
+			if (!state->concatenated) {
+				state->idx.usize = state->upos;
 				return XZF_E_EOF;
+			}
 
 			// Mark that decompressing a stream was finished.
 			// This way we know to reset the decompressor if
@@ -138,6 +309,208 @@ gzin_read(void *stateptr, unsigned char *out, size_t *out_size)
 }
 
 
+/// Start decoding from the given checkpoint or, if entry is NULL,
+/// from the beginning of the file.
+static int
+gzin_restore(struct gzin_state *state, const struct xzf_zindex_entry *entry)
+{
+	if (entry == NULL) {
+		if (xzf_seek(state->in, state->idx.base, XZF_SEEK_SET) == -1)
+			return errno;
+
+		const int ret = inflateReset2(&state->s, 31);
+		if (ret != Z_OK)
+			return gzin_errno(ret);
+
+		state->raw = false;
+		state->zpos = state->idx.base;
+		state->upos = 0;
+		state->isize = 0;
+		state->finished = false;
+		state->at_end = false;
+		return 0;
+	}
+
+	// If the checkpoint isn't at a byte boundary, the remaining
+	// bits of the previous byte are fed to inflate with inflatePrime().
+	if (xzf_seek(state->in, entry->in - (entry->bits > 0),
+			XZF_SEEK_SET) == -1)
+		return errno;
+
+	int ret = inflateReset2(&state->s, -15);
+
+	if (ret == Z_OK && entry->bits > 0) {
+		const unsigned char *buf;
+		if (xzf_peekin_start(state->in, &buf, 1) == 0)
+			return errno == XZF_E_EOF ? XZF_E_ZTRUNC : errno;
+
+		const int value = buf[0] >> (8 - entry->bits);
+		xzf_peekin_end(state->in, 1);
+		ret = inflatePrime(&state->s, (int)entry->bits, value);
+	}
+
+	if (ret == Z_OK && entry->window_size > 0)
+		ret = inflateSetDictionary(&state->s, entry->window,
+				(uInt)entry->window_size);
+
+	if (ret != Z_OK)
+		return gzin_errno(ret);
+
+	state->raw = true;
+	state->zpos = entry->in;
+	state->upos = entry->out;
+	state->crc = entry->crc;
+	state->isize = entry->isize;
+	state->finished = false;
+	state->at_end = false;
+	return 0;
+}
+
+
+/// Decompress and discard data until the given uncompressed position.
+/// XZF_E_EOF is returned if the file ends before the target.
+static int
+gzin_discard(struct gzin_state *state, xzf_off target)
+{
+	if (state->upos < target && state->scratch == NULL) {
+		state->scratch = malloc(GZIN_SCRATCH_SIZE);
+		if (state->scratch == NULL)
+			return ENOMEM;
+	}
+
+	while (state->upos < target) {
+		size_t size = GZIN_SCRATCH_SIZE;
+		if ((xzf_off)size > target - state->upos)
+			size = (size_t)(target - state->upos);
+
+		const int errnum = gzin_read(state, state->scratch, &size);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	return 0;
+}
+
+
+/// Jump forward to the last checkpoint at or before the target if it
+/// is after the current position.
+static int
+gzin_jump(struct gzin_state *state, xzf_off target)
+{
+	const struct xzf_zindex_entry *entry
+			= xzf_zindex_find(&state->idx, target);
+	if (entry != NULL && entry->out > state->upos)
+		return gzin_restore(state, entry);
+
+	return 0;
+}
+
+
+/// Move to the given uncompressed position by restoring a checkpoint
+/// if needed and then decoding and discarding data. Moving past the end
+/// of the file is allowed. Reading will then indicate the end of the file.
+static int
+gzin_goto(struct gzin_state *state, xzf_off target)
+{
+	// If the uncompressed size is known, nothing needs to be
+	// decompressed to get to or past the end.
+	if (state->idx.usize != -1 && target >= state->idx.usize) {
+		state->upos = target;
+		state->at_end = true;
+		return 0;
+	}
+
+	// Going backwards requires restarting from a checkpoint or
+	// from the beginning. Going forwards jumps to a checkpoint
+	// if there is one after the current position.
+	int errnum;
+	if (target < state->upos)
+		errnum = gzin_restore(state,
+				xzf_zindex_find(&state->idx, target));
+	else
+		errnum = gzin_jump(state, target);
+
+	if (errnum == 0)
+		errnum = gzin_discard(state, target);
+
+	if (errnum == XZF_E_EOF) {
+		state->upos = target;
+		errnum = 0;
+	}
+
+	return errnum;
+}
+
+
+static int
+gzin_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct gzin_state *state = stateptr;
+	xzf_off target = *offset;
+
+	switch (whence) {
+	case XZF_SEEK_SET:
+		break;
+
+	case XZF_SEEK_CUR:
+		if (target > 0 && state->upos > XZF_OFF_MAX - target)
+			return EINVAL;
+
+		target += state->upos;
+		break;
+
+	case XZF_SEEK_END:
+		// The uncompressed size is known only after the whole
+		// file has been decompressed once. Checkpoints get
+		// recorded on the way.
+		if (state->idx.usize == -1) {
+			const int errnum = gzin_goto(state, XZF_OFF_MAX);
+			if (errnum != 0)
+				return errnum;
+
+			assert(state->idx.usize != -1);
+		}
+
+		if (target > 0 && state->idx.usize > XZF_OFF_MAX - target)
+			return EINVAL;
+
+		target += state->idx.usize;
+		break;
+
+	default:
+		return EINVAL;
+	}
+
+	if (target < 0)
+		return EINVAL;
+
+	*offset = target;
+
+	// Telling the current position must not disturb the decoder.
+	if (target == state->upos)
+		return 0;
+
+	return gzin_goto(state, target);
+}
+
+
+static int
+gzin_skip(void *stateptr, xzf_off *amount)
+{
+	struct gzin_state *state = stateptr;
+	const xzf_off start = state->upos;
+	const xzf_off target = *amount > XZF_OFF_MAX - start
+			? XZF_OFF_MAX : start + *amount;
+
+	int errnum = gzin_jump(state, target);
+	if (errnum == 0)
+		errnum = gzin_discard(state, target);
+
+	*amount = state->upos - start;
+	return errnum;
+}
+
+
 static int
 gzin_close(void *stateptr, int cl_flags)
 {
@@ -145,6 +518,8 @@ gzin_close(void *stateptr, int cl_flags)
 	xzf_stream *in = state->in;
 
 	(void)inflateEnd(&state->s);
+	xzf_zindex_end(&state->idx);
+	free(state->scratch);
 	free(state);
 
 	return cl_flags & XZF_CL_DETACH ? 0 : xzf_close(in, cl_flags);
@@ -169,6 +544,23 @@ gzin_getinfo(void *stateptr, int key, void *value)
 			return 0;
 		}
 
+		case XZF_KEY_ZINDEX_COPY:
+			if (state->span == 0)
+				return XZF_E_NOKEY;
+
+			return xzf_zindex_copy(value, &state->idx);
+
+		case XZF_KEY_ZINDEX_SET:
+			if (state->span == 0)
+				return XZF_E_NOKEY;
+
+			// Nothing may have been decompressed yet.
+			if (state->zpos != state->idx.base || state->upos != 0)
+				return EBUSY;
+
+			xzf_zindex_replace(&state->idx, value);
+			return 0;
+
 /*
 		case XZF_KEY_ZOFFSET: {
 			// TODO
@@ -201,13 +593,15 @@ gzin_getinfo(void *stateptr, int key, void *value)
 static const struct xzf_backend gzin_backend = {
 	.version = 0,
 	.read = &gzin_read,
+	.seek = &gzin_seek,
 	.close = &gzin_close,
 	.getinfo = &gzin_getinfo,
+	.skip = &gzin_skip,
 };
 
 
-extern xzf_stream *
-xzf_gzin_open(xzf_stream *in, int zflags)
+static xzf_stream *
+gzin_open(xzf_stream *in, int zflags, unsigned long long span)
 {
 	// TODO: Handle flags:
 	// - Switch to zlib format (or use another function?)
@@ -227,6 +621,35 @@ xzf_gzin_open(xzf_stream *in, int zflags)
 	state->in = in;
 	state->concatenated = (zflags & XZF_Z_SINGLE) == 0;
 	state->finished = false;
+	state->at_end = false;
+	state->span = 0;
+	xzf_zindex_init(&state->idx);
+	state->zpos = 0;
+	state->upos = 0;
+	state->raw = false;
+	state->crc = 0;
+	state->isize = 0;
+	state->scratch = NULL;
+
+	int flags = XZF_READ;
+
+#ifdef HAVE_INFLATEGETDICTIONARY
+	// Checkpoints are useful only if the substream is seekable.
+	if (span != 0 && (xzf_getflags(in) & XZF_SEEKABLE)) {
+		state->idx.base = xzf_seek(in, 0, XZF_SEEK_CUR);
+		if (state->idx.base == -1) {
+			free(state);
+			return NULL;
+		}
+
+		if (span > (unsigned long long)XZF_OFF_MAX)
+			span = (unsigned long long)XZF_OFF_MAX;
+
+		state->span = (xzf_off)span;
+		state->zpos = state->idx.base;
+		flags |= XZF_SEEKABLE;
+	}
+#endif
 
 	state->s.next_in = Z_NULL;
 	state->s.avail_in = 0;
@@ -242,7 +665,7 @@ xzf_gzin_open(xzf_stream *in, int zflags)
 	}
 
 	xzf_stream *strm = xzf_stream_init(NULL, &gzin_backend, state,
-			XZF_READ, XZF_BUFSIZE, XZF_BUFSIZE);
+			flags, XZF_BUFSIZE, XZF_BUFSIZE);
 	if (strm == NULL) {
 		const int saved_errno = errno;
 		gzin_close(state, XZF_CL_DETACH);
@@ -252,3 +675,17 @@ xzf_gzin_open(xzf_stream *in, int zflags)
 
 	return strm;
 }
+
+
+extern xzf_stream *
+xzf_gzin_open(xzf_stream *in, int zflags)
+{
+	return gzin_open(in, zflags, 0);
+}
+
+
+extern xzf_stream *
+xzf_gzin_open_index(xzf_stream *in, int zflags, unsigned long long span)
+{
+	return gzin_open(in, zflags, span == 0 ? GZIN_SPAN_DEFAULT : span);
+}
@@ -0,0 +1,857 @@
+/*
+ * Backend for reading multi-member .gz files using multiple threads
+ *
+ * The compressed input is read sequentially and split into chunks.
+ * A chunk is cut, when possible, at a position that looks like the
+ * beginning of a .gz member. Worker threads decompress the chunks that
+ * begin with a member header, each as a sequence of complete members.
+ *
+ * The output of a worker is used only if the preceding data is known to
+ * end exactly where the chunk begins and the worker decompressed the whole
+ * chunk into complete members. Otherwise the chunk is decompressed in
+ * the calling thread as a continuation of the preceding data. A false
+ * member start in the middle of compressed data thus only wastes some
+ * work. Single-member files end up being decompressed in the calling
+ * thread. BGZF blocks are small .gz members, so they are found by the
+ * same scan.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "mythread.h"
+#include "xzfile.h"
+
+#include <zlib.h>
+#include <lzma.h>
+
+
+/// Amount of compressed data after which a chunk is cut at the next
+/// member header
+#define GZINMT_CHUNK_SIZE (UINT32_C(1) << 20)
+
+/// If no member header is found, a chunk is cut at this size
+#define GZINMT_CHUNK_MAX (UINT32_C(2) << 20)
+
+/// Initial and maximum size of the output buffer of a chunk. If a chunk
+/// decompresses to more than this or the memory usage limit doesn't allow
+/// growing the buffer, it is decompressed in the calling thread instead.
+#define GZINMT_OUT_INIT (UINT32_C(4) << 20)
+#define GZINMT_OUT_MAX (UINT32_C(64) << 20)
+
+/// Memory that is reserved for each job when the number of jobs is
+/// chosen. The buffers are allocated when the job is first used.
+#define GZINMT_JOB_MEM (GZINMT_CHUNK_MAX + GZINMT_OUT_INIT)
+
+/// Number of bytes needed to check if a member header begins at
+/// a given position
+#define GZINMT_HEADER_CHECK 10
+
+/// Maximum number of threads
+#define GZINMT_THREADS_MAX 1024
+
+
+#ifdef MYTHREAD_ENABLED
+struct gzinmt_job {
+	/// Compressed data. This is allocated when the job is filled
+	/// for the first time.
+	unsigned char *in;
+	size_t in_size;
+
+	/// True if the chunk begins with what looks like a member header
+	bool member_start;
+
+	/// Uncompressed data. This is allocated by the worker when it
+	/// first needs it.
+	unsigned char *out;
+	size_t out_size;
+	size_t out_alloc;
+
+	/// True if the worker decompressed the whole chunk into
+	/// complete members
+	bool ok;
+
+	/// True once the worker has finished with this chunk
+	bool done;
+};
+
+
+struct gzinmt_worker {
+	struct gzinmt_state *state;
+	z_stream s;
+	bool s_init;
+	mythread thread;
+	bool thread_init;
+};
+
+
+struct gzinmt_state {
+	xzf_stream *in;
+
+	/// Ring buffer of jobs. The job with the sequence number seq
+	/// is jobs[seq % jobs_count].
+	struct gzinmt_job *jobs;
+	size_t jobs_count;
+
+	/// Sequence number of the next job to be filled with input
+	unsigned long long fill_seq;
+
+	/// Sequence number of the job whose output is being read
+	unsigned long long read_seq;
+
+	/// True if reading the job read_seq has been started
+	bool job_started;
+
+	/// True if the job read_seq is decompressed with s instead of
+	/// using the output of the worker
+	bool serial;
+
+	/// Read position in the output of the job read_seq
+	size_t out_pos;
+
+	/// True if the next chunk to be filled begins with a member header
+	bool next_member_start;
+
+	/// True once the end of the compressed input has been reached
+	bool in_eof;
+
+	/// Decoder for the chunks whose worker output cannot be used
+	z_stream s;
+	bool s_init;
+
+	/// True if the data before the job read_seq (or before the current
+	/// position of s) ended at the end of a .gz member
+	bool at_boundary;
+
+	/// True once at least one member has been decompressed
+	bool got_member;
+
+	/// First error that occurred
+	int errnum;
+
+	struct gzinmt_worker *workers;
+	unsigned int threads;
+
+	/// Protects work_seq, submitted_seq, stop, mem_used, and
+	/// gzinmt_job.done
+	mythread_mutex mutex;
+
+	/// Signaled when a new job has been submitted or stop is set
+	mythread_cond work_cond;
+
+	/// Signaled when a job has been finished
+	mythread_cond done_cond;
+
+	/// Sequence number of the next job to be taken by a worker
+	unsigned long long work_seq;
+
+	/// Jobs up to this sequence number have been submitted
+	unsigned long long submitted_seq;
+
+	/// Memory usage limit of the jobs and the amount that is in use.
+	/// GZINMT_JOB_MEM per job is counted from the start; output buffers
+	/// that grow past GZINMT_OUT_INIT take more.
+	uint64_t memlimit;
+	uint64_t mem_used;
+
+	bool stop;
+	bool mutex_init;
+};
+
+
+static int
+gzinmt_errno(int zerrnum)
+{
+	switch (zerrnum) {
+		case Z_NEED_DICT:
+			return XZF_E_ZOPTNOTSUP;
+
+		case Z_DATA_ERROR:
+			return XZF_E_ZCORRUPT;
+
+		case Z_MEM_ERROR:
+			return ENOMEM;
+
+		default:
+			return XZF_E_BUG;
+	}
+}
+
+
+static inline struct gzinmt_job *
+get_job(struct gzinmt_state *state, unsigned long long seq)
+{
+	return &state->jobs[seq % state->jobs_count];
+}
+
+
+/// Check if the buffer begins with something that looks like a .gz member
+/// header: the magic bytes, Deflate, no reserved flags set, and sensible
+/// values in the extra flags and operating system fields.
+static bool
+is_member_start(const unsigned char *buf)
+{
+	return buf[0] == 0x1F && buf[1] == 0x8B && buf[2] == 0x08
+			&& (buf[3] & 0xE0) == 0
+			&& (buf[8] == 0 || buf[8] == 2 || buf[8] == 4)
+			&& (buf[9] <= 13 || buf[9] == 255);
+}
+
+
+/// Take size bytes of the memory usage limit. Returns false if there
+/// isn't that much left.
+static bool
+mem_take(struct gzinmt_state *state, uint64_t size)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	const bool ok = state->memlimit - state->mem_used >= size;
+	if (ok)
+		state->mem_used += size;
+
+	mythread_mutex_unlock(&state->mutex);
+	return ok;
+}
+
+
+static void
+mem_give(struct gzinmt_state *state, uint64_t size)
+{
+	mythread_mutex_lock(&state->mutex);
+	state->mem_used -= size;
+	mythread_mutex_unlock(&state->mutex);
+}
+
+
+/// Allocate or grow the output buffer of a job.
+static bool
+grow_output(struct gzinmt_state *state, struct gzinmt_job *job)
+{
+	if (job->out_alloc >= GZINMT_OUT_MAX)
+		return false;
+
+	// The first GZINMT_OUT_INIT bytes were reserved with the job.
+	const size_t new_alloc = job->out_alloc == 0
+			? GZINMT_OUT_INIT : job->out_alloc * 2;
+	const size_t extra = new_alloc - (job->out_alloc == 0
+			? GZINMT_OUT_INIT : job->out_alloc);
+	if (extra > 0 && !mem_take(state, extra))
+		return false;
+
+	unsigned char *new_out = realloc(job->out, new_alloc);
+	if (new_out == NULL) {
+		if (extra > 0)
+			mem_give(state, extra);
+
+		return false;
+	}
+
+	job->out = new_out;
+	job->out_alloc = new_alloc;
+	return true;
+}
+
+
+/// Decompress a chunk as a sequence of complete .gz members. This is
+/// called by the worker threads. job->ok is set only on success; errors
+/// are reported when the chunk is decompressed again in the calling thread.
+static void
+decode_job(struct gzinmt_state *state, struct gzinmt_job *job, z_stream *s)
+{
+	job->ok = false;
+	job->out_size = 0;
+
+	if (!job->member_start || inflateReset(s) != Z_OK)
+		return;
+
+	s->next_in = job->in;
+	s->avail_in = (uInt)job->in_size;
+
+	while (true) {
+		if (job->out_size == job->out_alloc
+				&& !grow_output(state, job))
+			return;
+
+		size_t avail = job->out_alloc - job->out_size;
+		if (avail > UINT_MAX)
+			avail = UINT_MAX;
+
+		s->next_out = job->out + job->out_size;
+		s->avail_out = (uInt)avail;
+
+		const int ret = inflate(s, Z_NO_FLUSH);
+		job->out_size += avail - s->avail_out;
+
+		if (ret == Z_STREAM_END) {
+			// The chunk must end exactly at the end of a member.
+			if (s->avail_in == 0) {
+				job->ok = true;
+				return;
+			}
+
+			if (inflateReset(s) != Z_OK)
+				return;
+
+			continue;
+		}
+
+		// Running out of input in the middle of a member means that
+		// the chunk was cut at a false member header.
+		if ((ret != Z_OK && ret != Z_BUF_ERROR)
+				|| (s->avail_in == 0 && s->avail_out > 0))
+			return;
+	}
+}
+
+
+static void *
+worker_main(void *workerptr)
+{
+	struct gzinmt_worker *worker = workerptr;
+	struct gzinmt_state *state = worker->state;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (true) {
+		if (state->work_seq == state->submitted_seq) {
+			if (state->stop)
+				break;
+
+			mythread_cond_wait(&state->work_cond, &state->mutex);
+			continue;
+		}
+
+		struct gzinmt_job *job = get_job(state, state->work_seq++);
+		mythread_mutex_unlock(&state->mutex);
+
+		decode_job(state, job, &worker->s);
+
+		mythread_mutex_lock(&state->mutex);
+		job->done = true;
+		mythread_cond_broadcast(&state->done_cond);
+	}
+
+	mythread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+
+
+/// Append up to size bytes from the substream to the job.
+static void
+copy_input(struct gzinmt_state *state, struct gzinmt_job *job,
+		const unsigned char *buf, size_t size)
+{
+	memcpy(job->in + job->in_size, buf, size);
+	job->in_size += size;
+	xzf_peekin_end(state->in, size);
+}
+
+
+/// Fill the job fill_seq with the next chunk of compressed data.
+static int
+fill_job(struct gzinmt_state *state, struct gzinmt_job *job)
+{
+	job->in_size = 0;
+	job->member_start = state->next_member_start;
+	state->next_member_start = false;
+
+	while (job->in_size < GZINMT_CHUNK_MAX) {
+		// Once the chunk is big enough, enough input is needed
+		// to check for member headers.
+		const size_t want = job->in_size < GZINMT_CHUNK_SIZE
+				? 1 : GZINMT_HEADER_CHECK;
+
+		const unsigned char *buf;
+		size_t avail = xzf_peekin_start(state->in, &buf, want);
+		if (avail == 0) {
+			if (errno != XZF_E_EOF)
+				return errno;
+
+			state->in_eof = true;
+			return 0;
+		}
+
+		if (avail > GZINMT_CHUNK_MAX - job->in_size)
+			avail = GZINMT_CHUNK_MAX - job->in_size;
+
+		if (job->in_size < GZINMT_CHUNK_SIZE) {
+			if (avail > GZINMT_CHUNK_SIZE - job->in_size)
+				avail = GZINMT_CHUNK_SIZE - job->in_size;
+
+			copy_input(state, job, buf, avail);
+			continue;
+		}
+
+		// Near the end of the input there may be less than
+		// GZINMT_HEADER_CHECK bytes. Those cannot begin a member.
+		if (avail < GZINMT_HEADER_CHECK) {
+			copy_input(state, job, buf, avail);
+			continue;
+		}
+
+		// Search for a member header. The last few bytes are left
+		// in the substream so that a header that is split between
+		// two peeks isn't missed.
+		const size_t limit = avail - GZINMT_HEADER_CHECK + 1;
+		size_t pos = 0;
+
+		while (pos < limit) {
+			const unsigned char *p = memchr(buf + pos, 0x1F,
+					limit - pos);
+			if (p == NULL) {
+				pos = limit;
+				break;
+			}
+
+			pos = (size_t)(p - buf);
+			if (is_member_start(p)) {
+				copy_input(state, job, buf, pos);
+				state->next_member_start = true;
+				return 0;
+			}
+
+			++pos;
+		}
+
+		copy_input(state, job, buf, limit);
+	}
+
+	return 0;
+}
+
+
+/// Fill and submit jobs until all the jobs are in use or the end of
+/// the input has been reached.
+static int
+fill_jobs(struct gzinmt_state *state)
+{
+	while (!state->in_eof && state->fill_seq - state->read_seq
+			< state->jobs_count) {
+		struct gzinmt_job *job = get_job(state, state->fill_seq);
+
+		if (job->in == NULL) {
+			job->in = malloc(GZINMT_CHUNK_MAX);
+			if (job->in == NULL)
+				return ENOMEM;
+		}
+
+		// The first chunk begins at a member if the file is valid.
+		if (state->fill_seq == 0) {
+			const unsigned char *buf;
+			const size_t avail = xzf_peekin_start(state->in, &buf,
+					GZINMT_HEADER_CHECK);
+			if (avail == 0 && errno != XZF_E_EOF)
+				return errno;
+
+			if (avail > 0) {
+				state->next_member_start = avail
+						>= GZINMT_HEADER_CHECK
+						&& is_member_start(buf);
+				xzf_peekin_end(state->in, 0);
+			}
+		}
+
+		const int ret = fill_job(state, job);
+		if (ret != 0)
+			return ret;
+
+		if (job->in_size == 0)
+			break;
+
+		++state->fill_seq;
+
+		mythread_mutex_lock(&state->mutex);
+		state->submitted_seq = state->fill_seq;
+		mythread_cond_signal(&state->work_cond);
+		mythread_mutex_unlock(&state->mutex);
+	}
+
+	return 0;
+}
+
+
+/// Start reading the job read_seq. This waits for the worker and decides
+/// if its output can be used.
+static int
+start_job(struct gzinmt_state *state, struct gzinmt_job *job)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	while (!job->done)
+		mythread_cond_wait(&state->done_cond, &state->mutex);
+
+	job->done = false;
+	mythread_mutex_unlock(&state->mutex);
+
+	state->job_started = true;
+	state->out_pos = 0;
+	state->serial = !(state->at_boundary && job->ok);
+
+	if (state->serial) {
+		// If the preceding data ended at a member boundary,
+		// a new member has to begin here.
+		if (state->at_boundary) {
+			const int ret = inflateReset(&state->s);
+			if (ret != Z_OK)
+				return gzinmt_errno(ret);
+		}
+
+		state->at_boundary = false;
+		state->s.next_in = job->in;
+		state->s.avail_in = (uInt)job->in_size;
+	}
+
+	return 0;
+}
+
+
+static void
+finish_job(struct gzinmt_state *state)
+{
+	state->job_started = false;
+	++state->read_seq;
+}
+
+
+/// Decompress the job in the calling thread. Returns zero when out is full
+/// or the job has been finished.
+static int
+decode_serial(struct gzinmt_state *state, unsigned char **out,
+		size_t *remaining, size_t *out_size)
+{
+	size_t out_limit = *remaining;
+	if (out_limit > UINT_MAX)
+		out_limit = UINT_MAX;
+
+	state->s.next_out = *out;
+	state->s.avail_out = (uInt)out_limit;
+
+	const int ret = inflate(&state->s, Z_NO_FLUSH);
+
+	const size_t out_used = out_limit - state->s.avail_out;
+	*out += out_used;
+	*out_size += out_used;
+	*remaining -= out_used;
+
+	if (ret == Z_STREAM_END) {
+		state->got_member = true;
+
+		if (state->s.avail_in == 0) {
+			state->at_boundary = true;
+			finish_job(state);
+			return 0;
+		}
+
+		// The next member continues in the same chunk.
+		const int reset_ret = inflateReset(&state->s);
+		return reset_ret == Z_OK ? 0 : gzinmt_errno(reset_ret);
+	}
+
+	if (ret != Z_OK && ret != Z_BUF_ERROR)
+		return gzinmt_errno(ret);
+
+	// The member continues in the next chunk.
+	if (state->s.avail_in == 0 && state->s.avail_out > 0)
+		finish_job(state);
+
+	return 0;
+}
+
+
+static int
+gzinmt_read(void *stateptr, unsigned char *out, size_t *out_size)
+{
+	struct gzinmt_state *state = stateptr;
+	size_t remaining = *out_size;
+	*out_size = 0;
+
+	if (state->errnum != 0)
+		return state->errnum;
+
+	while (remaining > 0) {
+		// Keep the workers busy.
+		int ret = fill_jobs(state);
+		if (ret != 0)
+			return state->errnum = ret;
+
+		if (state->read_seq == state->fill_seq) {
+			// All the input has been decompressed. It must
+			// have ended at the end of a member.
+			if (!state->at_boundary || !state->got_member)
+				return state->errnum = XZF_E_ZTRUNC;
+
+			return XZF_E_EOF;
+		}
+
+		struct gzinmt_job *job = get_job(state, state->read_seq);
+
+		if (!state->job_started) {
+			ret = start_job(state, job);
+			if (ret != 0)
+				return state->errnum = ret;
+		}
+
+		if (state->serial) {
+			ret = decode_serial(state, &out, &remaining,
+					out_size);
+			if (ret != 0)
+				return state->errnum = ret;
+
+			continue;
+		}
+
+		size_t copy_size = job->out_size - state->out_pos;
+		if (copy_size > remaining)
+			copy_size = remaining;
+
+		memcpy(out, job->out + state->out_pos, copy_size);
+		state->out_pos += copy_size;
+		out += copy_size;
+		*out_size += copy_size;
+		remaining -= copy_size;
+
+		if (state->out_pos == job->out_size) {
+			state->got_member = true;
+			finish_job(state);
+		}
+	}
+
+	return 0;
+}
+
+
+/// Stop the threads and free the memory. This works also
+/// on a partially initialized state.
+static void
+gzinmt_free(struct gzinmt_state *state)
+{
+	if (state->workers != NULL) {
+		if (state->mutex_init) {
+			mythread_mutex_lock(&state->mutex);
+			state->stop = true;
+			mythread_cond_broadcast(&state->work_cond);
+			mythread_mutex_unlock(&state->mutex);
+		}
+
+		for (unsigned int i = 0; i < state->threads; ++i) {
+			struct gzinmt_worker *worker = &state->workers[i];
+
+			if (worker->thread_init)
+				(void)mythread_join(worker->thread);
+
+			if (worker->s_init)
+				(void)inflateEnd(&worker->s);
+		}
+
+		free(state->workers);
+	}
+
+	if (state->mutex_init) {
+		mythread_cond_destroy(&state->done_cond);
+		mythread_cond_destroy(&state->work_cond);
+		mythread_mutex_destroy(&state->mutex);
+	}
+
+	if (state->jobs != NULL) {
+		for (size_t i = 0; i < state->jobs_count; ++i) {
+			free(state->jobs[i].in);
+			free(state->jobs[i].out);
+		}
+
+		free(state->jobs);
+	}
+
+	if (state->s_init)
+		(void)inflateEnd(&state->s);
+
+	free(state);
+}
+
+
+static int
+gzinmt_close(void *stateptr, int cl_flags)
+{
+	struct gzinmt_state *state = stateptr;
+	xzf_stream *in = state->in;
+
+	gzinmt_free(state);
+
+	return cl_flags & XZF_CL_DETACH ? 0 : xzf_close(in, cl_flags);
+}
+
+
+static int
+gzinmt_getinfo(void *stateptr, int key, void *value)
+{
+	struct gzinmt_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_SUBSTREAM: {
+			xzf_stream **strm = value;
+			*strm = state->in;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_GZ;
+			return 0;
+		}
+	}
+
+	return xzf_getinfo(state->in, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend gzinmt_backend = {
+	.version = 0,
+	.read = &gzinmt_read,
+	.close = &gzinmt_close,
+	.getinfo = &gzinmt_getinfo,
+};
+
+
+static int
+inflate_init(z_stream *s)
+{
+	s->next_in = Z_NULL;
+	s->avail_in = 0;
+	s->zalloc = Z_NULL;
+	s->zfree = Z_NULL;
+	s->opaque = Z_NULL;
+
+	const int ret = inflateInit2(s, 31);
+	return ret == Z_OK ? 0 : gzinmt_errno(ret);
+}
+
+
+static int
+gzinmt_init(struct gzinmt_state *state)
+{
+	int ret = inflate_init(&state->s);
+	if (ret != 0)
+		return ret;
+
+	state->s_init = true;
+
+	// Use twice as many jobs as there are threads so that the
+	// threads have more work queued while the output is being read.
+	// The buffers are allocated when the jobs are used, so small
+	// files don't allocate memory for all the jobs.
+	state->jobs_count = state->threads * 2;
+	state->mem_used = state->jobs_count * (uint64_t)GZINMT_JOB_MEM;
+	state->jobs = calloc(state->jobs_count, sizeof(struct gzinmt_job));
+	state->workers = calloc(state->threads, sizeof(struct gzinmt_worker));
+	if (state->jobs == NULL || state->workers == NULL)
+		return ENOMEM;
+
+	for (unsigned int i = 0; i < state->threads; ++i) {
+		struct gzinmt_worker *worker = &state->workers[i];
+		worker->state = state;
+
+		ret = inflate_init(&worker->s);
+		if (ret != 0)
+			return ret;
+
+		worker->s_init = true;
+	}
+
+	ret = mythread_mutex_init(&state->mutex);
+	if (ret != 0)
+		return ret;
+
+	ret = mythread_cond_init(&state->work_cond);
+	if (ret != 0) {
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	ret = mythread_cond_init(&state->done_cond);
+	if (ret != 0) {
+		mythread_cond_destroy(&state->work_cond);
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	state->mutex_init = true;
+
+	for (unsigned int i = 0; i < state->threads; ++i) {
+		struct gzinmt_worker *worker = &state->workers[i];
+		ret = mythread_create(&worker->thread, &worker_main, worker);
+		if (ret != 0)
+			return ret;
+
+		worker->thread_init = true;
+	}
+
+	return 0;
+}
+#endif
+
+
+extern xzf_stream *
+xzf_gzin_open_mt(xzf_stream *in, int zflags, unsigned int threads,
+		unsigned long long memlimit)
+{
+	static const int supported_flags = XZF_Z_SINGLE;
+	if ((zflags & ~supported_flags) || threads > GZINMT_THREADS_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+#ifdef MYTHREAD_ENABLED
+	if (threads == 0)
+		threads = mythread_ncpus();
+
+	// Like with .xz, the default limit is a quarter of the RAM.
+	if (memlimit == 0) {
+		memlimit = lzma_physmem() / 4;
+		if (memlimit == 0)
+			memlimit = UINT64_C(1) << 30;
+	}
+
+	// Reduce the number of threads so that the buffers of their
+	// jobs fit in the limit.
+	const uint64_t max_jobs = memlimit / GZINMT_JOB_MEM;
+	if (max_jobs < (uint64_t)threads * 2)
+		threads = (unsigned int)(max_jobs / 2);
+
+	// A single member cannot be decompressed in parallel.
+	if (threads <= 1 || (zflags & XZF_Z_SINGLE))
+		return xzf_gzin_open(in, zflags);
+
+	struct gzinmt_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->in = in;
+	state->threads = threads;
+	state->memlimit = memlimit;
+	state->at_boundary = true;
+
+	const int ret = gzinmt_init(state);
+	if (ret != 0) {
+		gzinmt_free(state);
+		errno = ret;
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &gzinmt_backend, state,
+			XZF_READ, XZF_BUFSIZE, XZF_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		gzinmt_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+#else
+	(void)threads;
+	(void)memlimit;
+	return xzf_gzin_open(in, zflags);
+#endif
+}
@@ -0,0 +1,1010 @@
+/*
+ * Backend for writing .gz files using multiple threads
+ *
+ * The input is split into blocks which are compressed independently
+ * as raw Deflate. Each block is primed with the last 32 KiB of the
+ * preceding uncompressed data so that the compression ratio stays close
+ * to single-threaded gzip. All blocks except the last one are ended with
+ * Z_SYNC_FLUSH which makes them byte aligned. The compressed blocks are
+ * written in order into a single .gz member whose CRC32 is combined from
+ * the per-block CRC32s. This is the same method that pigz uses.
+ *
+ * In BGZF mode, each block is instead compressed into a .gz member of its
+ * own with the BGZF extra field that stores the size of the member. The
+ * members don't depend on each other which makes the output seekable.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "mythread.h"
+#include "xzfile.h"
+
+#include <unistd.h>
+#include <zlib.h>
+
+
+/// Size of the Deflate history window
+#define GZOUT_DICT_SIZE (UINT32_C(1) << 15)
+
+/// Default amount of uncompressed data per block
+#define GZOUT_BLOCK_SIZE (UINT32_C(128) << 10)
+
+/// Limits for the block size. The maximum keeps the sizes in uInt.
+#define GZOUT_BLOCK_MIN GZOUT_DICT_SIZE
+#define GZOUT_BLOCK_MAX (UINT32_C(256) << 20)
+
+/// Maximum number of threads
+#define GZOUT_THREADS_MAX 1024
+
+/// Maximum size of a BGZF block, both compressed and uncompressed
+#define BGZF_BLOCK_MAX 65536
+
+/// Default amount of uncompressed data per BGZF block. This is what
+/// other BGZF writers use. It leaves room for the case when the data
+/// doesn't compress.
+#define BGZF_BLOCK_SIZE 0xFF00
+
+/// Size of the .gz header with the BGZF extra field and of the trailer
+#define BGZF_HEADER_SIZE 18
+#define BGZF_TRAILER_SIZE 8
+
+
+struct gzout_job {
+	/// Uncompressed data
+	unsigned char *in;
+	size_t in_size;
+
+	/// Preset dictionary, that is, the uncompressed data that
+	/// immediately precedes this block
+	unsigned char *dict;
+	size_t dict_size;
+
+	/// Compressed data
+	unsigned char *out;
+	size_t out_size;
+	size_t out_alloc;
+
+	/// CRC32 of the uncompressed data in this block
+	uLong crc;
+
+	/// True if this is the last block of the .gz member
+	bool last;
+
+	/// True once the block has been compressed
+	bool done;
+
+	/// Error code from compressing this block
+	int errnum;
+};
+
+
+struct gzout_worker {
+	struct gzout_state *state;
+	z_stream s;
+	bool s_init;
+#ifdef MYTHREAD_ENABLED
+	mythread thread;
+	bool thread_init;
+#endif
+};
+
+
+struct gzout_state {
+	xzf_stream *out;
+
+	int level;
+	int strategy;
+	size_t block_size;
+
+	/// True when writing BGZF
+	bool bgzf;
+
+	/// BGZF: Name of the .gzi file to write when closing or NULL
+	char *gzi_filename;
+
+	/// BGZF: Compressed and uncompressed offsets at the end of
+	/// each block written so far. These are collected only if
+	/// gzi_filename isn't NULL.
+	uint64_t *gzi;
+	size_t gzi_count;
+	size_t gzi_alloc;
+
+	/// BGZF: Amount of compressed and uncompressed data written so far
+	uint64_t zpos;
+	uint64_t upos;
+
+	/// Ring buffer of jobs. The job with the sequence number seq
+	/// is jobs[seq % jobs_count].
+	struct gzout_job *jobs;
+	size_t jobs_count;
+
+	/// Sequence number of the job that is being filled with input
+	unsigned long long fill_seq;
+
+	/// Sequence number of the oldest job whose output
+	/// hasn't been written yet
+	unsigned long long write_seq;
+
+	/// Preset dictionary for the next block
+	unsigned char dict[GZOUT_DICT_SIZE];
+	size_t dict_size;
+
+	/// CRC32 and size of the uncompressed data written so far
+	uLong crc;
+	uLong isize;
+
+	bool header_written;
+
+	/// First error that occurred. Once set, all further
+	/// operations fail with this error.
+	int errnum;
+
+	struct gzout_worker *workers;
+	unsigned int threads;
+
+#ifdef MYTHREAD_ENABLED
+	/// Protects work_seq, stop, and gzout_job.done
+	mythread_mutex mutex;
+
+	/// Signaled when a new job has been submitted or stop is set
+	mythread_cond work_cond;
+
+	/// Signaled when a job has been finished
+	mythread_cond done_cond;
+
+	/// Sequence number of the next job to be taken by a worker.
+	/// The jobs [work_seq, fill_seq) are waiting for a worker.
+	unsigned long long work_seq;
+
+	/// Jobs up to this sequence number have been submitted.
+	/// This is a copy of fill_seq that is protected by the mutex.
+	unsigned long long submitted_seq;
+
+	bool stop;
+	bool mutex_init;
+#endif
+};
+
+
+static int
+gzout_errno(int zerrnum)
+{
+	return zerrnum == Z_MEM_ERROR ? ENOMEM : XZF_E_BUG;
+}
+
+
+static inline struct gzout_job *
+get_job(struct gzout_state *state, unsigned long long seq)
+{
+	return &state->jobs[seq % state->jobs_count];
+}
+
+
+/// Compress one job. This is called by the worker threads,
+/// or directly from gzout_submit() when threading isn't used.
+static void
+compress_job(struct gzout_job *job, z_stream *s)
+{
+	int ret = deflateReset(s);
+
+	if (ret == Z_OK && job->dict_size > 0)
+		ret = deflateSetDictionary(s, job->dict,
+				(uInt)job->dict_size);
+
+	if (ret != Z_OK) {
+		job->errnum = gzout_errno(ret);
+		return;
+	}
+
+	s->next_in = job->in;
+	s->avail_in = (uInt)job->in_size;
+	job->out_size = 0;
+
+	const int action = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+	while (true) {
+		// Usually the initial allocation is enough. Grow the buffer
+		// if some weird input needs more than deflateBound() says.
+		if (job->out_size == job->out_alloc) {
+			const size_t new_alloc = job->out_alloc * 2;
+			unsigned char *new_out = realloc(job->out, new_alloc);
+			if (new_out == NULL) {
+				job->errnum = ENOMEM;
+				return;
+			}
+
+			job->out = new_out;
+			job->out_alloc = new_alloc;
+		}
+
+		size_t avail = job->out_alloc - job->out_size;
+		if (avail > UINT_MAX)
+			avail = UINT_MAX;
+
+		s->next_out = job->out + job->out_size;
+		s->avail_out = (uInt)avail;
+
+		ret = deflate(s, action);
+		job->out_size += avail - s->avail_out;
+
+		if (ret == Z_STREAM_END)
+			break;
+
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			job->errnum = gzout_errno(ret);
+			return;
+		}
+
+		// With Z_SYNC_FLUSH, all input has been compressed and
+		// flushed when deflate() didn't fill the output buffer.
+		if (action == Z_SYNC_FLUSH && s->avail_in == 0
+				&& s->avail_out > 0)
+			break;
+	}
+
+	job->crc = crc32(crc32(0, Z_NULL, 0), job->in, (uInt)job->in_size);
+	job->errnum = 0;
+}
+
+
+static void
+put_le16(unsigned char *buf, unsigned int num)
+{
+	buf[0] = (unsigned char)num;
+	buf[1] = (unsigned char)(num >> 8);
+}
+
+
+static void
+put_le32(unsigned char *buf, uLong num)
+{
+	buf[0] = (unsigned char)num;
+	buf[1] = (unsigned char)(num >> 8);
+	buf[2] = (unsigned char)(num >> 16);
+	buf[3] = (unsigned char)(num >> 24);
+}
+
+
+/// Write the .gz header and trailer of a BGZF block around
+/// deflate_size bytes of Deflate data at buf + BGZF_HEADER_SIZE.
+/// Returns the total size of the block.
+static size_t
+bgzf_wrap(unsigned char *buf, size_t deflate_size, uLong crc, size_t in_size)
+{
+	// FEXTRA is set. The extra field has one subfield "BC" whose
+	// two-byte payload is the total size of the block minus one.
+	static const unsigned char header[BGZF_HEADER_SIZE - 2] = {
+		0x1F, 0x8B, 0x08, 0x04, 0, 0, 0, 0, 0, 0xFF,
+		6, 0, 'B', 'C', 2, 0
+	};
+
+	const size_t total = BGZF_HEADER_SIZE + deflate_size
+			+ BGZF_TRAILER_SIZE;
+	assert(total <= BGZF_BLOCK_MAX);
+
+	memcpy(buf, header, sizeof(header));
+	put_le16(buf + sizeof(header), (unsigned int)(total - 1));
+
+	unsigned char *trailer = buf + BGZF_HEADER_SIZE + deflate_size;
+	put_le32(trailer, crc);
+	put_le32(trailer + 4, (uLong)in_size);
+
+	return total;
+}
+
+
+/// Compress one job into a complete BGZF block. If the data doesn't fit
+/// into a block when compressed, it is stored uncompressed instead.
+static void
+compress_bgzf(struct gzout_job *job, z_stream *s)
+{
+	assert(job->out_alloc >= BGZF_BLOCK_MAX);
+
+	job->crc = crc32(crc32(0, Z_NULL, 0), job->in, (uInt)job->in_size);
+
+	int ret = deflateReset(s);
+	if (ret != Z_OK) {
+		job->errnum = gzout_errno(ret);
+		return;
+	}
+
+	unsigned char *deflate_buf = job->out + BGZF_HEADER_SIZE;
+	const size_t deflate_max = BGZF_BLOCK_MAX - BGZF_HEADER_SIZE
+			- BGZF_TRAILER_SIZE;
+
+	s->next_in = job->in;
+	s->avail_in = (uInt)job->in_size;
+	s->next_out = deflate_buf;
+	s->avail_out = (uInt)deflate_max;
+
+	ret = deflate(s, Z_FINISH);
+
+	size_t deflate_size;
+	if (ret == Z_STREAM_END) {
+		deflate_size = deflate_max - s->avail_out;
+	} else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+		// A single stored block with the final bit set.
+		// The block size is limited so that this always fits.
+		assert(job->in_size + 5 <= deflate_max);
+		deflate_buf[0] = 0x01;
+		put_le16(deflate_buf + 1, (unsigned int)job->in_size);
+		put_le16(deflate_buf + 3, (unsigned int)~job->in_size & 0xFFFF);
+		memcpy(deflate_buf + 5, job->in, job->in_size);
+		deflate_size = job->in_size + 5;
+	} else {
+		job->errnum = gzout_errno(ret);
+		return;
+	}
+
+	job->out_size = bgzf_wrap(job->out, deflate_size, job->crc,
+			job->in_size);
+	job->errnum = 0;
+}
+
+
+#ifdef MYTHREAD_ENABLED
+static void *
+worker_main(void *workerptr)
+{
+	struct gzout_worker *worker = workerptr;
+	struct gzout_state *state = worker->state;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (true) {
+		if (state->work_seq == state->submitted_seq) {
+			if (state->stop)
+				break;
+
+			mythread_cond_wait(&state->work_cond, &state->mutex);
+			continue;
+		}
+
+		struct gzout_job *job = get_job(state, state->work_seq++);
+		mythread_mutex_unlock(&state->mutex);
+
+		if (state->bgzf)
+			compress_bgzf(job, &worker->s);
+		else
+			compress_job(job, &worker->s);
+
+		mythread_mutex_lock(&state->mutex);
+		job->done = true;
+		mythread_cond_broadcast(&state->done_cond);
+	}
+
+	mythread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+#endif
+
+
+static int
+write_header(struct gzout_state *state)
+{
+	// Modification time isn't stored. The extra flags indicate
+	// the fastest and the best compression like gzip does.
+	// The operating system is always Unix.
+	unsigned char header[10] = { 0x1F, 0x8B, 0x08, 0, 0, 0, 0, 0, 0, 3 };
+
+	if (state->level == 9)
+		header[8] = 2;
+	else if (state->level == 1)
+		header[8] = 4;
+
+	if (xzf_write(state->out, header, sizeof(header)))
+		return errno;
+
+	state->header_written = true;
+	return 0;
+}
+
+
+/// Write a compressed BGZF block and remember where it ended for the .gzi.
+static int
+write_bgzf(struct gzout_state *state, struct gzout_job *job)
+{
+	if (xzf_write(state->out, job->out, job->out_size))
+		return errno;
+
+	state->zpos += job->out_size;
+	state->upos += job->in_size;
+
+	if (state->gzi_filename != NULL) {
+		if (state->gzi_count == state->gzi_alloc) {
+			const size_t new_alloc = state->gzi_alloc == 0
+					? 256 : state->gzi_alloc * 2;
+			if (new_alloc > SIZE_MAX / (2 * sizeof(uint64_t)))
+				return ENOMEM;
+
+			uint64_t *new_gzi = realloc(state->gzi,
+					new_alloc * 2 * sizeof(uint64_t));
+			if (new_gzi == NULL)
+				return ENOMEM;
+
+			state->gzi = new_gzi;
+			state->gzi_alloc = new_alloc;
+		}
+
+		state->gzi[2 * state->gzi_count] = state->zpos;
+		state->gzi[2 * state->gzi_count + 1] = state->upos;
+		++state->gzi_count;
+	}
+
+	job->in_size = 0;
+	++state->write_seq;
+	return 0;
+}
+
+
+/// Write the output of the oldest job to the substream. If wait is false
+/// and the job hasn't been compressed yet, XZF_E_EOF is returned to
+/// indicate that nothing was done.
+static int
+write_job(struct gzout_state *state, bool wait)
+{
+	assert(state->write_seq < state->fill_seq);
+
+	struct gzout_job *job = get_job(state, state->write_seq);
+
+#ifdef MYTHREAD_ENABLED
+	if (state->threads > 1) {
+		mythread_mutex_lock(&state->mutex);
+
+		while (!job->done) {
+			if (!wait) {
+				mythread_mutex_unlock(&state->mutex);
+				return XZF_E_EOF;
+			}
+
+			mythread_cond_wait(&state->done_cond, &state->mutex);
+		}
+
+		job->done = false;
+		mythread_mutex_unlock(&state->mutex);
+	}
+#else
+	(void)wait;
+#endif
+
+	if (job->errnum != 0)
+		return job->errnum;
+
+	if (state->bgzf)
+		return write_bgzf(state, job);
+
+	if (!state->header_written) {
+		const int ret = write_header(state);
+		if (ret != 0)
+			return ret;
+	}
+
+	if (job->out_size > 0 && xzf_write(state->out, job->out, job->out_size))
+		return errno;
+
+	state->crc = crc32_combine(state->crc, job->crc,
+			(z_off_t)job->in_size);
+	state->isize += (uLong)job->in_size;
+
+	job->in_size = 0;
+	++state->write_seq;
+	return 0;
+}
+
+
+/// Write the output of all the jobs that have been finished. If wait is
+/// true, wait for all the submitted jobs to finish.
+static int
+write_finished(struct gzout_state *state, bool wait)
+{
+	while (state->write_seq < state->fill_seq) {
+		const int ret = write_job(state, wait);
+		if (ret == XZF_E_EOF)
+			break;
+
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+
+/// Submit the job that is being filled for compression and make a new
+/// job available for filling.
+static int
+gzout_submit(struct gzout_state *state, bool last)
+{
+	struct gzout_job *job = get_job(state, state->fill_seq);
+	job->last = last;
+
+	// BGZF blocks are independent so there is no preset dictionary.
+	if (state->bgzf) {
+		job->dict_size = 0;
+		++state->fill_seq;
+		goto submit;
+	}
+
+	// The preset dictionary of this job is the end of the data
+	// that has been submitted before this job.
+	memcpy(job->dict, state->dict, state->dict_size);
+	job->dict_size = state->dict_size;
+
+	// Update the dictionary for the next job.
+	if (job->in_size >= GZOUT_DICT_SIZE) {
+		memcpy(state->dict, job->in + job->in_size - GZOUT_DICT_SIZE,
+				GZOUT_DICT_SIZE);
+		state->dict_size = GZOUT_DICT_SIZE;
+	} else {
+		const size_t keep = GZOUT_DICT_SIZE - job->in_size
+				< state->dict_size
+				? GZOUT_DICT_SIZE - job->in_size
+				: state->dict_size;
+		memmove(state->dict, state->dict + state->dict_size - keep,
+				keep);
+		memcpy(state->dict + keep, job->in, job->in_size);
+		state->dict_size = keep + job->in_size;
+	}
+
+	++state->fill_seq;
+
+submit:
+#ifdef MYTHREAD_ENABLED
+	if (state->threads > 1) {
+		mythread_mutex_lock(&state->mutex);
+		state->submitted_seq = state->fill_seq;
+		mythread_cond_signal(&state->work_cond);
+		mythread_mutex_unlock(&state->mutex);
+	} else
+#endif
+	if (state->bgzf) {
+		compress_bgzf(job, &state->workers[0].s);
+	} else {
+		compress_job(job, &state->workers[0].s);
+	}
+
+	// Write whatever is ready and then, if needed, wait until
+	// there is a free job for the new input.
+	int ret = write_finished(state, false);
+
+	while (ret == 0 && state->fill_seq - state->write_seq
+			>= state->jobs_count)
+		ret = write_job(state, true);
+
+	return ret;
+}
+
+
+static int
+gzout_write(void *stateptr, const unsigned char *buf, size_t size)
+{
+	struct gzout_state *state = stateptr;
+
+	if (state->errnum != 0)
+		return state->errnum;
+
+	while (size > 0) {
+		struct gzout_job *job = get_job(state, state->fill_seq);
+
+		size_t copy_size = state->block_size - job->in_size;
+		if (copy_size > size)
+			copy_size = size;
+
+		memcpy(job->in + job->in_size, buf, copy_size);
+		job->in_size += copy_size;
+		buf += copy_size;
+		size -= copy_size;
+
+		if (job->in_size == state->block_size) {
+			const int ret = gzout_submit(state, false);
+			if (ret != 0)
+				return state->errnum = ret;
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+gzout_flush(void *stateptr, int fl_flags)
+{
+	struct gzout_state *state = stateptr;
+
+	if (state->errnum != 0)
+		return state->errnum;
+
+	int ret = 0;
+
+	// Empty blocks aren't submitted. They would only add
+	// a useless sync flush marker to the output.
+	if (get_job(state, state->fill_seq)->in_size > 0)
+		ret = gzout_submit(state, false);
+
+	if (ret == 0)
+		ret = write_finished(state, true);
+
+	if (ret != 0)
+		return state->errnum = ret;
+
+	return xzf_flush(state->out, fl_flags) ? errno : 0;
+}
+
+
+/// Write the .gzi file: the number of entries followed by the compressed
+/// and uncompressed offsets at the end of each block, all as 64-bit
+/// little endian integers. This is the format used by bgzip.
+static int
+write_gzi(struct gzout_state *state)
+{
+	xzf_stream *file = xzf_fd_open(state->gzi_filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0666);
+	if (file == NULL)
+		return errno;
+
+	unsigned char buf[8];
+	put_le32(buf, (uLong)state->gzi_count);
+	put_le32(buf + 4, (uLong)((uint64_t)state->gzi_count >> 32));
+	int ret = xzf_write(file, buf, sizeof(buf)) ? errno : 0;
+
+	for (size_t i = 0; ret == 0 && i < 2 * state->gzi_count; ++i) {
+		put_le32(buf, (uLong)state->gzi[i]);
+		put_le32(buf + 4, (uLong)(state->gzi[i] >> 32));
+		if (xzf_write(file, buf, sizeof(buf)))
+			ret = errno;
+	}
+
+	if (ret == 0) {
+		if (xzf_close(file, 0))
+			ret = errno;
+	} else {
+		(void)xzf_close(file, XZF_CL_FORGET);
+	}
+
+	if (ret != 0)
+		(void)unlink(state->gzi_filename);
+
+	return ret;
+}
+
+
+/// Finish BGZF: compress the last block, write the empty end-of-file
+/// block, and write the .gzi file.
+static int
+bgzf_finish(struct gzout_state *state)
+{
+	int ret = 0;
+	if (get_job(state, state->fill_seq)->in_size > 0)
+		ret = gzout_submit(state, true);
+
+	if (ret == 0)
+		ret = write_finished(state, true);
+
+	if (ret == 0) {
+		// An empty Deflate stream is 0x03 0x00.
+		unsigned char eof_block[BGZF_HEADER_SIZE + 2
+				+ BGZF_TRAILER_SIZE];
+		eof_block[BGZF_HEADER_SIZE] = 0x03;
+		eof_block[BGZF_HEADER_SIZE + 1] = 0x00;
+		bgzf_wrap(eof_block, 2, 0, 0);
+
+		if (xzf_write(state->out, eof_block, sizeof(eof_block)))
+			ret = errno;
+	}
+
+	if (ret == 0 && state->gzi_filename != NULL)
+		ret = write_gzi(state);
+
+	return ret;
+}
+
+
+/// Finish the .gz member: compress the last block and write the trailer.
+static int
+gzout_finish(struct gzout_state *state)
+{
+	if (state->bgzf)
+		return bgzf_finish(state);
+
+	int ret = gzout_submit(state, true);
+	if (ret == 0)
+		ret = write_finished(state, true);
+
+	if (ret == 0) {
+		unsigned char trailer[8];
+		put_le32(trailer, state->crc);
+		put_le32(trailer + 4, state->isize);
+
+		if (xzf_write(state->out, trailer, sizeof(trailer)))
+			ret = errno;
+	}
+
+	return ret;
+}
+
+
+/// Stop the threads and free the memory. This works also
+/// on a partially initialized state.
+static void
+gzout_free(struct gzout_state *state)
+{
+	if (state->workers != NULL) {
+#ifdef MYTHREAD_ENABLED
+		if (state->mutex_init) {
+			mythread_mutex_lock(&state->mutex);
+			state->stop = true;
+			mythread_cond_broadcast(&state->work_cond);
+			mythread_mutex_unlock(&state->mutex);
+		}
+#endif
+
+		for (unsigned int i = 0; i < state->threads; ++i) {
+			struct gzout_worker *worker = &state->workers[i];
+
+#ifdef MYTHREAD_ENABLED
+			if (worker->thread_init)
+				(void)mythread_join(worker->thread);
+#endif
+
+			if (worker->s_init)
+				(void)deflateEnd(&worker->s);
+		}
+
+		free(state->workers);
+	}
+
+#ifdef MYTHREAD_ENABLED
+	if (state->mutex_init) {
+		mythread_cond_destroy(&state->done_cond);
+		mythread_cond_destroy(&state->work_cond);
+		mythread_mutex_destroy(&state->mutex);
+	}
+#endif
+
+	if (state->jobs != NULL) {
+		for (size_t i = 0; i < state->jobs_count; ++i) {
+			free(state->jobs[i].in);
+			free(state->jobs[i].dict);
+			free(state->jobs[i].out);
+		}
+
+		free(state->jobs);
+	}
+
+	free(state->gzi_filename);
+	free(state->gzi);
+	free(state);
+}
+
+
+static int
+gzout_close(void *stateptr, int cl_flags)
+{
+	struct gzout_state *state = stateptr;
+	xzf_stream *out = state->out;
+
+	int ret = state->errnum;
+	if (ret == 0 && !(cl_flags & XZF_CL_FORGET))
+		ret = gzout_finish(state);
+
+	gzout_free(state);
+
+	if (!(cl_flags & XZF_CL_DETACH)) {
+		const int close_ret = xzf_close(out, cl_flags);
+		if (ret == 0)
+			ret = close_ret;
+	}
+
+	return ret;
+}
+
+
+static int
+gzout_getinfo(void *stateptr, int key, void *value)
+{
+	struct gzout_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_SUBSTREAM: {
+			xzf_stream **strm = value;
+			*strm = state->out;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_GZ;
+			return 0;
+		}
+	}
+
+	return xzf_getinfo(state->out, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend gzout_backend = {
+	.version = 0,
+	.write = &gzout_write,
+	.flush = &gzout_flush,
+	.close = &gzout_close,
+	.getinfo = &gzout_getinfo,
+};
+
+
+static int
+gzout_init(struct gzout_state *state, const struct xzf_gzout_mt *options)
+{
+	state->threads = options->threads == 0
+			? mythread_ncpus() : options->threads;
+#ifndef MYTHREAD_ENABLED
+	state->threads = 1;
+#endif
+
+	// Use twice as many jobs as there are threads so that the
+	// threads have more work queued while the finished blocks
+	// are being written out.
+	state->jobs_count = state->threads == 1 ? 1 : state->threads * 2;
+	state->jobs = calloc(state->jobs_count, sizeof(struct gzout_job));
+	state->workers = calloc(state->threads, sizeof(struct gzout_worker));
+	if (state->jobs == NULL || state->workers == NULL)
+		return ENOMEM;
+
+	for (unsigned int i = 0; i < state->threads; ++i) {
+		struct gzout_worker *worker = &state->workers[i];
+		worker->state = state;
+		worker->s.zalloc = Z_NULL;
+		worker->s.zfree = Z_NULL;
+		worker->s.opaque = Z_NULL;
+
+		// Negative window bits give raw Deflate.
+		const int ret = deflateInit2(&worker->s, state->level,
+				Z_DEFLATED, -15, 8, state->strategy);
+		if (ret != Z_OK)
+			return ret == Z_STREAM_ERROR ? EINVAL
+					: gzout_errno(ret);
+
+		worker->s_init = true;
+	}
+
+	size_t out_alloc = deflateBound(&state->workers[0].s,
+			(uLong)state->block_size) + 16;
+	if (state->bgzf && out_alloc < BGZF_BLOCK_MAX)
+		out_alloc = BGZF_BLOCK_MAX;
+
+	for (size_t i = 0; i < state->jobs_count; ++i) {
+		struct gzout_job *job = &state->jobs[i];
+		job->in = malloc(state->block_size);
+		job->dict = malloc(GZOUT_DICT_SIZE);
+		job->out = malloc(out_alloc);
+		job->out_alloc = out_alloc;
+
+		if (job->in == NULL || job->dict == NULL || job->out == NULL)
+			return ENOMEM;
+	}
+
+#ifdef MYTHREAD_ENABLED
+	if (state->threads > 1) {
+		int ret = mythread_mutex_init(&state->mutex);
+		if (ret != 0)
+			return ret;
+
+		ret = mythread_cond_init(&state->work_cond);
+		if (ret != 0) {
+			mythread_mutex_destroy(&state->mutex);
+			return ret;
+		}
+
+		ret = mythread_cond_init(&state->done_cond);
+		if (ret != 0) {
+			mythread_cond_destroy(&state->work_cond);
+			mythread_mutex_destroy(&state->mutex);
+			return ret;
+		}
+
+		state->mutex_init = true;
+
+		for (unsigned int i = 0; i < state->threads; ++i) {
+			struct gzout_worker *worker = &state->workers[i];
+			ret = mythread_create(&worker->thread,
+					&worker_main, worker);
+			if (ret != 0)
+				return ret;
+
+			worker->thread_init = true;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+
+static xzf_stream *
+gzout_open(xzf_stream *out, const struct xzf_gzout_mt *options, bool bgzf,
+		const char *gzi_filename)
+{
+	const size_t block_min = bgzf ? 1 : GZOUT_BLOCK_MIN;
+	const size_t block_max = bgzf ? BGZF_BLOCK_SIZE : GZOUT_BLOCK_MAX;
+
+	if (options == NULL
+			|| options->level < Z_DEFAULT_COMPRESSION
+			|| options->level > Z_BEST_COMPRESSION
+			|| options->threads > GZOUT_THREADS_MAX
+			|| (options->block_size != 0
+				&& (options->block_size < block_min
+				|| options->block_size > block_max))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct gzout_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->out = out;
+	state->level = options->level;
+	state->strategy = options->strategy;
+	state->block_size = options->block_size != 0 ? options->block_size
+			: bgzf ? BGZF_BLOCK_SIZE : GZOUT_BLOCK_SIZE;
+	state->bgzf = bgzf;
+	state->crc = crc32(0, Z_NULL, 0);
+
+	if (gzi_filename != NULL) {
+		state->gzi_filename = strdup(gzi_filename);
+		if (state->gzi_filename == NULL) {
+			free(state);
+			return NULL;
+		}
+	}
+
+	const int ret = gzout_init(state, options);
+	if (ret != 0) {
+		gzout_free(state);
+		errno = ret;
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &gzout_backend, state,
+			XZF_WRITE, 0, XZF_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		gzout_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
+
+
+extern xzf_stream *
+xzf_gzout_open_mt(xzf_stream *out, const struct xzf_gzout_mt *options)
+{
+	return gzout_open(out, options, false, NULL);
+}
+
+
+extern xzf_stream *
+xzf_bgzfout_open(xzf_stream *out, const struct xzf_gzout_mt *options,
+		const char *gzi_filename)
+{
+	return gzout_open(out, options, true, gzi_filename);
+}
+
+
+extern xzf_stream *
+xzf_gzout_open(xzf_stream *out, int level, int strategy)
+{
+	const struct xzf_gzout_mt options = {
+		.level = level,
+		.strategy = strategy,
+		.threads = 0,
+		.block_size = 0,
+	};
+
+	return xzf_gzout_open_mt(out, &options);
+}
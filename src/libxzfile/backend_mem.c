@@ -0,0 +1,374 @@
+/*
+ * Backends for reading from and writing to memory
+ *
+ * The reader gives an existing buffer to the frontend with peekin so
+ * nothing is copied. The writer stores the output in a list of chunks
+ * that are given to the frontend with peekout. A full chunk is never
+ * reallocated or moved; a new chunk is added instead. The result is
+ * available as an array of xzf_iovec.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+#include "keys.h"
+
+
+/// Default and minimum size of the first output chunk
+#define MEMOUT_CHUNK_DEFAULT (UINT32_C(64) << 10)
+#define MEMOUT_CHUNK_MIN XZF_BUFSIZE
+
+/// Each chunk is twice as big as the previous one up to this size
+#define MEMOUT_CHUNK_MAX (UINT32_C(16) << 20)
+
+
+struct memin_state {
+	const unsigned char *buf;
+	size_t size;
+
+	/// Current position. It may be past the end of the buffer
+	/// after seeking.
+	xzf_off pos;
+};
+
+
+/// Number of bytes available at the current position
+static size_t
+memin_avail(const struct memin_state *state)
+{
+	return state->pos < (xzf_off)state->size
+			? state->size - (size_t)state->pos : 0;
+}
+
+
+static int
+memin_peekin_start(void *stateptr, const unsigned char **buf, size_t *size)
+{
+	struct memin_state *state = stateptr;
+	const size_t min = *size;
+
+	*size = memin_avail(state);
+	if (*size == 0)
+		return XZF_E_EOF;
+
+	*buf = state->buf + state->pos;
+	return *size < min ? XZF_E_EOF : 0;
+}
+
+
+static int
+memin_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct memin_state *state = stateptr;
+	state->pos += (xzf_off)bytes_used;
+	return 0;
+}
+
+
+static int
+memin_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct memin_state *state = stateptr;
+	xzf_off base;
+
+	switch (whence) {
+	case XZF_SEEK_SET:
+		base = 0;
+		break;
+
+	case XZF_SEEK_CUR:
+		base = state->pos;
+		break;
+
+	case XZF_SEEK_END:
+		base = (xzf_off)state->size;
+		break;
+
+	default:
+		return EINVAL;
+	}
+
+	if (*offset < 0 ? base < -*offset : base > XZF_OFF_MAX - *offset)
+		return EINVAL;
+
+	state->pos = base + *offset;
+	*offset = state->pos;
+	return 0;
+}
+
+
+static int
+memin_skip(void *stateptr, xzf_off *amount)
+{
+	struct memin_state *state = stateptr;
+
+	const xzf_off avail = (xzf_off)memin_avail(state);
+	const bool eof = avail < *amount;
+	if (eof)
+		*amount = avail;
+
+	state->pos += *amount;
+	return eof ? XZF_E_EOF : 0;
+}
+
+
+static int
+memin_close(void *stateptr, int cl_flags)
+{
+	(void)cl_flags;
+	free(stateptr);
+	return 0;
+}
+
+
+static int
+mem_getinfo_common(int key, void *value)
+{
+	switch (key) {
+		case XZF_KEY_ISATTY: {
+			int *result = value;
+			*result = 0;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_NONE;
+			return 0;
+		}
+	}
+
+	return XZF_E_NOKEY;
+}
+
+
+static int
+memin_getinfo(void *stateptr, int key, void *value)
+{
+	(void)stateptr;
+	return mem_getinfo_common(key, value);
+}
+
+
+static const struct xzf_backend memin_backend = {
+	.version = 0,
+	.seek = &memin_seek,
+	.close = &memin_close,
+	.peekin_start = &memin_peekin_start,
+	.peekin_end = &memin_peekin_end,
+	.getinfo = &memin_getinfo,
+	.skip = &memin_skip,
+};
+
+
+extern xzf_stream *
+xzf_memin_open(const void *buf, size_t size)
+{
+	if (buf == NULL && size > 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct memin_state *state = malloc(sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->buf = buf;
+	state->size = size;
+	state->pos = 0;
+
+	xzf_stream *strm = xzf_stream_init(NULL, &memin_backend, state,
+			XZF_READ | XZF_SEEKABLE, XZF_BUFSIZE, 0);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
+
+
+struct memout_state {
+	/// The chunks. len is the number of bytes written to the chunk.
+	xzf_iovec *chunks;
+	size_t count;
+	size_t alloc;
+
+	/// Allocated size of the last chunk. The earlier chunks
+	/// don't get more data.
+	size_t last_size;
+
+	/// Size of the next chunk unless more is needed for one peekout
+	size_t next_size;
+};
+
+
+/// The array of chunks given by xzf_getinfo() with XZF_KEY_MEMIOV
+struct memout_iov {
+	const xzf_iovec *iov;
+	size_t iovcnt;
+};
+
+
+/// Add a chunk that has room for at least min bytes.
+static int
+memout_add_chunk(struct memout_state *state, size_t min)
+{
+	if (state->count == state->alloc) {
+		const size_t alloc = state->alloc == 0 ? 16 : 2 * state->alloc;
+		xzf_iovec *chunks = realloc(state->chunks,
+				alloc * sizeof(*chunks));
+		if (chunks == NULL)
+			return ENOMEM;
+
+		state->chunks = chunks;
+		state->alloc = alloc;
+	}
+
+	const size_t size = min > state->next_size ? min : state->next_size;
+	unsigned char *buf = malloc(size);
+	if (buf == NULL)
+		return ENOMEM;
+
+	state->chunks[state->count].base = buf;
+	state->chunks[state->count].len = 0;
+	++state->count;
+	state->last_size = size;
+
+	if (state->next_size < MEMOUT_CHUNK_MAX)
+		state->next_size *= 2;
+
+	return 0;
+}
+
+
+static int
+memout_peekout_start(void *stateptr, unsigned char **buf, size_t *size)
+{
+	struct memout_state *state = stateptr;
+	const size_t min = *size;
+
+	// The rest of the last chunk is left unused if it is too small.
+	if (state->count == 0 || state->last_size
+			- state->chunks[state->count - 1].len < min) {
+		const int errnum = memout_add_chunk(state, min);
+		if (errnum != 0) {
+			*size = 0;
+			return errnum;
+		}
+	}
+
+	xzf_iovec *last = &state->chunks[state->count - 1];
+	*buf = (unsigned char *)last->base + last->len;
+	*size = state->last_size - last->len;
+	return 0;
+}
+
+
+static int
+memout_peekout_end(void *stateptr, size_t bytes_written)
+{
+	struct memout_state *state = stateptr;
+	state->chunks[state->count - 1].len += bytes_written;
+	return 0;
+}
+
+
+static void
+memout_free(struct memout_state *state)
+{
+	for (size_t i = 0; i < state->count; ++i)
+		free(state->chunks[i].base);
+
+	free(state->chunks);
+	free(state);
+}
+
+
+static int
+memout_close(void *stateptr, int cl_flags)
+{
+	(void)cl_flags;
+	memout_free(stateptr);
+	return 0;
+}
+
+
+static int
+memout_getinfo(void *stateptr, int key, void *value)
+{
+	struct memout_state *state = stateptr;
+
+	if (key == XZF_KEY_MEMIOV) {
+		// A new chunk that hasn't been written to is omitted.
+		struct memout_iov *result = value;
+		result->iov = state->chunks;
+		result->iovcnt = state->count;
+		if (result->iovcnt > 0
+				&& state->chunks[result->iovcnt - 1].len == 0)
+			--result->iovcnt;
+
+		return 0;
+	}
+
+	return mem_getinfo_common(key, value);
+}
+
+
+static const struct xzf_backend memout_backend = {
+	.version = 0,
+	.close = &memout_close,
+	.peekout_start = &memout_peekout_start,
+	.peekout_end = &memout_peekout_end,
+	.getinfo = &memout_getinfo,
+};
+
+
+extern xzf_stream *
+xzf_memout_open(size_t chunk_size)
+{
+	if (chunk_size != 0 && (chunk_size < MEMOUT_CHUNK_MIN
+			|| chunk_size > MEMOUT_CHUNK_MAX)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct memout_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->next_size = chunk_size == 0 ? MEMOUT_CHUNK_DEFAULT : chunk_size;
+
+	// The first chunk size is the biggest buffer that
+	// xzf_peekout_start() can request.
+	xzf_stream *strm = xzf_stream_init(NULL, &memout_backend, state,
+			XZF_WRITE, XZF_BUFSIZE, state->next_size);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		memout_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
+
+
+extern int
+xzf_memout_getiov(xzf_stream *stream, const xzf_iovec **iov, size_t *iovcnt)
+{
+	struct memout_iov result;
+	if (xzf_flush(stream, 0)
+			|| xzf_getinfo(stream, XZF_KEY_MEMIOV, &result))
+		return -1;
+
+	*iov = result.iov;
+	*iovcnt = result.iovcnt;
+	return 0;
+}
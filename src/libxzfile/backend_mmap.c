@@ -0,0 +1,409 @@
+/*
+ * Backend for reading regular files via a memory mapping
+ *
+ * The file is given to the frontend with peekin directly from the mapping
+ * so reading doesn't need to copy the data into an input buffer. On 64-bit
+ * systems the whole file is mapped at once. On 32-bit systems the address
+ * space is too small for big files, so a window of the file is mapped and
+ * moved forward as the file is read.
+ *
+ * If the file is truncated while it is mapped, accessing the pages past
+ * the new end of the file raises SIGBUS. Thus this backend should be used
+ * only with files that don't change while they are being read.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#ifdef HAVE_MMAP
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#ifndef O_BINARY
+#	define O_BINARY 0
+#endif
+
+#ifndef O_NOCTTY
+#	define O_NOCTTY 0
+#endif
+
+#ifndef O_CLOEXEC
+#	define O_CLOEXEC 0
+#endif
+
+/// Maximum size of the mapping. Bigger files are mapped in windows
+/// of this size.
+#ifndef MMAP_WINDOW_SIZE
+#	if SIZE_MAX > UINT32_MAX
+#		define MMAP_WINDOW_SIZE ((size_t)1 << 46)
+#	else
+#		define MMAP_WINDOW_SIZE ((size_t)64 << 20)
+#	endif
+#endif
+
+
+struct mmap_state {
+	int fd;
+
+	/// True if the mapping should be prefaulted with MAP_POPULATE
+	bool populate;
+
+	/// Page size of the system. Mappings start at multiples of this.
+	size_t page_size;
+
+	/// Size of the file. It is updated if the end of the file is
+	/// reached so that data appended to the file can be read.
+	xzf_off size;
+
+	/// Current position in the file
+	xzf_off pos;
+
+	/// The mapped part of the file or NULL if nothing is mapped
+	unsigned char *map;
+
+	/// File offset of the beginning of the mapping
+	xzf_off map_off;
+
+	/// Size of the mapping
+	size_t map_size;
+};
+
+
+static void
+mmap_unmap(struct mmap_state *state)
+{
+	if (state->map != NULL) {
+		(void)munmap(state->map, state->map_size);
+		state->map = NULL;
+		state->map_off = 0;
+		state->map_size = 0;
+	}
+}
+
+
+/// Map the part of the file that begins at state->pos and is at least
+/// min bytes. The caller has checked that the file is big enough.
+static int
+mmap_map(struct mmap_state *state, size_t min)
+{
+	mmap_unmap(state);
+
+	const xzf_off off = state->pos
+			- state->pos % (xzf_off)state->page_size;
+	const size_t misalign = (size_t)(state->pos - off);
+
+	size_t size = MMAP_WINDOW_SIZE;
+	if (size < misalign + min)
+		size = misalign + min;
+
+	if ((xzf_off)size > state->size - off)
+		size = (size_t)(state->size - off);
+
+	int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if (state->populate)
+		flags |= MAP_POPULATE;
+#endif
+
+	void *map = mmap(NULL, size, PROT_READ, flags, state->fd, (off_t)off);
+	if (map == MAP_FAILED)
+		return errno;
+
+#ifdef MADV_SEQUENTIAL
+	// This is only a hint so errors are ignored.
+	(void)madvise(map, size, MADV_SEQUENTIAL);
+#endif
+
+	state->map = map;
+	state->map_off = off;
+	state->map_size = size;
+	return 0;
+}
+
+
+/// Update the file size in case the file has grown.
+static int
+mmap_update_size(struct mmap_state *state)
+{
+	struct stat st;
+	if (fstat(state->fd, &st))
+		return errno;
+
+	state->size = (xzf_off)st.st_size;
+	return 0;
+}
+
+
+static int
+mmap_peekin_start(void *stateptr, const unsigned char **buf, size_t *size)
+{
+	struct mmap_state *state = stateptr;
+	const size_t min = *size;
+
+	// Check the file size again before reporting the end of the file.
+	if (state->size - state->pos < (xzf_off)min) {
+		const int errnum = mmap_update_size(state);
+		if (errnum != 0) {
+			*size = 0;
+			return errnum;
+		}
+	}
+
+	if (state->pos >= state->size) {
+		*size = 0;
+		return XZF_E_EOF;
+	}
+
+	const xzf_off avail = state->size - state->pos;
+	const size_t want = (xzf_off)min < avail ? min : (size_t)avail;
+
+	// Move the window if the requested part isn't mapped.
+	if (state->map == NULL || state->pos < state->map_off
+			|| state->pos + (xzf_off)want
+				> state->map_off + (xzf_off)state->map_size) {
+		const int errnum = mmap_map(state, want);
+		if (errnum != 0) {
+			*size = 0;
+			return errnum;
+		}
+	}
+
+	const size_t offset = (size_t)(state->pos - state->map_off);
+	*buf = state->map + offset;
+	*size = state->map_size - offset;
+
+	return *size < min ? XZF_E_EOF : 0;
+}
+
+
+static int
+mmap_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct mmap_state *state = stateptr;
+	state->pos += (xzf_off)bytes_used;
+	return 0;
+}
+
+
+static int
+mmap_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct mmap_state *state = stateptr;
+	xzf_off base;
+
+	switch (whence) {
+		case XZF_SEEK_SET:
+			base = 0;
+			break;
+
+		case XZF_SEEK_CUR:
+			base = state->pos;
+			break;
+
+		case XZF_SEEK_END: {
+			const int errnum = mmap_update_size(state);
+			if (errnum != 0)
+				return errnum;
+
+			base = state->size;
+			break;
+		}
+
+		default:
+			return EINVAL;
+	}
+
+	if (*offset < 0 ? base < -*offset : base > XZF_OFF_MAX - *offset)
+		return EINVAL;
+
+	state->pos = base + *offset;
+	*offset = state->pos;
+	return 0;
+}
+
+
+static int
+mmap_skip(void *stateptr, xzf_off *amount)
+{
+	struct mmap_state *state = stateptr;
+
+	// Skipping doesn't need the data so it isn't mapped.
+	if (state->size - state->pos < *amount) {
+		const int errnum = mmap_update_size(state);
+		if (errnum != 0) {
+			*amount = 0;
+			return errnum;
+		}
+	}
+
+	const xzf_off avail = state->pos < state->size
+			? state->size - state->pos : 0;
+	const bool eof = avail < *amount;
+	if (eof)
+		*amount = avail;
+
+	state->pos += *amount;
+	return eof ? XZF_E_EOF : 0;
+}
+
+
+static int
+mmap_close(void *stateptr, int cl_flags)
+{
+	struct mmap_state *state = stateptr;
+
+	mmap_unmap(state);
+
+	const int close_ret = cl_flags & XZF_CL_DETACH ? 0 : close(state->fd);
+	const int close_errnum = errno;
+
+	free(state);
+
+	return close_ret ? close_errnum : 0;
+}
+
+
+static int
+mmap_getinfo(void *stateptr, int key, void *value)
+{
+	struct mmap_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_FD: {
+			int *fd = value;
+			*fd = state->fd;
+			return 0;
+		}
+
+		case XZF_KEY_ISATTY: {
+			int *result = value;
+			*result = 0;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_NONE;
+			return 0;
+		}
+	}
+
+	return XZF_E_NOKEY;
+}
+
+
+static const struct xzf_backend mmap_backend = {
+	.version = 0,
+	.seek = &mmap_seek,
+	.close = &mmap_close,
+	.peekin_start = &mmap_peekin_start,
+	.peekin_end = &mmap_peekin_end,
+	.getinfo = &mmap_getinfo,
+	.skip = &mmap_skip,
+};
+
+
+extern xzf_stream *
+xzf_mmap_open(const char *filename, int xflags)
+{
+	static const int supported_xflags = XZF_READ | XZF_NOFOLLOW
+			| XZF_REGFILE | XZF_MMAP | XZF_POPULATE;
+
+	if ((xflags & ~supported_xflags) || !(xflags & XZF_READ)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	int oflags = O_RDONLY | O_NOCTTY | O_BINARY | O_CLOEXEC;
+
+	// TODO: Support systems that don't have O_NOFOLLOW.
+	if (xflags & XZF_NOFOLLOW)
+		oflags |= O_NOFOLLOW;
+
+	struct mmap_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	// Opening with O_NONBLOCK doesn't block on FIFOs, which cannot
+	// be mapped anyway. It doesn't affect regular files.
+	state->fd = open(filename, oflags | O_NONBLOCK);
+	if (state->fd == -1)
+		goto error;
+
+	struct stat st;
+	if (fstat(state->fd, &st))
+		goto error;
+
+	if (!S_ISREG(st.st_mode)) {
+		errno = XZF_E_NOTFILE;
+		goto error;
+	}
+
+	// The file descriptor is available via XZF_KEY_FD so don't leave
+	// it non-blocking.
+	const int fl = fcntl(state->fd, F_GETFL);
+	if (fl == -1 || fcntl(state->fd, F_SETFL, fl & ~O_NONBLOCK) == -1)
+		goto error;
+
+	const long page_size = sysconf(_SC_PAGESIZE);
+	state->page_size = page_size > 0 ? (size_t)page_size : 4096;
+	state->populate = (xflags & XZF_POPULATE) != 0;
+	state->size = (xzf_off)st.st_size;
+	state->pos = 0;
+	state->map = NULL;
+
+	// Map the beginning of the file already now so that errors
+	// are caught early. Empty files aren't mapped.
+	if (state->size > 0) {
+		const int errnum = mmap_map(state, 1);
+		if (errnum != 0) {
+			errno = errnum;
+			goto error;
+		}
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &mmap_backend, state,
+			XZF_READ | XZF_SEEKABLE, XZF_BUFSIZE, 0);
+	if (strm == NULL)
+		goto error;
+
+	return strm;
+
+error:
+	{
+		const int saved_errno = errno;
+
+		mmap_unmap(state);
+
+		if (state->fd != -1)
+			(void)close(state->fd);
+
+		free(state);
+
+		errno = saved_errno;
+		return NULL;
+	}
+}
+
+#else
+
+extern xzf_stream *
+xzf_mmap_open(const char *filename, int xflags)
+{
+	(void)filename;
+	(void)xflags;
+	errno = ENOSYS;
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,494 @@
+/*
+ * Read-ahead stage that reads the substream in a separate thread
+ *
+ * A producer thread reads the substream into a ring of buffers while the
+ * consumer uses the data from the previous buffers via peekin. When the
+ * substream is a decompressor, decompression and whatever the application
+ * does with the data run on different processor cores.
+ *
+ * The substream is used by the producer thread only while the thread is
+ * running. Operations that need the substream in the calling thread stop
+ * the thread first, so the substream doesn't need XZF_THRSAFE. After
+ * XZF_KEY_SUBSTREAM the thread stays stopped until more data is needed.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "mythread.h"
+#include "xzfile.h"
+
+
+/// Default and maximum number of buffers
+#define READAHEAD_NBUFS_DEFAULT 4
+#define READAHEAD_NBUFS_MAX 64
+
+/// Default, minimum, and maximum buffer size
+#define READAHEAD_BUFSIZE_DEFAULT (UINT32_C(256) << 10)
+#define READAHEAD_BUFSIZE_MIN XZF_BUFSIZE
+#define READAHEAD_BUFSIZE_MAX (UINT32_C(64) << 20)
+
+
+#ifdef MYTHREAD_ENABLED
+struct readahead_buf {
+	unsigned char *data;
+
+	/// Number of bytes read into the buffer
+	size_t size;
+
+	/// Number of bytes used by the consumer
+	size_t used;
+
+	/// XZF_E_EOF or an error code if reading stopped after
+	/// this buffer, otherwise zero
+	int errnum;
+};
+
+
+struct readahead_state {
+	xzf_stream *in;
+
+	struct readahead_buf *bufs;
+	unsigned int nbufs;
+	size_t bufsize;
+
+	/// Index of the buffer that the consumer is using
+	unsigned int head;
+
+	/// Number of filled buffers. The producer fills the buffer at
+	/// (head + count) % nbufs next.
+	unsigned int count;
+
+	/// Data that spans buffers is copied here so that peekin can
+	/// return it in one piece. The data at [joint_pos, joint_size)
+	/// comes before the data in the buffers.
+	unsigned char *joint;
+	size_t joint_pos;
+	size_t joint_size;
+
+	/// True once the producer has stored a buffer with errnum set
+	bool finished;
+
+	/// Tells the producer thread to exit
+	bool stop;
+
+	mythread thread;
+	bool thread_running;
+
+	mythread_mutex mutex;
+	bool mutex_init;
+
+	/// Signaled when a buffer has been filled
+	mythread_cond filled_cond;
+
+	/// Signaled when a buffer has been freed or stop is set
+	mythread_cond free_cond;
+};
+
+
+static void *
+producer_main(void *stateptr)
+{
+	struct readahead_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (!state->stop && !state->finished) {
+		if (state->count == state->nbufs) {
+			mythread_cond_wait(&state->free_cond, &state->mutex);
+			continue;
+		}
+
+		struct readahead_buf *buf = &state->bufs[
+				(state->head + state->count) % state->nbufs];
+		mythread_mutex_unlock(&state->mutex);
+
+		// xzf_read() reads large amounts directly from the backend
+		// so there is no extra copying in the substream.
+		const size_t size = xzf_read(state->in, buf->data,
+				state->bufsize);
+		int errnum = 0;
+		if (size < state->bufsize)
+			errnum = errno != 0 ? errno : XZF_E_EOF;
+
+		mythread_mutex_lock(&state->mutex);
+		buf->size = size;
+		buf->used = 0;
+		buf->errnum = errnum;
+		++state->count;
+		state->finished = errnum != 0;
+		mythread_cond_signal(&state->filled_cond);
+	}
+
+	mythread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+
+
+static int
+producer_start(struct readahead_state *state)
+{
+	if (state->thread_running || state->finished)
+		return 0;
+
+	state->stop = false;
+	const int ret = mythread_create(&state->thread, &producer_main, state);
+	if (ret != 0)
+		return ret;
+
+	state->thread_running = true;
+	return 0;
+}
+
+
+/// Stop the producer thread. The buffers that have been filled are kept.
+static void
+producer_stop(struct readahead_state *state)
+{
+	if (!state->thread_running)
+		return;
+
+	mythread_mutex_lock(&state->mutex);
+	state->stop = true;
+	mythread_cond_signal(&state->free_cond);
+	mythread_mutex_unlock(&state->mutex);
+
+	(void)mythread_join(state->thread);
+	state->thread_running = false;
+}
+
+
+/// Wait until the head buffer has been filled.
+static struct readahead_buf *
+wait_head(struct readahead_state *state)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	while (state->count == 0)
+		mythread_cond_wait(&state->filled_cond, &state->mutex);
+
+	mythread_mutex_unlock(&state->mutex);
+	return &state->bufs[state->head];
+}
+
+
+/// Give the head buffer back to the producer.
+static void
+release_head(struct readahead_state *state)
+{
+	mythread_mutex_lock(&state->mutex);
+	state->head = (state->head + 1) % state->nbufs;
+	--state->count;
+	mythread_cond_signal(&state->free_cond);
+	mythread_mutex_unlock(&state->mutex);
+}
+
+
+/// Copy data from the buffers to the joint buffer until it has
+/// at least min bytes or the data ends.
+static int
+fill_joint(struct readahead_state *state, size_t min)
+{
+	const size_t remaining = state->joint_size - state->joint_pos;
+	memmove(state->joint, state->joint + state->joint_pos, remaining);
+	state->joint_pos = 0;
+	state->joint_size = remaining;
+
+	while (state->joint_size < min) {
+		struct readahead_buf *buf = wait_head(state);
+
+		size_t n = buf->size - buf->used;
+		if (n > state->bufsize - state->joint_size)
+			n = state->bufsize - state->joint_size;
+
+		memcpy(state->joint + state->joint_size,
+				buf->data + buf->used, n);
+		state->joint_size += n;
+		buf->used += n;
+
+		if (buf->used == buf->size) {
+			if (buf->errnum != 0)
+				return buf->errnum;
+
+			release_head(state);
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+readahead_peekin_start(void *stateptr, const unsigned char **buf,
+		size_t *size)
+{
+	struct readahead_state *state = stateptr;
+	const size_t min = *size;
+	assert(min <= state->bufsize);
+
+	// The thread was stopped by XZF_KEY_SUBSTREAM or its restart
+	// failed after seeking or xzf_getinfo().
+	int errnum = producer_start(state);
+	if (errnum != 0) {
+		*size = 0;
+		return errnum;
+	}
+
+	if (state->joint_size == 0) {
+		struct readahead_buf *b = wait_head(state);
+
+		if (b->size - b->used >= min) {
+			*buf = b->data + b->used;
+			*size = b->size - b->used;
+			return 0;
+		}
+
+		// The last buffer has less than requested left.
+		if (b->errnum != 0) {
+			*buf = b->data + b->used;
+			*size = b->size - b->used;
+			return b->errnum;
+		}
+	}
+
+	if (state->joint_size - state->joint_pos < min)
+		errnum = fill_joint(state, min);
+
+	*buf = state->joint + state->joint_pos;
+	*size = state->joint_size - state->joint_pos;
+	return errnum;
+}
+
+
+static int
+readahead_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct readahead_state *state = stateptr;
+
+	if (state->joint_size > 0) {
+		state->joint_pos += bytes_used;
+		if (state->joint_pos == state->joint_size) {
+			state->joint_pos = 0;
+			state->joint_size = 0;
+		}
+
+		return 0;
+	}
+
+	struct readahead_buf *buf = &state->bufs[state->head];
+	buf->used += bytes_used;
+
+	// The last buffer is kept so that its error is returned again.
+	if (buf->used == buf->size && buf->errnum == 0)
+		release_head(state);
+
+	return 0;
+}
+
+
+/// Number of bytes that have been read from the substream but not used
+static xzf_off
+buffered(const struct readahead_state *state)
+{
+	xzf_off total = (xzf_off)(state->joint_size - state->joint_pos);
+
+	for (unsigned int i = 0; i < state->count; ++i) {
+		const struct readahead_buf *buf = &state->bufs[
+				(state->head + i) % state->nbufs];
+		total += (xzf_off)(buf->size - buf->used);
+	}
+
+	return total;
+}
+
+
+static int
+readahead_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct readahead_state *state = stateptr;
+
+	producer_stop(state);
+
+	// The substream is ahead of the consumer by the buffered amount.
+	if (whence == XZF_SEEK_CUR)
+		*offset -= buffered(state);
+
+	*offset = xzf_seek(state->in, *offset, whence);
+	const int errnum = *offset == -1 ? errno : 0;
+
+	// Whether the seek succeeded or not, the read-ahead continues
+	// from the current position of the substream.
+	state->head = 0;
+	state->count = 0;
+	state->joint_pos = 0;
+	state->joint_size = 0;
+	state->finished = false;
+
+	const int ret = producer_start(state);
+	return errnum != 0 ? errnum : ret;
+}
+
+
+/// Stop the thread and free the memory. This works also
+/// on a partially initialized state.
+static void
+readahead_free(struct readahead_state *state)
+{
+	producer_stop(state);
+
+	if (state->mutex_init) {
+		mythread_cond_destroy(&state->free_cond);
+		mythread_cond_destroy(&state->filled_cond);
+		mythread_mutex_destroy(&state->mutex);
+	}
+
+	if (state->bufs != NULL) {
+		for (unsigned int i = 0; i < state->nbufs; ++i)
+			free(state->bufs[i].data);
+
+		free(state->bufs);
+	}
+
+	free(state->joint);
+	free(state);
+}
+
+
+static int
+readahead_close(void *stateptr, int cl_flags)
+{
+	struct readahead_state *state = stateptr;
+	xzf_stream *in = state->in;
+
+	readahead_free(state);
+
+	return cl_flags & XZF_CL_DETACH ? 0 : xzf_close(in, cl_flags);
+}
+
+
+static int
+readahead_getinfo(void *stateptr, int key, void *value)
+{
+	struct readahead_state *state = stateptr;
+
+	// The substream cannot be used while the producer is reading it.
+	producer_stop(state);
+
+	// The caller may use the substream until this stream is read
+	// again, so the thread is restarted only when data is needed.
+	if (key == XZF_KEY_SUBSTREAM) {
+		xzf_stream **strm = value;
+		*strm = state->in;
+		return 0;
+	}
+
+	const int errnum = xzf_getinfo(state->in, key, value) ? errno : 0;
+	const int ret = producer_start(state);
+	return errnum != 0 ? errnum : ret;
+}
+
+
+static const struct xzf_backend readahead_backend = {
+	.version = 0,
+	.seek = &readahead_seek,
+	.close = &readahead_close,
+	.peekin_start = &readahead_peekin_start,
+	.peekin_end = &readahead_peekin_end,
+	.getinfo = &readahead_getinfo,
+};
+
+
+static int
+readahead_init(struct readahead_state *state)
+{
+	state->bufs = calloc(state->nbufs, sizeof(*state->bufs));
+	state->joint = malloc(state->bufsize);
+	if (state->bufs == NULL || state->joint == NULL)
+		return ENOMEM;
+
+	for (unsigned int i = 0; i < state->nbufs; ++i) {
+		state->bufs[i].data = malloc(state->bufsize);
+		if (state->bufs[i].data == NULL)
+			return ENOMEM;
+	}
+
+	int ret = mythread_mutex_init(&state->mutex);
+	if (ret != 0)
+		return ret;
+
+	ret = mythread_cond_init(&state->filled_cond);
+	if (ret != 0) {
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	ret = mythread_cond_init(&state->free_cond);
+	if (ret != 0) {
+		mythread_cond_destroy(&state->filled_cond);
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	state->mutex_init = true;
+
+	return producer_start(state);
+}
+#endif
+
+
+extern xzf_stream *
+xzf_readahead_open(xzf_stream *in, unsigned int nbufs, size_t bufsize)
+{
+	if (nbufs == 1 || nbufs > READAHEAD_NBUFS_MAX
+			|| (bufsize != 0 && (bufsize < READAHEAD_BUFSIZE_MIN
+				|| bufsize > READAHEAD_BUFSIZE_MAX))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+#ifdef MYTHREAD_ENABLED
+	if (in == NULL)
+		return NULL;
+
+	if (!(xzf_getflags(in) & XZF_READ)) {
+		errno = XZF_E_NOTREADABLE;
+		return NULL;
+	}
+
+	struct readahead_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->in = in;
+	state->nbufs = nbufs == 0 ? READAHEAD_NBUFS_DEFAULT : nbufs;
+	state->bufsize = bufsize == 0 ? READAHEAD_BUFSIZE_DEFAULT : bufsize;
+
+	int flags = XZF_READ;
+	if (xzf_getflags(in) & XZF_SEEKABLE)
+		flags |= XZF_SEEKABLE;
+
+	const int ret = readahead_init(state);
+	if (ret != 0) {
+		readahead_free(state);
+		errno = ret;
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &readahead_backend, state,
+			flags, state->bufsize, XZF_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		readahead_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+#else
+	// Without threads the substream is returned as is.
+	return in;
+#endif
+}
@@ -0,0 +1,469 @@
+/*
+ * Tee stage that writes the same data to several substreams in parallel
+ *
+ * The application fills a ring of buffers via peekout. Each substream
+ * (sink) has a worker thread that writes the queued buffers to the sink
+ * in order. A buffer has a reference count of the sinks that haven't
+ * written it yet and it is reused once every sink has written it, so
+ * the data isn't copied per sink. The application waits only when all
+ * the buffers are still needed by the slowest sink.
+ *
+ * The sinks are used by the calling thread only when the workers have
+ * no buffers to write, so the sinks don't need XZF_THRSAFE.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "mythread.h"
+#include "xzfile.h"
+
+
+/// Maximum number of sinks
+#define TEE_SINKS_MAX 64
+
+/// Number and size of the buffers
+#define TEE_NBUFS 4
+#define TEE_BUFSIZE (UINT32_C(256) << 10)
+
+
+#ifdef MYTHREAD_ENABLED
+struct tee_state;
+
+struct tee_sink {
+	xzf_stream *out;
+	struct tee_state *tee;
+
+	/// Sequence number of the buffer that this sink writes next
+	uint64_t next;
+
+	/// The first error from writing to this sink. The later buffers
+	/// are skipped by this sink but still released.
+	int errnum;
+
+	mythread thread;
+	bool thread_running;
+};
+
+
+struct tee_state {
+	struct tee_sink *sinks;
+	size_t nsinks;
+
+	unsigned char *bufs[TEE_NBUFS];
+
+	/// Number of bytes in each buffer
+	size_t sizes[TEE_NBUFS];
+
+	/// Number of sinks that haven't written each buffer yet
+	size_t refs[TEE_NBUFS];
+
+	/// Sequence number of the oldest buffer that some sink still
+	/// needs. The buffer of the sequence number n is bufs[n % TEE_NBUFS].
+	uint64_t head;
+
+	/// Sequence number of the buffer that is given out with peekout
+	uint64_t tail;
+
+	/// The queued buffers are skipped because of XZF_CL_FORGET.
+	bool discard;
+
+	/// Tells the worker threads to exit once they have nothing to write
+	bool stop;
+
+	mythread_mutex mutex;
+	bool mutex_init;
+
+	/// Broadcast when a buffer has been queued or stop is set
+	mythread_cond queued_cond;
+
+	/// Signaled when a buffer has been released by all the sinks
+	mythread_cond done_cond;
+};
+
+
+static void *
+worker_main(void *sinkptr)
+{
+	struct tee_sink *sink = sinkptr;
+	struct tee_state *state = sink->tee;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (true) {
+		if (sink->next == state->tail) {
+			if (state->stop)
+				break;
+
+			mythread_cond_wait(&state->queued_cond,
+					&state->mutex);
+			continue;
+		}
+
+		const size_t i = (size_t)(sink->next % TEE_NBUFS);
+		const bool skip = sink->errnum != 0 || state->discard;
+		mythread_mutex_unlock(&state->mutex);
+
+		int errnum = 0;
+		if (!skip && xzf_write(sink->out, state->bufs[i],
+				state->sizes[i]))
+			errnum = errno;
+
+		mythread_mutex_lock(&state->mutex);
+		if (sink->errnum == 0)
+			sink->errnum = errnum;
+
+		++sink->next;
+
+		// The sinks write the buffers in order, so the buffers are
+		// released in order too.
+		if (--state->refs[i] == 0) {
+			++state->head;
+			mythread_cond_signal(&state->done_cond);
+		}
+	}
+
+	mythread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+
+
+/// Get the first error of the sinks. The mutex must be locked.
+static int
+first_errnum(const struct tee_state *state)
+{
+	for (size_t i = 0; i < state->nsinks; ++i)
+		if (state->sinks[i].errnum != 0)
+			return state->sinks[i].errnum;
+
+	return 0;
+}
+
+
+/// Wait until every sink has written all the queued buffers.
+/// The sinks may be used by the calling thread after this.
+static int
+drain(struct tee_state *state)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	while (state->head != state->tail)
+		mythread_cond_wait(&state->done_cond, &state->mutex);
+
+	const int errnum = first_errnum(state);
+	mythread_mutex_unlock(&state->mutex);
+	return errnum;
+}
+
+
+static int
+tee_peekout_start(void *stateptr, unsigned char **buf, size_t *size)
+{
+	struct tee_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (state->tail - state->head == TEE_NBUFS)
+		mythread_cond_wait(&state->done_cond, &state->mutex);
+
+	const int errnum = first_errnum(state);
+	const size_t i = (size_t)(state->tail % TEE_NBUFS);
+	mythread_mutex_unlock(&state->mutex);
+
+	if (errnum != 0) {
+		*size = 0;
+		return errnum;
+	}
+
+	*buf = state->bufs[i];
+	*size = TEE_BUFSIZE;
+	return 0;
+}
+
+
+static int
+tee_peekout_end(void *stateptr, size_t bytes_written)
+{
+	struct tee_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	if (bytes_written > 0) {
+		const size_t i = (size_t)(state->tail % TEE_NBUFS);
+		state->sizes[i] = bytes_written;
+		state->refs[i] = state->nsinks;
+		++state->tail;
+		mythread_cond_broadcast(&state->queued_cond);
+	}
+
+	const int errnum = first_errnum(state);
+	mythread_mutex_unlock(&state->mutex);
+	return errnum;
+}
+
+
+static int
+tee_flush(void *stateptr, int fl_flags)
+{
+	struct tee_state *state = stateptr;
+
+	const int errnum = drain(state);
+	if (errnum != 0)
+		return errnum;
+
+	for (size_t i = 0; i < state->nsinks; ++i)
+		if (xzf_flush(state->sinks[i].out, fl_flags))
+			return errno;
+
+	return 0;
+}
+
+
+/// Stop the threads and free the memory. This works also
+/// on a partially initialized state.
+static void
+tee_free(struct tee_state *state)
+{
+	if (state->mutex_init) {
+		mythread_mutex_lock(&state->mutex);
+		state->stop = true;
+		mythread_cond_broadcast(&state->queued_cond);
+		mythread_mutex_unlock(&state->mutex);
+	}
+
+	for (size_t i = 0; i < state->nsinks; ++i)
+		if (state->sinks[i].thread_running)
+			(void)mythread_join(state->sinks[i].thread);
+
+	if (state->mutex_init) {
+		mythread_cond_destroy(&state->done_cond);
+		mythread_cond_destroy(&state->queued_cond);
+		mythread_mutex_destroy(&state->mutex);
+	}
+
+	for (size_t i = 0; i < TEE_NBUFS; ++i)
+		free(state->bufs[i]);
+
+	free(state->sinks);
+	free(state);
+}
+
+
+static int
+tee_close(void *stateptr, int cl_flags)
+{
+	struct tee_state *state = stateptr;
+
+	if (cl_flags & XZF_CL_FORGET) {
+		mythread_mutex_lock(&state->mutex);
+		state->discard = true;
+		mythread_mutex_unlock(&state->mutex);
+	}
+
+	int ret = drain(state);
+
+	// Every sink is closed even if some of them fail.
+	if (!(cl_flags & XZF_CL_DETACH)) {
+		for (size_t i = 0; i < state->nsinks; ++i) {
+			const int close_ret = xzf_close(
+					state->sinks[i].out, cl_flags);
+			if (ret == 0)
+				ret = close_ret;
+		}
+	}
+
+	tee_free(state);
+	return ret;
+}
+
+
+static const struct xzf_backend tee_backend = {
+	.version = 0,
+	.flush = &tee_flush,
+	.close = &tee_close,
+	.peekout_start = &tee_peekout_start,
+	.peekout_end = &tee_peekout_end,
+};
+
+
+static int
+tee_init(struct tee_state *state, xzf_stream **sinks)
+{
+	state->sinks = calloc(state->nsinks, sizeof(*state->sinks));
+	if (state->sinks == NULL)
+		return ENOMEM;
+
+	for (size_t i = 0; i < TEE_NBUFS; ++i) {
+		state->bufs[i] = malloc(TEE_BUFSIZE);
+		if (state->bufs[i] == NULL)
+			return ENOMEM;
+	}
+
+	int ret = mythread_mutex_init(&state->mutex);
+	if (ret != 0)
+		return ret;
+
+	ret = mythread_cond_init(&state->queued_cond);
+	if (ret != 0) {
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	ret = mythread_cond_init(&state->done_cond);
+	if (ret != 0) {
+		mythread_cond_destroy(&state->queued_cond);
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	state->mutex_init = true;
+
+	for (size_t i = 0; i < state->nsinks; ++i) {
+		struct tee_sink *sink = &state->sinks[i];
+		sink->out = sinks[i];
+		sink->tee = state;
+
+		ret = mythread_create(&sink->thread, &worker_main, sink);
+		if (ret != 0)
+			return ret;
+
+		sink->thread_running = true;
+	}
+
+	return 0;
+}
+
+#else
+
+struct tee_state {
+	xzf_stream **sinks;
+	size_t nsinks;
+};
+
+
+static int
+tee_write(void *stateptr, const unsigned char *buf, size_t size)
+{
+	struct tee_state *state = stateptr;
+
+	for (size_t i = 0; i < state->nsinks; ++i)
+		if (xzf_write(state->sinks[i], buf, size))
+			return errno;
+
+	return 0;
+}
+
+
+static int
+tee_flush(void *stateptr, int fl_flags)
+{
+	struct tee_state *state = stateptr;
+
+	for (size_t i = 0; i < state->nsinks; ++i)
+		if (xzf_flush(state->sinks[i], fl_flags))
+			return errno;
+
+	return 0;
+}
+
+
+static void
+tee_free(struct tee_state *state)
+{
+	free(state->sinks);
+	free(state);
+}
+
+
+static int
+tee_close(void *stateptr, int cl_flags)
+{
+	struct tee_state *state = stateptr;
+	int ret = 0;
+
+	if (!(cl_flags & XZF_CL_DETACH)) {
+		for (size_t i = 0; i < state->nsinks; ++i) {
+			const int close_ret = xzf_close(
+					state->sinks[i], cl_flags);
+			if (ret == 0)
+				ret = close_ret;
+		}
+	}
+
+	tee_free(state);
+	return ret;
+}
+
+
+static const struct xzf_backend tee_backend = {
+	.version = 0,
+	.write = &tee_write,
+	.flush = &tee_flush,
+	.close = &tee_close,
+};
+
+
+static int
+tee_init(struct tee_state *state, xzf_stream **sinks)
+{
+	state->sinks = malloc(state->nsinks * sizeof(*state->sinks));
+	if (state->sinks == NULL)
+		return ENOMEM;
+
+	memcpy(state->sinks, sinks, state->nsinks * sizeof(*state->sinks));
+	return 0;
+}
+#endif
+
+
+extern xzf_stream *
+xzf_tee_open(xzf_stream **sinks, size_t nsinks)
+{
+	if (sinks == NULL || nsinks == 0 || nsinks > TEE_SINKS_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (size_t i = 0; i < nsinks; ++i) {
+		if (sinks[i] == NULL)
+			return NULL;
+
+		if (!(xzf_getflags(sinks[i]) & XZF_WRITE)) {
+			errno = XZF_E_NOTWRITABLE;
+			return NULL;
+		}
+	}
+
+	struct tee_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->nsinks = nsinks;
+
+	const int ret = tee_init(state, sinks);
+	if (ret != 0) {
+		tee_free(state);
+		errno = ret;
+		return NULL;
+	}
+
+#ifdef MYTHREAD_ENABLED
+	const size_t out_buf_size = TEE_BUFSIZE;
+#else
+	const size_t out_buf_size = XZF_BUFSIZE;
+#endif
+
+	xzf_stream *strm = xzf_stream_init(NULL, &tee_backend, state,
+			XZF_WRITE, 0, out_buf_size);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		tee_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
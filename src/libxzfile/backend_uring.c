@@ -0,0 +1,873 @@
+/*
+ * Backend for files using asynchronous I/O with Linux io_uring
+ *
+ * When reading, a number of buffers is kept queued so that the kernel
+ * reads ahead while the previous buffers are being used. The buffers are
+ * given to the frontend with peekin. When writing, the frontend fills the
+ * buffers via peekout and each full buffer is queued for writing while
+ * the next one is being filled.
+ *
+ * Reads and writes use explicit file offsets so that several of them can
+ * be in flight at the same time. Thus only regular files and block
+ * devices are supported. The buffers are registered with the kernel as
+ * fixed buffers if possible.
+ *
+ * liblzma and zlib don't need liburing so the system calls are used
+ * directly here too.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+
+#ifndef O_CLOEXEC
+#	define O_CLOEXEC 0
+#endif
+
+/// Size of each buffer
+#define URING_BUF_SIZE (128 << 10)
+
+/// Default and maximum number of buffers
+#define URING_DEPTH_DEFAULT 8
+#define URING_DEPTH_MAX 256
+
+
+struct uring_buf {
+	unsigned char *data;
+
+	/// File offset of the first byte in the buffer
+	xzf_off offset;
+
+	/// Number of bytes requested to be read or written
+	size_t size;
+
+	/// Number of bytes read or written so far
+	size_t done;
+
+	/// Error from the read or zero
+	int errnum;
+
+	/// True while the kernel owns the buffer
+	bool pending;
+};
+
+
+struct uring_state {
+	int fd;
+	bool writing;
+
+	/// io_uring file descriptor
+	int ring_fd;
+
+	/// True if the buffers were registered as fixed buffers
+	bool fixed;
+
+	/// Mapped submission and completion rings
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/// Number of queued entries that haven't been submitted yet
+	unsigned int to_submit;
+
+	/// Number of requests that haven't completed
+	unsigned int inflight;
+
+	/// Memory of all buffers in one allocation
+	unsigned char *mem;
+
+	struct uring_buf *bufs;
+	unsigned int depth;
+
+	/// Current position in the file
+	xzf_off pos;
+
+	/// Reading: Index of the oldest buffer in the read-ahead sequence
+	unsigned int head;
+
+	/// Reading: Number of buffers in the read-ahead sequence
+	unsigned int count;
+
+	/// Reading: File offset of the next read to queue
+	xzf_off next_off;
+
+	/// Writing: Buffer given out with peekout or -1
+	int cur;
+
+	/// Writing: The first error from a completed write. It is
+	/// returned from the next call that can report errors.
+	int write_errnum;
+};
+
+
+static int
+uring_enter(struct uring_state *state, unsigned int min_complete)
+{
+	while (true) {
+		const long ret = syscall(__NR_io_uring_enter, state->ring_fd,
+				state->to_submit, min_complete,
+				min_complete > 0 ? IORING_ENTER_GETEVENTS : 0,
+				NULL, 0);
+		if (ret >= 0) {
+			state->to_submit -= (unsigned int)ret;
+			return 0;
+		}
+
+		if (errno != EINTR)
+			return errno;
+	}
+}
+
+
+/// Queue a read or write of buf starting from buf->done.
+static void
+uring_queue(struct uring_state *state, unsigned int index)
+{
+	struct uring_buf *buf = &state->bufs[index];
+
+	const unsigned int tail = *state->sq_tail;
+	const unsigned int i = tail & *state->sq_mask;
+	struct io_uring_sqe *sqe = &state->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+
+	if (state->fixed) {
+		sqe->opcode = state->writing
+				? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->buf_index = (uint16_t)index;
+	} else {
+		sqe->opcode = state->writing
+				? IORING_OP_WRITE : IORING_OP_READ;
+	}
+
+	sqe->fd = state->fd;
+	sqe->off = (uint64_t)(buf->offset + (xzf_off)buf->done);
+	sqe->addr = (uint64_t)(uintptr_t)(buf->data + buf->done);
+	sqe->len = (uint32_t)(buf->size - buf->done);
+	sqe->user_data = index;
+
+	state->sq_array[i] = i;
+	__atomic_store_n(state->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	buf->pending = true;
+	++state->to_submit;
+	++state->inflight;
+}
+
+
+/// Handle the completed requests.
+static void
+uring_reap(struct uring_state *state)
+{
+	unsigned int head = *state->cq_head;
+	const unsigned int tail = __atomic_load_n(
+			state->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		const struct io_uring_cqe *cqe
+				= &state->cqes[head & *state->cq_mask];
+		struct uring_buf *buf = &state->bufs[cqe->user_data];
+		const int res = cqe->res;
+		++head;
+
+		buf->pending = false;
+		--state->inflight;
+
+		if (!state->writing) {
+			buf->errnum = res < 0 ? -res : 0;
+			buf->done = res < 0 ? 0 : (size_t)res;
+			continue;
+		}
+
+		if (res <= 0) {
+			if (state->write_errnum == 0)
+				state->write_errnum = res < 0 ? -res : EIO;
+
+			continue;
+		}
+
+		// Queue the rest of a short write again.
+		buf->done += (size_t)res;
+		if (buf->done < buf->size)
+			uring_queue(state, (unsigned int)(buf - state->bufs));
+	}
+
+	__atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/// Submit the queued requests and wait until at least one completes.
+static int
+uring_wait(struct uring_state *state)
+{
+	const int errnum = uring_enter(state, 1);
+	if (errnum != 0)
+		return errnum;
+
+	uring_reap(state);
+	return 0;
+}
+
+
+/// Wait until all requests have completed.
+static int
+uring_drain(struct uring_state *state)
+{
+	while (state->inflight > 0) {
+		const int errnum = uring_wait(state);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	return 0;
+}
+
+
+/// Queue a read into the buffer at the end of the read-ahead sequence.
+static void
+read_queue(struct uring_state *state)
+{
+	const unsigned int index = (state->head + state->count) % state->depth;
+	struct uring_buf *buf = &state->bufs[index];
+
+	buf->offset = state->next_off;
+	buf->size = URING_BUF_SIZE;
+	buf->done = 0;
+	buf->errnum = 0;
+	uring_queue(state, index);
+
+	state->next_off += URING_BUF_SIZE;
+	++state->count;
+}
+
+
+/// Throw away the read-ahead and start reading again from state->pos.
+static int
+read_restart(struct uring_state *state)
+{
+	const int errnum = uring_drain(state);
+	if (errnum != 0)
+		return errnum;
+
+	state->head = 0;
+	state->count = 0;
+	state->next_off = state->pos;
+
+	while (state->count < state->depth)
+		read_queue(state);
+
+	return 0;
+}
+
+
+static int
+uring_peekin_start(void *stateptr, const unsigned char **buf, size_t *size)
+{
+	struct uring_state *state = stateptr;
+	const size_t min = *size;
+	assert(min <= URING_BUF_SIZE);
+
+	// True right after restarting so that a short buffer cannot
+	// cause another restart
+	bool restarted = false;
+
+	while (true) {
+		int errnum = 0;
+
+		if (state->count == 0
+				|| state->pos < state->bufs[state->head].offset
+				|| state->pos >= state->next_off) {
+			errnum = read_restart(state);
+			restarted = true;
+		}
+
+		struct uring_buf *b = &state->bufs[state->head];
+		while (errnum == 0 && b->pending)
+			errnum = uring_wait(state);
+
+		if (errnum == 0)
+			errnum = b->errnum;
+
+		if (errnum != 0) {
+			// Start again on the next call.
+			(void)uring_drain(state);
+			state->count = 0;
+			*size = 0;
+			return errnum;
+		}
+
+		const xzf_off end = b->offset + (xzf_off)b->done;
+
+		if (state->pos >= end) {
+			if (b->done < b->size) {
+				// A short read means usually the end of
+				// the file. The file may grow so the reads
+				// are queued again on the next call.
+				if (restarted) {
+					(void)uring_drain(state);
+					state->count = 0;
+					*size = 0;
+					return XZF_E_EOF;
+				}
+
+				state->count = 0;
+				continue;
+			}
+
+			// The buffer has been used. Reuse it at the end
+			// of the sequence.
+			state->head = (state->head + 1) % state->depth;
+			--state->count;
+			read_queue(state);
+			continue;
+		}
+
+		const size_t avail = (size_t)(end - state->pos);
+
+		if (avail < min) {
+			if (!restarted && (b->done == b->size
+					|| b->offset < state->pos)) {
+				// The requested amount continues in
+				// the next buffer. Read it again so that it
+				// is in one buffer.
+				state->count = 0;
+				continue;
+			}
+
+			*buf = b->data + (state->pos - b->offset);
+			*size = avail;
+			return XZF_E_EOF;
+		}
+
+		// Submit the reads queued above without waiting.
+		if (state->to_submit > 0) {
+			errnum = uring_enter(state, 0);
+			if (errnum != 0) {
+				*size = 0;
+				return errnum;
+			}
+		}
+
+		*buf = b->data + (state->pos - b->offset);
+		*size = avail;
+		return 0;
+	}
+}
+
+
+static int
+uring_peekin_end(void *stateptr, size_t bytes_used)
+{
+	struct uring_state *state = stateptr;
+	state->pos += (xzf_off)bytes_used;
+	return 0;
+}
+
+
+static int
+uring_peekout_start(void *stateptr, unsigned char **buf, size_t *size)
+{
+	struct uring_state *state = stateptr;
+	assert(state->cur == -1);
+
+	while (true) {
+		if (state->write_errnum != 0) {
+			*size = 0;
+			return state->write_errnum;
+		}
+
+		for (unsigned int i = 0; i < state->depth; ++i) {
+			if (!state->bufs[i].pending) {
+				state->cur = (int)i;
+				*buf = state->bufs[i].data;
+				*size = URING_BUF_SIZE;
+				return 0;
+			}
+		}
+
+		// All buffers are being written.
+		const int errnum = uring_wait(state);
+		if (errnum != 0) {
+			*size = 0;
+			return errnum;
+		}
+	}
+}
+
+
+static int
+uring_peekout_end(void *stateptr, size_t bytes_written)
+{
+	struct uring_state *state = stateptr;
+	assert(state->cur != -1);
+
+	const unsigned int index = (unsigned int)state->cur;
+	state->cur = -1;
+
+	if (bytes_written == 0)
+		return state->write_errnum;
+
+	struct uring_buf *buf = &state->bufs[index];
+	buf->offset = state->pos;
+	buf->size = bytes_written;
+	buf->done = 0;
+	uring_queue(state, index);
+	state->pos += (xzf_off)bytes_written;
+
+	const int errnum = uring_enter(state, 0);
+	return errnum != 0 ? errnum : state->write_errnum;
+}
+
+
+static int
+uring_flush(void *stateptr, int fl_flags)
+{
+	struct uring_state *state = stateptr;
+
+	if (!state->writing)
+		return 0;
+
+	int errnum = uring_drain(state);
+	if (errnum == 0)
+		errnum = state->write_errnum;
+
+	if (errnum != 0)
+		return errnum;
+
+	// Keep the file offset in sync for those who use the file
+	// descriptor directly.
+	if (lseek(state->fd, (off_t)state->pos, SEEK_SET) == -1)
+		return errno;
+
+	if (fl_flags & XZF_FL_SYNC)
+		while (fsync(state->fd) && errno != EINVAL)
+			if (errno != EINTR)
+				return errno;
+
+	return 0;
+}
+
+
+/// Get the size of the file without changing the file offset
+/// unless it is a block device.
+static int
+uring_file_size(struct uring_state *state, xzf_off *size)
+{
+	struct stat st;
+	if (fstat(state->fd, &st))
+		return errno;
+
+	if (S_ISREG(st.st_mode)) {
+		*size = (xzf_off)st.st_size;
+		return 0;
+	}
+
+	const off_t end = lseek(state->fd, 0, SEEK_END);
+	if (end == -1)
+		return errno;
+
+	*size = (xzf_off)end;
+	return 0;
+}
+
+
+static int
+uring_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct uring_state *state = stateptr;
+
+	if (state->writing) {
+		const int errnum = uring_flush(state, 0);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	xzf_off base;
+
+	switch (whence) {
+	case XZF_SEEK_SET:
+		base = 0;
+		break;
+
+	case XZF_SEEK_CUR:
+		base = state->pos;
+		break;
+
+	case XZF_SEEK_END: {
+		const int errnum = uring_file_size(state, &base);
+		if (errnum != 0)
+			return errnum;
+
+		break;
+	}
+
+	default:
+		return EINVAL;
+	}
+
+	if (*offset < 0 ? base < -*offset : base > XZF_OFF_MAX - *offset)
+		return EINVAL;
+
+	// The read-ahead is restarted on the next read if the new
+	// position isn't in it.
+	state->pos = base + *offset;
+	*offset = state->pos;
+	return 0;
+}
+
+
+static int
+uring_skip(void *stateptr, xzf_off *amount)
+{
+	struct uring_state *state = stateptr;
+
+	xzf_off size;
+	const int errnum = uring_file_size(state, &size);
+	if (errnum != 0) {
+		*amount = 0;
+		return errnum;
+	}
+
+	const xzf_off avail = state->pos < size ? size - state->pos : 0;
+	const bool eof = avail < *amount;
+	if (eof)
+		*amount = avail;
+
+	state->pos += *amount;
+	return eof ? XZF_E_EOF : 0;
+}
+
+
+/// Free everything except the file descriptor
+static void
+uring_free(struct uring_state *state)
+{
+	// The kernel may still write to the buffers until the requests
+	// have completed. Closing the ring doesn't wait for them.
+	if (state->cqes != NULL)
+		(void)uring_drain(state);
+
+	if (state->sqes != NULL)
+		(void)munmap(state->sqes, state->sqes_size);
+
+	if (state->cq_ring != NULL && state->cq_ring != state->sq_ring)
+		(void)munmap(state->cq_ring, state->cq_ring_size);
+
+	if (state->sq_ring != NULL)
+		(void)munmap(state->sq_ring, state->sq_ring_size);
+
+	if (state->ring_fd != -1)
+		(void)close(state->ring_fd);
+
+	free(state->bufs);
+	free(state->mem);
+	free(state);
+}
+
+
+static int
+uring_close(void *stateptr, int cl_flags)
+{
+	struct uring_state *state = stateptr;
+
+	// XZF_CL_SYNC == XZF_FL_SYNC so we can just call uring_flush().
+	int errnum = uring_flush(state, cl_flags);
+
+	// Leave the file offset at the current position also when reading.
+	if (!state->writing && (cl_flags & XZF_CL_DETACH)
+			&& lseek(state->fd, (off_t)state->pos, SEEK_SET) == -1
+			&& errnum == 0)
+		errnum = errno;
+
+	if (!(cl_flags & XZF_CL_DETACH) && close(state->fd) && errnum == 0)
+		errnum = errno;
+
+	uring_free(state);
+	return errnum;
+}
+
+
+static int
+uring_getinfo(void *stateptr, int key, void *value)
+{
+	struct uring_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_FD: {
+			int *fd = value;
+			*fd = state->fd;
+			return 0;
+		}
+
+		case XZF_KEY_ISATTY: {
+			int *result = value;
+			*result = 0;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_NONE;
+			return 0;
+		}
+	}
+
+	return XZF_E_NOKEY;
+}
+
+
+static const struct xzf_backend uring_read_backend = {
+	.version = 0,
+	.seek = &uring_seek,
+	.flush = &uring_flush,
+	.close = &uring_close,
+	.peekin_start = &uring_peekin_start,
+	.peekin_end = &uring_peekin_end,
+	.getinfo = &uring_getinfo,
+	.skip = &uring_skip,
+};
+
+
+static const struct xzf_backend uring_write_backend = {
+	.version = 0,
+	.seek = &uring_seek,
+	.flush = &uring_flush,
+	.close = &uring_close,
+	.peekout_start = &uring_peekout_start,
+	.peekout_end = &uring_peekout_end,
+	.getinfo = &uring_getinfo,
+};
+
+
+/// Set up the rings and the buffers.
+static int
+uring_init(struct uring_state *state)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	const long ring_fd = syscall(__NR_io_uring_setup, state->depth, &p);
+	if (ring_fd == -1)
+		return errno;
+
+	state->ring_fd = (int)ring_fd;
+
+	state->sq_ring_size = p.sq_off.array
+			+ p.sq_entries * sizeof(unsigned int);
+	state->cq_ring_size = p.cq_off.cqes
+			+ p.cq_entries * sizeof(struct io_uring_cqe);
+
+	// With IORING_FEAT_SINGLE_MMAP both rings are in one mapping.
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (state->sq_ring_size < state->cq_ring_size)
+			state->sq_ring_size = state->cq_ring_size;
+
+		state->cq_ring_size = state->sq_ring_size;
+	}
+
+	void *sq_ring = mmap(NULL, state->sq_ring_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			state->ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+		return errno;
+
+	state->sq_ring = sq_ring;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		state->cq_ring = sq_ring;
+	} else {
+		void *cq_ring = mmap(NULL, state->cq_ring_size,
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE,
+				state->ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED)
+			return errno;
+
+		state->cq_ring = cq_ring;
+	}
+
+	state->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(NULL, state->sqes_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			state->ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return errno;
+
+	state->sqes = sqes;
+
+	unsigned char *sq = state->sq_ring;
+	unsigned char *cq = state->cq_ring;
+	state->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	state->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	state->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	state->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	state->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	state->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	state->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	// Page-aligned buffers are good for the kernel and are required
+	// if the file is opened with O_DIRECT.
+	void *mem;
+	const int errnum = posix_memalign(&mem, 4096,
+			(size_t)state->depth * URING_BUF_SIZE);
+	if (errnum != 0)
+		return errnum;
+
+	state->mem = mem;
+
+	state->bufs = calloc(state->depth, sizeof(*state->bufs));
+	struct iovec *iov = calloc(state->depth, sizeof(*iov));
+	if (state->bufs == NULL || iov == NULL) {
+		free(iov);
+		return ENOMEM;
+	}
+
+	for (unsigned int i = 0; i < state->depth; ++i) {
+		state->bufs[i].data = state->mem + (size_t)i * URING_BUF_SIZE;
+		iov[i].iov_base = state->bufs[i].data;
+		iov[i].iov_len = URING_BUF_SIZE;
+	}
+
+	// Fixed buffers save mapping the pages on every request. This
+	// may fail if RLIMIT_MEMLOCK is too low, and then normal buffers
+	// are used.
+	state->fixed = syscall(__NR_io_uring_register, state->ring_fd,
+			IORING_REGISTER_BUFFERS, iov, state->depth) == 0;
+
+	free(iov);
+	return 0;
+}
+
+
+extern xzf_stream *
+xzf_uring_open(const char *filename, int xflags, int mode,
+		unsigned int depth)
+{
+	static const int supported_xflags = XZF_RW | XZF_CREAT | XZF_TRUNC
+			| XZF_EXCL | XZF_NOFOLLOW | XZF_REGFILE;
+
+	// Only one direction at a time is supported.
+	const int rw = xflags & XZF_RW;
+	if ((xflags & ~supported_xflags) || rw == 0 || rw == XZF_RW
+			|| depth > URING_DEPTH_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	int oflags = (rw == XZF_READ ? O_RDONLY : O_WRONLY) | O_CLOEXEC;
+
+	if (xflags & XZF_CREAT)
+		oflags |= O_CREAT;
+
+	if (xflags & XZF_TRUNC)
+		oflags |= O_TRUNC;
+
+	if (xflags & XZF_EXCL)
+		oflags |= O_EXCL;
+
+	// TODO: Support systems that don't have O_NOFOLLOW.
+	if (xflags & XZF_NOFOLLOW)
+		oflags |= O_NOFOLLOW;
+
+	struct uring_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->ring_fd = -1;
+	state->writing = rw == XZF_WRITE;
+	state->depth = depth == 0 ? URING_DEPTH_DEFAULT : depth;
+	state->cur = -1;
+
+	// O_NONBLOCK avoids blocking on FIFOs, which aren't supported.
+	// It is removed once the file type has been checked.
+	state->fd = open(filename, oflags | O_NONBLOCK, (mode_t)mode);
+	if (state->fd == -1) {
+		const int saved_errno = errno;
+		uring_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	int errnum = 0;
+
+	// Explicit file offsets need a regular file or a block device.
+	struct stat st;
+	if (fstat(state->fd, &st))
+		errnum = errno;
+	else if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+		errnum = XZF_E_NOTFILE;
+	else if ((oflags = fcntl(state->fd, F_GETFL)) == -1
+			|| fcntl(state->fd, F_SETFL, oflags & ~O_NONBLOCK))
+		errnum = errno;
+
+	// Start from the current offset like the other backends.
+	if (errnum == 0) {
+		state->pos = lseek(state->fd, 0, SEEK_CUR);
+		if (state->pos == -1)
+			errnum = errno;
+	}
+
+	if (errnum == 0)
+		errnum = uring_init(state);
+
+	xzf_stream *strm = NULL;
+	if (errnum == 0) {
+		strm = xzf_stream_init(NULL, state->writing
+					? &uring_write_backend
+					: &uring_read_backend,
+				state, rw | XZF_SEEKABLE,
+				URING_BUF_SIZE, URING_BUF_SIZE);
+		if (strm == NULL)
+			errnum = errno;
+	}
+
+	if (strm == NULL) {
+		(void)close(state->fd);
+		uring_free(state);
+		errno = errnum;
+	}
+
+	return strm;
+}
+
+#else
+
+extern xzf_stream *
+xzf_uring_open(const char *filename, int xflags, int mode,
+		unsigned int depth)
+{
+	(void)filename;
+	(void)xflags;
+	(void)mode;
+	(void)depth;
+	errno = ENOSYS;
+	return NULL;
+}
+
+#endif
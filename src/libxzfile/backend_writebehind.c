@@ -0,0 +1,392 @@
+/*
+ * Write-behind stage that writes the substream in a separate thread
+ *
+ * The application fills a ring of buffers via peekout and a worker thread
+ * writes the filled buffers to the substream. When the substream is
+ * a compressor, compression and the actual writing to the file happen
+ * in the worker thread while the application keeps producing the data.
+ *
+ * The substream is used by the calling thread only when the worker has
+ * no buffers to write and thus doesn't touch the substream, so the
+ * substream doesn't need XZF_THRSAFE. The same applies to the caller
+ * of XZF_KEY_SUBSTREAM until it writes to this stream again.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "mythread.h"
+#include "xzfile.h"
+
+
+/// Default and maximum number of buffers
+#define WRITEBEHIND_NBUFS_DEFAULT 4
+#define WRITEBEHIND_NBUFS_MAX 64
+
+/// Default, minimum, and maximum buffer size
+#define WRITEBEHIND_BUFSIZE_DEFAULT (UINT32_C(256) << 10)
+#define WRITEBEHIND_BUFSIZE_MIN XZF_BUFSIZE
+#define WRITEBEHIND_BUFSIZE_MAX (UINT32_C(64) << 20)
+
+
+#ifdef MYTHREAD_ENABLED
+struct writebehind_buf {
+	unsigned char *data;
+
+	/// Number of bytes to write
+	size_t size;
+};
+
+
+struct writebehind_state {
+	xzf_stream *out;
+
+	struct writebehind_buf *bufs;
+	unsigned int nbufs;
+	size_t bufsize;
+
+	/// Index of the buffer that the worker writes next
+	unsigned int head;
+
+	/// Number of buffers queued for writing. The buffer that the
+	/// worker is writing is counted until it has been written.
+	/// The buffer at (head + count) % nbufs is given out with peekout.
+	unsigned int count;
+
+	/// The first error from writing to the substream. The queued
+	/// buffers are discarded once this has been set.
+	int write_errnum;
+
+	/// The queued buffers are discarded because of XZF_CL_FORGET.
+	bool discard;
+
+	/// Tells the worker thread to exit once the queue is empty
+	bool stop;
+
+	mythread thread;
+	bool thread_running;
+
+	mythread_mutex mutex;
+	bool mutex_init;
+
+	/// Signaled when a buffer has been queued or stop is set
+	mythread_cond queued_cond;
+
+	/// Signaled when a buffer has been written
+	mythread_cond done_cond;
+};
+
+
+static void *
+worker_main(void *stateptr)
+{
+	struct writebehind_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	while (true) {
+		if (state->count == 0) {
+			if (state->stop)
+				break;
+
+			mythread_cond_wait(&state->queued_cond,
+					&state->mutex);
+			continue;
+		}
+
+		const struct writebehind_buf *buf = &state->bufs[state->head];
+		const bool skip = state->write_errnum != 0 || state->discard;
+		mythread_mutex_unlock(&state->mutex);
+
+		int errnum = 0;
+		if (!skip && xzf_write(state->out, buf->data, buf->size))
+			errnum = errno;
+
+		mythread_mutex_lock(&state->mutex);
+		if (state->write_errnum == 0)
+			state->write_errnum = errnum;
+
+		state->head = (state->head + 1) % state->nbufs;
+		--state->count;
+		mythread_cond_signal(&state->done_cond);
+	}
+
+	mythread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+
+
+/// Wait until the worker has written all the queued buffers.
+/// The substream may be used by the calling thread after this.
+static int
+drain(struct writebehind_state *state)
+{
+	mythread_mutex_lock(&state->mutex);
+
+	while (state->count > 0)
+		mythread_cond_wait(&state->done_cond, &state->mutex);
+
+	const int errnum = state->write_errnum;
+	mythread_mutex_unlock(&state->mutex);
+	return errnum;
+}
+
+
+static int
+writebehind_peekout_start(void *stateptr, unsigned char **buf, size_t *size)
+{
+	struct writebehind_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	// One buffer is always free when the worker has
+	// no more than nbufs - 1 buffers queued.
+	while (state->count == state->nbufs && state->write_errnum == 0)
+		mythread_cond_wait(&state->done_cond, &state->mutex);
+
+	const int errnum = state->write_errnum;
+	const unsigned int i = (state->head + state->count) % state->nbufs;
+	mythread_mutex_unlock(&state->mutex);
+
+	if (errnum != 0) {
+		*size = 0;
+		return errnum;
+	}
+
+	*buf = state->bufs[i].data;
+	*size = state->bufsize;
+	return 0;
+}
+
+
+static int
+writebehind_peekout_end(void *stateptr, size_t bytes_written)
+{
+	struct writebehind_state *state = stateptr;
+
+	mythread_mutex_lock(&state->mutex);
+
+	if (bytes_written > 0) {
+		state->bufs[(state->head + state->count) % state->nbufs]
+				.size = bytes_written;
+		++state->count;
+		mythread_cond_signal(&state->queued_cond);
+	}
+
+	// An error from an earlier buffer is reported here so that
+	// the application notices it without waiting for the worker.
+	const int errnum = state->write_errnum;
+	mythread_mutex_unlock(&state->mutex);
+	return errnum;
+}
+
+
+static int
+writebehind_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct writebehind_state *state = stateptr;
+
+	const int errnum = drain(state);
+	if (errnum != 0)
+		return errnum;
+
+	*offset = xzf_seek(state->out, *offset, whence);
+	return *offset == -1 ? errno : 0;
+}
+
+
+static int
+writebehind_flush(void *stateptr, int fl_flags)
+{
+	struct writebehind_state *state = stateptr;
+
+	const int errnum = drain(state);
+	if (errnum != 0)
+		return errnum;
+
+	return xzf_flush(state->out, fl_flags) ? errno : 0;
+}
+
+
+/// Stop the thread and free the memory. This works also
+/// on a partially initialized state.
+static void
+writebehind_free(struct writebehind_state *state)
+{
+	if (state->thread_running) {
+		mythread_mutex_lock(&state->mutex);
+		state->stop = true;
+		mythread_cond_signal(&state->queued_cond);
+		mythread_mutex_unlock(&state->mutex);
+
+		(void)mythread_join(state->thread);
+	}
+
+	if (state->mutex_init) {
+		mythread_cond_destroy(&state->done_cond);
+		mythread_cond_destroy(&state->queued_cond);
+		mythread_mutex_destroy(&state->mutex);
+	}
+
+	if (state->bufs != NULL) {
+		for (unsigned int i = 0; i < state->nbufs; ++i)
+			free(state->bufs[i].data);
+
+		free(state->bufs);
+	}
+
+	free(state);
+}
+
+
+static int
+writebehind_close(void *stateptr, int cl_flags)
+{
+	struct writebehind_state *state = stateptr;
+	xzf_stream *out = state->out;
+
+	if (cl_flags & XZF_CL_FORGET) {
+		mythread_mutex_lock(&state->mutex);
+		state->discard = true;
+		mythread_mutex_unlock(&state->mutex);
+	}
+
+	const int errnum = drain(state);
+	writebehind_free(state);
+
+	if (cl_flags & XZF_CL_DETACH)
+		return errnum;
+
+	// The substream is closed even if writing to it failed.
+	const int ret = xzf_close(out, cl_flags);
+	return errnum != 0 ? errnum : ret;
+}
+
+
+static int
+writebehind_getinfo(void *stateptr, int key, void *value)
+{
+	struct writebehind_state *state = stateptr;
+
+	// Write errors are reported by the other functions.
+	(void)drain(state);
+
+	if (key == XZF_KEY_SUBSTREAM) {
+		xzf_stream **strm = value;
+		*strm = state->out;
+		return 0;
+	}
+
+	return xzf_getinfo(state->out, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend writebehind_backend = {
+	.version = 0,
+	.seek = &writebehind_seek,
+	.flush = &writebehind_flush,
+	.close = &writebehind_close,
+	.peekout_start = &writebehind_peekout_start,
+	.peekout_end = &writebehind_peekout_end,
+	.getinfo = &writebehind_getinfo,
+};
+
+
+static int
+writebehind_init(struct writebehind_state *state)
+{
+	state->bufs = calloc(state->nbufs, sizeof(*state->bufs));
+	if (state->bufs == NULL)
+		return ENOMEM;
+
+	for (unsigned int i = 0; i < state->nbufs; ++i) {
+		state->bufs[i].data = malloc(state->bufsize);
+		if (state->bufs[i].data == NULL)
+			return ENOMEM;
+	}
+
+	int ret = mythread_mutex_init(&state->mutex);
+	if (ret != 0)
+		return ret;
+
+	ret = mythread_cond_init(&state->queued_cond);
+	if (ret != 0) {
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	ret = mythread_cond_init(&state->done_cond);
+	if (ret != 0) {
+		mythread_cond_destroy(&state->queued_cond);
+		mythread_mutex_destroy(&state->mutex);
+		return ret;
+	}
+
+	state->mutex_init = true;
+
+	ret = mythread_create(&state->thread, &worker_main, state);
+	if (ret != 0)
+		return ret;
+
+	state->thread_running = true;
+	return 0;
+}
+#endif
+
+
+extern xzf_stream *
+xzf_writebehind_open(xzf_stream *out, unsigned int nbufs, size_t bufsize)
+{
+	if (nbufs == 1 || nbufs > WRITEBEHIND_NBUFS_MAX
+			|| (bufsize != 0 && (bufsize < WRITEBEHIND_BUFSIZE_MIN
+				|| bufsize > WRITEBEHIND_BUFSIZE_MAX))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+#ifdef MYTHREAD_ENABLED
+	if (out == NULL)
+		return NULL;
+
+	if (!(xzf_getflags(out) & XZF_WRITE)) {
+		errno = XZF_E_NOTWRITABLE;
+		return NULL;
+	}
+
+	struct writebehind_state *state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->out = out;
+	state->nbufs = nbufs == 0 ? WRITEBEHIND_NBUFS_DEFAULT : nbufs;
+	state->bufsize = bufsize == 0 ? WRITEBEHIND_BUFSIZE_DEFAULT : bufsize;
+
+	int flags = XZF_WRITE;
+	if (xzf_getflags(out) & XZF_SEEKABLE)
+		flags |= XZF_SEEKABLE;
+
+	const int ret = writebehind_init(state);
+	if (ret != 0) {
+		writebehind_free(state);
+		errno = ret;
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &writebehind_backend, state,
+			flags, XZF_BUFSIZE, state->bufsize);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		writebehind_free(state);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+#else
+	// Without threads the substream is returned as is.
+	return out;
+#endif
+}
@@ -0,0 +1,664 @@
+/*
+ * Backend for reading .xz files
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+#include "zindex.h"
+
+#include <lzma.h>
+
+
+/// Size of the buffer that skipped data is decompressed into
+#define XZIN_SCRATCH_SIZE 65536
+
+
+struct xzin_state {
+	xzf_stream *in;
+	lzma_stream s;
+
+	/// LZMA_RUN until the end of the input has been reached,
+	/// then LZMA_FINISH
+	lzma_action action;
+
+	/// True once the decoder has returned LZMA_STREAM_END
+	bool finished;
+
+	/// True if only the first .xz Stream is decoded
+	bool single;
+
+	/// Memory usage limit given to xzf_xzin_open()
+	uint64_t memlimit;
+
+	/// Locations of the non-empty Blocks. This is empty unless
+	/// the substream is seekable.
+	struct xzf_zindex idx;
+
+	/// Current position in the uncompressed data
+	xzf_off upos;
+
+	/// Until the first seek, the whole file is decoded with the
+	/// Stream decoder which may use multiple threads. After a seek,
+	/// the Blocks are decoded one by one with the Block decoder.
+	bool block_mode;
+
+	/// The Block being decoded in Block mode (index in idx.entries)
+	size_t block;
+
+	/// Block options of the current Block. The Block decoder keeps
+	/// a pointer to this structure until the Block has been decoded.
+	lzma_block block_options;
+
+	/// Buffer for decompressing data that is skipped. This is
+	/// allocated when needed.
+	uint8_t *scratch;
+};
+
+
+static int
+xzin_errno(lzma_ret ret)
+{
+	switch (ret) {
+	case LZMA_MEM_ERROR:
+		return ENOMEM;
+
+	case LZMA_MEMLIMIT_ERROR:
+		return XZF_E_ZMEMLIMIT;
+
+	case LZMA_FORMAT_ERROR:
+		return XZF_E_FORMAT;
+
+	case LZMA_OPTIONS_ERROR:
+		return XZF_E_ZOPTNOTSUP;
+
+	case LZMA_DATA_ERROR:
+		return XZF_E_ZCORRUPT;
+
+	case LZMA_BUF_ERROR:
+		return XZF_E_ZTRUNC;
+
+	default:
+		return XZF_E_BUG;
+	}
+}
+
+
+/// Prepare to decode the Block at idx.entries[block] with the Block decoder.
+/// If there are no more Blocks, XZF_E_EOF is returned.
+static int
+block_start(struct xzin_state *state, size_t block)
+{
+	state->block = block;
+	state->action = LZMA_RUN;
+
+	if (block >= state->idx.count) {
+		state->finished = true;
+		return XZF_E_EOF;
+	}
+
+	const struct xzf_zindex_entry *entry = &state->idx.entries[block];
+	if (xzf_seek(state->in, entry->in, XZF_SEEK_SET) == -1)
+		return errno;
+
+	// The first byte of the Block Header tells the size of the header.
+	const unsigned char *buf;
+	if (xzf_peekin_start(state->in, &buf, 1) == 0)
+		return errno == XZF_E_EOF ? XZF_E_ZTRUNC : errno;
+
+	const uint32_t header_size = lzma_block_header_size_decode(buf[0]);
+	xzf_peekin_end(state->in, 0);
+
+	const size_t avail = xzf_peekin_start(state->in, &buf, header_size);
+	if (avail < header_size) {
+		if (avail == 0)
+			return errno == XZF_E_EOF ? XZF_E_ZTRUNC : errno;
+
+		xzf_peekin_end(state->in, 0);
+		return XZF_E_ZTRUNC;
+	}
+
+	lzma_filter filters[LZMA_FILTERS_MAX + 1];
+	lzma_block *block_options = &state->block_options;
+	memset(block_options, 0, sizeof(*block_options));
+	block_options->version = 1;
+	block_options->check = (lzma_check)entry->check;
+	block_options->header_size = header_size;
+	block_options->filters = filters;
+
+	lzma_ret ret = lzma_block_header_decode(block_options, NULL, buf);
+	xzf_peekin_end(state->in, ret == LZMA_OK ? header_size : 0);
+	if (ret != LZMA_OK)
+		return xzin_errno(ret);
+
+	ret = lzma_block_decoder(&state->s, block_options);
+
+	// The filter chain was copied by the decoder.
+	block_options->filters = NULL;
+
+	for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+		free(filters[i].options);
+
+	return ret == LZMA_OK ? 0 : xzin_errno(ret);
+}
+
+
+static int
+xzin_read(void *stateptr, unsigned char *out, size_t *out_size)
+{
+	struct xzin_state *state = stateptr;
+	size_t remaining = *out_size;
+	*out_size = 0;
+
+	if (state->finished)
+		return XZF_E_EOF;
+
+	do {
+		// Prepare the input buffer. Once the end of the input has
+		// been reached, the decoder is told to finish. It may still
+		// have buffered input or output left.
+		const unsigned char *in = NULL;
+		size_t in_size = 0;
+
+		if (state->action == LZMA_RUN) {
+			in_size = xzf_peekin_start(state->in, &in, 1);
+			if (in_size == 0) {
+				if (errno != XZF_E_EOF)
+					return errno;
+
+				state->action = LZMA_FINISH;
+			}
+		}
+
+		state->s.next_in = in;
+		state->s.avail_in = in_size;
+		state->s.next_out = out;
+		state->s.avail_out = remaining;
+
+		// Decompress
+		const lzma_ret ret = lzma_code(&state->s, state->action);
+
+		// Update the input buffer position.
+		if (in_size > 0)
+			xzf_peekin_end(state->in,
+					in_size - state->s.avail_in);
+
+		// Update the output buffer position.
+		const size_t out_used = remaining - state->s.avail_out;
+		out += out_used;
+		*out_size += out_used;
+		remaining -= out_used;
+		state->upos += out_used;
+
+		// Handle end of file and errors. The decoder takes care
+		// of concatenated .xz streams by itself unless XZF_Z_SINGLE
+		// was used.
+		if (ret != LZMA_OK) {
+			if (ret != LZMA_STREAM_END)
+				return xzin_errno(ret);
+
+			// In Block mode, continue from the next Block.
+			if (state->block_mode) {
+				const int errnum = block_start(
+						state, state->block + 1);
+				if (errnum != 0)
+					return errnum;
+
+				continue;
+			}
+
+			state->finished = true;
+			return XZF_E_EOF;
+		}
+	} while (remaining > 0);
+
+	return 0;
+}
+
+
+/// Decompress and discard data until the given uncompressed position.
+/// XZF_E_EOF is returned if the file ends before the target.
+static int
+xzin_discard(struct xzin_state *state, xzf_off target)
+{
+	if (state->upos < target && state->scratch == NULL) {
+		state->scratch = malloc(XZIN_SCRATCH_SIZE);
+		if (state->scratch == NULL)
+			return ENOMEM;
+	}
+
+	while (state->upos < target) {
+		size_t size = XZIN_SCRATCH_SIZE;
+		if ((xzf_off)size > target - state->upos)
+			size = (size_t)(target - state->upos);
+
+		const int errnum = xzin_read(state, state->scratch, &size);
+		if (errnum != 0)
+			return errnum;
+	}
+
+	return 0;
+}
+
+
+/// Move to the given position which must be less than the uncompressed
+/// size. The Blocks before the one that contains the target are skipped
+/// using the Index without decompressing them.
+static int
+xzin_goto(struct xzin_state *state, xzf_off target)
+{
+	assert(target < state->idx.usize);
+
+	const struct xzf_zindex_entry *entry
+			= xzf_zindex_find(&state->idx, target);
+	assert(entry != NULL);
+	const size_t block = (size_t)(entry - state->idx.entries);
+
+	// Seeking forward within the Block that is being decoded
+	// is done by decoding. Otherwise start from the beginning
+	// of the Block that contains the target.
+	if (!state->block_mode || state->finished || block != state->block
+			|| target < state->upos) {
+		const int errnum = block_start(state, block);
+		if (errnum != 0)
+			return errnum;
+
+		state->block_mode = true;
+		state->upos = entry->out;
+	}
+
+	state->finished = false;
+
+	// Decode and discard until the target position.
+	const int errnum = xzin_discard(state, target);
+	return errnum == XZF_E_EOF ? XZF_E_ZCORRUPT : errnum;
+}
+
+
+static int
+xzin_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct xzin_state *state = stateptr;
+	xzf_off target = *offset;
+
+	switch (whence) {
+	case XZF_SEEK_SET:
+		break;
+
+	case XZF_SEEK_CUR:
+		if (target > 0 && state->upos > XZF_OFF_MAX - target)
+			return EINVAL;
+
+		target += state->upos;
+		break;
+
+	case XZF_SEEK_END:
+		if (target > 0 && state->idx.usize > XZF_OFF_MAX - target)
+			return EINVAL;
+
+		target += state->idx.usize;
+		break;
+
+	default:
+		return EINVAL;
+	}
+
+	if (target < 0)
+		return EINVAL;
+
+	*offset = target;
+
+	// Telling the current position must not disturb the decoder.
+	if (target == state->upos)
+		return 0;
+
+	// Seeking to or past the end of the uncompressed data
+	// doesn't need any decoding.
+	if (target >= state->idx.usize) {
+		state->upos = target;
+		state->finished = true;
+		return 0;
+	}
+
+	return xzin_goto(state, target);
+}
+
+
+static int
+xzin_skip(void *stateptr, xzf_off *amount)
+{
+	struct xzin_state *state = stateptr;
+	const xzf_off start = state->upos;
+	xzf_off target = *amount > XZF_OFF_MAX - start
+			? XZF_OFF_MAX : start + *amount;
+
+	int errnum;
+
+	if (state->idx.usize == -1) {
+		// Without the Index everything has to be decompressed.
+		errnum = xzin_discard(state, target);
+	} else if (start >= state->idx.usize) {
+		errnum = XZF_E_EOF;
+	} else if (target >= state->idx.usize) {
+		// Nothing needs to be decoded to skip to the end.
+		state->upos = state->idx.usize;
+		state->finished = true;
+		errnum = XZF_E_EOF;
+	} else if (target < state->upos + XZIN_SCRATCH_SIZE
+			&& !state->finished) {
+		// Decoding a little is faster than restarting a Block.
+		errnum = xzin_discard(state, target);
+	} else {
+		errnum = xzin_goto(state, target);
+	}
+
+	// If an error occurred when the Block was being decoded again,
+	// the position may be before the start. Nothing was skipped then.
+	*amount = state->upos > start ? state->upos - start : 0;
+	return errnum;
+}
+
+
+static int
+xzin_close(void *stateptr, int cl_flags)
+{
+	struct xzin_state *state = stateptr;
+	xzf_stream *in = state->in;
+
+	lzma_end(&state->s);
+	xzf_zindex_end(&state->idx);
+	free(state->scratch);
+	free(state);
+
+	return cl_flags & XZF_CL_DETACH ? 0 : xzf_close(in, cl_flags);
+}
+
+
+static int
+xzin_getinfo(void *stateptr, int key, void *value)
+{
+	struct xzin_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_SUBSTREAM: {
+			xzf_stream **strm = value;
+			*strm = state->in;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_XZ;
+			return 0;
+		}
+
+		case XZF_KEY_ZINDEX_COPY:
+			if (state->idx.usize == -1)
+				return XZF_E_NOKEY;
+
+			return xzf_zindex_copy(value, &state->idx);
+
+		case XZF_KEY_ZINDEX_SET:
+			if (state->idx.usize == -1)
+				return XZF_E_NOKEY;
+
+			// In Block mode the decoder uses the current entries.
+			if (state->block_mode || state->upos != 0)
+				return EBUSY;
+
+			xzf_zindex_replace(&state->idx, value);
+			return 0;
+	}
+
+	return xzf_getinfo(state->in, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend xzin_backend = {
+	.version = 0,
+	.read = &xzin_read,
+	.seek = &xzin_seek,
+	.close = &xzin_close,
+	.getinfo = &xzin_getinfo,
+	.skip = &xzin_skip,
+};
+
+
+#ifdef HAVE_LZMA_FILE_INFO_DECODER
+/// Decode the Index fields of all the .xz Streams into lzma_index.
+static int
+decode_index(struct xzin_state *state, xzf_off base, lzma_index **index)
+{
+	const xzf_off end = xzf_seek(state->in, 0, XZF_SEEK_END);
+	if (end == -1 || xzf_seek(state->in, base, XZF_SEEK_SET) == -1)
+		return errno;
+
+	lzma_stream s = LZMA_STREAM_INIT;
+	lzma_ret ret = lzma_file_info_decoder(&s, index, state->memlimit,
+			(uint64_t)(end - base));
+	if (ret != LZMA_OK)
+		return xzin_errno(ret);
+
+	lzma_action action = LZMA_RUN;
+	int errnum = 0;
+
+	do {
+		const unsigned char *in = NULL;
+		size_t in_size = 0;
+
+		if (action == LZMA_RUN) {
+			in_size = xzf_peekin_start(state->in, &in, 1);
+			if (in_size == 0) {
+				if (errno != XZF_E_EOF) {
+					errnum = errno;
+					break;
+				}
+
+				action = LZMA_FINISH;
+			}
+		}
+
+		s.next_in = in;
+		s.avail_in = in_size;
+
+		ret = lzma_code(&s, action);
+
+		if (in_size > 0)
+			xzf_peekin_end(state->in, in_size - s.avail_in);
+
+		// The decoder reads the Stream Footers and Indexes
+		// backwards from the end of the file.
+		if (ret == LZMA_SEEK_NEEDED) {
+			if (xzf_seek(state->in, base + (xzf_off)s.seek_pos,
+					XZF_SEEK_SET) == -1) {
+				errnum = errno;
+				break;
+			}
+
+			action = LZMA_RUN;
+			ret = LZMA_OK;
+		}
+	} while (ret == LZMA_OK);
+
+	if (errnum == 0 && ret != LZMA_STREAM_END)
+		errnum = xzin_errno(ret);
+
+	lzma_end(&s);
+	return errnum;
+}
+
+
+/// Build the Block index from the Index fields of the .xz file and
+/// seek back to the beginning. Returns zero if the index was built.
+static int
+read_index(struct xzin_state *state)
+{
+	const xzf_off base = xzf_seek(state->in, 0, XZF_SEEK_CUR);
+	if (base == -1)
+		return errno;
+
+	lzma_index *index = NULL;
+	int errnum = decode_index(state, base, &index);
+
+	if (errnum == 0) {
+		state->idx.base = base;
+
+		lzma_index_iter iter;
+		lzma_index_iter_init(&iter, index);
+
+		// With XZF_Z_SINGLE only the first Stream is used.
+		if (state->single) {
+			if (lzma_index_iter_next(&iter, LZMA_INDEX_ITER_STREAM))
+				errnum = XZF_E_BUG;
+
+			state->idx.usize = (xzf_off)
+					iter.stream.uncompressed_size;
+			lzma_index_iter_rewind(&iter);
+		} else {
+			state->idx.usize = (xzf_off)
+					lzma_index_uncompressed_size(index);
+		}
+
+		while (errnum == 0 && !lzma_index_iter_next(&iter,
+				LZMA_INDEX_ITER_NONEMPTY_BLOCK)) {
+			if (state->single && iter.stream.number != 1)
+				break;
+
+			const xzf_off in = base
+				+ (xzf_off)iter.block.compressed_file_offset;
+			const xzf_off out
+				= (xzf_off)iter.block.uncompressed_file_offset;
+			struct xzf_zindex_entry *entry = xzf_zindex_add(
+					&state->idx, in, out);
+			if (entry == NULL)
+				errnum = ENOMEM;
+			else
+				entry->check = (unsigned int)
+						iter.stream.flags->check;
+		}
+
+		lzma_index_end(index, NULL);
+	}
+
+	if (errnum != 0)
+		xzf_zindex_end(&state->idx);
+
+	// Go back to the beginning even if the index couldn't be read.
+	if (xzf_seek(state->in, base, XZF_SEEK_SET) == -1)
+		return errno;
+
+	return errnum;
+}
+#endif
+
+
+static lzma_ret
+xzin_decoder_init(lzma_stream *s, uint32_t flags, unsigned int threads,
+		uint64_t memlimit)
+{
+#ifdef HAVE_LZMA_STREAM_DECODER_MT
+	if (threads == 0)
+		threads = lzma_cputhreads();
+
+	if (threads > 1) {
+		// Without an explicit limit, use the same default
+		// that liblzma docs suggest for the threading limit.
+		// Hitting it only reduces the number of threads.
+		uint64_t memlimit_threading = memlimit;
+		if (memlimit_threading == UINT64_MAX) {
+			memlimit_threading = lzma_physmem() / 4;
+			if (memlimit_threading == 0)
+				memlimit_threading = UINT64_C(1) << 30;
+		}
+
+		const lzma_mt mt = {
+			.flags = flags,
+			.threads = threads,
+			.timeout = 0,
+			.memlimit_threading = memlimit_threading,
+			.memlimit_stop = memlimit,
+		};
+
+		return lzma_stream_decoder_mt(s, &mt);
+	}
+#else
+	(void)threads;
+#endif
+
+	return lzma_stream_decoder(s, memlimit, flags);
+}
+
+
+extern xzf_stream *
+xzf_xzin_open(xzf_stream *in, int zflags, unsigned int threads,
+		unsigned long long memlimit)
+{
+	static const int supported_flags = XZF_Z_SINGLE;
+	if (zflags & ~supported_flags) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct xzin_state *state = malloc(sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->in = in;
+	state->action = LZMA_RUN;
+	state->finished = false;
+	state->single = (zflags & XZF_Z_SINGLE) != 0;
+	state->memlimit = memlimit == 0 ? UINT64_MAX : memlimit;
+	state->upos = 0;
+	state->block_mode = false;
+	state->block = 0;
+	state->scratch = NULL;
+	xzf_zindex_init(&state->idx);
+
+	const lzma_stream s_init = LZMA_STREAM_INIT;
+	state->s = s_init;
+
+	int flags = XZF_READ;
+
+#ifdef HAVE_LZMA_FILE_INFO_DECODER
+	// If the substream is seekable, locate the Blocks so that
+	// seeking can be supported. If the Index cannot be read,
+	// the file might still be decodable from the beginning.
+	// If seeking back to the beginning failed, give up.
+	if (xzf_getflags(in) & XZF_SEEKABLE) {
+		const int errnum = read_index(state);
+		if (errnum == 0) {
+			flags |= XZF_SEEKABLE;
+		} else if (errnum == ENOMEM || errnum == XZF_E_ZMEMLIMIT
+				|| xzf_geterr(in) != 0) {
+			free(state);
+			errno = errnum;
+			return NULL;
+		}
+	}
+#endif
+
+	const lzma_ret ret = xzin_decoder_init(&state->s,
+			state->single ? 0 : LZMA_CONCATENATED,
+			threads, state->memlimit);
+	if (ret != LZMA_OK) {
+		xzf_zindex_end(&state->idx);
+		free(state);
+		errno = xzin_errno(ret);
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &xzin_backend, state,
+			flags, XZF_BUFSIZE, XZF_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		xzin_close(state, XZF_CL_DETACH);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
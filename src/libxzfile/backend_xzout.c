@@ -0,0 +1,278 @@
+/*
+ * Backend for writing .xz files
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <lzma.h>
+
+
+struct xzout_state {
+	xzf_stream *out;
+	lzma_stream s;
+
+	/// Uncompressed size of a Block or zero if the Blocks are
+	/// split by the encoder itself
+	uint64_t block_size;
+
+	/// Amount of uncompressed input that still fits in the current
+	/// Block. This is used only when Blocks are split by using
+	/// LZMA_FULL_FLUSH with the single-threaded encoder.
+	uint64_t block_left;
+
+	/// First error that occurred
+	int errnum;
+};
+
+
+static int
+xzout_errno(lzma_ret ret)
+{
+	switch (ret) {
+	case LZMA_MEM_ERROR:
+		return ENOMEM;
+
+	case LZMA_OPTIONS_ERROR:
+	case LZMA_UNSUPPORTED_CHECK:
+		return XZF_E_ZOPTNOTSUP;
+
+	default:
+		return XZF_E_BUG;
+	}
+}
+
+
+/// Run the encoder with the given action. The output is written directly
+/// into the buffer of the substream. With LZMA_RUN, this returns once all
+/// the input has been consumed. With the other actions, this returns when
+/// the encoder has finished the action.
+static int
+xzout_code(struct xzout_state *state, lzma_action action)
+{
+	while (true) {
+		unsigned char *out;
+		const size_t out_size = xzf_peekout_start(state->out, &out, 1);
+		if (out_size == 0)
+			return errno;
+
+		state->s.next_out = out;
+		state->s.avail_out = out_size;
+
+		const lzma_ret ret = lzma_code(&state->s, action);
+
+		if (xzf_peekout_end(state->out,
+				out_size - state->s.avail_out))
+			return errno;
+
+		if (ret == LZMA_STREAM_END) {
+			assert(action != LZMA_RUN);
+			return 0;
+		}
+
+		if (ret != LZMA_OK)
+			return xzout_errno(ret);
+
+		if (action == LZMA_RUN && state->s.avail_in == 0)
+			return 0;
+	}
+}
+
+
+static int
+xzout_write(void *stateptr, const unsigned char *buf, size_t size)
+{
+	struct xzout_state *state = stateptr;
+
+	if (state->errnum != 0)
+		return state->errnum;
+
+	while (size > 0) {
+		size_t in_size = size;
+
+		if (state->block_size != 0 && in_size > state->block_left)
+			in_size = (size_t)state->block_left;
+
+		state->s.next_in = buf;
+		state->s.avail_in = in_size;
+
+		int ret = xzout_code(state, LZMA_RUN);
+
+		buf += in_size;
+		size -= in_size;
+
+		// Start a new Block when the current one is full.
+		if (ret == 0 && state->block_size != 0) {
+			state->block_left -= in_size;
+			if (state->block_left == 0) {
+				ret = xzout_code(state, LZMA_FULL_FLUSH);
+				state->block_left = state->block_size;
+			}
+		}
+
+		if (ret != 0)
+			return state->errnum = ret;
+	}
+
+	return 0;
+}
+
+
+static int
+xzout_flush(void *stateptr, int fl_flags)
+{
+	struct xzout_state *state = stateptr;
+
+	if (state->errnum != 0)
+		return state->errnum;
+
+	// Ending the Block is the only way to get all the data out
+	// from the multithreaded encoder. It keeps the file seekable
+	// at the flush points too.
+	const int ret = xzout_code(state, LZMA_FULL_FLUSH);
+	if (ret != 0)
+		return state->errnum = ret;
+
+	if (state->block_size != 0)
+		state->block_left = state->block_size;
+
+	return xzf_flush(state->out, fl_flags) ? errno : 0;
+}
+
+
+static int
+xzout_close(void *stateptr, int cl_flags)
+{
+	struct xzout_state *state = stateptr;
+	xzf_stream *out = state->out;
+
+	int ret = state->errnum;
+	if (ret == 0 && !(cl_flags & XZF_CL_FORGET))
+		ret = xzout_code(state, LZMA_FINISH);
+
+	lzma_end(&state->s);
+	free(state);
+
+	if (!(cl_flags & XZF_CL_DETACH)) {
+		const int close_ret = xzf_close(out, cl_flags);
+		if (ret == 0)
+			ret = close_ret;
+	}
+
+	return ret;
+}
+
+
+static int
+xzout_getinfo(void *stateptr, int key, void *value)
+{
+	struct xzout_state *state = stateptr;
+
+	switch (key) {
+		case XZF_KEY_SUBSTREAM: {
+			xzf_stream **strm = value;
+			*strm = state->out;
+			return 0;
+		}
+
+		case XZF_KEY_ZTYPE: {
+			int *type = value;
+			*type = XZF_Z_XZ;
+			return 0;
+		}
+	}
+
+	return xzf_getinfo(state->out, key, value) ? errno : 0;
+}
+
+
+static const struct xzf_backend xzout_backend = {
+	.version = 0,
+	.write = &xzout_write,
+	.flush = &xzout_flush,
+	.close = &xzout_close,
+	.getinfo = &xzout_getinfo,
+};
+
+
+static lzma_ret
+xzout_encoder_init(struct xzout_state *state, uint32_t preset,
+		unsigned int threads, uint64_t block_size)
+{
+#ifdef HAVE_LZMA_STREAM_ENCODER_MT
+	if (threads == 0)
+		threads = lzma_cputhreads();
+
+	if (threads == 0)
+		threads = 1;
+
+	// The multithreaded encoder is used also with one thread when
+	// the Block size was specified. Unlike the single-threaded
+	// encoder, it stores the sizes in the Block Headers which is
+	// needed for multithreaded decoding.
+	if (threads > 1 || block_size != 0) {
+		const lzma_mt mt = {
+			.flags = 0,
+			.threads = threads,
+			.block_size = block_size,
+			.timeout = 0,
+			.preset = preset,
+			.filters = NULL,
+			.check = LZMA_CHECK_CRC64,
+		};
+
+		return lzma_stream_encoder_mt(&state->s, &mt);
+	}
+#else
+	(void)threads;
+
+	// Split the Blocks with LZMA_FULL_FLUSH. The Blocks can
+	// be located via the Index but not decoded in parallel.
+	state->block_size = block_size;
+	state->block_left = block_size;
+#endif
+
+	return lzma_easy_encoder(&state->s, preset, LZMA_CHECK_CRC64);
+}
+
+
+extern xzf_stream *
+xzf_xzout_open(xzf_stream *out, unsigned int preset, unsigned int threads,
+		unsigned long long block_size)
+{
+	struct xzout_state *state = malloc(sizeof(*state));
+	if (state == NULL)
+		return NULL;
+
+	state->out = out;
+	state->block_size = 0;
+	state->block_left = 0;
+	state->errnum = 0;
+
+	const lzma_stream s_init = LZMA_STREAM_INIT;
+	state->s = s_init;
+
+	const lzma_ret ret = xzout_encoder_init(state, preset, threads,
+			block_size);
+	if (ret != LZMA_OK) {
+		free(state);
+		errno = ret == LZMA_OPTIONS_ERROR ? EINVAL : xzout_errno(ret);
+		return NULL;
+	}
+
+	xzf_stream *strm = xzf_stream_init(NULL, &xzout_backend, state,
+			XZF_WRITE, 0, XZF_BUFSIZE);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		xzout_close(state, XZF_CL_DETACH | XZF_CL_FORGET);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	return strm;
+}
@@ -0,0 +1,464 @@
+/*
+ * Callbacks to calculate checksums
+ *
+ * CRC32 uses carryless multiplication (PCLMULQDQ) and CRC32C the SSE4.2
+ * CRC32 instruction on x86 if the processor has them. The instructions
+ * are detected at runtime so the library doesn't need to be built for
+ * a specific processor. On ARM64 the CRC32 instructions are used if the
+ * compiler targets a processor that has them. CRC64 is done by liblzma
+ * which has its own CLMUL code.
+ *
+ * xzf_cb_checksums() calculates several checksums in one pass: the
+ * buffer is processed in blocks that fit into the L1 cache and every
+ * checksum is updated from one block before moving to the next. Thus
+ * the data is read from memory only once no matter how many checksums
+ * are needed.
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <lzma.h>
+
+#ifdef HAVE_CRC_X86
+#	include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#	include <arm_acle.h>
+#	define CRC_ARM64 1
+#endif
+
+#include "crc32c_table.h"
+
+
+/// Size of the blocks in xzf_cb_checksums()
+#define CHECKSUMS_BLOCK (UINT32_C(16) << 10)
+
+/// Smallest input for which the CLMUL code is used for CRC32.
+/// It needs at least 64 bytes.
+#define CRC32_CLMUL_MIN 64
+
+/// The XXH64 primes
+#define XXH_PRIME64_1 UINT64_C(0x9E3779B185EBCA87)
+#define XXH_PRIME64_2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define XXH_PRIME64_3 UINT64_C(0x165667B19E3779F9)
+#define XXH_PRIME64_4 UINT64_C(0x85EBCA77C2B2AE63)
+#define XXH_PRIME64_5 UINT64_C(0x27D4EB2F165667C5)
+
+
+static inline uint32_t
+read32le(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8)
+			| ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
+static inline uint64_t
+read64le(const unsigned char *buf)
+{
+	return (uint64_t)read32le(buf) | ((uint64_t)read32le(buf + 4) << 32);
+}
+
+
+static inline uint64_t
+rotl64(uint64_t x, unsigned int n)
+{
+	return (x << n) | (x >> (64 - n));
+}
+
+
+///////////
+// CRC32 //
+///////////
+
+#ifdef HAVE_CRC_X86
+/// CRC32 (the polynomial of gzip) with folding by carryless multiplication
+/// as described in the Intel white paper "Fast CRC Computation for Generic
+/// Polynomials Using PCLMULQDQ Instruction". size must be at least 64 and
+/// a multiple of 16. crc is not inverted at the beginning or at the end.
+__attribute__((__target__("pclmul")))
+static uint32_t
+crc32_clmul(const unsigned char *buf, size_t size, uint32_t crc)
+{
+	// x^(4*128+32) and x^(4*128-32), x^(128+32) and x^(128-32),
+	// x^64, and the polynomial and its Barrett constant, all
+	// bit-reflected
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163CD6124);
+	const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+	const __m128i *p = (const __m128i *)buf;
+	__m128i x1 = _mm_loadu_si128(p);
+	__m128i x2 = _mm_loadu_si128(p + 1);
+	__m128i x3 = _mm_loadu_si128(p + 2);
+	__m128i x4 = _mm_loadu_si128(p + 3);
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	p += 4;
+	size -= 64;
+
+	// Fold four 128-bit lanes at a time.
+	for (; size >= 64; p += 4, size -= 64) {
+		const __m128i y1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		const __m128i y2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		const __m128i y3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		const __m128i y4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, y1), _mm_loadu_si128(p));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, y2),
+				_mm_loadu_si128(p + 1));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, y3),
+				_mm_loadu_si128(p + 2));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, y4),
+				_mm_loadu_si128(p + 3));
+	}
+
+	// Fold the lanes into one and then the rest 16 bytes at a time.
+	const __m128i lanes[3] = { x2, x3, x4 };
+	for (size_t i = 0; i < 3 + size / 16; ++i) {
+		const __m128i next = i < 3 ? lanes[i] : _mm_loadu_si128(p++);
+		const __m128i y1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, y1), next);
+	}
+
+	// Fold 128 bits to 64 bits.
+	__m128i y1 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), y1);
+
+	y1 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00);
+	x1 = _mm_xor_si128(x1, y1);
+
+	// Barrett reduction to 32 bits
+	y1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+	y1 = _mm_clmulepi64_si128(_mm_and_si128(y1, mask32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, y1);
+
+	return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+
+static uint32_t
+crc32_update(const unsigned char *buf, size_t size, uint32_t crc)
+{
+#if defined(HAVE_CRC_X86)
+	if (size >= CRC32_CLMUL_MIN && __builtin_cpu_supports("pclmul")) {
+		const size_t n = size & ~(size_t)15;
+		crc = ~crc32_clmul(buf, n, ~crc);
+		buf += n;
+		size -= n;
+	}
+
+#elif defined(CRC_ARM64)
+	crc = ~crc;
+
+	for (; size >= 8; buf += 8, size -= 8)
+		crc = __crc32d(crc, read64le(buf));
+
+	for (; size > 0; ++buf, --size)
+		crc = __crc32b(crc, *buf);
+
+	return ~crc;
+#endif
+
+	// liblzma handles the rest and the processors
+	// without the instructions.
+	return lzma_crc32(buf, size, crc);
+}
+
+
+extern void
+xzf_cb_crc32(void *state, const unsigned char *buf, size_t size)
+{
+	uint32_t *crc = state;
+	*crc = crc32_update(buf, size, *crc);
+}
+
+
+////////////
+// CRC32C //
+////////////
+
+#ifdef HAVE_CRC_X86
+/// CRC32C with the SSE4.2 CRC32 instruction. crc is not inverted.
+__attribute__((__target__("sse4.2")))
+static uint32_t
+crc32c_sse42(const unsigned char *buf, size_t size, uint32_t crc)
+{
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	for (; size >= 8; buf += 8, size -= 8)
+		crc64 = _mm_crc32_u64(crc64, read64le(buf));
+
+	crc = (uint32_t)crc64;
+#endif
+
+	for (; size >= 4; buf += 4, size -= 4)
+		crc = _mm_crc32_u32(crc, read32le(buf));
+
+	for (; size > 0; ++buf, --size)
+		crc = _mm_crc32_u8(crc, *buf);
+
+	return crc;
+}
+#endif
+
+
+static uint32_t
+crc32c_update(const unsigned char *buf, size_t size, uint32_t crc)
+{
+	crc = ~crc;
+
+#if defined(HAVE_CRC_X86)
+	if (__builtin_cpu_supports("sse4.2"))
+		return ~crc32c_sse42(buf, size, crc);
+
+#elif defined(CRC_ARM64)
+	for (; size >= 8; buf += 8, size -= 8)
+		crc = __crc32cd(crc, read64le(buf));
+
+	for (; size > 0; ++buf, --size)
+		crc = __crc32cb(crc, *buf);
+
+	return ~crc;
+#endif
+
+	// Slicing-by-8
+	for (; size >= 8; buf += 8, size -= 8) {
+		const uint32_t a = crc ^ read32le(buf);
+		const uint32_t b = read32le(buf + 4);
+		crc = crc32c_table[7][a & 0xFF]
+				^ crc32c_table[6][(a >> 8) & 0xFF]
+				^ crc32c_table[5][(a >> 16) & 0xFF]
+				^ crc32c_table[4][a >> 24]
+				^ crc32c_table[3][b & 0xFF]
+				^ crc32c_table[2][(b >> 8) & 0xFF]
+				^ crc32c_table[1][(b >> 16) & 0xFF]
+				^ crc32c_table[0][b >> 24];
+	}
+
+	for (; size > 0; ++buf, --size)
+		crc = crc32c_table[0][(crc ^ *buf) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+
+extern void
+xzf_cb_crc32c(void *state, const unsigned char *buf, size_t size)
+{
+	uint32_t *crc = state;
+	*crc = crc32c_update(buf, size, *crc);
+}
+
+
+///////////
+// CRC64 //
+///////////
+
+extern void
+xzf_cb_crc64(void *state, const unsigned char *buf, size_t size)
+{
+	uint64_t *crc = state;
+	*crc = lzma_crc64(buf, size, *crc);
+}
+
+
+///////////
+// XXH64 //
+///////////
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+
+static inline uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+
+/// Process the 32-byte stripes of buf. Returns the number of bytes used.
+static size_t
+xxh64_stripes(uint64_t acc[4], const unsigned char *buf, size_t size)
+{
+	uint64_t v1 = acc[0];
+	uint64_t v2 = acc[1];
+	uint64_t v3 = acc[2];
+	uint64_t v4 = acc[3];
+	size_t i = 0;
+
+	for (; size - i >= 32; i += 32) {
+		v1 = xxh64_round(v1, read64le(buf + i));
+		v2 = xxh64_round(v2, read64le(buf + i + 8));
+		v3 = xxh64_round(v3, read64le(buf + i + 16));
+		v4 = xxh64_round(v4, read64le(buf + i + 24));
+	}
+
+	acc[0] = v1;
+	acc[1] = v2;
+	acc[2] = v3;
+	acc[3] = v4;
+	return i;
+}
+
+
+extern void
+xzf_xxh64_init(xzf_xxh64 *state, uint64_t seed)
+{
+	state->acc[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+	state->acc[1] = seed + XXH_PRIME64_2;
+	state->acc[2] = seed;
+	state->acc[3] = seed - XXH_PRIME64_1;
+	state->total = 0;
+	state->buf_size = 0;
+}
+
+
+static void
+xxh64_update(xzf_xxh64 *state, const unsigned char *buf, size_t size)
+{
+	state->total += size;
+
+	// Complete a stripe that was left partial by the previous call.
+	if (state->buf_size > 0) {
+		size_t n = 32 - state->buf_size;
+		if (n > size)
+			n = size;
+
+		memcpy(state->buf + state->buf_size, buf, n);
+		state->buf_size += n;
+		buf += n;
+		size -= n;
+
+		if (state->buf_size < 32)
+			return;
+
+		xxh64_stripes(state->acc, state->buf, 32);
+		state->buf_size = 0;
+	}
+
+	const size_t used = xxh64_stripes(state->acc, buf, size);
+
+	if (used < size) {
+		memcpy(state->buf, buf + used, size - used);
+		state->buf_size = size - used;
+	}
+}
+
+
+extern void
+xzf_cb_xxh64(void *state, const unsigned char *buf, size_t size)
+{
+	xxh64_update(state, buf, size);
+}
+
+
+extern uint64_t
+xzf_xxh64_digest(const xzf_xxh64 *state)
+{
+	uint64_t h;
+
+	if (state->total >= 32) {
+		h = rotl64(state->acc[0], 1) + rotl64(state->acc[1], 7)
+				+ rotl64(state->acc[2], 12)
+				+ rotl64(state->acc[3], 18);
+		for (size_t i = 0; i < 4; ++i)
+			h = xxh64_merge_round(h, state->acc[i]);
+	} else {
+		// acc[2] is still the seed.
+		h = state->acc[2] + XXH_PRIME64_5;
+	}
+
+	h += state->total;
+
+	const unsigned char *p = state->buf;
+	size_t size = state->buf_size;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		h ^= xxh64_round(0, read64le(p));
+		h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+
+	if (size >= 4) {
+		h ^= (uint64_t)read32le(p) * XXH_PRIME64_1;
+		h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+		size -= 4;
+	}
+
+	for (; size > 0; ++p, --size) {
+		h ^= *p * XXH_PRIME64_5;
+		h = rotl64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+//////////////
+// Combined //
+//////////////
+
+extern void
+xzf_checksums_init(xzf_checksums *sums, int checks)
+{
+	sums->checks = checks;
+	sums->crc32 = 0;
+	sums->crc32c = 0;
+	sums->crc64 = 0;
+	xzf_xxh64_init(&sums->xxh64, 0);
+}
+
+
+extern void
+xzf_cb_checksums(void *state, const unsigned char *buf, size_t size)
+{
+	xzf_checksums *sums = state;
+	const int checks = sums->checks;
+
+	while (size > 0) {
+		const size_t n = size < CHECKSUMS_BLOCK
+				? size : CHECKSUMS_BLOCK;
+
+		if (checks & XZF_CHECK_CRC32)
+			sums->crc32 = crc32_update(buf, n, sums->crc32);
+
+		if (checks & XZF_CHECK_CRC32C)
+			sums->crc32c = crc32c_update(buf, n, sums->crc32c);
+
+		if (checks & XZF_CHECK_CRC64)
+			sums->crc64 = lzma_crc64(buf, n, sums->crc64);
+
+		if (checks & XZF_CHECK_XXH64)
+			xxh64_update(&sums->xxh64, buf, n);
+
+		buf += n;
+		size -= n;
+	}
+}
@@ -39,8 +39,6 @@ typedef struct xzf_stream xzf_stream;
 #endif
 
 
-#define XZF_OFF_MAX LLONG_MAX
-
 #define XZF_BUF_MAX PTRDIFF_MAX
 #if XZF_BUF_MAX > XZF_OFF_MAX
 #	undef XZF_BUF_MAX
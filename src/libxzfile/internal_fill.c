@@ -112,6 +112,14 @@ xzf_internal_fill(xzf_stream *strm, size_t min_fill)
 	// FIXME: This isn't so simple. E.g. what about EOF flag?
 	if (strm->errnum != 0
 			|| (strm->eof && strm->in_next >= strm->in_end)) {
+		// The buffer of the backend must be given back still.
+		// Otherwise it would be freed as if it was our own buffer.
+		if (strm->backend_peekin) {
+			(void)fill_with_peekin(strm, 0);
+			strm->in_next = strm->in_buf;
+			strm->in_stop = strm->in_buf;
+		}
+
 		errno = strm->errnum != 0 ? strm->errnum : XZF_E_EOF;
 		return -1;
 	}
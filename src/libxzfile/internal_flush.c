@@ -76,8 +76,10 @@ flush_with_peekout(xzf_stream *strm, size_t min_size)
 		}
 	}
 
+	// The backend may give less than out_buf_size as long as
+	// it is at least min_size.
 	assert(strm->out_buf != NULL);
-	strm->out_end = strm->out_buf + strm->out_buf_size;
+	strm->out_end = strm->out_buf + size;
 	strm->backend_peekout = true;
 	return 0;
 }
@@ -88,6 +90,17 @@ xzf_internal_flush(xzf_stream *strm, size_t min_size)
 {
 	// If an error has already occurred, return immediately.
 	if (strm->errnum != 0) {
+		// The buffer of the backend must be given back still.
+		// Nothing more is written after an error.
+		if (min_size == 0 && strm->backend_peekout) {
+			(void)strm->backend->peekout_end(strm->state, 0);
+			strm->out_buf = NULL;
+			strm->out_end = NULL;
+			strm->out_next = NULL;
+			strm->out_stop = NULL;
+			strm->backend_peekout = false;
+		}
+
 		errno = strm->errnum;
 		return -1;
 	}
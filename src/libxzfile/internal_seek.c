@@ -13,7 +13,7 @@
 extern xzf_off
 xzf_internal_seek(xzf_stream *strm, xzf_off offset, enum xzf_whence whence)
 {
-	if ((unsigned int)whence > XZF_SEEK_END || offset < -XZF_OFF_MAX) {
+	if ((unsigned int)whence > XZF_SEEK_HOLE || offset < -XZF_OFF_MAX) {
 		strm->errnum = errno = EINVAL;
 		return -1;
 	}
@@ -34,6 +34,8 @@ xzf_internal_seek(xzf_stream *strm, xzf_off offset, enum xzf_whence whence)
 
 	switch (whence) {
 		case XZF_SEEK_SET:
+		case XZF_SEEK_DATA:
+		case XZF_SEEK_HOLE:
 			if (offset < 0) {
 				strm->errnum = errno = EINVAL;
 				return -1;
@@ -67,11 +69,21 @@ xzf_internal_seek(xzf_stream *strm, xzf_off offset, enum xzf_whence whence)
 	const int errnum = strm->backend->seek(
 			strm->state, &offset, whence);
 	if (errnum != 0) {
-		strm->errnum = errno = errnum;
+		// ENXIO from XZF_SEEK_DATA only tells that there is no
+		// more data. It isn't an error in the stream.
+		if (errnum == ENXIO && whence >= XZF_SEEK_DATA)
+			errno = errnum;
+		else
+			strm->errnum = errno = errnum;
+
 		return -1;
 	}
 
 	strm->in_next = strm->in_end;
 
+	// A successful seek clears the end-of-file indicator
+	// like fseek() does.
+	strm->eof = false;
+
 	return offset;
 }
@@ -0,0 +1,36 @@
+/*
+ * Internal getinfo keys
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#ifndef XZF_KEYS_H
+#define XZF_KEYS_H
+
+/// The getinfo keys that are used only inside the library. xzfile.h
+/// reserves the values from -1000 downwards for them. They are all
+/// defined here so that they cannot collide with each other.
+
+
+/// XZF_KEY_ZINDEX_COPY fills a struct xzf_zindex * with a copy of the index
+/// of a decompressor using xzf_zindex_copy(). The caller frees it with
+/// xzf_zindex_end(). The index itself cannot be handed out because the
+/// decoder may add entries to it as soon as the lock is released.
+///
+/// XZF_KEY_ZINDEX_SET replaces the index with a new one (struct xzf_zindex *)
+/// using xzf_zindex_replace(). EBUSY is returned if decompression has
+/// already started because the decoder may refer to the old entries.
+///
+/// These are used by xzf_index_save() and xzf_index_load(). The backends
+/// handle them under the lock of the decompressor stream.
+#define XZF_KEY_ZINDEX_COPY   (-1001)
+#define XZF_KEY_ZINDEX_SET    (-1002)
+
+/// Used by xzf_memout_getiov(). The value is struct memout_iov *
+/// that is defined in backend_mem.c.
+#define XZF_KEY_MEMIOV        (-1003)
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ * xzf_copy()
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "internal.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_SENDFILE_H
+#	include <sys/sendfile.h>
+#endif
+
+
+/// File descriptor and position of one end of a kernel copy
+struct copy_end {
+	int fd;
+
+	/// True if the position is passed to the kernel explicitly.
+	/// Otherwise the file offset of the descriptor is used, which
+	/// is the only option with pipes and sockets.
+	bool seekable;
+	xzf_off pos;
+};
+
+
+/// Amount to copy in one system call
+static size_t
+copy_limit(xzf_off left)
+{
+	return (unsigned long long)left < SSIZE_MAX
+			? (size_t)left : SSIZE_MAX;
+}
+
+
+/// Tells if the error means that the copying method cannot be used
+/// with these descriptors, in which case the next method is tried.
+static bool
+is_unsupported(int errnum)
+{
+	return errnum == EINVAL || errnum == ENOSYS || errnum == EXDEV
+			|| errnum == EBADF || errnum == EOPNOTSUPP
+			|| errnum == ESPIPE;
+}
+
+
+#ifdef HAVE_COPY_FILE_RANGE
+/// Copy between regular files. Some filesystems share the extents
+/// between the files instead of copying the data.
+static ssize_t
+copy_with_copy_file_range(struct copy_end *dst, struct copy_end *src,
+		size_t size)
+{
+	loff_t src_pos = src->pos;
+	loff_t dst_pos = dst->pos;
+	return copy_file_range(src->fd, src->seekable ? &src_pos : NULL,
+			dst->fd, dst->seekable ? &dst_pos : NULL, size, 0);
+}
+#endif
+
+
+#ifdef HAVE_SYS_SENDFILE_H
+/// Copy from a file that can be mapped to memory to anything,
+/// for example to a socket.
+static ssize_t
+copy_with_sendfile(struct copy_end *dst, struct copy_end *src, size_t size)
+{
+	if (!src->seekable) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// sendfile() writes at the file offset of dst.
+	if (dst->seekable && lseek(dst->fd, (off_t)dst->pos, SEEK_SET) == -1)
+		return -1;
+
+	off_t src_pos = (off_t)src->pos;
+	return sendfile(dst->fd, src->fd, &src_pos, size);
+}
+#endif
+
+
+#ifdef HAVE_SPLICE
+/// Copy from or to a pipe.
+static ssize_t
+copy_with_splice(struct copy_end *dst, struct copy_end *src, size_t size)
+{
+	loff_t src_pos = src->pos;
+	loff_t dst_pos = dst->pos;
+	return splice(src->fd, src->seekable ? &src_pos : NULL,
+			dst->fd, dst->seekable ? &dst_pos : NULL,
+			size, SPLICE_F_MOVE);
+}
+#endif
+
+
+typedef ssize_t (*copy_function)(
+		struct copy_end *dst, struct copy_end *src, size_t size);
+
+static const copy_function copy_functions[] = {
+#ifdef HAVE_COPY_FILE_RANGE
+	&copy_with_copy_file_range,
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+	&copy_with_sendfile,
+#endif
+#ifdef HAVE_SPLICE
+	&copy_with_splice,
+#endif
+	NULL
+};
+
+
+/// Copy up to *left bytes in the kernel. *left is decremented by
+/// the amount copied. If no method works with these descriptors or
+/// the end of the file may have been reached, *left is left non-zero
+/// and zero is returned.
+static int
+copy_in_kernel(struct copy_end *dst, struct copy_end *src, xzf_off *left)
+{
+	for (size_t i = 0; copy_functions[i] != NULL; ++i) {
+		while (*left > 0) {
+			const ssize_t ret = copy_functions[i](
+					dst, src, copy_limit(*left));
+
+			if (ret > 0) {
+				*left -= ret;
+				src->pos += ret;
+				dst->pos += ret;
+				continue;
+			}
+
+			// Reading via peekin confirms the end of the file.
+			// Some special files look empty to the kernel
+			// copying functions although they aren't.
+			if (ret == 0)
+				return 0;
+
+			if (errno == EINTR)
+				continue;
+
+			if (!is_unsupported(errno))
+				return errno;
+
+			// Try the next method from the current position.
+			break;
+		}
+
+		if (*left == 0)
+			break;
+	}
+
+	return 0;
+}
+
+
+/// Get the descriptor of a stream that reads or writes the descriptor
+/// directly without any processing in between.
+static bool
+get_end(xzf_stream *strm, struct copy_end *end)
+{
+	xzf_stream *sub;
+	if (xzf_getinfo(strm, XZF_KEY_SUBSTREAM, &sub) == 0
+			|| xzf_getinfo(strm, XZF_KEY_FD, &end->fd) != 0)
+		return false;
+
+	end->seekable = (xzf_getflags(strm) & XZF_SEEKABLE) != 0;
+	end->pos = 0;
+
+	if (end->seekable) {
+		end->pos = xzf_seek(strm, 0, XZF_SEEK_CUR);
+		if (end->pos == -1)
+			return false;
+	}
+
+	return true;
+}
+
+
+/// Copy the data in the input buffer of src and then the rest via
+/// peekin. The data is written from the buffer of src, so large
+/// amounts go to the backend of dst without an intermediate copy.
+static int
+copy_with_peekin(xzf_stream *dst, xzf_stream *src, xzf_off *left)
+{
+	while (*left > 0) {
+		const unsigned char *buf;
+		size_t size = xzf_peekin_start(src, &buf, 1);
+		if (size == 0)
+			return errno;
+
+		if ((unsigned long long)size > (unsigned long long)*left)
+			size = (size_t)*left;
+
+		const int errnum = xzf_write(dst, buf, size) ? errno : 0;
+		xzf_peekin_end(src, errnum != 0 ? 0 : size);
+		if (errnum != 0)
+			return errnum;
+
+		*left -= (xzf_off)size;
+	}
+
+	return 0;
+}
+
+
+/// Copy only what is already in the input buffer of src.
+static int
+copy_buffered(xzf_stream *dst, xzf_stream *src, xzf_off *left)
+{
+	internal_lock(src);
+	const size_t avail = src->is_reading ? src->in_end - src->in_next : 0;
+	internal_unlock(src);
+
+	if (avail == 0)
+		return 0;
+
+	xzf_off amount = (unsigned long long)avail < (unsigned long long)*left
+			? (xzf_off)avail : *left;
+	*left -= amount;
+	const int errnum = copy_with_peekin(dst, src, &amount);
+	*left += amount;
+	return errnum;
+}
+
+
+extern xzf_off
+xzf_copy(xzf_stream *dst, xzf_stream *src, xzf_off max)
+{
+	if (max < 0 || dst == src) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((xzf_getflags(src) & XZF_READ) == 0) {
+		errno = XZF_E_NOTREADABLE;
+		return -1;
+	}
+
+	if ((xzf_getflags(dst) & XZF_WRITE) == 0) {
+		errno = XZF_E_NOTWRITABLE;
+		return -1;
+	}
+
+	xzf_off left = max;
+	int errnum = copy_buffered(dst, src, &left);
+
+	struct copy_end dst_end;
+	struct copy_end src_end;
+	if (errnum == 0 && left > 0
+			&& get_end(src, &src_end) && get_end(dst, &dst_end)) {
+		// The output that has been buffered in dst
+		// must be written before the kernel copies anything.
+		if (xzf_flush(dst, 0))
+			errnum = errno;
+
+		const xzf_off before = left;
+		if (errnum == 0)
+			errnum = copy_in_kernel(&dst_end, &src_end, &left);
+
+		// Tell the streams where the kernel left the files.
+		if (left != before) {
+			if (src_end.seekable && xzf_seek(src, src_end.pos,
+					XZF_SEEK_SET) == -1 && errnum == 0)
+				errnum = errno;
+
+			if (dst_end.seekable && xzf_seek(dst, dst_end.pos,
+					XZF_SEEK_SET) == -1 && errnum == 0)
+				errnum = errno;
+		}
+	}
+
+	if (errnum == 0)
+		errnum = copy_with_peekin(dst, src, &left);
+
+	if (errnum != 0)
+		errno = errnum;
+
+	return max - left;
+}
@@ -19,6 +19,14 @@ xzf_getinfo(xzf_stream *strm, int key, void *value)
 	assert(!strm->frontend_peekin);
 	assert(!strm->frontend_peekout);
 
+	// A backend that gives input with peekin knows its position
+	// only after the frontend has told how much it has used.
+	if (key == XZF_KEY_ZOFFSET && strm->backend_peekin
+			&& xzf_internal_fill(strm, 0)) {
+		internal_unlock(strm);
+		return -1;
+	}
+
 	if (strm->backend->getinfo != NULL) {
 		ret = strm->backend->getinfo(strm->state, key, value);
 		if (ret != 0) {
@@ -0,0 +1,434 @@
+/*
+ * xzf_index_save() and xzf_index_load()
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+#include "zindex.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#ifdef HAVE_MMAP
+#	include <sys/mman.h>
+#endif
+
+#ifndef O_CLOEXEC
+#	define O_CLOEXEC 0
+#endif
+
+
+// Index file format, all integers little endian:
+//
+//     Header (56 bytes)
+//         8   Magic bytes
+//         4   Format version
+//         4   XZF_Z_GZ or XZF_Z_XZ
+//         8   Size of the compressed file
+//         8   Modification time of the compressed file: seconds
+//         4   Modification time of the compressed file: nanoseconds
+//         4   Reserved (zero)
+//         8   Uncompressed size or 2^64 - 1 if unknown
+//         8   Number of entries
+//
+//     Entries (48 bytes each)
+//         8   Compressed offset relative to the beginning of
+//             the compressed data
+//         8   Uncompressed offset
+//         4   .xz Check ID
+//         4   .gz bit position
+//         4   .gz CRC32 of the member so far
+//         4   .gz size of the member so far
+//         8   Offset of the window in the index file
+//         4   Size of the window
+//         4   Reserved (zero)
+//
+//     4   CRC32 of everything above and of the windows
+//
+//     Windows
+//
+// The windows are used directly from the memory-mapped index file.
+
+#define INDEX_MAGIC "\xFDXZFIDX\n"
+#define INDEX_MAGIC_SIZE 8
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 56
+#define INDEX_ENTRY_SIZE 48
+#define INDEX_CRC_SIZE 4
+
+
+static void
+write32le(unsigned char *buf, uint32_t num)
+{
+	buf[0] = (unsigned char)num;
+	buf[1] = (unsigned char)(num >> 8);
+	buf[2] = (unsigned char)(num >> 16);
+	buf[3] = (unsigned char)(num >> 24);
+}
+
+
+static void
+write64le(unsigned char *buf, uint64_t num)
+{
+	write32le(buf, (uint32_t)num);
+	write32le(buf + 4, (uint32_t)(num >> 32));
+}
+
+
+static uint32_t
+read32le(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8)
+			| ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+
+static uint64_t
+read64le(const unsigned char *buf)
+{
+	return (uint64_t)read32le(buf) | ((uint64_t)read32le(buf + 4) << 32);
+}
+
+
+/// crc32() from zlib takes the size as uInt which may be smaller than size_t.
+static uint32_t
+crc32_buf(uint32_t crc, const unsigned char *buf, size_t size)
+{
+	while (size > 0) {
+		size_t n = size;
+#if UINT_MAX < SIZE_MAX
+		if (n > UINT_MAX)
+			n = UINT_MAX;
+#endif
+
+		crc = (uint32_t)crc32(crc, buf, (uInt)n);
+		buf += n;
+		size -= n;
+	}
+
+	return crc;
+}
+
+
+/// Get a copy of the index, the compression type, and the identity of
+/// the compressed file. Returns zero on success and an error number on
+/// error. On success the caller must free idx with xzf_zindex_end().
+static int
+get_index(xzf_stream *stream, struct xzf_zindex *idx, int *ztype,
+		struct stat *st)
+{
+	int fd;
+	if (xzf_getinfo(stream, XZF_KEY_ZTYPE, ztype)
+			|| xzf_getinfo(stream, XZF_KEY_FD, &fd))
+		return errno;
+
+	if (fstat(fd, st))
+		return errno;
+
+	// The decoder may keep adding entries to its index, for example
+	// in the thread of a read-ahead stage, so a copy is used.
+	return xzf_getinfo(stream, XZF_KEY_ZINDEX_COPY, idx) ? errno : 0;
+}
+
+
+/// Fill the header of the index file
+static void
+encode_header(unsigned char *buf, const struct xzf_zindex *idx, int ztype,
+		const struct stat *st)
+{
+	memcpy(buf, INDEX_MAGIC, INDEX_MAGIC_SIZE);
+	write32le(buf + 8, INDEX_VERSION);
+	write32le(buf + 12, (uint32_t)ztype);
+	write64le(buf + 16, (uint64_t)st->st_size);
+	write64le(buf + 24, (uint64_t)st->st_mtime);
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	write32le(buf + 32, (uint32_t)st->st_mtim.tv_nsec);
+#else
+	write32le(buf + 32, 0);
+#endif
+	write32le(buf + 36, 0);
+	write64le(buf + 40, idx->usize == -1 ? UINT64_MAX
+			: (uint64_t)idx->usize);
+	write64le(buf + 48, idx->count);
+}
+
+
+/// Write the index file. Returns zero on success and an error number
+/// on error.
+static int
+save_index(const struct xzf_zindex *idx, int ztype, const struct stat *st,
+		const char *filename)
+{
+	// The header and the entries are built in memory so that
+	// the CRC32 can be calculated easily.
+	if (idx->count > (SIZE_MAX - INDEX_HEADER_SIZE - INDEX_CRC_SIZE)
+			/ INDEX_ENTRY_SIZE)
+		return ENOMEM;
+
+	const size_t meta_size = INDEX_HEADER_SIZE
+			+ idx->count * INDEX_ENTRY_SIZE + INDEX_CRC_SIZE;
+	unsigned char *meta = malloc(meta_size);
+	if (meta == NULL)
+		return ENOMEM;
+
+	encode_header(meta, idx, ztype, st);
+
+	uint64_t window_pos = meta_size;
+	unsigned char *buf = meta + INDEX_HEADER_SIZE;
+
+	for (size_t i = 0; i < idx->count; ++i) {
+		const struct xzf_zindex_entry *entry = &idx->entries[i];
+
+		write64le(buf, (uint64_t)(entry->in - idx->base));
+		write64le(buf + 8, (uint64_t)entry->out);
+		write32le(buf + 16, entry->check);
+		write32le(buf + 20, entry->bits);
+		write32le(buf + 24, entry->crc);
+		write32le(buf + 28, entry->isize);
+		write64le(buf + 32, entry->window_size == 0 ? 0 : window_pos);
+		write32le(buf + 40, (uint32_t)entry->window_size);
+		write32le(buf + 44, 0);
+
+		window_pos += entry->window_size;
+		buf += INDEX_ENTRY_SIZE;
+	}
+
+	uint32_t crc = crc32_buf(0, meta, (size_t)(buf - meta));
+	for (size_t i = 0; i < idx->count; ++i)
+		crc = crc32_buf(crc, idx->entries[i].window,
+				idx->entries[i].window_size);
+
+	write32le(buf, crc);
+
+	xzf_stream *file = xzf_fd_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0666);
+	if (file == NULL) {
+		free(meta);
+		return errno;
+	}
+
+	int errnum = xzf_write(file, meta, meta_size) ? errno : 0;
+	free(meta);
+
+	for (size_t i = 0; errnum == 0 && i < idx->count; ++i)
+		if (xzf_write(file, idx->entries[i].window,
+				idx->entries[i].window_size))
+			errnum = errno;
+
+	if (errnum == 0) {
+		if (xzf_close(file, 0))
+			errnum = errno;
+	} else {
+		(void)xzf_close(file, XZF_CL_FORGET);
+	}
+
+	if (errnum != 0)
+		(void)unlink(filename);
+
+	return errnum;
+}
+
+
+extern int
+xzf_index_save(xzf_stream *stream, const char *filename)
+{
+	struct xzf_zindex idx;
+	int ztype;
+	struct stat st;
+	int errnum = get_index(stream, &idx, &ztype, &st);
+	if (errnum == 0) {
+		errnum = save_index(&idx, ztype, &st, filename);
+		xzf_zindex_end(&idx);
+	}
+
+	if (errnum != 0) {
+		errno = errnum;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/// Read the whole index file into memory. The file is memory-mapped
+/// if possible.
+static int
+map_file(const char *filename, void **map, size_t *map_size)
+{
+	const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return errno;
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		const int saved_errno = errno;
+		(void)close(fd);
+		return saved_errno;
+	}
+
+	// An empty file cannot be mapped and isn't a valid index anyway.
+	if (st.st_size < INDEX_HEADER_SIZE + INDEX_CRC_SIZE
+			|| (uintmax_t)st.st_size > SIZE_MAX) {
+		(void)close(fd);
+		return XZF_E_FORMAT;
+	}
+
+	*map_size = (size_t)st.st_size;
+
+#ifdef HAVE_MMAP
+	*map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	const int errnum = *map == MAP_FAILED ? errno : 0;
+	(void)close(fd);
+	return errnum;
+#else
+	*map = malloc(*map_size);
+	if (*map == NULL) {
+		(void)close(fd);
+		return ENOMEM;
+	}
+
+	size_t pos = 0;
+	while (pos < *map_size) {
+		const ssize_t ret = read(fd, (char *)*map + pos,
+				*map_size - pos);
+		if (ret <= 0) {
+			if (ret == -1 && errno == EINTR)
+				continue;
+
+			const int errnum = ret == 0 ? XZF_E_FORMAT : errno;
+			free(*map);
+			(void)close(fd);
+			return errnum;
+		}
+
+		pos += (size_t)ret;
+	}
+
+	(void)close(fd);
+	return 0;
+#endif
+}
+
+
+/// Validate the index file and build the new index into idx.
+static int
+parse_index(struct xzf_zindex *idx, const unsigned char *map, size_t map_size,
+		int ztype, const struct stat *st)
+{
+	unsigned char header[INDEX_HEADER_SIZE];
+	if (memcmp(map, INDEX_MAGIC, INDEX_MAGIC_SIZE) != 0
+			|| read32le(map + 8) != INDEX_VERSION
+			|| read32le(map + 12) != (uint32_t)ztype)
+		return XZF_E_FORMAT;
+
+	const uint64_t count = read64le(map + 48);
+	if (count > (map_size - INDEX_HEADER_SIZE - INDEX_CRC_SIZE)
+			/ INDEX_ENTRY_SIZE)
+		return XZF_E_FORMAT;
+
+	const size_t meta_size = INDEX_HEADER_SIZE
+			+ (size_t)count * INDEX_ENTRY_SIZE;
+	const size_t windows_pos = meta_size + INDEX_CRC_SIZE;
+	uint32_t crc = crc32_buf(0, map, meta_size);
+	crc = crc32_buf(crc, map + windows_pos, map_size - windows_pos);
+	if (read32le(map + meta_size) != crc)
+		return XZF_E_FORMAT;
+
+	// Compare the header to what it would be if the index was saved
+	// now. The uncompressed size is allowed to differ because it
+	// might not have been known yet.
+	const uint64_t usize = read64le(map + 40);
+	if (usize != UINT64_MAX && usize > (uint64_t)XZF_OFF_MAX)
+		return XZF_E_FORMAT;
+
+	idx->usize = usize == UINT64_MAX ? -1 : (xzf_off)usize;
+	encode_header(header, idx, ztype, st);
+	if (memcmp(map + 16, header + 16, 24) != 0)
+		return XZF_E_STALE;
+
+	const unsigned char *buf = map + INDEX_HEADER_SIZE;
+	for (uint64_t i = 0; i < count; ++i) {
+		const uint64_t in = read64le(buf);
+		const uint64_t out = read64le(buf + 8);
+		const unsigned int bits = read32le(buf + 20);
+		const uint64_t window_pos = read64le(buf + 32);
+		const uint32_t window_size = read32le(buf + 40);
+
+		if (in > (uint64_t)(XZF_OFF_MAX - idx->base)
+				|| out > (uint64_t)XZF_OFF_MAX
+				|| (idx->count > 0 && (xzf_off)out
+					<= idx->entries[idx->count - 1].out)
+				|| bits > 7 || window_size > 32768
+				|| window_pos > map_size
+				|| map_size - window_pos < window_size)
+			return XZF_E_FORMAT;
+
+		struct xzf_zindex_entry *entry = xzf_zindex_add(idx,
+				idx->base + (xzf_off)in, (xzf_off)out);
+		if (entry == NULL)
+			return ENOMEM;
+
+		entry->check = read32le(buf + 16);
+		entry->bits = bits;
+		entry->crc = read32le(buf + 24);
+		entry->isize = read32le(buf + 28);
+
+		// The window is used directly from the map.
+		if (window_size > 0) {
+			entry->window = (unsigned char *)map + window_pos;
+			entry->window_size = window_size;
+		}
+
+		buf += INDEX_ENTRY_SIZE;
+	}
+
+	return 0;
+}
+
+
+extern int
+xzf_index_load(xzf_stream *stream, const char *filename)
+{
+	struct xzf_zindex idx;
+	int ztype;
+	struct stat st;
+	int errnum = get_index(stream, &idx, &ztype, &st);
+	if (errnum != 0) {
+		errno = errnum;
+		return -1;
+	}
+
+	// The index of the decompressor is replaced under its lock
+	// only after the whole file has been validated. Only the base
+	// offset is needed from the current index.
+	struct xzf_zindex new_idx;
+	xzf_zindex_init(&new_idx);
+	new_idx.base = idx.base;
+	xzf_zindex_end(&idx);
+
+	errnum = map_file(filename, &new_idx.map, &new_idx.map_size);
+	if (errnum != 0) {
+		errno = errnum;
+		return -1;
+	}
+
+	errnum = parse_index(&new_idx, new_idx.map, new_idx.map_size,
+			ztype, &st);
+	if (errnum == 0 && xzf_getinfo(stream, XZF_KEY_ZINDEX_SET, &new_idx))
+		errnum = errno;
+
+	if (errnum != 0) {
+		xzf_zindex_end(&new_idx);
+		errno = errnum;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * xzf_open() and xzf_fdopen()
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <stdarg.h>
+
+
+/// Stack a compressor or decompressor on top of a newly opened stream.
+/// The stream is closed with cl_flags if this fails.
+static xzf_stream *
+open_comp(xzf_stream *file, int flags, int zflags, int cl_flags)
+{
+	if (file == NULL || (flags & XZF_COMP) == 0)
+		return file;
+
+	xzf_stream *strm = xzf_xzfopen(file,
+			(flags & XZF_RW) | XZF_COMP, zflags);
+	if (strm == NULL) {
+		const int saved_errno = errno;
+		(void)xzf_close(file, cl_flags);
+		errno = saved_errno;
+	}
+
+	return strm;
+}
+
+
+/// Open a file with the backend that the flags ask for.
+static xzf_stream *
+open_file(const char *filename, int flags, int mode)
+{
+	flags &= ~XZF_COMP;
+
+#ifdef HAVE_MMAP
+	// Only files that are opened read-only can be mapped. Flags that
+	// xzf_mmap_open() doesn't support are left to xzf_fd_open(). This
+	// includes XZF_DIRECT and XZF_NOCACHE because mapping would go
+	// through the page cache. Files that cannot be mapped are read
+	// normally unless only regular files are wanted.
+	static const int mmap_flags = XZF_READ | XZF_NOFOLLOW | XZF_REGFILE
+			| XZF_MMAP | XZF_POPULATE;
+	if ((flags & XZF_MMAP) && (flags & ~mmap_flags) == 0) {
+		xzf_stream *strm = xzf_mmap_open(filename, flags);
+		if (strm != NULL || errno != XZF_E_NOTFILE
+				|| (flags & XZF_REGFILE))
+			return strm;
+	}
+#endif
+
+	return xzf_fd_open(filename, flags & ~(XZF_MMAP | XZF_POPULATE), mode);
+}
+
+
+extern xzf_stream *
+xzf_open(const char *filename, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	const int mode = flags & XZF_CREAT ? va_arg(ap, int) : 0;
+	const int zflags = flags & XZF_COMP ? va_arg(ap, int) : 0;
+	va_end(ap);
+
+	return open_comp(open_file(filename, flags, mode), flags, zflags, 0);
+}
+
+
+extern xzf_stream *
+xzf_fdopen(int fd, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	const int zflags = flags & XZF_COMP ? va_arg(ap, int) : 0;
+	va_end(ap);
+
+	// Like with fdopen(), the file descriptor is left open on failure.
+	return open_comp(xzf_fd_fdopen(fd, flags & ~XZF_COMP), flags, zflags,
+			XZF_CL_DETACH);
+}
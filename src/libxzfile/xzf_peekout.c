@@ -75,7 +75,7 @@ xzf_peekout_end(xzf_stream *strm, size_t size)
 		strm->out_next += size;
 		ret = xzf_internal_flush(strm, 0);
 
-	} else if (memchr(strm->out_next, '\n', size) != NULL) {
+	} else {
 		assert(strm->flags & XZF_LINEBUF);
 
 		// With line-buffered streams, flushing is done if a newline
@@ -84,7 +84,10 @@ xzf_peekout_end(xzf_stream *strm, size_t size)
 		// implementation simple also when the backend uses peeking.
 		// The use of xzf_peekout_start() and _end() is probably
 		// rare on line-buffered streams anyway.
-		ret = xzf_internal_flush(strm, 0);
+		const bool has_newline
+				= memchr(strm->out_next, '\n', size) != NULL;
+		strm->out_next += size;
+		ret = has_newline ? xzf_internal_flush(strm, 0) : 0;
 	}
 
 	strm->frontend_peekout = false;
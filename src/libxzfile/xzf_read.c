@@ -64,18 +64,33 @@ read_directly(xzf_stream *strm, unsigned char *buf, size_t pos, size_t size)
 }
 
 
-extern size_t
-xzf_read(xzf_stream *strm, void *bufptr, size_t size)
+/// Read into buf[pos...size-1] after the input buffer has been emptied.
+static size_t
+read_any(xzf_stream *strm, unsigned char *buf, size_t pos, size_t size)
 {
-	internal_lock(strm);
+	if (pos < size) {
+		// If the total amount requested is greater than or equal
+		// to the internal input buffer size, guess that the
+		// application will request more data using big buffer sizes
+		// and read the data directly from the backend instead of
+		// copying it via the internal input buffer.
+		if (size >= strm->in_buf_size && strm->backend->read != NULL)
+			pos = read_directly(strm, buf, pos, size);
+		else
+			pos = read_via_buf(strm, buf, pos, size);
+	}
 
-	assert(!strm->frontend_peekin);
+	return pos;
+}
 
-	unsigned char *buf = bufptr;
+
+/// Copy from the input buffer to buf[0...size-1].
+static size_t
+read_buffered(xzf_stream *strm, unsigned char *buf, size_t size)
+{
 	size_t pos = 0;
 
-	// Copy from the input buffer first if it isn't empty.
-	if (strm->in_next < strm->in_end) {
+	if (size > 0 && strm->in_next < strm->in_end) {
 		pos = strm->in_end - strm->in_next;
 		if (pos > size)
 			pos = size;
@@ -84,16 +99,167 @@ xzf_read(xzf_stream *strm, void *bufptr, size_t size)
 		strm->in_next += pos;
 	}
 
-	if (pos < size) {
-		// If the total amount requested is greater than or equal
-		// to the internal input buffer size, guess that the
-		// application will request more data using big buffer sizes
-		// and read the data directly from the backend instead of
-		// copying it via the internal input buffer.
-		if (size >= strm->in_buf_size && strm->backend->read != NULL)
-			pos = read_directly(strm, buf, pos, size);
-		else
-			pos = read_via_buf(strm, buf, pos, size);
+	return pos;
+}
+
+
+extern size_t
+xzf_read(xzf_stream *strm, void *bufptr, size_t size)
+{
+	internal_lock(strm);
+
+	assert(!strm->frontend_peekin);
+
+	// Copy from the input buffer first if it isn't empty.
+	unsigned char *buf = bufptr;
+	size_t pos = read_buffered(strm, buf, size);
+	pos = read_any(strm, buf, pos, size);
+
+	internal_unlock(strm);
+	return pos;
+}
+
+
+/// Maximum number of buffers given to backend->readv() at once.
+/// The last one may be the internal input buffer.
+#define READV_BATCH 16
+
+
+/// Read with backend->readv() into the application buffers starting
+/// from iov[*i] at the offset *off. When the batch includes the last
+/// application buffer, the internal input buffer is appended to it so
+/// that the same call reads ahead what would otherwise need another
+/// call to the backend. Returns the number of bytes read into the
+/// application buffers.
+static size_t
+readv_directly(xzf_stream *strm, const xzf_iovec *iov, size_t iovcnt,
+		size_t i, size_t off)
+{
+	assert(strm->backend->readv != NULL);
+	assert(strm->in_next >= strm->in_end);
+
+	// This checks the errors and EOF and switches to reading mode.
+	// The input buffer is empty after this.
+	if (xzf_internal_fill(strm, 0))
+		return 0;
+
+	size_t pos = 0;
+
+	while (true) {
+		while (i < iovcnt && off == iov[i].len) {
+			++i;
+			off = 0;
+		}
+
+		if (i == iovcnt)
+			break;
+
+		xzf_iovec vec[READV_BATCH];
+		size_t n = 0;
+		size_t j = i;
+		vec[n].base = (unsigned char *)iov[j].base + off;
+		vec[n++].len = iov[j++].len - off;
+
+		while (j < iovcnt && n < READV_BATCH - 1)
+			vec[n++] = iov[j++];
+
+		const bool read_ahead = j == iovcnt;
+		if (read_ahead) {
+			vec[n].base = strm->in_buf;
+			vec[n++].len = strm->in_buf_size;
+		}
+
+		size_t size;
+		const int errnum = strm->backend->readv(
+				strm->state, vec, n, &size);
+
+		// Advance in the application buffers. Whatever is left
+		// was read into the input buffer.
+		while (size > 0 && i < iovcnt) {
+			const size_t avail = iov[i].len - off;
+			if (size < avail) {
+				off += size;
+				pos += size;
+				size = 0;
+			} else {
+				size -= avail;
+				pos += avail;
+				++i;
+				off = 0;
+			}
+		}
+
+		if (size > 0) {
+			assert(read_ahead);
+			assert(size <= strm->in_buf_size);
+			strm->in_next = strm->in_buf;
+			strm->in_end = strm->in_buf + size;
+			strm->in_stop = strm->flags & XZF_THRSAFE
+					? strm->in_next : strm->in_end;
+		}
+
+		if (errnum != 0) {
+			if (errnum == XZF_E_EOF)
+				strm->eof = true;
+			else
+				strm->errnum = errnum;
+
+			errno = errnum;
+			break;
+		}
+	}
+
+	return pos;
+}
+
+
+extern size_t
+xzf_readv(xzf_stream *strm, const xzf_iovec *iov, size_t iovcnt)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < iovcnt; ++i) {
+		if (iov[i].len > SIZE_MAX - total) {
+			errno = EINVAL;
+			return 0;
+		}
+
+		total += iov[i].len;
+	}
+
+	internal_lock(strm);
+
+	assert(!strm->frontend_peekin);
+
+	// Copy from the input buffer first if it isn't empty.
+	size_t pos = 0;
+	size_t i = 0;
+	size_t off = 0;
+	while (i < iovcnt && strm->in_next < strm->in_end) {
+		off = read_buffered(strm, iov[i].base, iov[i].len);
+		pos += off;
+		if (off == iov[i].len) {
+			++i;
+			off = 0;
+		}
+	}
+
+	if (pos < total) {
+		if (strm->backend->readv != NULL
+				&& strm->backend->read != NULL) {
+			pos += readv_directly(strm, iov, iovcnt, i, off);
+		} else {
+			// Stop at the first short read.
+			for (; i < iovcnt; ++i) {
+				unsigned char *buf = iov[i].base;
+				const size_t n = read_any(strm, buf, off,
+						iov[i].len);
+				pos += n - off;
+				if (n < iov[i].len)
+					break;
+
+				off = 0;
+			}
+		}
 	}
 
 	internal_unlock(strm);
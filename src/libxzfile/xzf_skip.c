@@ -10,6 +10,18 @@
 #include "internal.h"
 
 
+/// Skip the data in the input buffer. Returns the amount left to skip.
+static xzf_off
+skip_buffered(xzf_stream *strm, xzf_off left)
+{
+	const size_t avail = strm->in_end - strm->in_next;
+	const size_t skip = avail < (unsigned long long)left
+			? avail : (size_t)left;
+	strm->in_next += skip;
+	return left - (xzf_off)skip;
+}
+
+
 static xzf_off
 skip_by_reading(xzf_stream *strm, xzf_off left)
 {
@@ -20,23 +32,51 @@ skip_by_reading(xzf_stream *strm, xzf_off left)
 				&& xzf_internal_fill(strm, 1))
 			return left;
 
-		const size_t avail = strm->in_end - strm->in_next;
-		const size_t skip = avail < (unsigned long long)left
-				? avail : left;
-		strm->in_next += skip;
-		left -= skip;
+		left = skip_buffered(strm, left);
 	}
 
 	return 0;
 }
 
 
+static xzf_off
+skip_with_backend(xzf_stream *strm, xzf_off left)
+{
+	assert(left >= 0);
+
+	left = skip_buffered(strm, left);
+	if (left == 0)
+		return 0;
+
+	// This hands the peeked input back to the backend and
+	// takes care of the error, end of file, and reading mode checks.
+	if (xzf_internal_fill(strm, 0))
+		return left;
+
+	while (left > 0) {
+		xzf_off skipped = left;
+		const int errnum = strm->backend->skip(strm->state, &skipped);
+		assert(skipped >= 0 && skipped <= left);
+		left -= skipped;
+
+		if (errnum != 0) {
+			if (errnum == XZF_E_EOF)
+				strm->eof = true;
+			else
+				strm->errnum = errnum;
+
+			errno = errnum;
+			break;
+		}
+	}
+
+	return left;
+}
+
+
 extern xzf_off
 xzf_skip(xzf_stream *strm, xzf_off amount)
 {
-	// FIXME TODO: Some backends could provide fast skipping even when
-	// they cannot support seeking.
-
 	if (amount < 0) {
 		// FIXME: strm->errnum?
 		errno = EINVAL;
@@ -45,16 +85,20 @@ xzf_skip(xzf_stream *strm, xzf_off amount)
 
 	internal_lock(strm);
 
-	if (amount == 0) {
-		if ((strm->flags & XZF_READ) == 0) {
-			// FIXME: strm->errnum?
-			errno = XZF_E_NOTREADABLE;
-			amount = -1;
-		}
+	if ((strm->flags & XZF_READ) == 0) {
+		// FIXME: strm->errnum?
+		errno = XZF_E_NOTREADABLE;
+		amount = -1;
+
+	} else if (amount == 0) {
+		// Nothing to do
+
+	} else if (strm->backend->skip != NULL) {
+		amount -= skip_with_backend(strm, amount);
 
 	} else if (strm->flags & XZF_SEEKABLE) {
 		// FIXME? Allow seeking past the end of the file?
-		if (xzf_seek(strm, amount, XZF_SEEK_CUR)) // FIXME _internal?
+		if (xzf_internal_seek(strm, amount, XZF_SEEK_CUR) == -1)
 			amount = -1;
 
 	} else {
@@ -62,5 +106,5 @@ xzf_skip(xzf_stream *strm, xzf_off amount)
 	}
 
 	internal_unlock(strm);
-	return 0;
+	return amount;
 }
@@ -205,8 +205,13 @@ xzf_stream_init(xzf_stream_mem *mem,
 	}
 
 	// If preallocation wasn't used, allocate the required memory now.
+	// With peekin and peekout the backend provides the buffers and
+	// the sizes are only the maximum sizes of the peeks.
 	if (strm == NULL) {
-		mem = xzf_stream_prealloc(in_buf_size, out_buf_size);
+		mem = xzf_stream_prealloc(
+				backend->peekin_start != NULL ? 0 : in_buf_size,
+				backend->peekout_start != NULL
+					? 0 : out_buf_size);
 		strm = (xzf_stream *)mem;
 		if (strm == NULL)
 			return NULL;
@@ -9,6 +9,8 @@
 
 #include "internal.h"
 
+#include <stdio.h>
+
 
 // FIXME: Fix after gettext is configured for this package.
 #define _(s) s
@@ -21,16 +23,19 @@
 
 static const char *err_msgs[] = {
 	[-XZF_E_EOF]          = N_("End of input successfully reached"),
-// 	[-XZF_E_UEEOF]        = N_("Unexpected end of input"),
+	[-XZF_E_NOTFILE]      = N_("Not a regular file"),
 	[-XZF_E_NOTREADABLE]  = N_("Not open for reading"),
 	[-XZF_E_NOTWRITABLE]  = N_("Not open for writing"),
-// 	[-XZF_E_FORMAT]       = N_("File format not recognized"),
+	[-XZF_E_FORMAT]       = N_("File format not recognized"),
 	[-XZF_E_ZCORRUPT]     = N_("Compressed data is corrupt"),
 	[-XZF_E_ZTRUNC]       = N_("Compressed data is truncated "
 	                           "or otherwise corrupt"),
-// 	[-XZF_E_ZOPNOTSUP]    = N_("Unsupported compression options"),
-// 	[-XZF_E_ZMEMLIMIT]    = N_("Decompressor memory usage limit reached"),
+	[-XZF_E_ZOPTNOTSUP]   = N_("Unsupported compression options"),
+	[-XZF_E_ZMEMLIMIT]    = N_("Decompressor memory usage limit reached"),
+	[-XZF_E_STALE]        = N_("Index file doesn't match the data file"),
 	[-XZF_E_BUG]          = N_("Internal error (bug)"),
+	[-XZF_E_CALLBACK]     = N_("Callback function failed"),
+	[-XZF_E_NOKEY]        = N_("Unsupported information key"),
 };
 
 
@@ -59,7 +64,7 @@ xzf_strerr(int errnum, xzf_errbuf *buf)
 	}
 
 	// Unknown error number
-	xzf_sprintf(buf->buf, sizeof(buf->buf),
+	snprintf(buf->buf, sizeof(buf->buf),
 			_("Unknown error number %d"), errnum);
 	return buf->buf;
 }
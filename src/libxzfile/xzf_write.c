@@ -101,26 +101,125 @@ write_fullybuf(xzf_stream *strm, const unsigned char *buf, size_t size)
 }
 
 
+static int
+write_any(xzf_stream *strm, const unsigned char *buf, size_t size)
+{
+/* FIXME?
+	const int ret = strm->write_func(strm, buf, size);
+*/
+
+	if ((strm->flags & (XZF_LINEBUF | XZF_UNBUF)) == 0)
+		return write_fullybuf(strm, buf, size);
+
+	if (strm->flags & XZF_LINEBUF)
+		return write_linebuf(strm, buf, size);
+
+	if (strm->backend->write == NULL)
+		return write_via_buf(strm, buf, size);
+
+	return write_unbuf(strm, buf, size);
+}
+
+
 extern int
 xzf_write(xzf_stream *strm, const void *buf, size_t size)
 {
-	int ret;
 	internal_lock(strm);
 
 	assert(!strm->frontend_peekout);
 
-/* FIXME?
-	const int ret = strm->write_func(strm, buf, size);
-*/
+	const int ret = write_any(strm, buf, size);
 
-	if ((strm->flags & (XZF_LINEBUF | XZF_UNBUF)) == 0)
-		ret = write_fullybuf(strm, buf, size);
-	else if (strm->flags & XZF_LINEBUF)
-		ret = write_linebuf(strm, buf, size);
-	else if (strm->backend->write == NULL)
-		ret = write_via_buf(strm, buf, size);
-	else
-		ret = write_unbuf(strm, buf, size);
+	internal_unlock(strm);
+	return ret;
+}
+
+
+/// Maximum number of buffers given to backend->writev() at once.
+/// The first one may be the internal output buffer.
+#define WRITEV_BATCH 16
+
+
+/// Write the data in the output buffer and the application buffers
+/// with backend->writev() so that nothing needs to be copied.
+static int
+write_vectored(xzf_stream *strm, const xzf_iovec *iov, size_t iovcnt)
+{
+	assert(strm->backend->writev != NULL);
+	assert(strm->backend->peekout_start == NULL);
+
+	// Flushing checks the errors and that the stream is open for
+	// writing. Once writing, the buffered data is included in
+	// the first call to backend->writev() instead.
+	if ((strm->errnum != 0 || !strm->is_writing)
+			&& xzf_internal_flush(strm, 0))
+		return -1;
+
+	size_t pending = strm->out_next - strm->out_buf;
+	size_t i = 0;
+
+	while (pending > 0 || i < iovcnt) {
+		xzf_iovec vec[WRITEV_BATCH];
+		size_t n = 0;
+
+		if (pending > 0) {
+			vec[n].base = strm->out_buf;
+			vec[n++].len = pending;
+			pending = 0;
+		}
+
+		while (i < iovcnt && n < WRITEV_BATCH)
+			vec[n++] = iov[i++];
+
+		const int errnum = strm->backend->writev(strm->state, vec, n);
+		if (errnum != 0) {
+			assert(errnum != XZF_E_EOF);
+			errno = strm->errnum = errnum;
+			strm->out_next = strm->out_buf;
+			strm->out_stop = strm->out_buf;
+			strm->out_end = strm->out_buf;
+			return -1;
+		}
+	}
+
+	strm->out_next = strm->out_buf;
+	strm->out_end = strm->out_buf + strm->out_buf_size;
+	strm->out_stop = strm->flags & (XZF_LINEBUF | XZF_UNBUF | XZF_THRSAFE)
+			? strm->out_next : strm->out_end;
+	return 0;
+}
+
+
+extern int
+xzf_writev(xzf_stream *strm, const xzf_iovec *iov, size_t iovcnt)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < iovcnt; ++i) {
+		if (iov[i].len > SIZE_MAX - total) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		total += iov[i].len;
+	}
+
+	int ret = 0;
+	internal_lock(strm);
+
+	assert(!strm->frontend_peekout);
+
+	// Like in write_fullybuf(), big amounts are written without
+	// copying. Line buffering has to look for the newlines.
+	if (strm->backend->writev != NULL && strm->backend->write != NULL
+			&& strm->backend->peekout_start == NULL
+			&& (strm->flags & XZF_LINEBUF) == 0
+			&& (total >= strm->out_buf_size
+				|| (strm->flags & XZF_UNBUF))) {
+		ret = write_vectored(strm, iov, iovcnt);
+	} else {
+		for (size_t i = 0; i < iovcnt && ret == 0; ++i)
+			ret = write_any(strm, iov[i].base, iov[i].len);
+	}
 
 	internal_unlock(strm);
 	return ret;
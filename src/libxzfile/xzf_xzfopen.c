@@ -0,0 +1,133 @@
+/*
+ * xzf_xzfopen()
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <stdarg.h>
+
+
+/// Identify the compression format from the first bytes of the stream
+/// without consuming them. Returns one of XZF_Z_NONE, XZF_Z_GZ, XZF_Z_BZ2,
+/// or XZF_Z_XZ, or -1 on read error.
+static int
+detect(xzf_stream *stream)
+{
+	static const unsigned char xz_magic[6]
+			= { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+
+	const unsigned char *buf;
+	const size_t size = xzf_peekin_start(stream, &buf, sizeof(xz_magic));
+	if (size == 0)
+		return errno == XZF_E_EOF ? XZF_Z_NONE : -1;
+
+	int type = XZF_Z_NONE;
+
+	if (size >= 2 && buf[0] == 0x1F && buf[1] == 0x8B)
+		type = XZF_Z_GZ;
+	else if (size >= sizeof(xz_magic)
+			&& memcmp(buf, xz_magic, sizeof(xz_magic)) == 0)
+		type = XZF_Z_XZ;
+	else if (size >= 4 && buf[0] == 'B' && buf[1] == 'Z'
+			&& buf[2] == 'h' && buf[3] >= '1' && buf[3] <= '9')
+		type = XZF_Z_BZ2;
+
+	xzf_peekin_end(stream, 0);
+	return type;
+}
+
+
+static xzf_stream *
+open_decoder(xzf_stream *stream, int zflags)
+{
+	const int type = detect(stream);
+	if (type == -1)
+		return NULL;
+
+	if ((zflags & type) == 0) {
+		errno = XZF_E_FORMAT;
+		return NULL;
+	}
+
+	const int single = zflags & XZF_Z_SINGLE;
+
+	switch (type) {
+	case XZF_Z_GZ:
+		return xzf_gzin_open(stream, single);
+
+	case XZF_Z_XZ:
+		return xzf_xzin_open(stream, single, 0, 0);
+
+#ifdef HAVE_BZLIB
+	case XZF_Z_BZ2:
+		return xzf_bz2in_open(stream, single);
+#endif
+
+	case XZF_Z_NONE:
+		// Uncompressed input is read directly from the stream.
+		return stream;
+	}
+
+	errno = XZF_E_ZOPTNOTSUP;
+	return NULL;
+}
+
+
+static xzf_stream *
+open_encoder(xzf_stream *stream, int zflags)
+{
+	switch (zflags & XZF_Z_ANY) {
+	case XZF_Z_NONE:
+		return stream;
+
+	case XZF_Z_GZ:
+		return xzf_gzout_open(stream, 6, 0);
+
+	case XZF_Z_XZ:
+		return xzf_xzout_open(stream, 6, 0, 0);
+
+	case XZF_Z_BZ2:
+	case XZF_Z_LZO:
+		errno = XZF_E_ZOPTNOTSUP;
+		return NULL;
+	}
+
+	// Exactly one format must be specified when compressing.
+	errno = EINVAL;
+	return NULL;
+}
+
+
+extern xzf_stream *
+xzf_xzfopen(xzf_stream *stream, int flags, ...)
+{
+	static const int supported_flags = XZF_READ | XZF_WRITE | XZF_COMP;
+	if ((flags & ~supported_flags) || (flags & XZF_RW) == XZF_RW
+			|| (flags & XZF_RW) == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// Without XZF_COMP there is nothing to do.
+	if ((flags & XZF_COMP) == 0)
+		return stream;
+
+	va_list ap;
+	va_start(ap, flags);
+	const int zflags = va_arg(ap, int);
+	va_end(ap);
+
+	if (zflags & ~(XZF_Z_ANY | XZF_Z_SINGLE)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return flags & XZF_READ ? open_decoder(stream, zflags)
+			: open_encoder(stream, zflags);
+}
@@ -17,6 +17,8 @@
 #define XZF_XZFILE_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -139,6 +141,10 @@ extern "C" {
 
 /**
  * \brief       Try to make the file sparse when writing
+ *
+ * When reading, holes in the file are returned as zeros without
+ * reading them from the kernel. This makes copying sparse files
+ * much faster.
  */
 #define XZF_SPARSE      0x4000
 
@@ -147,6 +153,52 @@ extern "C" {
  */
 #define XZF_COMP        0x8000
 
+/**
+ * \brief       Read a regular file via a memory mapping
+ *
+ * xzf_open() uses xzf_mmap_open() if this is used with XZF_READ without
+ * XZF_WRITE and without flags that only xzf_fd_open() supports, such as
+ * XZF_DIRECT and XZF_NOCACHE. Files that cannot be mapped are read
+ * normally unless XZF_REGFILE is used too. The file must not be truncated
+ * while it is being read or the process gets SIGBUS.
+ */
+#define XZF_MMAP        0x10000
+
+/**
+ * \brief       Fault in the whole mapping when the file is mapped
+ *
+ * This maps to MAP_POPULATE in mmap(2) if it is available. It helps
+ * with files that will be read completely and are likely to be cached.
+ */
+#define XZF_POPULATE    0x20000
+
+/**
+ * \brief       Bypass the page cache with direct I/O
+ *
+ * xzf_fd_open() opens the file with O_DIRECT and reads and writes it
+ * through its own buffer that is aligned to the block size. Unaligned
+ * data at the end of the file and around seek positions is handled with
+ * read-modify-write of the partial blocks, so a file opened for writing
+ * needs to be readable too. This can be used with either XZF_READ or
+ * XZF_WRITE but not both, and not with XZF_APPEND or XZF_SPARSE. Only
+ * regular files and block devices are supported. If the file system
+ * doesn't support O_DIRECT, the file is still accessed in large aligned
+ * blocks but via the page cache.
+ */
+#define XZF_DIRECT      0x40000
+
+/**
+ * \brief       Keep a file that is read or written once out of the cache
+ *
+ * The file descriptor backend drops the pages behind the current
+ * position from the page cache with posix_fadvise(). Written data is
+ * first written to the disk with sync_file_range() so that the pages can
+ * be dropped. When reading, the kernel is asked to read ahead. Unlike
+ * XZF_DIRECT, this keeps the normal buffered semantics. It is ignored
+ * with XZF_DIRECT and with other than regular files and block devices.
+ */
+#define XZF_NOCACHE     0x80000
+
 #define XZF_Z_NONE      0x0001
 #define XZF_Z_GZ        0x0002
 #define XZF_Z_BZ2       0x0004
@@ -186,7 +238,7 @@ extern "C" {
 #define XZF_CL_SYNC     0x10
 
 
-/* Keys */
+/* Keys. Values from -1000 downwards are used internally. */
 
 #define XZF_KEY_FD            (-1)
 #define XZF_KEY_ISATTY        (-2)
@@ -214,6 +266,9 @@ extern "C" {
 #define XZF_E_BUG (-8)
 #define XZF_E_CALLBACK (-9)
 #define XZF_E_NOKEY (-10)
+#define XZF_E_FORMAT (-11)
+#define XZF_E_ZMEMLIMIT (-12)
+#define XZF_E_STALE (-13)
 
 
 #ifndef XZF_INTERNAL_H
@@ -243,6 +298,8 @@ typedef struct xzf_stream {
 typedef long long xzf_off;
 typedef unsigned long long xzf_u_off; // FIXME? In case someone needs unsigned?
 
+#define XZF_OFF_MAX LLONG_MAX
+
 // FIXME?
 #define XZF_PRIiOFF "lli"
 #define XZF_PRIdOFF "lld"
@@ -251,12 +308,29 @@ typedef unsigned long long xzf_u_off; // FIXME? In case someone needs unsigned?
 #define XZF_PRIXOFF "llX"
 
 
+/**
+ * \brief       One buffer of scatter/gather I/O (compare to struct iovec)
+ */
+typedef struct xzf_iovec {
+	void *base;
+	size_t len;
+} xzf_iovec;
+
+
 enum xzf_whence {
 	XZF_SEEK_SET = 0,
 	XZF_SEEK_CUR = 1,
-	XZF_SEEK_END = 2
-// FIXME? Also XZF_SEEK_HOLE and XZF_SEEK_DATA for sparse support?
-// Solaris has those and on Linux they can nowadays be emulated with fiemap.
+	XZF_SEEK_END = 2,
+
+	/// Seek to the first byte of data at or after the offset. Like
+	/// SEEK_DATA in lseek(2), the offset is absolute and the seek
+	/// fails with ENXIO if there is no data after it. Only backends
+	/// that read sparse files support this.
+	XZF_SEEK_DATA = 3,
+
+	/// Seek to the first hole at or after the offset. The end of
+	/// the file counts as a hole.
+	XZF_SEEK_HOLE = 4
 // FIXME? Also XZF_SEEK_BLOCK to locate .xz block boundaries?
 };
 
@@ -289,7 +363,24 @@ struct xzf_backend {
 
 	// FIXME TODO? int (*setflags)(void *state, int flags);
 
-	int (*reserved[21])(void *);
+	/* Discard up to *amount bytes of input without returning them.
+	   *amount is set to the number of bytes skipped. Like read(),
+	   XZF_E_EOF is returned if the end of the input was reached.
+	   This is never called with *amount == 0. Backends that
+	   decompress can skip much faster than the frontend because
+	   the data doesn't need to be copied to the input buffer. */
+	int (*skip)(void *state, xzf_off *amount);
+
+	/* Like read() and write() but with iovcnt buffers. These are
+	   optional and are used only if read() or write() is also
+	   available. readv() may read less than requested and sets
+	   *size to the number of bytes read. writev() must write
+	   everything. Empty buffers may be included. */
+	int (*readv)(void *state, const xzf_iovec *iov, size_t iovcnt,
+			size_t *size);
+	int (*writev)(void *state, const xzf_iovec *iov, size_t iovcnt);
+
+	int (*reserved[18])(void *);
 };
 
 typedef struct xzf_stream_mem xzf_stream_mem;
@@ -330,9 +421,48 @@ extern xzf_stream *xzf_stderr;
 extern int xzf_stdio_open(void);
 extern int xzf_stdio_close(void);
 
+/**
+ * \brief       Open a file, optionally with compression support
+ *
+ * If flags contains XZF_CREAT, the third argument is the mode (int)
+ * for the new file. If flags contains XZF_COMP, the next argument is
+ * an int that contains the XZF_Z_* flags to pass to xzf_xzfopen().
+ */
 extern xzf_stream *xzf_open(const char *filename, int flags, ...);
+
+/**
+ * \brief       Stack a compressor or decompressor on top of a stream
+ *
+ * flags must contain either XZF_READ or XZF_WRITE. If flags contains
+ * XZF_COMP, the third argument is an int with the XZF_Z_* flags.
+ * Otherwise the stream is returned as is.
+ *
+ * When reading, the format is detected from the first bytes of the stream.
+ * The XZF_Z_* flags tell which formats are accepted. XZF_Z_ANY accepts
+ * all the supported formats (.gz, .xz, and .bz2 if libbz2 is available)
+ * and also uncompressed data. If the input isn't compressed and
+ * XZF_Z_NONE is included, the stream itself is returned so that there
+ * is no extra overhead. xzf_getinfo() with XZF_KEY_ZTYPE tells which
+ * format was detected. If the format isn't accepted, NULL is returned
+ * and errno is set to XZF_E_FORMAT. XZF_Z_SINGLE is passed to
+ * the decompressor.
+ *
+ * When writing, exactly one of XZF_Z_NONE, XZF_Z_GZ, and XZF_Z_XZ must
+ * be given. The compressor uses the default settings.
+ *
+ * On failure, the stream is left open.
+ */
 extern xzf_stream *xzf_xzfopen(xzf_stream *stream, int flags, ...);
+
 // extern xzf_stream *xzf_fopen(FILE *file_stream, int flags, ...);
+
+/**
+ * \brief       Open a file descriptor, optionally with compression support
+ *
+ * If flags contains XZF_COMP, the third argument is an int that contains
+ * the XZF_Z_* flags to pass to xzf_xzfopen(). On failure, the file
+ * descriptor is left open.
+ */
 extern xzf_stream *xzf_fdopen(int fd, int flags, ...);
 extern xzf_stream *xzf_copen(const struct xzf_backend *backend, void *state,
 		int flags, size_t in_bufsize, size_t out_bufsize);
@@ -343,10 +473,69 @@ extern void xzf_swap(xzf_stream *stream1, xzf_stream *stream2);
 extern size_t xzf_read(xzf_stream *stream, void *buf, size_t size);
 extern int xzf_write(xzf_stream *stream, const void *buf, size_t size);
 
+/**
+ * \brief       Read into several buffers
+ *
+ * The buffers are filled in order like with xzf_read(). If the backend
+ * supports vectored reading, the buffers and the internal input buffer
+ * are filled with one call to the backend.
+ *
+ * \return      Number of bytes read. If it is less than the total size
+ *              of the buffers, the end of the file was reached or an
+ *              error occurred and errno tells which.
+ */
+extern size_t xzf_readv(xzf_stream *stream, const xzf_iovec *iov,
+		size_t iovcnt);
+
+/**
+ * \brief       Write from several buffers
+ *
+ * If the total size is at least the size of the output buffer and the
+ * backend supports vectored writing, the buffered output and the new
+ * data are given to the backend in one call without copying. Otherwise
+ * this is the same as calling xzf_write() for each buffer while holding
+ * the lock.
+ */
+extern int xzf_writev(xzf_stream *stream, const xzf_iovec *iov,
+		size_t iovcnt);
+
 extern xzf_off xzf_seek(xzf_stream *stream, xzf_off offset,
 		enum xzf_whence whence);
 // extern xzf_off xzf_getpos(xzf_stream *stream);
 
+/**
+ * \brief       Discard input without copying it anywhere
+ *
+ * Backends that support skipping do it without going through the input
+ * buffer: decompressors decompress into a scratch buffer or jump over
+ * whole blocks, and file descriptors use lseek() or splice(). Other
+ * seekable streams seek, and the rest are read and discarded.
+ *
+ * \return      Number of bytes skipped. If it is less than amount, the
+ *              end of the file was reached or an error occurred and
+ *              errno tells which. When seeking is used, skipping past
+ *              the end of the file isn't detected. -1 is returned if
+ *              amount is negative or seeking fails.
+ */
+extern xzf_off xzf_skip(xzf_stream *stream, xzf_off amount);
+
+/**
+ * \brief       Copy data from one stream to another
+ *
+ * Up to max bytes are copied from src to dst. The data that is already
+ * in the input buffer of src is written first. If both streams read and
+ * write a file descriptor directly, the kernel copies the rest with
+ * copy_file_range(), sendfile(), or splice() without going through
+ * user space. Otherwise the data is written from the input buffer of
+ * src so that it isn't copied to an intermediate buffer.
+ *
+ * \return      Number of bytes copied. If it is less than max, the end
+ *              of src was reached or an error occurred and errno tells
+ *              which. -1 is returned if max is negative, the streams
+ *              are the same, or they cannot be read or written.
+ */
+extern xzf_off xzf_copy(xzf_stream *dst, xzf_stream *src, xzf_off max);
+
 extern int xzf_flush(xzf_stream *stream, int fl_flags);
 extern int xzf_close(xzf_stream *stream, int cl_flags);
 
@@ -437,7 +626,6 @@ extern void xzf_purge(xzf_stream *stream, int flags);
 /*
 TODO:
 gzoffset()
-gzdirect()
 getline
 */
 
@@ -446,12 +634,416 @@ extern xzf_stream *xzf_dummy_open(void);
 extern xzf_stream *xzf_fd_open(const char *filename, int flags, int mode);
 extern xzf_stream *xzf_fd_fdopen(int fd, int xflags);
 
+/**
+ * \brief       Open a regular file for reading via a memory mapping
+ *
+ * \param       xflags      XZF_READ, optionally with XZF_NOFOLLOW,
+ *                          XZF_REGFILE, XZF_MMAP, and XZF_POPULATE
+ *
+ * The file is given to xzf_peekin_start() and to decompressors reading
+ * from this stream directly from the mapping without copying it into
+ * an input buffer. 64-bit systems map the whole file. 32-bit systems map
+ * windows of the file. The mapping is advised to be read sequentially.
+ *
+ * If the file isn't a regular file, NULL is returned and errno is set
+ * to XZF_E_NOTFILE. If mmap() isn't available, errno is set to ENOSYS.
+ */
+extern xzf_stream *xzf_mmap_open(const char *filename, int xflags);
+
+/**
+ * \brief       Open a buffer in memory for reading
+ *
+ * The buffer is given to xzf_peekin_start() and to decompressors reading
+ * from this stream without copying it. It must stay valid and unchanged
+ * until the stream has been closed. The stream is seekable.
+ */
+extern xzf_stream *xzf_memin_open(const void *buf, size_t size);
+
+/**
+ * \brief       Open a stream that writes to memory
+ *
+ * \param       chunk_size  Size of the first chunk of memory. Zero means
+ *                          the default (64 KiB). Otherwise it must be
+ *                          between XZF_BUFSIZE and 16 MiB.
+ *
+ * The output is stored in chunks that are allocated as needed. Each chunk
+ * is twice as big as the previous one up to 16 MiB. The data already
+ * written is never moved, and xzf_peekout_start() gives the free space
+ * of the last chunk so that the output can be formatted in place.
+ * The stream isn't seekable.
+ *
+ * The memory is freed when the stream is closed.
+ */
+extern xzf_stream *xzf_memout_open(size_t chunk_size);
+
+/**
+ * \brief       Get the data written to a stream from xzf_memout_open()
+ *
+ * The stream is flushed and *iov is set to point to an array of *iovcnt
+ * chunks that hold the data in order. The array and the chunks belong
+ * to the stream. They stay valid until the next write to the stream or
+ * until the stream is closed. A later write may reallocate the array
+ * and add data to the last chunk, so *iov and the length of the last
+ * chunk must not be used after it; call this function again instead.
+ *
+ * \return      Zero on success, -1 on error.
+ */
+extern int xzf_memout_getiov(xzf_stream *stream, const xzf_iovec **iov,
+		size_t *iovcnt);
+
+/**
+ * \brief       Open a file for asynchronous reading or writing with io_uring
+ *
+ * \param       xflags      Either XZF_READ or XZF_WRITE, optionally with
+ *                          XZF_CREAT, XZF_TRUNC, XZF_EXCL, XZF_NOFOLLOW,
+ *                          and XZF_REGFILE
+ * \param       mode        Mode for a new file if XZF_CREAT is used
+ * \param       depth       Number of 128 KiB buffers to keep in flight.
+ *                          Zero means the default (8). The maximum is 256.
+ *
+ * When reading, depth buffers are kept queued ahead of the current
+ * position so that the device sees many requests at a time. The data
+ * is given to xzf_peekin_start() directly from the buffers. When writing,
+ * each buffer is queued when it is full and the next free buffer is used
+ * for new data. Write errors are reported by a later write, xzf_flush(),
+ * or xzf_close().
+ *
+ * Only regular files and block devices are supported because the reads
+ * and writes use explicit file offsets. Other files fail with
+ * XZF_E_NOTFILE. If io_uring isn't supported, errno is ENOSYS or
+ * the error from io_uring_setup().
+ */
+extern xzf_stream *xzf_uring_open(const char *filename, int xflags, int mode,
+		unsigned int depth);
+
+/**
+ * \brief       Read a stream ahead in a separate thread
+ *
+ * \param       nbufs       Number of buffers. Zero means the default (4).
+ *                          The maximum is 64.
+ * \param       bufsize     Size of each buffer. Zero means the default
+ *                          (256 KiB). Otherwise it must be between
+ *                          XZF_BUFSIZE and 64 MiB.
+ *
+ * A producer thread reads the substream into the buffers while the
+ * application uses the data that was read earlier. This lets for example
+ * a decompressor and the code that parses its output run in parallel.
+ * The data is given to xzf_peekin_start() directly from the buffers.
+ *
+ * Seeking is supported if the substream is seekable. xzf_getinfo() pauses
+ * the thread while the substream is used. With XZF_KEY_SUBSTREAM the thread
+ * stays paused until the stream is read again, so the substream may be used
+ * until then. If the stream is closed with XZF_CL_DETACH, the substream has
+ * been read further than the data that was used.
+ *
+ * If threads aren't supported, the substream is returned as is.
+ */
+extern xzf_stream *xzf_readahead_open(xzf_stream *stream, unsigned int nbufs,
+		size_t bufsize);
+
+/**
+ * \brief       Write a stream behind in a separate thread
+ *
+ * \param       nbufs       Number of buffers. Zero means the default (4).
+ *                          The maximum is 64.
+ * \param       bufsize     Size of each buffer. Zero means the default
+ *                          (256 KiB). Otherwise it must be between
+ *                          XZF_BUFSIZE and 64 MiB.
+ *
+ * The application fills the buffers while a worker thread writes the
+ * filled buffers to the substream. This lets for example a compressor
+ * and slow writing to the disk run in parallel with the application.
+ * Writing blocks only when all the buffers are waiting to be written.
+ *
+ * An error from writing to the substream is reported by the next
+ * write, flush, or close after the worker has noticed it. xzf_flush()
+ * and xzf_close() wait until all the buffers have been written, so they
+ * report all the errors. Seeking is supported if the substream is seekable.
+ * xzf_getinfo() waits until the queued buffers have been written, so the
+ * substream from XZF_KEY_SUBSTREAM may be used until the next write.
+ *
+ * If threads aren't supported, the substream is returned as is.
+ */
+extern xzf_stream *xzf_writebehind_open(xzf_stream *stream,
+		unsigned int nbufs, size_t bufsize);
+
+/**
+ * \brief       Write the same data to several streams in parallel
+ *
+ * \param       sinks       Array of nsinks streams open for writing
+ * \param       nsinks      Number of sinks, 1-64
+ *
+ * Each sink has a worker thread that writes the data to it, so for
+ * example a gz file, an xz file, and a socket are written at the same
+ * time. The sinks share four 256 KiB buffers without copying the data.
+ * Writing blocks only when the slowest sink hasn't written any of them.
+ *
+ * An error from any sink is reported like with xzf_writebehind_open().
+ * xzf_close() closes every sink and returns the first error. If opening
+ * fails, the sinks are left open.
+ *
+ * If threads aren't supported, the sinks are written one after another
+ * in the calling thread.
+ */
+extern xzf_stream *xzf_tee_open(xzf_stream **sinks, size_t nsinks);
+
+/**
+ * \brief       Read several files one after another as one stream
+ *
+ * \param       filenames   Array of nfiles filenames. Unlike with
+ *                          xzf_concat_sopen(), the array isn't copied.
+ *                          The array and the strings must stay valid
+ *                          until the stream has been closed.
+ * \param       flags       Flags for xzf_open(). XZF_READ is required.
+ *                          XZF_WRITE and XZF_CREAT aren't allowed.
+ * \param       zflags      The XZF_Z_* flags for xzf_open() if flags
+ *                          contains XZF_COMP
+ * \param       skip_cb     Function that is called with the filename
+ *                          and the error number when a file cannot be
+ *                          opened or read. opened is zero if opening
+ *                          failed and one if reading failed. The file is
+ *                          skipped and reading continues from the next
+ *                          file. If this is NULL, the error is returned
+ *                          to the reader.
+ *
+ * While a file is being read, a prefetch thread opens the next file,
+ * detects its format, initializes the decompressor, and decodes the first
+ * buffer. Thus the reader doesn't wait at file boundaries, which matters
+ * with many small files. Each file is closed when its end is reached.
+ *
+ * Peeking gives the buffer of the current file without copying it.
+ * xzf_getinfo() gives the information of the current file, and
+ * XZF_KEY_SUBSTREAM gives its stream.
+ *
+ * If threads aren't supported, each file is opened when it is needed.
+ */
+extern xzf_stream *xzf_concat_open(const char *const *filenames,
+		size_t nfiles, int flags, int zflags,
+		void (*skip_cb)(void *skip_state, const char *filename,
+			int errnum, int opened),
+		void *skip_state);
+
+/**
+ * \brief       Read several streams one after another as one stream
+ *
+ * This is like xzf_concat_open() but the inputs are open streams that
+ * are owned by the new stream. While a stream is being read, the next one
+ * is prefetched by reading its first buffer. Each stream is closed when
+ * its end is reached. xzf_close() closes the streams that haven't been
+ * reached unless XZF_CL_DETACH is used. A read error is returned to
+ * the reader.
+ */
+extern xzf_stream *xzf_concat_sopen(xzf_stream **streams, size_t nstreams);
+
 // FIXME: Needs only XZF_C_SINGLE or similar as a flag?
 extern xzf_stream *xzf_gzin_open(xzf_stream *stream, int flags);
 
-// FIXME? Use a struct instead to pass the params?
+/**
+ * \brief       Open a multithreaded .gz decompressor
+ *
+ * \param       zflags      Zero or XZF_Z_SINGLE
+ * \param       threads     Number of worker threads. Zero means the
+ *                          number of online processors.
+ * \param       memlimit    Memory usage limit in bytes. Zero means
+ *                          a quarter of the physical memory.
+ *
+ * Files that consist of many .gz members, for example files whose writer
+ * started a new member at every flush or BGZF files, are decompressed
+ * using multiple threads. The member boundaries are found by scanning
+ * the compressed data so the substream doesn't need to be seekable.
+ * A file with only one member is decompressed in the calling thread.
+ *
+ * Each thread has two jobs that take up to 6 MiB each, allocated when the
+ * job is first used. The number of threads is reduced so that the jobs fit
+ * in memlimit. If a chunk decompresses to more than 4 MiB, its buffer grows
+ * only while the limit allows; otherwise the chunk is decompressed in the
+ * calling thread. With XZF_Z_SINGLE, with one thread, or if the limit is
+ * too low for two threads, this is the same as xzf_gzin_open().
+ */
+extern xzf_stream *xzf_gzin_open_mt(xzf_stream *stream, int zflags,
+		unsigned int threads, unsigned long long memlimit);
+
+/**
+ * \brief       Open a .bz2 decompressor on top of another xzf_stream
+ *
+ * \param       zflags      Zero or XZF_Z_SINGLE
+ *
+ * This is available only if libxzfile was built with libbz2.
+ */
+extern xzf_stream *xzf_bz2in_open(xzf_stream *stream, int zflags);
+
+/**
+ * \brief       Open a seekable .gz decompressor on top of another xzf_stream
+ *
+ * \param       zflags      Zero or XZF_Z_SINGLE
+ * \param       span        Minimum distance between checkpoints in the
+ *                          uncompressed data. Zero means the default
+ *                          (1 MiB).
+ *
+ * If the substream is seekable, checkpoints are recorded while
+ * decompressing. Each takes up to 32 KiB of memory. xzf_seek() restarts
+ * decompression from the nearest checkpoint before the target so that
+ * seeking within already decompressed data costs at most roughly one span
+ * of decompression. Seeking forwards past the checkpoints decompresses
+ * the data in between. XZF_SEEK_END decompresses the whole file if
+ * that hasn't been done yet.
+ *
+ * If the substream isn't seekable, this is the same as xzf_gzin_open().
+ */
+extern xzf_stream *xzf_gzin_open_index(xzf_stream *stream, int zflags,
+		unsigned long long span);
+
+/**
+ * \brief       Save the random access index of a decompressor to a file
+ *
+ * stream must be, or be stacked on top of, a decompressor that supports
+ * seeking: xzf_gzin_open_index() or xzf_xzin_open() on a seekable
+ * substream. The lowest substream must have a file descriptor. The index
+ * file records the size and the modification time of that file.
+ *
+ * With .gz, only the part of the file that has been decompressed so far
+ * is covered by the index. Seeking to the end first makes the index
+ * complete.
+ *
+ * \return      Zero on success. On error, -1 is returned and errno is set.
+ */
+extern int xzf_index_save(xzf_stream *stream, const char *filename);
+
+/**
+ * \brief       Load a random access index saved with xzf_index_save()
+ *
+ * The index file is memory-mapped and replaces the index of the
+ * decompressor. It must be loaded before anything is read from the
+ * decompressor or it is seeked so that seeking doesn't need to
+ * decompress the file first.
+ *
+ * \return      Zero on success. On error, -1 is returned and errno is set.
+ *              XZF_E_STALE means that the size or the modification time
+ *              of the compressed file has changed since the index was
+ *              saved. XZF_E_FORMAT means that the index file is corrupt.
+ *              EBUSY means that decompression has already started.
+ */
+extern int xzf_index_load(xzf_stream *stream, const char *filename);
+
+/**
+ * \brief       Open a .gz compressor on top of another xzf_stream
+ *
+ * level and strategy are the same as in deflateInit2() in zlib.
+ * The compression is done using as many threads as there are online
+ * processors. Use xzf_gzout_open_mt() to choose the number of threads.
+ */
 extern xzf_stream *xzf_gzout_open(xzf_stream *stream, int level, int strategy);
 
+/**
+ * \brief       Options for the multithreaded .gz compressor
+ */
+struct xzf_gzout_mt {
+	/** Compression level like in deflateInit2() */
+	int level;
+
+	/** Compression strategy like in deflateInit2() */
+	int strategy;
+
+	/**
+	 * Number of worker threads. Zero means the number of online
+	 * processors. With one thread, no threads are created and the
+	 * compression is done in the calling thread.
+	 */
+	unsigned int threads;
+
+	/**
+	 * Amount of uncompressed data per independently compressed
+	 * block. Zero means the default (128 KiB). Each block is primed
+	 * with the last 32 KiB of the preceding data so that smaller
+	 * blocks hurt the compression ratio only slightly.
+	 */
+	size_t block_size;
+};
+
+/**
+ * \brief       Open a multithreaded .gz compressor
+ *
+ * The output is a single .gz member that any gzip decompressor can
+ * decompress. The memory usage is roughly 2 * threads * (2 * block_size
+ * + 32 KiB) plus the zlib deflate state of each thread.
+ */
+extern xzf_stream *xzf_gzout_open_mt(xzf_stream *stream,
+		const struct xzf_gzout_mt *options);
+
+/**
+ * \brief       Open a BGZF compressor on top of another xzf_stream
+ *
+ * \param       options     Like with xzf_gzout_open_mt() except that
+ *                          block_size must be zero or at most 65280
+ *                          which is also the default.
+ * \param       gzi_filename
+ *                          If not NULL, a .gzi index is written to this
+ *                          file when the stream is closed. It is in the
+ *                          same format as bgzip writes.
+ *
+ * The output consists of independent .gz members of at most 64 KiB.
+ * Each has the "BC" extra field that stores the size of the member, and
+ * an empty member marks the end of the file. Any gzip decompressor can
+ * decompress the output. xzf_flush() ends the current block.
+ */
+extern xzf_stream *xzf_bgzfout_open(xzf_stream *stream,
+		const struct xzf_gzout_mt *options, const char *gzi_filename);
+
+/**
+ * \brief       Open a BGZF decompressor on top of another xzf_stream
+ *
+ * Positions in the uncompressed data are BGZF virtual offsets: the
+ * offset of a block in the compressed data shifted left by 16 bits ORed
+ * with an offset in the uncompressed data of that block. The compressed
+ * offsets are relative to the position of the substream when this was
+ * called. xzf_getinfo() with XZF_KEY_ZOFFSET gives the virtual offset
+ * as xzf_off.
+ *
+ * If the substream is seekable, so is the returned stream. Only
+ * XZF_SEEK_SET with a virtual offset and XZF_SEEK_CUR with zero to tell
+ * the current virtual offset are supported. Seeking decompresses only
+ * the block at the target.
+ *
+ * A .gz file that isn't BGZF makes reading fail with XZF_E_FORMAT.
+ */
+extern xzf_stream *xzf_bgzfin_open(xzf_stream *stream);
+
+/**
+ * \brief       Open a .xz decompressor on top of another xzf_stream
+ *
+ * \param       zflags      Zero or XZF_Z_SINGLE
+ * \param       threads     Number of decoder threads. Zero means the
+ *                          number of online processors. Only .xz files
+ *                          that have multiple Blocks with the sizes
+ *                          stored in the Block Headers (as written by
+ *                          multithreaded xz) can be decoded in parallel.
+ * \param       memlimit    Memory usage limit in bytes. The decoder fails
+ *                          with XZF_E_ZMEMLIMIT if the limit cannot be
+ *                          met even with one thread. Zero means no limit.
+ */
+extern xzf_stream *xzf_xzin_open(xzf_stream *stream, int zflags,
+		unsigned int threads, unsigned long long memlimit);
+
+/**
+ * \brief       Open a .xz compressor on top of another xzf_stream
+ *
+ * \param       preset      Compression preset like in lzma_easy_encoder()
+ * \param       threads     Number of encoder threads. Zero means the
+ *                          number of online processors.
+ * \param       block_size  Uncompressed size of a Block. Zero means the
+ *                          liblzma default which is three times the
+ *                          dictionary size. Smaller Blocks give more
+ *                          parallelism and finer seeking granularity
+ *                          at the cost of compression ratio.
+ *
+ * Unless both threads and block_size are one and zero, respectively,
+ * the output has the compressed and uncompressed sizes stored in the
+ * Block Headers which allows decoding it with multiple threads.
+ * xzf_flush() ends the current Block.
+ */
+extern xzf_stream *xzf_xzout_open(xzf_stream *stream, unsigned int preset,
+		unsigned int threads, unsigned long long block_size);
+
 
 extern xzf_stream *xzf_cb_open(xzf_stream *stream,
 		void (*in_cb)(void *in_state, const unsigned char *buf,
@@ -471,8 +1063,137 @@ extern xzf_stream *xzf_cb_outopen(xzf_stream *stream,
 			size_t size),
 		void *out_state);
 
+/**
+ * \brief       Call a callback on the data read in a separate thread
+ *
+ * This is like xzf_cb_inopen() but the callback doesn't slow down
+ * reading: the substream is read into four 256 KiB buffers and a worker
+ * thread calls the callback on each buffer while the application uses
+ * the data. The callback is called on the data as it is read from the
+ * substream, so at close it has seen also the data that was read ahead
+ * but not used.
+ *
+ * The callback is called on one buffer at a time in the order of the
+ * data. The application must not use the callback state until
+ * xzf_flush() or xzf_close() has returned; both wait until the callback
+ * has been called on everything read so far.
+ *
+ * If threads aren't supported, this is the same as xzf_cb_inopen().
+ */
+extern xzf_stream *xzf_cb_async_inopen(xzf_stream *stream,
+		void (*in_cb)(void *in_state, const unsigned char *buf,
+			size_t size),
+		void *in_state);
 
+/**
+ * \brief       Call a callback on the data written in a separate thread
+ *
+ * The data is collected into four 256 KiB buffers. A full buffer is
+ * written to the substream in the calling thread and the callback is
+ * called on it in a worker thread. A buffer is reused only after the
+ * callback has returned.
+ *
+ * Like with xzf_cb_async_inopen(), xzf_flush() and xzf_close() wait
+ * for the callback. Data that hasn't been written when the stream is
+ * closed with XZF_CL_FORGET isn't given to the callback.
+ *
+ * If threads aren't supported, this is the same as xzf_cb_outopen().
+ */
+extern xzf_stream *xzf_cb_async_outopen(xzf_stream *stream,
+		void (*out_cb)(void *out_state, const unsigned char *buf,
+			size_t size),
+		void *out_state);
+
+
+/**
+ * \brief       Callbacks to calculate checksums
+ *
+ * These can be used with xzf_cb_open(), xzf_cb_inopen(), and
+ * xzf_cb_outopen(). The state is a pointer to uint32_t for CRC32 and
+ * CRC32C and to uint64_t for CRC64. Initialize it to zero; the value is
+ * the final checksum after every call. CRC32 is the same as in .gz and
+ * .xz, CRC64 the same as in .xz, and CRC32C is the Castagnoli CRC used
+ * by iSCSI and ext4.
+ */
 extern void xzf_cb_crc32(void *crc, const unsigned char *buf, size_t size);
+extern void xzf_cb_crc32c(void *crc, const unsigned char *buf, size_t size);
+extern void xzf_cb_crc64(void *crc, const unsigned char *buf, size_t size);
+
+
+/**
+ * \brief       State of xzf_cb_xxh64()
+ *
+ * The members are private.
+ */
+typedef struct {
+	uint64_t acc[4];
+	uint64_t total;
+	unsigned char buf[32];
+	size_t buf_size;
+} xzf_xxh64;
+
+/**
+ * \brief       Initialize the state of xzf_cb_xxh64()
+ */
+extern void xzf_xxh64_init(xzf_xxh64 *state, uint64_t seed);
+
+/**
+ * \brief       Callback to calculate the XXH64 hash
+ *
+ * XXH64 is a fast non-cryptographic hash. It detects accidental
+ * corruption but not deliberate changes. The state is a xzf_xxh64
+ * initialized with xzf_xxh64_init().
+ */
+extern void xzf_cb_xxh64(void *state, const unsigned char *buf, size_t size);
+
+/**
+ * \brief       Get the XXH64 hash of the data given so far
+ *
+ * The state isn't modified so more data may be hashed afterwards.
+ */
+extern uint64_t xzf_xxh64_digest(const xzf_xxh64 *state);
+
+
+/**
+ * \brief       Checksums for xzf_cb_checksums()
+ */
+#define XZF_CHECK_CRC32  0x01
+#define XZF_CHECK_CRC32C 0x02
+#define XZF_CHECK_CRC64  0x04
+#define XZF_CHECK_XXH64  0x08
+
+/**
+ * \brief       State of xzf_cb_checksums()
+ *
+ * Only the checksums selected with the checks bitmask are updated.
+ * The XXH64 hash is got with xzf_xxh64_digest(&sums.xxh64).
+ */
+typedef struct {
+	int checks;
+	uint32_t crc32;
+	uint32_t crc32c;
+	uint64_t crc64;
+	xzf_xxh64 xxh64;
+} xzf_checksums;
+
+/**
+ * \brief       Initialize the state of xzf_cb_checksums()
+ *
+ * \param       checks      Bitwise-or of XZF_CHECK_* flags
+ *
+ * XXH64 uses zero as the seed.
+ */
+extern void xzf_checksums_init(xzf_checksums *sums, int checks);
+
+/**
+ * \brief       Callback to calculate several checksums in one pass
+ *
+ * This gives the same results as the separate callbacks but reads the
+ * data from memory only once. The state is a xzf_checksums initialized
+ * with xzf_checksums_init().
+ */
+extern void xzf_cb_checksums(void *sums, const unsigned char *buf,
+		size_t size);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,159 @@
+/*
+ * Random access index for compressed streams
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "zindex.h"
+
+#ifdef HAVE_MMAP
+#	include <sys/mman.h>
+#endif
+
+
+extern void
+xzf_zindex_init(struct xzf_zindex *idx)
+{
+	idx->entries = NULL;
+	idx->count = 0;
+	idx->alloc = 0;
+	idx->usize = -1;
+	idx->base = 0;
+	idx->map = NULL;
+	idx->map_size = 0;
+}
+
+
+extern void
+xzf_zindex_end(struct xzf_zindex *idx)
+{
+	const uintptr_t map_start = (uintptr_t)idx->map;
+	const uintptr_t map_end = map_start + idx->map_size;
+
+	for (size_t i = 0; i < idx->count; ++i) {
+		const uintptr_t window = (uintptr_t)idx->entries[i].window;
+		if (window < map_start || window >= map_end)
+			free(idx->entries[i].window);
+	}
+
+	free(idx->entries);
+
+	if (idx->map != NULL) {
+#ifdef HAVE_MMAP
+		(void)munmap(idx->map, idx->map_size);
+#else
+		free(idx->map);
+#endif
+	}
+
+	xzf_zindex_init(idx);
+}
+
+
+extern int
+xzf_zindex_copy(struct xzf_zindex *dst, const struct xzf_zindex *src)
+{
+	xzf_zindex_init(dst);
+	dst->usize = src->usize;
+	dst->base = src->base;
+
+	if (src->count == 0)
+		return 0;
+
+	dst->entries = malloc(src->count * sizeof(struct xzf_zindex_entry));
+	if (dst->entries == NULL)
+		return ENOMEM;
+
+	dst->alloc = src->count;
+
+	// The count is kept up to date so that xzf_zindex_end() frees
+	// the windows that have been copied so far.
+	for (size_t i = 0; i < src->count; ++i) {
+		const struct xzf_zindex_entry *entry = &src->entries[i];
+		dst->entries[i] = *entry;
+		dst->entries[i].window = NULL;
+		dst->entries[i].window_size = 0;
+		dst->count = i + 1;
+
+		if (entry->window_size > 0) {
+			unsigned char *window = malloc(entry->window_size);
+			if (window == NULL) {
+				xzf_zindex_end(dst);
+				return ENOMEM;
+			}
+
+			memcpy(window, entry->window, entry->window_size);
+			dst->entries[i].window = window;
+			dst->entries[i].window_size = entry->window_size;
+		}
+	}
+
+	return 0;
+}
+
+
+extern void
+xzf_zindex_replace(struct xzf_zindex *idx, struct xzf_zindex *new_idx)
+{
+	if (new_idx->usize == -1)
+		new_idx->usize = idx->usize;
+
+	xzf_zindex_end(idx);
+	*idx = *new_idx;
+	xzf_zindex_init(new_idx);
+}
+
+
+extern struct xzf_zindex_entry *
+xzf_zindex_add(struct xzf_zindex *idx, xzf_off in, xzf_off out)
+{
+	assert(idx->count == 0 || out > idx->entries[idx->count - 1].out);
+
+	if (idx->count == idx->alloc) {
+		const size_t new_alloc = idx->alloc == 0 ? 64 : idx->alloc * 2;
+		if (new_alloc > SIZE_MAX / sizeof(struct xzf_zindex_entry))
+			return NULL;
+
+		struct xzf_zindex_entry *new_entries = realloc(idx->entries,
+				new_alloc * sizeof(struct xzf_zindex_entry));
+		if (new_entries == NULL)
+			return NULL;
+
+		idx->entries = new_entries;
+		idx->alloc = new_alloc;
+	}
+
+	struct xzf_zindex_entry *entry = &idx->entries[idx->count++];
+	entry->in = in;
+	entry->out = out;
+	entry->check = 0;
+	entry->bits = 0;
+	entry->crc = 0;
+	entry->isize = 0;
+	entry->window = NULL;
+	entry->window_size = 0;
+
+	return entry;
+}
+
+
+extern const struct xzf_zindex_entry *
+xzf_zindex_find(const struct xzf_zindex *idx, xzf_off out)
+{
+	// Binary search for the last entry with entry->out <= out.
+	size_t left = 0;
+	size_t right = idx->count;
+
+	while (left < right) {
+		const size_t pos = left + (right - left) / 2;
+		if (idx->entries[pos].out <= out)
+			left = pos + 1;
+		else
+			right = pos;
+	}
+
+	return left == 0 ? NULL : &idx->entries[left - 1];
+}
@@ -0,0 +1,96 @@
+/*
+ * Random access index for compressed streams
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#ifndef XZF_ZINDEX_H
+#define XZF_ZINDEX_H
+
+#include "sysdefs.h"
+#include "xzfile.h"
+#include "keys.h"
+
+
+/**
+ * \brief       A point from which decompression can be started
+ */
+struct xzf_zindex_entry {
+	/// Offset in the compressed input
+	xzf_off in;
+
+	/// Offset in the uncompressed output
+	xzf_off out;
+
+	/// .xz: The Check ID of the Stream that contains the Block
+	/// that starts at this point
+	unsigned int check;
+
+	/// .gz: Number of bits of the byte at in - 1 that belong to
+	/// the Deflate data after this point (0-7)
+	unsigned int bits;
+
+	/// .gz: CRC32 and size (modulo 2^32) of the uncompressed data
+	/// of the .gz member up to this point
+	uint32_t crc;
+	uint32_t isize;
+
+	/// .gz: Up to 32 KiB of uncompressed data before this point
+	/// or NULL if there is no window. This is freed by
+	/// xzf_zindex_end() unless it points inside the map.
+	unsigned char *window;
+	size_t window_size;
+};
+
+
+/**
+ * \brief       List of access points sorted by the uncompressed offset
+ */
+struct xzf_zindex {
+	struct xzf_zindex_entry *entries;
+	size_t count;
+	size_t alloc;
+
+	/// Total uncompressed size or -1 if it isn't known yet
+	xzf_off usize;
+
+	/// Offset of the beginning of the compressed data in the
+	/// substream. The offsets in the entries include this.
+	xzf_off base;
+
+	/// Index file loaded by xzf_index_load() or NULL. The windows
+	/// of the loaded entries point inside it.
+	void *map;
+	size_t map_size;
+};
+
+
+extern void xzf_zindex_init(struct xzf_zindex *idx);
+extern void xzf_zindex_end(struct xzf_zindex *idx);
+
+/// Append a new entry. The uncompressed offset must be greater than the
+/// offset of the last entry. The other members of the new entry are set
+/// to zero or NULL. NULL is returned if memory allocation fails.
+extern struct xzf_zindex_entry *xzf_zindex_add(struct xzf_zindex *idx,
+		xzf_off in, xzf_off out);
+
+/// Make dst an independent copy of src including the windows.
+/// Returns zero on success and ENOMEM on error. dst doesn't need
+/// to be initialized and is left empty on error.
+extern int xzf_zindex_copy(struct xzf_zindex *dst,
+		const struct xzf_zindex *src);
+
+/// Replace the contents of idx with new_idx, which is left empty.
+/// The uncompressed size of idx is kept if new_idx doesn't know it.
+extern void xzf_zindex_replace(struct xzf_zindex *idx,
+		struct xzf_zindex *new_idx);
+
+/// Get the last entry whose uncompressed offset is at most the given
+/// offset. NULL is returned if there is no such entry.
+extern const struct xzf_zindex_entry *xzf_zindex_find(
+		const struct xzf_zindex *idx, xzf_off out);
+
+#endif
@@ -10,14 +10,24 @@
 #include "sysdefs.h"
 #include "xzfile.h"
 
-
-// FIXME DEBUG
 #include <stdio.h>
 #include <unistd.h>
 
 
 static void
-cat_file(xzf_stream *file)
+print_error(const char *filename, const char *msg, int errnum)
+{
+	xzf_errbuf buf;
+	fprintf(stderr, "xzfcat: %s: %s: %s\n", filename, msg,
+			xzf_strerr(errnum, &buf));
+}
+
+
+/// Copy file to xzf_stdout. filename is used in error messages about
+/// reading; it is NULL if the file name isn't known. Returns zero on
+/// success and one if an error message was printed.
+static int
+cat_file(xzf_stream *file, const char *filename)
 {
 /*
 	// Test xzf_getc().
@@ -74,12 +84,31 @@ cat_file(xzf_stream *file)
 		xzf_putc(xzf_stdout, c);
 */
 
-	const unsigned char *b;
-	size_t size;
-	while ((size = xzf_peekin_start(file, &b, 1)) > 0) {
-		xzf_write(xzf_stdout, b, size);
-		xzf_peekin_end(file, size);
+	// Uncompressed files from stdin are copied by the kernel.
+	if (xzf_copy(xzf_stdout, file, XZF_OFF_MAX) != -1
+			&& errno == XZF_E_EOF)
+		return 0;
+
+	const int errnum = errno;
+	const int write_errnum = xzf_geterr(xzf_stdout);
+	if (write_errnum != 0) {
+		print_error("(stdout)", "Cannot write", write_errnum);
+	} else if (filename != NULL) {
+		print_error(filename, "Cannot read", errnum);
+	} else {
+		xzf_errbuf buf;
+		fprintf(stderr, "xzfcat: %s\n", xzf_strerr(errnum, &buf));
 	}
+
+	return 1;
+}
+
+
+static void
+skip_file(void *ret, const char *filename, int errnum, int opened)
+{
+	print_error(filename, opened ? "Cannot read" : "Cannot open", errnum);
+	*(int *)ret = 1;
 }
 
 
@@ -88,20 +117,68 @@ main(int argc, char **argv)
 {
 	xzf_stdio_open();
 
-	if (argc > 1) {
-		for (int i = 1; i < argc; ++i) {
-			xzf_stream *file = xzf_fd_open(
-					argv[i], XZF_READ | XZF_REGFILE, 0);
-			file = xzf_gzin_open(file, 0);
-			cat_file(file);
-			xzf_close(file, 0);
+	// Memory mapping the files avoids copying them but the process
+	// gets SIGBUS if a file is truncated while it is being read.
+	// Thus it is done only with -m.
+	int flags = XZF_READ | XZF_REGFILE | XZF_COMP;
+	int opt;
+	while ((opt = getopt(argc, argv, "m")) != -1) {
+		if (opt != 'm') {
+			fprintf(stderr, "Usage: xzfcat [-m] [FILE]...\n");
+			return 1;
 		}
+
+		flags |= XZF_MMAP;
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	int ret = 0;
+
+	if (argc > 0) {
+		// Compressed and uncompressed files are accepted.
+		// The next file is opened and its decompressor
+		// initialized while the current file is being copied.
+		xzf_stream *file = xzf_concat_open(
+				(const char *const *)argv, (size_t)argc,
+				flags, XZF_Z_ANY, &skip_file, &ret);
+		if (file == NULL) {
+			xzf_errbuf buf;
+			fprintf(stderr, "xzfcat: %s\n",
+					xzf_strerr(errno, &buf));
+			return 1;
+		}
+
+		// Read errors of the individual files are reported
+		// by skip_file().
+		if (cat_file(file, NULL))
+			ret = 1;
+
+		xzf_close(file, 0);
 	} else {
-		xzf_stream *file = xzf_gzin_open(xzf_stdin, 0);
-		cat_file(file);
-		xzf_close(file, XZF_CL_DETACH);
+		xzf_stream *file = xzf_xzfopen(xzf_stdin,
+				XZF_READ | XZF_COMP, XZF_Z_ANY);
+		if (file == NULL) {
+			print_error("(stdin)", "Cannot open", errno);
+			return 1;
+		}
+
+		if (cat_file(file, "(stdin)"))
+			ret = 1;
+
+		// Uncompressed input is read from xzf_stdin directly.
+		if (file != xzf_stdin)
+			xzf_close(file, XZF_CL_DETACH);
 // 		xzf_putc(xzf_stdout, xzf_getc(xzf_stdin));
 	}
 
-	return 0;
+	// A write error would otherwise be noticed only when xzf_stdout
+	// is closed at exit, and then no message would be printed.
+	if (xzf_geterr(xzf_stdout) == 0 && xzf_flush(xzf_stdout, 0)) {
+		print_error("(stdout)", "Cannot write", errno);
+		ret = 1;
+	}
+
+	return ret;
 }
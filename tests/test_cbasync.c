@@ -0,0 +1,170 @@
+/*
+ * Test the asynchronous callback streams
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 567)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static uint32_t
+crc32_of(const unsigned char *p, size_t size)
+{
+	uint32_t crc = 0;
+	xzf_cb_crc32(&crc, p, size);
+	return crc;
+}
+
+
+static bool
+test_read(void)
+{
+	xzf_checksums sums;
+	xzf_checksums_init(&sums, XZF_CHECK_CRC32 | XZF_CHECK_XXH64);
+
+	xzf_stream *strm = xzf_cb_async_inopen(
+			xzf_memin_open(data, DATA_SIZE),
+			&xzf_cb_checksums, &sums);
+	if (strm == NULL)
+		return false;
+
+	// Mix reads with peeks of the maximum size so that
+	// some peeks span two buffers.
+	size_t pos = 0;
+	bool ok = true;
+	for (size_t n = 1; ok && pos < DATA_SIZE; n = n * 7 % 70001 + 1) {
+		if (n % 2 == 0) {
+			const unsigned char *p;
+			size_t got = xzf_peekin_start(strm, &p, XZF_BUFSIZE);
+			ok = got >= XZF_BUFSIZE || got == DATA_SIZE - pos;
+			if (got > n)
+				got = n;
+
+			if (got > 0) {
+				memcpy(buf + pos, p, got);
+				xzf_peekin_end(strm, got);
+			}
+
+			pos += got;
+		} else {
+			pos += xzf_read(strm, buf + pos, n);
+		}
+	}
+
+	ok = ok && pos == DATA_SIZE && memcmp(buf, data, DATA_SIZE) == 0
+			&& xzf_read(strm, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	// The state may be used after xzf_close().
+	if (xzf_close(strm, 0) || !ok)
+		return false;
+
+	xzf_xxh64 xxh64;
+	xzf_xxh64_init(&xxh64, 0);
+	xzf_cb_xxh64(&xxh64, data, DATA_SIZE);
+
+	return sums.crc32 == crc32_of(data, DATA_SIZE)
+			&& xzf_xxh64_digest(&sums.xxh64)
+				== xzf_xxh64_digest(&xxh64);
+}
+
+
+static bool
+test_read_empty(void)
+{
+	uint32_t crc = 0;
+	xzf_stream *strm = xzf_cb_async_inopen(xzf_memin_open(data, 0),
+			&xzf_cb_crc32, &crc);
+	if (strm == NULL)
+		return false;
+
+	const bool ok = xzf_read(strm, buf, 10) == 0 && errno == XZF_E_EOF;
+	return xzf_close(strm, 0) == 0 && ok && crc == 0;
+}
+
+
+static bool
+test_write(void)
+{
+	xzf_stream *mem = xzf_memout_open(0);
+	uint32_t crc = 0;
+	xzf_stream *strm = xzf_cb_async_outopen(mem, &xzf_cb_crc32, &crc);
+	if (strm == NULL)
+		return false;
+
+	size_t pos = 0;
+	bool ok = true;
+	for (size_t n = 1; ok && pos < DATA_SIZE; n = n * 5 % 90001 + 1) {
+		if (n > DATA_SIZE - pos)
+			n = DATA_SIZE - pos;
+
+		ok = xzf_write(strm, data + pos, n) == 0;
+		pos += n;
+
+		// xzf_flush() waits for the callback.
+		if (ok && pos > DATA_SIZE / 2 && pos - n <= DATA_SIZE / 2)
+			ok = xzf_flush(strm, 0) == 0
+					&& crc == crc32_of(data, pos);
+	}
+
+	if (xzf_close(strm, XZF_CL_DETACH) || !ok
+			|| crc != crc32_of(data, DATA_SIZE))
+		return false;
+
+	const xzf_iovec *iov;
+	size_t iovcnt;
+	if (xzf_memout_getiov(mem, &iov, &iovcnt))
+		return false;
+
+	pos = 0;
+	for (size_t i = 0; i < iovcnt; ++i) {
+		if (iov[i].len > DATA_SIZE - pos)
+			return false;
+
+		memcpy(buf + pos, iov[i].base, iov[i].len);
+		pos += iov[i].len;
+	}
+
+	return xzf_close(mem, 0) == 0 && pos == DATA_SIZE
+			&& memcmp(buf, data, DATA_SIZE) == 0;
+}
+
+
+static bool
+test_write_error(void)
+{
+	xzf_stream *full = xzf_fd_open("/dev/full", XZF_WRITE, 0);
+	if (full == NULL)
+		return errno == ENOENT || errno == EACCES;
+
+	uint32_t crc = 0;
+	xzf_stream *strm = xzf_cb_async_outopen(full, &xzf_cb_crc32, &crc);
+	if (strm == NULL)
+		return false;
+
+	// The error is noticed when the first buffer is written
+	// or at the latest when closing.
+	(void)xzf_write(strm, data, DATA_SIZE);
+	return xzf_close(strm, 0) != 0 && errno == ENOSPC;
+}
+
+
+extern int
+main(void)
+{
+	tests_init_data(data, DATA_SIZE, 17, 0);
+
+	const bool ok = test_read() && test_read_empty() && test_write()
+			&& test_write_error();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/*
+ * Test the checksum callbacks
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+
+
+#define DATA_SIZE (1024 * 1024 + 123)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+/// Bit-at-a-time CRC32 to compare against
+static uint32_t
+crc32_ref(const unsigned char *p, size_t size, uint32_t crc, uint32_t poly)
+{
+	crc = ~crc;
+
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= p[i];
+		for (int bit = 0; bit < 8; ++bit)
+			crc = crc & 1 ? (crc >> 1) ^ poly : crc >> 1;
+	}
+
+	return ~crc;
+}
+
+
+static uint64_t
+xxh64_str(const char *str, uint64_t seed)
+{
+	xzf_xxh64 state;
+	xzf_xxh64_init(&state, seed);
+	xzf_cb_xxh64(&state, (const unsigned char *)str, strlen(str));
+	return xzf_xxh64_digest(&state);
+}
+
+
+static bool
+test_vectors(void)
+{
+	const unsigned char *check = (const unsigned char *)"123456789";
+
+	uint32_t crc32 = 0;
+	uint32_t crc32c = 0;
+	uint64_t crc64 = 0;
+	xzf_cb_crc32(&crc32, check, 9);
+	xzf_cb_crc32c(&crc32c, check, 9);
+	xzf_cb_crc64(&crc64, check, 9);
+
+	return crc32 == UINT32_C(0xCBF43926)
+			&& crc32c == UINT32_C(0xE3069283)
+			&& crc64 == UINT64_C(0x995DC9BBDF1939FA)
+			&& xxh64_str("", 0) == UINT64_C(0xEF46DB3751D8E999)
+			&& xxh64_str("a", 0) == UINT64_C(0xD24EC4F1A98C6E5B)
+			&& xxh64_str("abc", 0) == UINT64_C(0x44BC2CF5AD770999)
+			&& xxh64_str("Nobody inspects the spammish "
+					"repetition", 0)
+				== UINT64_C(0xFBCEA83C8A378BF1);
+}
+
+
+static bool
+test_sizes(void)
+{
+	// Every size and alignment around the block sizes of the SIMD code
+	for (size_t offset = 0; offset < 16; ++offset) {
+		for (size_t size = 0; size < 300; ++size) {
+			uint32_t crc32 = 0;
+			uint32_t crc32c = 0;
+			xzf_cb_crc32(&crc32, data + offset, size);
+			xzf_cb_crc32c(&crc32c, data + offset, size);
+
+			if (crc32 != crc32_ref(data + offset, size, 0,
+						UINT32_C(0xEDB88320))
+					|| crc32c != crc32_ref(data + offset,
+						size, 0, UINT32_C(0x82F63B78)))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+static bool
+test_combined(void)
+{
+	// The whole data at once
+	uint32_t crc32 = 0;
+	uint32_t crc32c = 0;
+	uint64_t crc64 = 0;
+	xzf_xxh64 xxh64;
+	xzf_xxh64_init(&xxh64, 0);
+
+	xzf_cb_crc32(&crc32, data, DATA_SIZE);
+	xzf_cb_crc32c(&crc32c, data, DATA_SIZE);
+	xzf_cb_crc64(&crc64, data, DATA_SIZE);
+	xzf_cb_xxh64(&xxh64, data, DATA_SIZE);
+
+	if (crc32 != crc32_ref(data, DATA_SIZE, 0, UINT32_C(0xEDB88320))
+			|| crc32c != crc32_ref(data, DATA_SIZE, 0,
+				UINT32_C(0x82F63B78)))
+		return false;
+
+	// Read through the callback backend in odd-sized pieces so that
+	// the partial XXH64 stripes are tested too.
+	xzf_checksums sums;
+	xzf_checksums_init(&sums, XZF_CHECK_CRC32 | XZF_CHECK_CRC32C
+			| XZF_CHECK_CRC64 | XZF_CHECK_XXH64);
+
+	xzf_stream *strm = xzf_cb_inopen(xzf_memin_open(data, DATA_SIZE),
+			&xzf_cb_checksums, &sums);
+	if (strm == NULL)
+		return false;
+
+	size_t pos = 0;
+	for (size_t n = 1; pos < DATA_SIZE; n = n * 3 % 100003 + 1) {
+		const size_t got = xzf_read(strm, buf + pos, n);
+		pos += got;
+		if (got < n)
+			break;
+	}
+
+	if (xzf_close(strm, 0) || pos != DATA_SIZE
+			|| memcmp(buf, data, DATA_SIZE) != 0)
+		return false;
+
+	// Only the selected checksums are calculated.
+	xzf_checksums crc64_only;
+	xzf_checksums_init(&crc64_only, XZF_CHECK_CRC64);
+	xzf_cb_checksums(&crc64_only, data, DATA_SIZE);
+
+	return sums.crc32 == crc32 && sums.crc32c == crc32c
+			&& sums.crc64 == crc64
+			&& xzf_xxh64_digest(&sums.xxh64)
+				== xzf_xxh64_digest(&xxh64)
+			&& crc64_only.crc64 == crc64
+			&& crc64_only.crc32 == 0
+			&& xzf_xxh64_digest(&crc64_only.xxh64)
+				== xxh64_str("", 0);
+}
+
+
+extern int
+main(void)
+{
+	tests_init_data(data, DATA_SIZE, 5, 0);
+
+	const bool ok = test_vectors() && test_sizes() && test_combined();
+	return ok ? 0 : 1;
+}
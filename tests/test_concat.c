@@ -0,0 +1,216 @@
+/*
+ * Test concatenation of inputs
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (300 * 1024 + 99)
+#define NFILES 6
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[2 * DATA_SIZE];
+
+/// The files are slices of data[] with these boundaries.
+/// The fourth file is empty.
+static const size_t bounds[NFILES + 1] = {
+	0, 10, 100000, 100123, 100123, 200000, DATA_SIZE
+};
+
+static const int ztypes[NFILES] = {
+	XZF_Z_NONE, XZF_Z_GZ, XZF_Z_XZ, XZF_Z_GZ, XZF_Z_NONE, XZF_Z_GZ
+};
+
+
+static bool
+create_files(char names[][32])
+{
+	for (size_t i = 0; i < NFILES; ++i) {
+		xzf_stream *file = xzf_open(names[i],
+				XZF_WRITE | XZF_TRUNC | XZF_COMP, ztypes[i]);
+		if (file == NULL || xzf_write(file, data + bounds[i],
+					bounds[i + 1] - bounds[i])
+				|| xzf_close(file, 0))
+			return false;
+	}
+
+	return true;
+}
+
+
+static void
+count_skipped(void *count, const char *filename, int errnum, int opened)
+{
+	(void)filename;
+
+	if (errnum == ENOENT && !opened)
+		++*(size_t *)count;
+}
+
+
+static bool
+read_all(xzf_stream *strm, size_t size)
+{
+	return strm != NULL && xzf_read(strm, buf, sizeof(buf)) == size
+			&& memcmp(data, buf, size) == 0 && errno == XZF_E_EOF;
+}
+
+
+static bool
+test_files(char names[][32])
+{
+	// The missing files are skipped.
+	const char *list[NFILES + 2] = { "test_concat.missing" };
+	for (size_t i = 0; i < NFILES; ++i)
+		list[i + 1] = names[i];
+
+	list[NFILES + 1] = "test_concat.missing";
+
+	size_t skipped = 0;
+	xzf_stream *strm = xzf_concat_open(list, NFILES + 2,
+			XZF_READ | XZF_COMP, XZF_Z_ANY,
+			&count_skipped, &skipped);
+	bool ok = read_all(strm, DATA_SIZE) && skipped == 2;
+	if (strm == NULL || xzf_close(strm, 0) != 0)
+		return false;
+
+	// Reading in small pieces crosses the boundaries.
+	strm = xzf_concat_open(list + 1, NFILES, XZF_READ | XZF_COMP,
+			XZF_Z_ANY, NULL, NULL);
+	if (strm == NULL)
+		return false;
+
+	for (size_t pos = 0; ok && pos < DATA_SIZE; pos += 7) {
+		const size_t n = DATA_SIZE - pos < 7 ? DATA_SIZE - pos : 7;
+		ok = xzf_read(strm, buf, n) == n
+				&& memcmp(buf, data + pos, n) == 0;
+	}
+
+	ok = ok && xzf_read(strm, buf, 1) == 0 && errno == XZF_E_EOF;
+	if (xzf_close(strm, 0) != 0)
+		return false;
+
+	// Without a callback the error is returned after the data
+	// of the files before it.
+	strm = xzf_concat_open(list + 1, NFILES + 1, XZF_READ | XZF_COMP,
+			XZF_Z_ANY, NULL, NULL);
+	ok = ok && strm != NULL
+			&& xzf_read(strm, buf, sizeof(buf)) == DATA_SIZE
+			&& errno == ENOENT;
+	if (strm == NULL || xzf_close(strm, 0) != ENOENT)
+		return false;
+
+	// Closing before the end closes the prefetched file.
+	strm = xzf_concat_open(list + 1, NFILES, XZF_READ | XZF_COMP,
+			XZF_Z_ANY, NULL, NULL);
+	ok = ok && strm != NULL && xzf_read(strm, buf, 5) == 5;
+	if (strm == NULL || xzf_close(strm, 0) != 0)
+		return false;
+
+	// Nothing to read
+	strm = xzf_concat_open(NULL, 0, XZF_READ, 0, NULL, NULL);
+	ok = ok && read_all(strm, 0);
+	return strm != NULL && xzf_close(strm, 0) == 0 && ok;
+}
+
+
+static bool
+test_peek_skip(char names[][32])
+{
+	const char *list[NFILES];
+	for (size_t i = 0; i < NFILES; ++i)
+		list[i] = names[i];
+
+	xzf_stream *strm = xzf_concat_open(list, NFILES,
+			XZF_READ | XZF_COMP, XZF_Z_ANY, NULL, NULL);
+	if (strm == NULL)
+		return false;
+
+	// A peek that doesn't fit in the rest of the first file
+	// continues from the second one.
+	const unsigned char *p;
+	bool ok = xzf_read(strm, buf, 5) == 5
+			&& xzf_peekin_start(strm, &p, 100) >= 100
+			&& memcmp(p, data + 5, 100) == 0;
+	if (ok)
+		xzf_peekin_end(strm, 50);
+
+	// The information is about the file being read.
+	int ztype = 0;
+	xzf_stream *sub = NULL;
+	ok = ok && xzf_getinfo(strm, XZF_KEY_ZTYPE, &ztype) == 0
+			&& ztype == XZF_Z_GZ
+			&& xzf_getinfo(strm, XZF_KEY_SUBSTREAM, &sub) == 0
+			&& sub != NULL;
+
+	// Skipping crosses several files including the empty one.
+	const size_t pos = 55 + 100100;
+	ok = ok && xzf_skip(strm, 100100) == 100100
+			&& xzf_read(strm, buf, 1000) == 1000
+			&& memcmp(buf, data + pos, 1000) == 0;
+
+	// Now the buffer of the uncompressed file is being peeked.
+	// Getting the information doesn't lose or repeat data.
+	ztype = -1;
+	ok = ok && xzf_getinfo(strm, XZF_KEY_ZTYPE, &ztype) == 0
+			&& ztype == XZF_Z_NONE
+			&& xzf_read(strm, buf, 1000) == 1000
+			&& memcmp(buf, data + pos + 1000, 1000) == 0
+			&& xzf_skip(strm, DATA_SIZE)
+				== (xzf_off)(DATA_SIZE - pos - 2000)
+			&& errno == XZF_E_EOF;
+
+	return xzf_close(strm, 0) == 0 && ok;
+}
+
+
+static bool
+test_streams(char names[][32])
+{
+	xzf_stream *streams[NFILES];
+	for (size_t i = 0; i < NFILES; ++i) {
+		streams[i] = i % 2 == 0
+			? xzf_memin_open(data + bounds[i],
+				bounds[i + 1] - bounds[i])
+			: xzf_open(names[i], XZF_READ | XZF_COMP, XZF_Z_ANY);
+		if (streams[i] == NULL)
+			return false;
+	}
+
+	xzf_stream *strm = xzf_concat_sopen(streams, NFILES);
+	const bool ok = read_all(strm, DATA_SIZE);
+	return strm != NULL && xzf_close(strm, 0) == 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char names[NFILES][32];
+	for (size_t i = 0; i < NFILES; ++i) {
+		strcpy(names[i], "test_concat.tmp.XXXXXX");
+		const int fd = mkstemp(names[i]);
+		if (fd == -1)
+			return 1;
+
+		(void)close(fd);
+	}
+
+	tests_init_data(data, DATA_SIZE, 41, 17);
+
+	const bool ok = create_files(names) && test_files(names)
+			&& test_peek_skip(names) && test_streams(names);
+
+	for (size_t i = 0; i < NFILES; ++i)
+		(void)unlink(names[i]);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+/*
+ * Test xzf_copy()
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (2 * 1024 * 1024 + 3333)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+check_file(const char *filename)
+{
+	xzf_stream *file = xzf_fd_open(filename, XZF_READ, 0);
+	if (file == NULL)
+		return false;
+
+	const bool ok = xzf_read(file, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_fd(const char *src_name, const char *dst_name)
+{
+	xzf_stream *src = xzf_fd_open(src_name, XZF_READ, 0);
+	xzf_stream *dst = xzf_fd_open(dst_name, XZF_WRITE | XZF_TRUNC, 0);
+	if (src == NULL || dst == NULL)
+		return false;
+
+	// Both streams have buffered data when the copying starts.
+	bool ok = xzf_read(src, buf, 1000) == 1000
+			&& xzf_write(dst, buf, 1000) == 0
+			&& xzf_copy(dst, src, 500000) == 500000
+			&& xzf_seek(src, 0, XZF_SEEK_CUR) == 501000
+			&& xzf_seek(dst, 0, XZF_SEEK_CUR) == 501000
+			&& xzf_read(src, buf, 1000) == 1000
+			&& xzf_write(dst, buf, 1000) == 0
+			&& xzf_copy(dst, src, XZF_OFF_MAX) == DATA_SIZE - 502000
+			&& errno == XZF_E_EOF
+			&& xzf_seek(dst, 0, XZF_SEEK_CUR) == DATA_SIZE
+			&& xzf_copy(dst, src, 1) == 0 && errno == XZF_E_EOF;
+
+	ok = xzf_close(src, 0) == 0 && ok;
+	ok = xzf_close(dst, 0) == 0 && ok;
+	return ok && check_file(dst_name);
+}
+
+
+static bool
+test_mmap(const char *src_name, const char *dst_name)
+{
+	xzf_stream *src = xzf_mmap_open(src_name, XZF_READ);
+	xzf_stream *dst = xzf_fd_open(dst_name, XZF_WRITE | XZF_TRUNC, 0);
+	if (src == NULL || dst == NULL)
+		return false;
+
+	bool ok = xzf_copy(dst, src, XZF_OFF_MAX) == DATA_SIZE
+			&& errno == XZF_E_EOF;
+
+	ok = xzf_close(src, 0) == 0 && ok;
+	ok = xzf_close(dst, 0) == 0 && ok;
+	return ok && check_file(dst_name);
+}
+
+
+static bool
+test_gz(const char *src_name, const char *dst_name)
+{
+	// The decompressor is copied via peekin.
+	xzf_stream *gz = xzf_gzout_open(xzf_fd_open(dst_name,
+			XZF_WRITE | XZF_TRUNC, 0), 6, 0);
+	if (gz == NULL || xzf_write(gz, data, DATA_SIZE) || xzf_close(gz, 0))
+		return false;
+
+	xzf_stream *src = xzf_gzin_open(xzf_fd_open(dst_name, XZF_READ, 0), 0);
+	xzf_stream *dst = xzf_fd_open(src_name, XZF_WRITE | XZF_TRUNC, 0);
+	if (src == NULL || dst == NULL)
+		return false;
+
+	bool ok = xzf_copy(dst, src, 12345) == 12345
+			&& xzf_copy(dst, src, XZF_OFF_MAX) == DATA_SIZE - 12345
+			&& errno == XZF_E_EOF;
+
+	ok = xzf_close(src, 0) == 0 && ok;
+	ok = xzf_close(dst, 0) == 0 && ok;
+	return ok && check_file(src_name);
+}
+
+
+static void
+count_cb(void *state, const unsigned char *b, size_t size)
+{
+	(void)b;
+	*(size_t *)state += size;
+}
+
+
+static bool
+test_cb(const char *src_name, const char *dst_name)
+{
+	// The callback must see all the data.
+	size_t count = 0;
+	xzf_stream *src = xzf_cb_inopen(xzf_fd_open(src_name, XZF_READ, 0),
+			&count_cb, &count);
+	xzf_stream *dst = xzf_fd_open(dst_name, XZF_WRITE | XZF_TRUNC, 0);
+	if (src == NULL || dst == NULL)
+		return false;
+
+	bool ok = xzf_copy(dst, src, XZF_OFF_MAX) == DATA_SIZE;
+
+	ok = xzf_close(src, 0) == 0 && ok;
+	ok = xzf_close(dst, 0) == 0 && ok;
+	return ok && count == DATA_SIZE && check_file(dst_name);
+}
+
+
+static bool
+test_pipe(const char *src_name)
+{
+	// Less than the default capacity of a pipe is copied
+	// so that no reader thread is needed.
+	const size_t size = 50000;
+
+	int fds[2];
+	if (pipe(fds))
+		return false;
+
+	xzf_stream *src = xzf_fd_open(src_name, XZF_READ, 0);
+	xzf_stream *dst = xzf_fd_fdopen(fds[1], XZF_WRITE);
+	if (src == NULL || dst == NULL)
+		return false;
+
+	bool ok = xzf_copy(dst, src, size) == (xzf_off)size;
+	ok = xzf_close(src, 0) == 0 && ok;
+	ok = xzf_close(dst, 0) == 0 && ok;
+
+	xzf_stream *in = xzf_fd_fdopen(fds[0], XZF_READ);
+	if (in == NULL)
+		return false;
+
+	ok = ok && xzf_read(in, buf, DATA_SIZE) == size
+			&& memcmp(data, buf, size) == 0;
+
+	return xzf_close(in, 0) == 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char src_name[] = "test_copy.tmp.XXXXXX";
+	char dst_name[] = "test_copy.tmp.XXXXXX";
+	const int src_fd = mkstemp(src_name);
+	const int dst_fd = mkstemp(dst_name);
+	if (src_fd == -1 || dst_fd == -1)
+		return 1;
+
+	(void)close(src_fd);
+	(void)close(dst_fd);
+
+	tests_init_data(data, DATA_SIZE, 23, 5);
+
+	xzf_stream *file = xzf_fd_open(src_name, XZF_WRITE | XZF_TRUNC, 0);
+	bool ok = file != NULL && xzf_write(file, data, DATA_SIZE) == 0
+			&& xzf_close(file, 0) == 0;
+
+	ok = ok && test_fd(src_name, dst_name)
+			&& test_mmap(src_name, dst_name)
+			&& test_gz(src_name, dst_name)
+			&& test_cb(src_name, dst_name)
+			&& test_pipe(src_name);
+
+	(void)unlink(src_name);
+	(void)unlink(dst_name);
+	return ok ? 0 : 1;
+}
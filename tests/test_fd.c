@@ -0,0 +1,243 @@
+/*
+ * Test the file descriptor backend
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (1024 * 1024 + 777)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+/// Data with runs of zeros, including at the end
+static void
+init_data(void)
+{
+	memset(data, 0, sizeof(data));
+	memset(data, 'a', 5000);
+	memset(data + 300000, 'b', 100);
+	data[600001] = 'c';
+	memset(data + 700000, 'd', 70000);
+}
+
+
+static bool
+write_file(const char *filename, int flags, size_t chunk_size)
+{
+	xzf_stream *file = xzf_fd_open(filename, XZF_WRITE | flags, 0600);
+	if (file == NULL)
+		return false;
+
+	for (size_t pos = 0; pos < DATA_SIZE; pos += chunk_size) {
+		const size_t n = DATA_SIZE - pos < chunk_size
+				? DATA_SIZE - pos : chunk_size;
+		if (xzf_write(file, data + pos, n))
+			return false;
+	}
+
+	return xzf_close(file, 0) == 0;
+}
+
+
+static bool
+check_file(const char *filename, int flags)
+{
+	xzf_stream *file = xzf_fd_open(filename, XZF_READ | flags, 0);
+	if (file == NULL)
+		return false;
+
+	const bool ok = xzf_read(file, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_sparse(const char *filename)
+{
+	if (!write_file(filename, XZF_TRUNC | XZF_SPARSE, 100000)
+			|| !check_file(filename, 0)
+			|| !write_file(filename, XZF_TRUNC | XZF_SPARSE, 1)
+			|| !check_file(filename, 0))
+		return false;
+
+	// Zeros must overwrite existing data even in sparse mode.
+	memset(data, 'x', sizeof(data));
+	if (!write_file(filename, XZF_TRUNC, 65536))
+		return false;
+
+	init_data();
+	return write_file(filename, XZF_SPARSE, 65536)
+			&& check_file(filename, 0);
+}
+
+
+/// Check that reading at pos gives the expected data.
+static bool
+check_at(xzf_stream *file, xzf_off pos, size_t size)
+{
+	if (pos < 0 || (size_t)pos > DATA_SIZE)
+		return false;
+
+	if (size > DATA_SIZE - (size_t)pos)
+		size = DATA_SIZE - (size_t)pos;
+
+	return xzf_read(file, buf, size) == size
+			&& memcmp(data + pos, buf, size) == 0;
+}
+
+
+static bool
+test_holes(const char *filename)
+{
+	if (!write_file(filename, XZF_TRUNC | XZF_SPARSE, 65536)
+			|| !check_file(filename, XZF_SPARSE))
+		return false;
+
+	xzf_stream *file = xzf_fd_open(filename, XZF_READ | XZF_SPARSE, 0);
+	if (file == NULL)
+		return false;
+
+	// Where the holes are depends on the file system. If it doesn't
+	// support holes, everything is data.
+	xzf_off data_pos = -1;
+	xzf_off hole_pos = -1;
+	bool ok = (data_pos = xzf_seek(file, 10000, XZF_SEEK_DATA))
+				>= 10000
+			&& data_pos <= 300000
+			&& check_at(file, data_pos, 1000)
+			&& (hole_pos = xzf_seek(file, 0, XZF_SEEK_HOLE)) >= 5000
+			&& hole_pos <= DATA_SIZE
+			&& check_at(file, hole_pos, 100000);
+
+	// There is no data at the end of the file.
+	ok = ok && xzf_seek(file, DATA_SIZE, XZF_SEEK_DATA) == -1
+			&& errno == ENXIO;
+
+	// A failed seek in the middle of a hole must not lose
+	// the zeros that are still pending.
+	ok = ok && xzf_seek(file, 10000, XZF_SEEK_SET) == 10000
+			&& check_at(file, 10000, 1000)
+			&& xzf_seek(file, DATA_SIZE, XZF_SEEK_DATA) == -1
+			&& errno == ENXIO
+			&& xzf_seek(file, DATA_SIZE, XZF_SEEK_HOLE) == -1
+			&& errno == ENXIO
+			&& check_at(file, 11000, 300000);
+
+	// Reading in the middle of a hole leaves zeros pending
+	// which must be taken into account in the position.
+	ok = ok && xzf_seek(file, 10000, XZF_SEEK_SET) == 10000
+			&& check_at(file, 10000, 1000)
+			&& xzf_seek(file, 0, XZF_SEEK_CUR) == 11000
+			&& xzf_skip(file, 289000) == 289000
+			&& check_at(file, 300000, 1000)
+			&& xzf_seek(file, -1000, XZF_SEEK_CUR) == 300000
+			&& check_at(file, 300000, 400000)
+			&& xzf_seek(file, 900000, XZF_SEEK_SET) == 900000
+			&& check_at(file, 900000, DATA_SIZE)
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_direct(const char *filename)
+{
+	if (!write_file(filename, XZF_TRUNC | XZF_DIRECT, 100000)
+			|| !check_file(filename, 0)
+			|| !write_file(filename, XZF_TRUNC | XZF_DIRECT, 1)
+			|| !check_file(filename, XZF_DIRECT))
+		return false;
+
+	// Overwrite unaligned parts so that the partial blocks
+	// must be merged with the existing data.
+	xzf_stream *file = xzf_fd_open(filename, XZF_WRITE | XZF_DIRECT, 0);
+	if (file == NULL)
+		return false;
+
+	memset(data + 12345, 'Z', 100);
+	memset(data + DATA_SIZE - 10, 'Y', 10);
+	bool ok = xzf_seek(file, 12345, XZF_SEEK_SET) == 12345
+			&& xzf_write(file, data + 12345, 100) == 0
+			&& xzf_seek(file, 0, XZF_SEEK_CUR) == 12445
+			&& xzf_flush(file, 0) == 0
+			&& xzf_seek(file, -10, XZF_SEEK_END) == DATA_SIZE - 10
+			&& xzf_write(file, data + DATA_SIZE - 10, 10) == 0;
+
+	if (xzf_close(file, 0) || !ok || !check_file(filename, 0))
+		return false;
+
+	// Seeking within and outside the buffer
+	file = xzf_fd_open(filename, XZF_READ | XZF_DIRECT, 0);
+	if (file == NULL)
+		return false;
+
+	ok = check_at(file, 0, 5000)
+			&& xzf_seek(file, 12300, XZF_SEEK_SET) == 12300
+			&& check_at(file, 12300, 200)
+			&& xzf_seek(file, -100, XZF_SEEK_CUR) == 12400
+			&& check_at(file, 12400, 1000)
+			&& xzf_seek(file, 1000001, XZF_SEEK_SET) == 1000001
+			&& check_at(file, 1000001, 30000)
+			&& xzf_seek(file, -5, XZF_SEEK_END) == DATA_SIZE - 5
+			&& check_at(file, DATA_SIZE - 5, 100)
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	init_data();
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_nocache(const char *filename)
+{
+	// Only the data can be checked here, not what is in the cache.
+	if (!write_file(filename, XZF_TRUNC | XZF_NOCACHE, 65536)
+			|| !check_file(filename, XZF_NOCACHE))
+		return false;
+
+	xzf_stream *file = xzf_fd_open(filename, XZF_READ | XZF_NOCACHE, 0);
+	if (file == NULL)
+		return false;
+
+	const bool ok = xzf_seek(file, 700000, XZF_SEEK_SET) == 700000
+			&& check_at(file, 700000, 100000)
+			&& xzf_seek(file, 5, XZF_SEEK_SET) == 5
+			&& check_at(file, 5, DATA_SIZE);
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_fd.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	init_data();
+
+	const bool ok = test_sparse(filename) && test_holes(filename)
+			&& test_direct(filename) && test_nocache(filename);
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
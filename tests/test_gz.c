@@ -0,0 +1,491 @@
+/*
+ * Test the .gz compressor and decompressors
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 12345)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+test_roundtrip(const char *filename, unsigned int threads, size_t block_size,
+		size_t chunk_size)
+{
+	xzf_stream *file = xzf_fd_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0600);
+	if (file == NULL)
+		return false;
+
+	const struct xzf_gzout_mt options = {
+		.level = 6,
+		.strategy = 0,
+		.threads = threads,
+		.block_size = block_size,
+	};
+
+	if (!tests_write_chunks(xzf_gzout_open_mt(file, &options),
+			data, DATA_SIZE, chunk_size))
+		return false;
+
+	file = xzf_fd_open(filename, XZF_READ, 0);
+	if (file == NULL)
+		return false;
+
+	xzf_stream *gz = xzf_gzin_open_index(file, 0, 100000);
+	if (gz == NULL)
+		return false;
+
+	const size_t size = xzf_read(gz, buf, DATA_SIZE);
+	const bool eof = xzf_read(gz, buf + size, 1) == 0
+			&& errno == XZF_E_EOF;
+	const bool same = size == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0;
+
+	// Seeking uses the checkpoints recorded while reading above.
+	// Once the size is known, seeking to the end decompresses nothing
+	// but going back from there has to work.
+	const bool seek_ok = xzf_seek(gz, 0, XZF_SEEK_END) == DATA_SIZE
+			&& tests_check_seeks(gz, data, DATA_SIZE, buf)
+			&& xzf_seek(gz, 0, XZF_SEEK_END) == DATA_SIZE
+			&& xzf_read(gz, buf, 1) == 0 && errno == XZF_E_EOF
+			&& xzf_seek(gz, -1000, XZF_SEEK_END) == DATA_SIZE - 1000
+			&& xzf_read(gz, buf, 1000) == 1000
+			&& memcmp(data + DATA_SIZE - 1000, buf, 1000) == 0;
+
+	if (xzf_close(gz, 0))
+		return false;
+
+	return eof && same && seek_ok;
+}
+
+
+static bool
+test_skip(const char *filename)
+{
+	// Without and with checkpoints
+	for (int i = 0; i < 2; ++i) {
+		xzf_stream *file = xzf_fd_open(filename, XZF_READ, 0);
+		xzf_stream *gz = i == 0 ? xzf_gzin_open(file, 0)
+				: xzf_gzin_open_index(file, 0, 100000);
+		if (gz == NULL)
+			return false;
+
+		const bool ok = tests_check_skip(gz, data, DATA_SIZE, buf);
+		if (xzf_close(gz, 0) || !ok)
+			return false;
+	}
+
+	// The file descriptor backend skips by seeking in a regular file.
+	xzf_stream *file = xzf_fd_open(filename, XZF_READ, 0);
+	if (file == NULL)
+		return false;
+
+	const xzf_off size = xzf_seek(file, 0, XZF_SEEK_END);
+	const bool ok = size > 100 && xzf_seek(file, 0, XZF_SEEK_SET) == 0
+			&& xzf_skip(file, 100) == 100
+			&& xzf_skip(file, size) == size - 100
+			&& errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+/// Decompress the file with xzf_gzin_open_mt() and compare it to
+/// the first size bytes of data.
+static bool
+check_mt(const char *filename, unsigned int threads,
+		unsigned long long memlimit, size_t size)
+{
+	xzf_stream *gz = xzf_gzin_open_mt(
+			xzf_fd_open(filename, XZF_READ, 0), 0, threads,
+			memlimit);
+	if (gz == NULL)
+		return false;
+
+	const size_t got = xzf_read(gz, buf, DATA_SIZE);
+	const bool eof = xzf_read(gz, buf + got, 1) == 0
+			&& errno == XZF_E_EOF;
+
+	return xzf_close(gz, 0) == 0 && eof && got == size
+			&& memcmp(data, buf, size) == 0;
+}
+
+
+/// Write data so that each member_size-byte piece is a separate .gz
+/// member. If ends isn't NULL, the compressed offset of the end of
+/// each member is stored there.
+static bool
+write_members(const char *filename, size_t member_size, int level,
+		xzf_off *ends)
+{
+	xzf_stream *file = xzf_fd_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0600);
+	if (file == NULL)
+		return false;
+
+	for (size_t pos = 0; pos < DATA_SIZE; pos += member_size) {
+		const size_t n = DATA_SIZE - pos < member_size
+				? DATA_SIZE - pos : member_size;
+		xzf_stream *gz = xzf_gzout_open(file, level, 0);
+		if (gz == NULL || xzf_write(gz, data + pos, n)
+				|| xzf_close(gz, XZF_CL_DETACH))
+			return false;
+
+		if (ends != NULL && (*ends++ = xzf_seek(file, 0,
+				XZF_SEEK_CUR)) == -1)
+			return false;
+	}
+
+	return xzf_close(file, 0) == 0;
+}
+
+
+/// Decompress the file with xzf_gzin_open_mt() until an error. The data
+/// that was returned must match data. Returns the error number.
+static int
+check_mt_error(const char *filename)
+{
+	xzf_stream *gz = xzf_gzin_open_mt(
+			xzf_fd_open(filename, XZF_READ, 0), 0, 4, 0);
+	if (gz == NULL)
+		return errno;
+
+	size_t got = 0;
+	while (got < DATA_SIZE) {
+		const size_t n = xzf_read(gz, buf + got, DATA_SIZE - got);
+		got += n;
+		if (n == 0)
+			break;
+	}
+
+	int errnum = errno;
+	if (got == DATA_SIZE && xzf_read(gz, buf, 1) == 0)
+		errnum = errno;
+
+	if (memcmp(data, buf, got) != 0)
+		errnum = 0;
+
+	(void)xzf_close(gz, 0);
+	return errnum;
+}
+
+
+/// XOR the byte at the given offset of the file with mask.
+static bool
+patch_byte(const char *filename, off_t offset, unsigned char mask)
+{
+	const int fd = open(filename, O_RDWR);
+	if (fd == -1)
+		return false;
+
+	unsigned char byte;
+	bool ok = pread(fd, &byte, 1, offset) == 1;
+	byte ^= mask;
+	ok = ok && pwrite(fd, &byte, 1, offset) == 1;
+	return close(fd) == 0 && ok;
+}
+
+
+static bool
+test_members(const char *filename)
+{
+	if (!write_members(filename, 100000, 6, NULL))
+		return false;
+
+	// A limit of 30 MiB allows two threads. With a limit of one byte
+	// the file is decompressed in the calling thread.
+	return check_mt(filename, 4, 0, DATA_SIZE)
+			&& check_mt(filename, 8, UINT64_C(30) << 20, DATA_SIZE)
+			&& check_mt(filename, 4, 1, DATA_SIZE);
+}
+
+
+static bool
+test_members_special(const char *filename)
+{
+	// A single member is decompressed in the calling thread.
+	if (!write_members(filename, DATA_SIZE, 6, NULL)
+			|| !check_mt(filename, 4, 0, DATA_SIZE))
+		return false;
+
+	// Stored blocks keep the data as is, so member headers in the data
+	// make the chunks be cut in the middle of the member. The workers
+	// fail on them and the chunks are decompressed in the calling
+	// thread as a continuation of the member.
+	static const unsigned char header[] = {
+		0x1F, 0x8B, 0x08, 0x00, 0, 0, 0, 0, 0x00, 0x03 };
+	for (size_t pos = 1000000; pos + sizeof(header) < DATA_SIZE;
+			pos += 123457)
+		memcpy(data + pos, header, sizeof(header));
+
+	const bool ok = write_members(filename, DATA_SIZE, 0, NULL)
+			&& check_mt(filename, 4, 0, DATA_SIZE);
+
+	tests_init_data(data, DATA_SIZE, 42, 23);
+	return ok;
+}
+
+
+static bool
+test_members_errors(const char *filename)
+{
+	// Truncating the last member is noticed after its data has
+	// been decompressed in the calling thread.
+	xzf_off ends[DATA_SIZE / 100000 + 1];
+	const size_t last = DATA_SIZE / 100000;
+	if (!write_members(filename, 100000, 6, ends)
+			|| truncate(filename, (off_t)ends[last] - 3)
+			|| check_mt_error(filename) != XZF_E_ZTRUNC)
+		return false;
+
+	// A wrong CRC32 in the middle of the file and a wrong ISIZE at
+	// the end of the file must be errors even though the data
+	// decompresses fine.
+	return write_members(filename, 100000, 6, ends)
+			&& patch_byte(filename, (off_t)ends[last / 2] - 8, 0x01)
+			&& check_mt_error(filename) == XZF_E_ZCORRUPT
+			&& write_members(filename, 100000, 6, ends)
+			&& patch_byte(filename, (off_t)ends[last] - 1, 0x80)
+			&& check_mt_error(filename) == XZF_E_ZCORRUPT;
+}
+
+
+static bool
+test_index(const char *filename, const char *index_filename)
+{
+	// Build a complete index and save it. The first save happens
+	// while the read-ahead thread is still decompressing and adding
+	// entries to the index.
+	xzf_stream *gz = xzf_readahead_open(xzf_gzin_open_index(
+			xzf_fd_open(filename, XZF_READ, 0), 0, 100000), 0, 0);
+	if (gz == NULL)
+		return false;
+
+	if (xzf_read(gz, buf, 1000000) != 1000000
+			|| xzf_index_save(gz, index_filename)
+			|| xzf_seek(gz, 0, XZF_SEEK_END) != DATA_SIZE
+			|| xzf_index_save(gz, index_filename)
+			|| xzf_close(gz, 0))
+		return false;
+
+	// Use the saved index on a new stream.
+	gz = xzf_gzin_open_index(xzf_fd_open(filename, XZF_READ, 0), 0, 0);
+	if (gz == NULL)
+		return false;
+
+	// The index cannot be replaced once decompression has started.
+	const size_t pos = DATA_SIZE - 5000;
+	bool ok = xzf_index_load(gz, index_filename) == 0
+			&& xzf_seek(gz, (xzf_off)pos, XZF_SEEK_SET)
+				== (xzf_off)pos
+			&& xzf_read(gz, buf, 5000) == 5000
+			&& memcmp(data + pos, buf, 5000) == 0
+			&& xzf_index_load(gz, index_filename) == -1
+			&& errno == EBUSY;
+
+	if (xzf_close(gz, 0) || !ok)
+		return false;
+
+	// The index doesn't match if the modification time changes.
+	struct stat st;
+	if (stat(filename, &st))
+		return false;
+
+	const struct timespec times[2] = {
+		{ .tv_sec = 0, .tv_nsec = UTIME_OMIT },
+		{ .tv_sec = st.st_mtime - 10, .tv_nsec = 0 },
+	};
+	if (utimensat(AT_FDCWD, filename, times, 0))
+		return false;
+
+	gz = xzf_gzin_open_index(xzf_fd_open(filename, XZF_READ, 0), 0, 0);
+	if (gz == NULL)
+		return false;
+
+	ok = xzf_index_load(gz, index_filename) == -1
+			&& errno == XZF_E_STALE;
+	if (xzf_close(gz, 0) || !ok)
+		return false;
+
+	// The windows are covered by the CRC32 too.
+	const int fd = open(index_filename, O_RDWR);
+	if (fd == -1)
+		return false;
+
+	const off_t last = lseek(fd, -1, SEEK_END);
+	unsigned char byte = 0;
+	ok = last != -1 && pread(fd, &byte, 1, last) == 1;
+	byte ^= 1;
+	ok = ok && pwrite(fd, &byte, 1, last) == 1;
+	if (close(fd) || !ok)
+		return false;
+
+	gz = xzf_gzin_open_index(xzf_fd_open(filename, XZF_READ, 0), 0, 0);
+	if (gz == NULL)
+		return false;
+
+	ok = xzf_index_load(gz, index_filename) == -1
+			&& errno == XZF_E_FORMAT;
+	return xzf_close(gz, 0) == 0 && ok;
+}
+
+
+static uint64_t
+get_le64(const unsigned char *p)
+{
+	uint64_t num = 0;
+	for (size_t i = 8; i-- > 0; )
+		num = (num << 8) | p[i];
+
+	return num;
+}
+
+
+static bool
+test_bgzf(const char *filename, const char *gzi_filename)
+{
+	const struct xzf_gzout_mt options = {
+		.level = 6,
+		.strategy = 0,
+		.threads = 2,
+		.block_size = 0,
+	};
+
+	xzf_stream *gz = xzf_bgzfout_open(xzf_fd_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0600),
+			&options, gzi_filename);
+	if (gz == NULL || xzf_write(gz, data, DATA_SIZE) || xzf_close(gz, 0))
+		return false;
+
+	// Plain .gz decompression must work too.
+	gz = xzf_gzin_open(xzf_fd_open(filename, XZF_READ, 0), 0);
+	if (gz == NULL)
+		return false;
+
+	bool ok = xzf_read(gz, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(gz, buf, 1) == 0 && errno == XZF_E_EOF;
+	if (xzf_close(gz, 0) || !ok)
+		return false;
+
+	// Remember the virtual offset in the middle and seek back to it.
+	gz = xzf_bgzfin_open(xzf_fd_open(filename, XZF_READ, 0));
+	if (gz == NULL)
+		return false;
+
+	xzf_off voffset = -1;
+	xzf_off zoffset = -2;
+	ok = xzf_read(gz, buf, 300000) == 300000
+			&& memcmp(data, buf, 300000) == 0
+			&& (voffset = xzf_seek(gz, 0, XZF_SEEK_CUR)) != -1
+			&& xzf_getinfo(gz, XZF_KEY_ZOFFSET, &zoffset) == 0
+			&& zoffset == voffset
+			&& xzf_read(gz, buf, 100000) == 100000
+			&& xzf_seek(gz, voffset, XZF_SEEK_SET) == voffset
+			&& xzf_read(gz, buf, DATA_SIZE) == DATA_SIZE - 300000
+			&& memcmp(data + 300000, buf, DATA_SIZE - 300000) == 0;
+
+	// Seek to the blocks listed in the .gzi file.
+	xzf_stream *gzi = xzf_fd_open(gzi_filename, XZF_READ, 0);
+	unsigned char entry[16];
+	size_t count = 0;
+	if (gzi == NULL || xzf_read(gzi, entry, 8) != 8)
+		ok = false;
+	else
+		count = (size_t)get_le64(entry);
+
+	ok = ok && count == (DATA_SIZE + 0xFEFF) / 0xFF00;
+
+	for (size_t i = 0; ok && i + 1 < count; ++i) {
+		if (xzf_read(gzi, entry, 16) != 16)
+			ok = false;
+
+		const xzf_off in = (xzf_off)get_le64(entry);
+		const size_t out = (size_t)get_le64(entry + 8);
+
+		if (i % 7 == 0)
+			ok = ok && xzf_seek(gz, in << 16, XZF_SEEK_SET) != -1
+				&& xzf_read(gz, buf, 1000) == 1000
+				&& memcmp(data + out, buf, 1000) == 0;
+	}
+
+	if (gzi == NULL || xzf_close(gzi, 0))
+		ok = false;
+
+	return xzf_close(gz, 0) == 0 && ok;
+}
+
+
+static bool
+test_bgzf_corrupt(void)
+{
+	// A header whose XLEN doesn't fit into a block. The extra field
+	// is present in full so that only the XLEN check catches it.
+	static unsigned char bad[12 + 65535];
+	memset(bad, 'B', sizeof(bad));
+	memcpy(bad, "\x1F\x8B\x08\x04\0\0\0\0\0\xFF\xFF\xFF", 12);
+
+	xzf_stream *gz = xzf_bgzfin_open(xzf_memin_open(bad, sizeof(bad)));
+	if (gz == NULL)
+		return false;
+
+	// The error stays after a failed seek too.
+	const bool ok = xzf_read(gz, buf, 1) == 0 && errno == XZF_E_FORMAT
+			&& xzf_seek(gz, 0, XZF_SEEK_SET) == -1
+			&& errno == XZF_E_FORMAT;
+
+	return xzf_close(gz, 0) != 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_gz.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	char index_filename[] = "test_gz.idx.XXXXXX";
+	const int index_fd = mkstemp(index_filename);
+	if (index_fd == -1) {
+		(void)unlink(filename);
+		return 1;
+	}
+
+	(void)close(index_fd);
+
+	tests_init_data(data, DATA_SIZE, 42, 23);
+
+	const bool ok = test_roundtrip(filename, 1, 0, 100000)
+			&& test_roundtrip(filename, 4, 0, 4096)
+			&& test_roundtrip(filename, 3, 32768, 1000000)
+			&& test_roundtrip(filename, 0, 1 << 20, 1)
+			&& test_skip(filename)
+			&& test_members(filename)
+			&& test_index(filename, index_filename)
+			&& test_bgzf(filename, index_filename)
+			&& test_bgzf_corrupt()
+			&& test_members_special(filename)
+			&& test_members_errors(filename);
+
+	(void)unlink(filename);
+	(void)unlink(index_filename);
+	return ok ? 0 : 1;
+}
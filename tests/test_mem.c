@@ -0,0 +1,151 @@
+/*
+ * Test the memory backends
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 567)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+/// Copy the chunks of a memout stream to buf. Returns the total size.
+static size_t
+gather(xzf_stream *strm)
+{
+	const xzf_iovec *iov;
+	size_t iovcnt;
+	if (xzf_memout_getiov(strm, &iov, &iovcnt))
+		return 0;
+
+	size_t pos = 0;
+	for (size_t i = 0; i < iovcnt; ++i) {
+		if (iov[i].len > DATA_SIZE - pos)
+			return 0;
+
+		memcpy(buf + pos, iov[i].base, iov[i].len);
+		pos += iov[i].len;
+	}
+
+	return pos;
+}
+
+
+static bool
+test_memin(void)
+{
+	xzf_stream *strm = xzf_memin_open(data, DATA_SIZE);
+	if (strm == NULL)
+		return false;
+
+	// The data is given without copying.
+	const unsigned char *p;
+	const size_t n = xzf_peekin_start(strm, &p, 10);
+	if (n == 0)
+		return false;
+
+	xzf_peekin_end(strm, 10);
+
+	const bool ok = n == DATA_SIZE && p == data
+			&& xzf_seek(strm, -5, XZF_SEEK_END) == DATA_SIZE - 5
+			&& xzf_read(strm, buf, 100) == 5
+			&& memcmp(buf, data + DATA_SIZE - 5, 5) == 0
+			&& errno == XZF_E_EOF
+			&& xzf_seek(strm, 1000, XZF_SEEK_SET) == 1000
+			&& xzf_skip(strm, 1000) == 1000
+			&& xzf_read(strm, buf, 3) == 3
+			&& memcmp(buf, data + 2000, 3) == 0;
+
+	return xzf_close(strm, 0) == 0 && ok;
+}
+
+
+static bool
+test_memout(void)
+{
+	xzf_stream *strm = xzf_memout_open(0);
+	if (strm == NULL)
+		return false;
+
+	const xzf_iovec *iov;
+	size_t iovcnt;
+	bool ok = xzf_memout_getiov(strm, &iov, &iovcnt) == 0 && iovcnt == 0;
+
+	// Small writes, a write that crosses many chunks,
+	// and formatting in place
+	size_t pos = 0;
+	for (; pos < 100000; pos += 7)
+		ok = ok && xzf_write(strm, data + pos, 7) == 0;
+
+	ok = ok && xzf_write(strm, data + pos, DATA_SIZE / 2) == 0;
+	pos += DATA_SIZE / 2;
+
+	unsigned char *out;
+	while (ok && pos < DATA_SIZE) {
+		size_t n = xzf_peekout_start(strm, &out, XZF_BUFSIZE);
+		ok = n >= XZF_BUFSIZE;
+		if (n > DATA_SIZE - pos)
+			n = DATA_SIZE - pos;
+
+		if (ok)
+			memcpy(out, data + pos, n);
+
+		ok = ok && xzf_peekout_end(strm, n) == 0;
+		pos += n;
+	}
+
+	ok = ok && gather(strm) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_memout_getiov(strm, &iov, &iovcnt) == 0
+			&& iovcnt > 1;
+
+	return xzf_close(strm, 0) == 0 && ok;
+}
+
+
+static bool
+test_gz(void)
+{
+	// Compress from memory to memory and decompress back.
+	xzf_stream *mem = xzf_memout_open(XZF_BUFSIZE);
+	xzf_stream *gz = xzf_gzout_open(mem, 6, 0);
+	if (gz == NULL || xzf_write(gz, data, DATA_SIZE)
+			|| xzf_close(gz, XZF_CL_DETACH))
+		return false;
+
+	static unsigned char packed[DATA_SIZE];
+	const size_t packed_size = gather(mem);
+	memcpy(packed, buf, packed_size);
+	if (packed_size == 0 || xzf_close(mem, 0))
+		return false;
+
+	gz = xzf_gzin_open(xzf_memin_open(packed, packed_size), 0);
+	if (gz == NULL)
+		return false;
+
+	memset(buf, 0, DATA_SIZE);
+	const bool ok = xzf_read(gz, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(gz, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(gz, 0) == 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	tests_init_data(data, DATA_SIZE, 31, 11);
+
+	const bool ok = test_memin() && test_memout() && test_gz();
+	return ok ? 0 : 1;
+}
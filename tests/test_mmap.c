@@ -0,0 +1,187 @@
+/*
+ * Test the memory mapping backend
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (2 * 1024 * 1024 + 4321)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+write_file(const char *filename, int flags, int ztype, size_t size)
+{
+	xzf_stream *file = xzf_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_COMP | flags, 0600, ztype);
+	if (file == NULL)
+		return false;
+
+	return xzf_write(file, data, size) == 0 && xzf_close(file, 0) == 0;
+}
+
+
+static bool
+test_peekin(const char *filename)
+{
+	if (!write_file(filename, XZF_TRUNC, XZF_Z_NONE, DATA_SIZE))
+		return false;
+
+	xzf_stream *file = xzf_mmap_open(filename, XZF_READ);
+	if (file == NULL)
+		return false;
+
+	// The whole file should be available without copying on 64-bit
+	// systems, but only the contents are checked here.
+	size_t pos = 0;
+	bool ok = true;
+	const unsigned char *b;
+	size_t size;
+	while (ok && (size = xzf_peekin_start(file, &b, 1)) > 0) {
+		if (size > 100000)
+			size = 100000;
+
+		ok = size <= DATA_SIZE - pos
+				&& memcmp(data + pos, b, size) == 0;
+		xzf_peekin_end(file, size);
+		pos += size;
+	}
+
+	ok = ok && pos == DATA_SIZE && errno == XZF_E_EOF;
+
+	// Seeking and skipping
+	ok = ok && xzf_seek(file, 12345, XZF_SEEK_SET) == 12345
+			&& xzf_read(file, buf, 1000) == 1000
+			&& memcmp(data + 12345, buf, 1000) == 0
+			&& xzf_seek(file, -1000, XZF_SEEK_CUR) == 12345
+			&& xzf_skip(file, 1000000) == 1000000
+			&& xzf_read(file, buf, 1000) == 1000
+			&& memcmp(data + 1012345, buf, 1000) == 0
+			&& xzf_seek(file, -100, XZF_SEEK_END) == DATA_SIZE - 100
+			&& xzf_read(file, buf, 1000) == 100
+			&& memcmp(data + DATA_SIZE - 100, buf, 100) == 0
+			&& xzf_skip(file, 1) == 0 && errno == XZF_E_EOF;
+
+	if (xzf_close(file, 0) || !ok)
+		return false;
+
+	// Data appended after the end was reached can be read.
+	if (!write_file(filename, XZF_TRUNC, XZF_Z_NONE, 1000))
+		return false;
+
+	file = xzf_mmap_open(filename, XZF_READ | XZF_POPULATE);
+	if (file == NULL)
+		return false;
+
+	ok = xzf_read(file, buf, DATA_SIZE) == 1000
+			&& memcmp(data, buf, 1000) == 0;
+
+	xzf_stream *out = xzf_fd_open(filename, XZF_APPEND, 0);
+	ok = ok && out != NULL
+			&& xzf_write(out, data + 1000, 5000) == 0
+			&& xzf_close(out, 0) == 0;
+
+	ok = ok && xzf_seek(file, 0, XZF_SEEK_CUR) == 1000
+			&& xzf_read(file, buf, DATA_SIZE) == 5000
+			&& memcmp(data + 1000, buf, 5000) == 0;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_open(const char *filename, int ztype)
+{
+	if (!write_file(filename, XZF_TRUNC, ztype, DATA_SIZE))
+		return false;
+
+	xzf_stream *file = xzf_open(filename, XZF_READ | XZF_REGFILE
+			| XZF_MMAP | XZF_COMP, XZF_Z_ANY);
+	if (file == NULL)
+		return false;
+
+	int detected = 0;
+	const bool ok = xzf_getinfo(file, XZF_KEY_ZTYPE, &detected) == 0
+			&& detected == ztype
+			&& xzf_read(file, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_special(const char *filename)
+{
+	// An empty file isn't mapped at all.
+	if (!write_file(filename, XZF_TRUNC, XZF_Z_NONE, 0))
+		return false;
+
+	xzf_stream *file = xzf_mmap_open(filename, XZF_READ);
+	if (file == NULL)
+		return false;
+
+	const bool ok = xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+	if (xzf_close(file, 0) || !ok)
+		return false;
+
+	// Other than regular files are rejected by xzf_mmap_open() but
+	// xzf_open() reads them normally without XZF_REGFILE.
+	if (xzf_mmap_open("/dev/null", XZF_READ) != NULL
+			|| errno != XZF_E_NOTFILE)
+		return false;
+
+	file = xzf_open("/dev/null", XZF_READ | XZF_MMAP);
+	if (file == NULL || xzf_close(file, 0))
+		return false;
+
+	// The file descriptor isn't left non-blocking.
+	file = xzf_mmap_open(filename, XZF_READ);
+	int fd;
+	if (file == NULL || xzf_getinfo(file, XZF_KEY_FD, &fd))
+		return false;
+
+	const int fl = fcntl(fd, F_GETFL);
+	if (xzf_close(file, 0) || fl == -1 || (fl & O_NONBLOCK))
+		return false;
+
+	// Flags that only xzf_fd_open() supports make xzf_open()
+	// read the file normally.
+	file = xzf_open(filename, XZF_READ | XZF_MMAP | XZF_NOCACHE);
+	return file != NULL && xzf_close(file, 0) == 0;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_mmap.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	tests_init_data(data, DATA_SIZE, 7, 19);
+
+	const bool ok = test_peekin(filename)
+			&& test_open(filename, XZF_Z_NONE)
+			&& test_open(filename, XZF_Z_GZ)
+			&& test_open(filename, XZF_Z_XZ)
+			&& test_special(filename);
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
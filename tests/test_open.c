@@ -0,0 +1,68 @@
+/*
+ * Test format detection in xzf_open()
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+static const char data[] = "Hello, World!\nThis is a test.\n";
+
+
+static bool
+test_format(const char *filename, int ztype)
+{
+	xzf_stream *file = xzf_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC | XZF_COMP,
+			0600, ztype);
+	if (file == NULL)
+		return false;
+
+	if (xzf_write(file, data, sizeof(data)) || xzf_close(file, 0))
+		return false;
+
+	// Only other formats are accepted.
+	file = xzf_open(filename, XZF_READ | XZF_COMP, XZF_Z_ANY & ~ztype);
+	if (file != NULL || errno != XZF_E_FORMAT)
+		return false;
+
+	file = xzf_open(filename, XZF_READ | XZF_COMP, XZF_Z_ANY);
+	if (file == NULL)
+		return false;
+
+	char buf[sizeof(data) + 1];
+	int detected = 0;
+	const bool ok = xzf_getinfo(file, XZF_KEY_ZTYPE, &detected) == 0
+			&& detected == ztype
+			&& xzf_read(file, buf, sizeof(buf)) == sizeof(data)
+			&& memcmp(buf, data, sizeof(data)) == 0;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_open.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	const bool ok = test_format(filename, XZF_Z_NONE)
+			&& test_format(filename, XZF_Z_GZ)
+			&& test_format(filename, XZF_Z_XZ);
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
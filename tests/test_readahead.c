@@ -0,0 +1,123 @@
+/*
+ * Test the read-ahead stage
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 777)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+test_peekin(const char *filename, unsigned int nbufs, size_t bufsize)
+{
+	xzf_stream *file = xzf_readahead_open(
+			xzf_gzin_open(xzf_fd_open(filename, XZF_READ, 0), 0),
+			nbufs, bufsize);
+	if (file == NULL)
+		return false;
+
+	// Peek with varying minimum sizes so that some of them span
+	// the buffers.
+	size_t pos = 0;
+	uint32_t x = 11;
+	bool ok = true;
+	while (ok && pos < DATA_SIZE) {
+		tests_rand(&x);
+		size_t min = (x >> 12) % XZF_BUFSIZE + 1;
+		if (min > DATA_SIZE - pos)
+			min = DATA_SIZE - pos;
+
+		const unsigned char *b;
+		size_t size = xzf_peekin_start(file, &b, min);
+		if (size < min || size > DATA_SIZE - pos) {
+			ok = false;
+			break;
+		}
+
+		size = (x >> 4) % size + 1;
+		ok = memcmp(data + pos, b, size) == 0;
+		xzf_peekin_end(file, size);
+		pos += size;
+	}
+
+	int ztype = 0;
+	ok = ok && xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF
+			&& xzf_getinfo(file, XZF_KEY_ZTYPE, &ztype) == 0
+			&& ztype == XZF_Z_GZ;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_seek(const char *filename)
+{
+	// Checkpoints make the decompressor seekable.
+	xzf_stream *file = xzf_readahead_open(xzf_gzin_open_index(
+				xzf_fd_open(filename, XZF_READ, 0), 0, 100000),
+			3, 0);
+	if (file == NULL)
+		return false;
+
+	// The substream has been read further than the data that was
+	// used. It may be used until this stream is read again.
+	xzf_stream *sub = NULL;
+	const bool ok = xzf_read(file, buf, 1000000) == 1000000
+			&& memcmp(data, buf, 1000000) == 0
+			&& xzf_getinfo(file, XZF_KEY_SUBSTREAM, &sub) == 0
+			&& xzf_seek(sub, 0, XZF_SEEK_CUR) >= 1000000
+			&& xzf_read(file, buf, 1000) == 1000
+			&& memcmp(data + 1000000, buf, 1000) == 0
+			&& xzf_seek(file, -1000, XZF_SEEK_CUR) == 1000000
+			&& xzf_seek(file, 0, XZF_SEEK_CUR) == 1000000
+			&& xzf_seek(file, -5000, XZF_SEEK_CUR) == 995000
+			&& xzf_read(file, buf, 10000) == 10000
+			&& memcmp(data + 995000, buf, 10000) == 0
+			&& xzf_seek(file, 2500000, XZF_SEEK_SET) == 2500000
+			&& xzf_read(file, buf, DATA_SIZE) == DATA_SIZE - 2500000
+			&& memcmp(data + 2500000, buf, DATA_SIZE - 2500000) == 0
+			&& xzf_seek(file, 123, XZF_SEEK_SET) == 123
+			&& xzf_read(file, buf, 1000) == 1000
+			&& memcmp(data + 123, buf, 1000) == 0;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_readahead.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	tests_init_data(data, DATA_SIZE, 3, 11);
+
+	xzf_stream *gz = xzf_gzout_open(xzf_fd_open(filename,
+			XZF_WRITE | XZF_TRUNC, 0), 6, 0);
+	bool ok = gz != NULL && xzf_write(gz, data, DATA_SIZE) == 0
+			&& xzf_close(gz, 0) == 0;
+
+	ok = ok && test_peekin(filename, 0, 0)
+			&& test_peekin(filename, 2, XZF_BUFSIZE)
+			&& test_peekin(filename, 5, 100000)
+			&& test_seek(filename);
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
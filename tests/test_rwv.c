@@ -0,0 +1,168 @@
+/*
+ * Test xzf_readv() and xzf_writev()
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (1024 * 1024 + 4321)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+check_file(const char *filename, int ztype)
+{
+	xzf_stream *file = xzf_open(filename, XZF_READ | XZF_COMP, ztype);
+	if (file == NULL)
+		return false;
+
+	const bool ok = xzf_read(file, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+/// Write data[] with buffered data, a small header, a big payload,
+/// empty buffers, and small vectors that are copied to the buffer.
+static bool
+write_data(xzf_stream *file)
+{
+	const xzf_iovec big[4] = {
+		{ data + 100, 20 },
+		{ NULL, 0 },
+		{ data + 120, DATA_SIZE / 2 },
+		{ data + 120 + DATA_SIZE / 2, 5 },
+	};
+
+	const size_t pos = 125 + DATA_SIZE / 2;
+	const xzf_iovec small[3] = {
+		{ data + pos, 1 },
+		{ data + pos + 1, 999 },
+		{ data + pos + 1000, 10 },
+	};
+
+	// More vectors than are given to the backend at once
+	xzf_iovec many[40];
+	size_t rest = pos + 1010;
+	const size_t each = (DATA_SIZE - rest) / 40;
+	for (size_t i = 0; i < 40; ++i) {
+		many[i].base = data + rest;
+		many[i].len = i == 39 ? DATA_SIZE - rest : each;
+		rest += each;
+	}
+
+	return file != NULL && xzf_write(file, data, 100) == 0
+			&& xzf_writev(file, big, 4) == 0
+			&& xzf_writev(file, small, 3) == 0
+			&& xzf_writev(file, many, 40) == 0
+			&& xzf_writev(file, many, 0) == 0;
+}
+
+
+static bool
+test_writev(const char *filename)
+{
+	xzf_stream *file = xzf_fd_open(filename, XZF_WRITE | XZF_TRUNC, 0);
+	if (!write_data(file) || xzf_close(file, 0) != 0
+			|| !check_file(filename, XZF_Z_NONE))
+		return false;
+
+	// Unbuffered
+	file = xzf_fd_open(filename, XZF_WRITE | XZF_TRUNC, 0);
+	if (file == NULL || xzf_setflags(file,
+				xzf_getflags(file) | XZF_UNBUF) != 0
+			|| !write_data(file) || xzf_close(file, 0) != 0
+			|| !check_file(filename, XZF_Z_NONE))
+		return false;
+
+	// Without vectored writing in the backend
+	file = xzf_gzout_open(xzf_fd_open(filename,
+			XZF_WRITE | XZF_TRUNC, 0), 6, 0);
+	return write_data(file) && xzf_close(file, 0) == 0
+			&& check_file(filename, XZF_Z_GZ);
+}
+
+
+/// Read the whole file with a small read, a vector with a small and
+/// a big buffer, and then small vectors that come from the input buffer.
+static bool
+read_data(xzf_stream *file)
+{
+	memset(buf, 0, DATA_SIZE);
+
+	const xzf_iovec big[3] = {
+		{ buf + 10, 7 },
+		{ NULL, 0 },
+		{ buf + 17, DATA_SIZE / 2 },
+	};
+
+	size_t pos = 17 + DATA_SIZE / 2;
+	xzf_iovec small[3];
+	for (size_t i = 0; i < 3; ++i) {
+		small[i].base = buf + pos;
+		small[i].len = 3 + i;
+		pos += 3 + i;
+	}
+
+	const xzf_iovec rest[2] = {
+		{ buf + pos, DATA_SIZE - pos - 1 },
+		{ buf + DATA_SIZE - 1, 100 },
+	};
+
+	return file != NULL && xzf_read(file, buf, 10) == 10
+			&& xzf_readv(file, big, 3) == 7 + DATA_SIZE / 2
+			&& xzf_readv(file, small, 3) == 12
+			&& xzf_readv(file, rest, 2) == DATA_SIZE - pos
+			&& errno == XZF_E_EOF
+			&& xzf_readv(file, rest, 2) == 0 && errno == XZF_E_EOF
+			&& memcmp(data, buf, DATA_SIZE) == 0;
+}
+
+
+static bool
+test_readv(const char *filename)
+{
+	xzf_stream *file = xzf_fd_open(filename, XZF_WRITE | XZF_TRUNC, 0);
+	if (file == NULL || xzf_write(file, data, DATA_SIZE) != 0
+			|| xzf_close(file, 0) != 0)
+		return false;
+
+	file = xzf_fd_open(filename, XZF_READ, 0);
+	if (!read_data(file) || xzf_close(file, 0) != 0)
+		return false;
+
+	// Without vectored reading in the backend
+	file = xzf_mmap_open(filename, XZF_READ);
+	return read_data(file) && xzf_close(file, 0) == 0;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_rwv.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	tests_init_data(data, DATA_SIZE, 29, 3);
+
+	const bool ok = test_writev(filename) && test_readv(filename);
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+/*
+ * Test the tee stage
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 777)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+read_back(const char *filename, int ztype)
+{
+	xzf_stream *file = xzf_open(filename, XZF_READ | XZF_COMP, ztype);
+	if (file == NULL)
+		return false;
+
+	const bool ok = xzf_read(file, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_formats(char names[][32], size_t chunk_size)
+{
+	xzf_stream *sinks[3] = {
+		xzf_gzout_open(xzf_fd_open(names[0],
+				XZF_WRITE | XZF_TRUNC, 0), 6, 0),
+		xzf_xzout_open(xzf_fd_open(names[1],
+				XZF_WRITE | XZF_TRUNC, 0), 1, 1, 0),
+		xzf_fd_open(names[2], XZF_WRITE | XZF_TRUNC, 0),
+	};
+
+	xzf_stream *tee = xzf_tee_open(sinks, 3);
+	if (tee == NULL)
+		return false;
+
+	for (size_t pos = 0; pos < DATA_SIZE; pos += chunk_size) {
+		const size_t n = DATA_SIZE - pos < chunk_size
+				? DATA_SIZE - pos : chunk_size;
+		if (xzf_write(tee, data + pos, n))
+			return false;
+
+		if (pos == 20 * chunk_size && xzf_flush(tee, 0))
+			return false;
+	}
+
+	return xzf_close(tee, 0) == 0
+			&& read_back(names[0], XZF_Z_GZ)
+			&& read_back(names[1], XZF_Z_XZ)
+			&& read_back(names[2], XZF_Z_NONE);
+}
+
+
+static bool
+test_error(char names[][32])
+{
+	// One failing sink doesn't stop the others from being closed.
+	xzf_stream *sinks[2] = {
+		xzf_fd_open(names[2], XZF_WRITE | XZF_TRUNC, 0),
+		xzf_fd_open("/dev/full", XZF_WRITE, 0),
+	};
+
+	if (sinks[1] == NULL) {
+		(void)xzf_close(sinks[0], 0);
+		return errno == ENOENT || errno == EACCES;
+	}
+
+	xzf_stream *tee = xzf_tee_open(sinks, 2);
+	if (tee == NULL)
+		return false;
+
+	(void)xzf_write(tee, data, DATA_SIZE);
+	const bool ok = xzf_flush(tee, 0) == -1 && errno == ENOSPC;
+
+	return xzf_close(tee, 0) == ENOSPC && ok;
+}
+
+
+extern int
+main(void)
+{
+	char names[3][32];
+	for (size_t i = 0; i < 3; ++i) {
+		strcpy(names[i], "test_tee.tmp.XXXXXX");
+		const int fd = mkstemp(names[i]);
+		if (fd == -1)
+			return 1;
+
+		(void)close(fd);
+	}
+
+	tests_init_data(data, DATA_SIZE, 37, 13);
+
+	const bool ok = test_formats(names, 100000)
+			&& test_formats(names, 1)
+			&& test_formats(names, 1 << 20)
+			&& test_error(names)
+			&& xzf_tee_open(NULL, 0) == NULL && errno == EINVAL;
+
+	for (size_t i = 0; i < 3; ++i)
+		(void)unlink(names[i]);
+
+	return ok ? 0 : 1;
+}
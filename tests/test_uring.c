@@ -0,0 +1,146 @@
+/*
+ * Test the io_uring backend
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 5555)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+write_file(const char *filename, unsigned int depth, size_t chunk_size)
+{
+	xzf_stream *file = xzf_uring_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0600, depth);
+	if (file == NULL)
+		return false;
+
+	for (size_t pos = 0; pos < DATA_SIZE; pos += chunk_size) {
+		const size_t n = DATA_SIZE - pos < chunk_size
+				? DATA_SIZE - pos : chunk_size;
+		if (xzf_write(file, data + pos, n))
+			return false;
+
+		if (pos == 20 * chunk_size && xzf_flush(file, 0))
+			return false;
+	}
+
+	return xzf_close(file, 0) == 0;
+}
+
+
+static bool
+test_roundtrip(const char *filename, unsigned int depth, size_t chunk_size)
+{
+	if (!write_file(filename, depth, chunk_size))
+		return false;
+
+	xzf_stream *file = xzf_uring_open(filename, XZF_READ, 0, depth);
+	if (file == NULL)
+		return false;
+
+	// Peek with varying minimum sizes so that some of them cross
+	// the buffer boundaries.
+	size_t pos = 0;
+	uint32_t x = 5;
+	bool ok = true;
+	while (ok && pos < DATA_SIZE) {
+		tests_rand(&x);
+		size_t min = (x >> 12) % 20000 + 1;
+		if (min > DATA_SIZE - pos)
+			min = DATA_SIZE - pos;
+
+		const unsigned char *b;
+		size_t size = xzf_peekin_start(file, &b, min);
+		if (size < min || size > DATA_SIZE - pos) {
+			ok = false;
+			break;
+		}
+
+		size = (x >> 4) % size + 1;
+		ok = memcmp(data + pos, b, size) == 0;
+		xzf_peekin_end(file, size);
+		pos += size;
+	}
+
+	ok = ok && xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	// Seeking backwards and forwards restarts the read-ahead.
+	ok = ok && xzf_seek(file, 1000, XZF_SEEK_SET) == 1000
+			&& xzf_read(file, buf, 300000) == 300000
+			&& memcmp(data + 1000, buf, 300000) == 0
+			&& xzf_seek(file, 2000000, XZF_SEEK_SET) == 2000000
+			&& xzf_read(file, buf, 5000) == 5000
+			&& memcmp(data + 2000000, buf, 5000) == 0
+			&& xzf_skip(file, 100) == 100
+			&& xzf_read(file, buf, 5000) == 5000
+			&& memcmp(data + 2005100, buf, 5000) == 0
+			&& xzf_seek(file, -10, XZF_SEEK_END) == DATA_SIZE - 10
+			&& xzf_read(file, buf, 100) == 10
+			&& memcmp(data + DATA_SIZE - 10, buf, 10) == 0;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_gz(const char *filename)
+{
+	xzf_stream *gz = xzf_gzout_open(xzf_uring_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0600, 4), 6, 0);
+	if (gz == NULL || xzf_write(gz, data, DATA_SIZE) || xzf_close(gz, 0))
+		return false;
+
+	gz = xzf_gzin_open(xzf_uring_open(filename, XZF_READ, 0, 4), 0);
+	if (gz == NULL)
+		return false;
+
+	const bool ok = xzf_read(gz, buf, DATA_SIZE) == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0
+			&& xzf_read(gz, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(gz, 0) == 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_uring.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	// Skip the test if io_uring isn't available.
+	xzf_stream *file = xzf_uring_open(filename, XZF_READ, 0, 0);
+	if (file == NULL) {
+		(void)unlink(filename);
+		return errno == ENOSYS || errno == EPERM ? 77 : 1;
+	}
+
+	(void)xzf_close(file, 0);
+
+	tests_init_data(data, DATA_SIZE, 99, 13);
+
+	const bool ok = test_roundtrip(filename, 0, 100000)
+			&& test_roundtrip(filename, 1, 1)
+			&& test_roundtrip(filename, 3, 1 << 20)
+			&& test_gz(filename);
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
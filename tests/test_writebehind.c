@@ -0,0 +1,135 @@
+/*
+ * Test the write-behind stage
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 1234)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+
+
+static bool
+read_back(const char *filename, int ztype, size_t size)
+{
+	xzf_stream *file = xzf_open(filename, XZF_READ | XZF_COMP, ztype);
+	if (file == NULL)
+		return false;
+
+	const bool ok = xzf_read(file, buf, DATA_SIZE) == size
+			&& memcmp(data, buf, size) == 0
+			&& xzf_read(file, buf, 1) == 0 && errno == XZF_E_EOF;
+
+	return xzf_close(file, 0) == 0 && ok;
+}
+
+
+static bool
+test_gz(const char *filename, unsigned int nbufs, size_t bufsize,
+		size_t chunk_size)
+{
+	xzf_stream *file = xzf_writebehind_open(xzf_gzout_open(xzf_fd_open(
+				filename, XZF_WRITE | XZF_TRUNC, 0), 6, 0),
+			nbufs, bufsize);
+	if (file == NULL)
+		return false;
+
+	xzf_stream *sub = NULL;
+	if (xzf_getinfo(file, XZF_KEY_SUBSTREAM, &sub) || sub == NULL)
+		return false;
+
+	for (size_t pos = 0; pos < DATA_SIZE; pos += chunk_size) {
+		const size_t n = DATA_SIZE - pos < chunk_size
+				? DATA_SIZE - pos : chunk_size;
+		if (xzf_write(file, data + pos, n))
+			return false;
+
+		if (pos == 10 * chunk_size && xzf_flush(file, 0))
+			return false;
+	}
+
+	return xzf_close(file, 0) == 0 && read_back(filename, XZF_Z_GZ,
+			DATA_SIZE);
+}
+
+
+static bool
+test_seek(const char *filename)
+{
+	xzf_stream *file = xzf_writebehind_open(xzf_fd_open(filename,
+			XZF_WRITE | XZF_TRUNC, 0), 2, XZF_BUFSIZE);
+	if (file == NULL)
+		return false;
+
+	// Write the second half first.
+	const size_t half = DATA_SIZE / 2;
+	bool ok = xzf_seek(file, half, XZF_SEEK_SET) == (xzf_off)half
+			&& xzf_write(file, data + half, DATA_SIZE - half) == 0
+			&& xzf_seek(file, 0, XZF_SEEK_CUR) == DATA_SIZE
+			&& xzf_seek(file, 0, XZF_SEEK_SET) == 0
+			&& xzf_write(file, data, half) == 0;
+
+	// The worker has written the queued buffers when the substream
+	// is given, so it may be used here. Only the buffer that isn't
+	// full yet hasn't been queued.
+	xzf_stream *sub = NULL;
+	xzf_off sub_pos = -1;
+	ok = ok && xzf_getinfo(file, XZF_KEY_SUBSTREAM, &sub) == 0
+			&& (sub_pos = xzf_seek(sub, 0, XZF_SEEK_CUR))
+				>= (xzf_off)(half - XZF_BUFSIZE)
+			&& sub_pos <= (xzf_off)half;
+
+	return xzf_close(file, 0) == 0 && ok
+			&& read_back(filename, XZF_Z_NONE, DATA_SIZE);
+}
+
+
+static bool
+test_error(void)
+{
+	// Writing to /dev/full fails with ENOSPC. The error is noticed
+	// by the worker thread and reported later.
+	xzf_stream *file = xzf_writebehind_open(
+			xzf_fd_open("/dev/full", XZF_WRITE, 0), 0, 0);
+	if (file == NULL)
+		return errno == ENOENT || errno == EACCES;
+
+	(void)xzf_write(file, data, DATA_SIZE);
+	const bool ok = xzf_flush(file, 0) == -1 && errno == ENOSPC
+			&& xzf_write(file, data, 1) == -1 && errno == ENOSPC;
+
+	return xzf_close(file, 0) == ENOSPC && ok;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_writebehind.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	tests_init_data(data, DATA_SIZE, 17, 7);
+
+	const bool ok = test_gz(filename, 0, 0, 100000)
+			&& test_gz(filename, 2, XZF_BUFSIZE, 1)
+			&& test_gz(filename, 5, 100000, 1 << 20)
+			&& test_seek(filename)
+			&& test_error();
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
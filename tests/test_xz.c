@@ -0,0 +1,199 @@
+/*
+ * Test the .xz compressor and decompressor
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+
+#define DATA_SIZE (3 * 1024 * 1024 + 12345)
+
+static unsigned char data[DATA_SIZE];
+static unsigned char buf[DATA_SIZE];
+static unsigned char zbuf[DATA_SIZE];
+
+
+static bool
+test_roundtrip(const char *filename, unsigned int threads, size_t block_size,
+		size_t chunk_size)
+{
+	xzf_stream *file = xzf_fd_open(filename,
+			XZF_WRITE | XZF_CREAT | XZF_TRUNC, 0600);
+	if (file == NULL)
+		return false;
+
+	if (!tests_write_chunks(xzf_xzout_open(file, 1, threads, block_size),
+			data, DATA_SIZE, chunk_size))
+		return false;
+
+	file = xzf_fd_open(filename, XZF_READ, 0);
+	if (file == NULL)
+		return false;
+
+	xzf_stream *xz = xzf_xzin_open(file, 0, threads, 0);
+	if (xz == NULL)
+		return false;
+
+	const size_t size = xzf_read(xz, buf, DATA_SIZE);
+	const bool eof = xzf_read(xz, buf + size, 1) == 0
+			&& errno == XZF_E_EOF;
+	const bool same = size == DATA_SIZE
+			&& memcmp(data, buf, DATA_SIZE) == 0;
+
+	// Seeking uses the Index and thus needs a seekable substream.
+	const bool seek_ok = tests_check_seeks(xz, data, DATA_SIZE, buf);
+
+	if (xzf_close(xz, 0))
+		return false;
+
+	// Skipping uses the Index too.
+	xz = xzf_xzin_open(xzf_fd_open(filename, XZF_READ, 0), 0, threads, 0);
+	if (xz == NULL)
+		return false;
+
+	const bool skip_ok = tests_check_skip(xz, data, DATA_SIZE, buf);
+	if (xzf_close(xz, 0))
+		return false;
+
+	return eof && same && seek_ok && skip_ok;
+}
+
+
+/// Reader from memory that fails once the read position reaches fail_at
+struct failin_state {
+	const unsigned char *buf;
+	size_t size;
+	size_t pos;
+	size_t fail_at;
+};
+
+
+static int
+failin_read(void *stateptr, unsigned char *out, size_t *out_size)
+{
+	struct failin_state *state = stateptr;
+
+	if (state->pos >= state->fail_at) {
+		*out_size = 0;
+		return EIO;
+	}
+
+	if (*out_size > state->size - state->pos)
+		*out_size = state->size - state->pos;
+
+	memcpy(out, state->buf + state->pos, *out_size);
+	state->pos += *out_size;
+	return *out_size == 0 ? XZF_E_EOF : 0;
+}
+
+
+static int
+failin_seek(void *stateptr, xzf_off *offset, enum xzf_whence whence)
+{
+	struct failin_state *state = stateptr;
+	xzf_off pos = *offset;
+
+	if (whence == XZF_SEEK_CUR)
+		pos += (xzf_off)state->pos;
+	else if (whence == XZF_SEEK_END)
+		pos += (xzf_off)state->size;
+
+	if (pos < 0 || pos > (xzf_off)state->size)
+		return EINVAL;
+
+	state->pos = (size_t)pos;
+	*offset = pos;
+	return 0;
+}
+
+
+static int
+failin_close(void *stateptr, int cl_flags)
+{
+	(void)stateptr;
+	(void)cl_flags;
+	return 0;
+}
+
+
+static const struct xzf_backend failin_backend = {
+	.version = 0,
+	.read = &failin_read,
+	.seek = &failin_seek,
+	.close = &failin_close,
+};
+
+
+static bool
+test_skip_error(void)
+{
+	// Compress into a single Block so that skipping forward from
+	// the middle of it has to start decoding the Block again.
+	xzf_stream *mem = xzf_memout_open(0);
+	xzf_stream *xz = xzf_xzout_open(mem, 1, 1, 0);
+	if (xz == NULL)
+		return false;
+
+	if (xzf_write(xz, data, DATA_SIZE) || xzf_close(xz, XZF_CL_DETACH))
+		return false;
+
+	const xzf_iovec *iov;
+	size_t iovcnt;
+	if (xzf_memout_getiov(mem, &iov, &iovcnt))
+		return false;
+
+	size_t zsize = 0;
+	for (size_t i = 0; i < iovcnt; ++i) {
+		memcpy(zbuf + zsize, iov[i].base, iov[i].len);
+		zsize += iov[i].len;
+	}
+
+	if (xzf_close(mem, 0))
+		return false;
+
+	struct failin_state state = { zbuf, zsize, 0, SIZE_MAX };
+	xzf_stream *in = xzf_stream_init(NULL, &failin_backend, &state,
+			XZF_READ | XZF_SEEKABLE, XZF_BUFSIZE, XZF_BUFSIZE);
+	xz = xzf_xzin_open(in, 0, 1, 0);
+	if (xz == NULL)
+		return false;
+
+	// Decode past the beginning of the input and then make the input
+	// fail so that decoding the Block again stops before the current
+	// position. Nothing may be reported as skipped.
+	bool ok = xzf_read(xz, buf, 200000) == 200000;
+	state.fail_at = 2 * XZF_BUFSIZE;
+	ok = ok && xzf_skip(xz, 1000000) == 0 && errno == EIO;
+
+	return xzf_close(xz, 0) != 0 && ok;
+}
+
+
+extern int
+main(void)
+{
+	char filename[] = "test_xz.tmp.XXXXXX";
+	const int fd = mkstemp(filename);
+	if (fd == -1)
+		return 1;
+
+	(void)close(fd);
+
+	tests_init_data(data, DATA_SIZE, 42, 23);
+
+	const bool ok = test_roundtrip(filename, 1, 0, 100000)
+			&& test_roundtrip(filename, 1, 100000, 4096)
+			&& test_roundtrip(filename, 4, 65536, 1000000)
+			&& test_roundtrip(filename, 0, 1 << 20, 1)
+			&& test_skip_error();
+
+	(void)unlink(filename);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/*
+ * Common helpers for the tests
+ *
+ * Author: Lasse Collin <lasse.collin@tukaani.org>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+#ifndef XZF_TESTS_H
+#define XZF_TESTS_H
+
+#include "sysdefs.h"
+#include "xzfile.h"
+
+
+/// Get the next number from a linear congruential generator
+static inline uint32_t
+tests_rand(uint32_t *x)
+{
+	*x = *x * 1103515245 + 12345;
+	return *x;
+}
+
+
+/// Fill data with something compressible but not too trivial: about
+/// a quarter of the bytes are random and the rest repeat the first
+/// period letters of the alphabet. If period is zero, all bytes are
+/// random. Different seeds give different data.
+static inline void
+tests_init_data(unsigned char *data, size_t size, uint32_t seed,
+		unsigned int period)
+{
+	uint32_t x = seed;
+	for (size_t i = 0; i < size; ++i) {
+		tests_rand(&x);
+		data[i] = period == 0 || (x >> 16) % 4 == 0
+				? (unsigned char)(x >> 24)
+				: (unsigned char)('a' + i % period);
+	}
+}
+
+
+/// Write data to strm in chunks of chunk_size bytes and flush once
+/// in the middle. strm is closed.
+static inline bool
+tests_write_chunks(xzf_stream *strm, const unsigned char *data, size_t size,
+		size_t chunk_size)
+{
+	if (strm == NULL)
+		return false;
+
+	for (size_t pos = 0; pos < size; pos += chunk_size) {
+		const size_t n = size - pos < chunk_size
+				? size - pos : chunk_size;
+		if (xzf_write(strm, data + pos, n))
+			break;
+
+		// Flushing in the middle must not break the output.
+		if (pos == 10 * chunk_size && xzf_flush(strm, 0))
+			break;
+	}
+
+	return xzf_close(strm, 0) == 0;
+}
+
+
+/// Seek to random positions in strm and check that the data read
+/// there matches data. buf must have room for size bytes.
+static inline bool
+tests_check_seeks(xzf_stream *strm, const unsigned char *data, size_t size,
+		unsigned char *buf)
+{
+	uint32_t x = 1;
+	for (int i = 0; i < 50; ++i) {
+		const size_t pos = (tests_rand(&x) >> 8) % size;
+		const size_t len = size - pos < 70000 ? size - pos : 70000;
+
+		if (xzf_seek(strm, (xzf_off)pos, XZF_SEEK_SET) != (xzf_off)pos
+				|| xzf_read(strm, buf, len) != len
+				|| memcmp(data + pos, buf, len) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+
+/// Skip and read alternately and compare to data. The stream must be
+/// at the beginning of the data. buf must have room for 70000 bytes.
+static inline bool
+tests_check_skip(xzf_stream *strm, const unsigned char *data, size_t size,
+		unsigned char *buf)
+{
+	const size_t steps[][2] = {
+		{ 0, 1000 },
+		{ 1234567, 1000 },
+		{ 5, 70000 },
+		{ 100000, 1 },
+	};
+
+	size_t pos = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(steps); ++i) {
+		const size_t skip = steps[i][0];
+		const size_t len = steps[i][1];
+		if (xzf_skip(strm, (xzf_off)skip) != (xzf_off)skip
+				|| xzf_read(strm, buf, len) != len
+				|| memcmp(data + pos + skip, buf, len) != 0)
+			return false;
+
+		pos += skip + len;
+	}
+
+	// Skipping past the end stops at the end.
+	return xzf_skip(strm, (xzf_off)size) == (xzf_off)(size - pos)
+			&& errno == XZF_E_EOF
+			&& xzf_skip(strm, 1) == 0;
+}
+
+#endif